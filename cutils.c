@@ -79,6 +79,50 @@ int has_suffix(const char *str, const char *suffix)
     return (len >= slen && !memcmp(str + len - slen, suffix, slen));
 }
 
+/* Size tracking allocator */
+
+void *sized_malloc(size_t size)
+{
+    SizedMallocHeader *h;
+
+    if (size > SIZE_MAX - SIZED_MALLOC_HEADER_SIZE)
+        return NULL;
+    h = malloc(SIZED_MALLOC_HEADER_SIZE + size);
+    if (!h)
+        return NULL;
+    h->size = size;
+    return h + 1;
+}
+
+void sized_free(void *ptr)
+{
+    if (!ptr)
+        return;
+    free((SizedMallocHeader *)ptr - 1);
+}
+
+void *sized_realloc(void *ptr, size_t size)
+{
+    SizedMallocHeader *h;
+
+    if (!ptr)
+        return sized_malloc(size);
+    if (size > SIZE_MAX - SIZED_MALLOC_HEADER_SIZE)
+        return NULL;
+    h = realloc((SizedMallocHeader *)ptr - 1, SIZED_MALLOC_HEADER_SIZE + size);
+    if (!h)
+        return NULL;
+    h->size = size;
+    return h + 1;
+}
+
+size_t sized_malloc_usable_size(const void *ptr)
+{
+    if (!ptr)
+        return 0;
+    return ((const SizedMallocHeader *)ptr - 1)->size;
+}
+
 /* Dynamic buffer package */
 
 static void *dbuf_default_realloc(void *opaque, void *ptr, size_t size)
@@ -629,3 +673,596 @@ void rqsort(void *base, size_t nmemb, size_t size, cmp_f cmp, void *opaque)
 }
 
 #endif
+
+/* SIMD string kernels. The instruction set is selected at build time
+   (AVX2, SSE2 or wasm SIMD128). */
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_SIZE 32
+typedef __m256i simd_t;
+#define simd_load(p) _mm256_loadu_si256((const __m256i *)(p))
+/* load SIMD_SIZE / 2 bytes and zero extend them to 16 bits */
+#define simd_load_u8_u16(p) \
+    _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(p)))
+#define simd_splat8(c) _mm256_set1_epi8(c)
+#define simd_splat16(c) _mm256_set1_epi16(c)
+#define simd_eq8(a, b) _mm256_cmpeq_epi8(a, b)
+#define simd_eq16(a, b) _mm256_cmpeq_epi16(a, b)
+#define simd_and(a, b) _mm256_and_si256(a, b)
+#define simd_or(a, b) _mm256_or_si256(a, b)
+/* one bit per byte (its most significant bit) */
+#define simd_mask(a) ((uint32_t)_mm256_movemask_epi8(a))
+#define simd_is_zero(a) _mm256_testz_si256(a, a)
+#define simd_store(p, a) _mm256_storeu_si256((__m256i *)(p), a)
+/* narrow two vectors of 16 bit values < 0x80 to one vector of bytes */
+#define simd_pack16(a, b) \
+    _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8)
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_SIZE 16
+typedef __m128i simd_t;
+#define simd_load(p) _mm_loadu_si128((const __m128i *)(p))
+#define simd_load_u8_u16(p) \
+    _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p)), _mm_setzero_si128())
+#define simd_splat8(c) _mm_set1_epi8(c)
+#define simd_splat16(c) _mm_set1_epi16(c)
+#define simd_eq8(a, b) _mm_cmpeq_epi8(a, b)
+#define simd_eq16(a, b) _mm_cmpeq_epi16(a, b)
+#define simd_and(a, b) _mm_and_si128(a, b)
+#define simd_or(a, b) _mm_or_si128(a, b)
+#define simd_mask(a) ((uint32_t)_mm_movemask_epi8(a))
+#define simd_is_zero(a) \
+    (_mm_movemask_epi8(_mm_cmpeq_epi8(a, _mm_setzero_si128())) == 0xffff)
+#define simd_store(p, a) _mm_storeu_si128((__m128i *)(p), a)
+#define simd_pack16(a, b) _mm_packus_epi16(a, b)
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define SIMD_SIZE 16
+typedef v128_t simd_t;
+#define simd_load(p) wasm_v128_load(p)
+#define simd_load_u8_u16(p) wasm_u16x8_load8x8(p)
+#define simd_splat8(c) wasm_i8x16_splat(c)
+#define simd_splat16(c) wasm_i16x8_splat(c)
+#define simd_eq8(a, b) wasm_i8x16_eq(a, b)
+#define simd_eq16(a, b) wasm_i16x8_eq(a, b)
+#define simd_and(a, b) wasm_v128_and(a, b)
+#define simd_or(a, b) wasm_v128_or(a, b)
+#define simd_mask(a) ((uint32_t)wasm_i8x16_bitmask(a))
+#define simd_is_zero(a) (!wasm_v128_any_true(a))
+#define simd_store(p, a) wasm_v128_store(p, a)
+#define simd_pack16(a, b) wasm_u8x16_narrow_i16x8(a, b)
+#endif
+
+#ifdef SIMD_SIZE
+#define SIMD_MASK_ALL ((uint32_t)((1ULL << SIMD_SIZE) - 1))
+#endif
+
+/* needles at least this long use the two-way algorithm, whose time is
+   linear in the haystack length whatever the input */
+#define TWO_WAY_MIN_LEN 32
+
+/* return the index of the first 'c' in s[0..len-1] or -1 */
+int mem_chr8(const uint8_t *s, int c, int len)
+{
+    int i = 0;
+#ifdef SIMD_SIZE
+    simd_t vc = simd_splat8(c);
+    uint32_t mask;
+
+    for(; i + SIMD_SIZE <= len; i += SIMD_SIZE) {
+        mask = simd_mask(simd_eq8(simd_load(s + i), vc));
+        if (mask)
+            return i + ctz32(mask);
+    }
+#endif
+    for(; i < len; i++) {
+        if (s[i] == c)
+            return i;
+    }
+    return -1;
+}
+
+int mem_chr16(const uint16_t *s, int c, int len)
+{
+    int i = 0;
+#ifdef SIMD_SIZE
+    simd_t vc = simd_splat16(c);
+    uint32_t mask;
+
+    for(; i + SIMD_SIZE / 2 <= len; i += SIMD_SIZE / 2) {
+        mask = simd_mask(simd_eq16(simd_load(s + i), vc));
+        if (mask)
+            return i + ctz32(mask) / 2;
+    }
+#endif
+    for(; i < len; i++) {
+        if (s[i] == c)
+            return i;
+    }
+    return -1;
+}
+
+/* return the index of the first difference or len */
+int mem_mismatch8(const uint8_t *a, const uint8_t *b, int len)
+{
+    int i = 0;
+#ifdef SIMD_SIZE
+    uint32_t mask;
+
+    for(; i + SIMD_SIZE <= len; i += SIMD_SIZE) {
+        mask = simd_mask(simd_eq8(simd_load(a + i), simd_load(b + i)));
+        if (mask != SIMD_MASK_ALL)
+            return i + ctz32(~mask);
+    }
+#endif
+    for(; i < len; i++) {
+        if (a[i] != b[i])
+            break;
+    }
+    return i;
+}
+
+int mem_mismatch16(const uint16_t *a, const uint16_t *b, int len)
+{
+    int i = 0;
+#ifdef SIMD_SIZE
+    uint32_t mask;
+
+    for(; i + SIMD_SIZE / 2 <= len; i += SIMD_SIZE / 2) {
+        mask = simd_mask(simd_eq16(simd_load(a + i), simd_load(b + i)));
+        if (mask != SIMD_MASK_ALL)
+            return i + ctz32(~mask) / 2;
+    }
+#endif
+    for(; i < len; i++) {
+        if (a[i] != b[i])
+            break;
+    }
+    return i;
+}
+
+int mem_mismatch16_8(const uint16_t *a, const uint8_t *b, int len)
+{
+    int i = 0;
+#ifdef SIMD_SIZE
+    uint32_t mask;
+
+    for(; i + SIMD_SIZE / 2 <= len; i += SIMD_SIZE / 2) {
+        mask = simd_mask(simd_eq16(simd_load(a + i), simd_load_u8_u16(b + i)));
+        if (mask != SIMD_MASK_ALL)
+            return i + ctz32(~mask) / 2;
+    }
+#endif
+    for(; i < len; i++) {
+        if (a[i] != b[i])
+            break;
+    }
+    return i;
+}
+
+/* Two-way string matching (Crochemore and Perrin). 'shift' is 0 for
+   8 bit and 1 for 16 bit characters. The functions are inlined so that
+   they are specialized for each character size. */
+
+#define TW_GET(s, i) (shift ? ((const uint16_t *)(s))[i] : ((const uint8_t *)(s))[i])
+
+/* return the position of a critical factorization of the needle and
+   set '*pperiod' to the period of its right half */
+static force_inline size_t two_way_factorize(const void *needle, size_t len,
+                                             int shift, size_t *pperiod)
+{
+    size_t max_suffix, max_suffix_rev, j, k, p;
+    int a, b;
+
+    /* maximal suffix for the ordering < */
+    max_suffix = SIZE_MAX;
+    j = 0;
+    k = p = 1;
+    while (j + k < len) {
+        a = TW_GET(needle, j + k);
+        b = TW_GET(needle, max_suffix + k);
+        if (a < b) {
+            j += k;
+            k = 1;
+            p = j - max_suffix;
+        } else if (a == b) {
+            if (k != p) {
+                k++;
+            } else {
+                j += p;
+                k = 1;
+            }
+        } else {
+            max_suffix = j++;
+            k = p = 1;
+        }
+    }
+    *pperiod = p;
+
+    /* maximal suffix for the ordering > */
+    max_suffix_rev = SIZE_MAX;
+    j = 0;
+    k = p = 1;
+    while (j + k < len) {
+        a = TW_GET(needle, j + k);
+        b = TW_GET(needle, max_suffix_rev + k);
+        if (b < a) {
+            j += k;
+            k = 1;
+            p = j - max_suffix_rev;
+        } else if (a == b) {
+            if (k != p) {
+                k++;
+            } else {
+                j += p;
+                k = 1;
+            }
+        } else {
+            max_suffix_rev = j++;
+            k = p = 1;
+        }
+    }
+    if (max_suffix_rev + 1 < max_suffix + 1)
+        return max_suffix + 1;
+    *pperiod = p;
+    return max_suffix_rev + 1;
+}
+
+/* return the number of positions to skip from 'j' until the first
+   character of the right half of the needle matches or -1 if none */
+static force_inline int two_way_skip(const void *hay, size_t hay_len,
+                                     size_t needle_len, size_t suffix,
+                                     int c, size_t j, int shift)
+{
+    if (shift)
+        return mem_chr16((const uint16_t *)hay + j + suffix, c,
+                         hay_len - needle_len - j + 1);
+    else
+        return mem_chr8((const uint8_t *)hay + j + suffix, c,
+                        hay_len - needle_len - j + 1);
+}
+
+static force_inline int two_way_search(const void *hay, size_t hay_len,
+                                       const void *needle, size_t needle_len,
+                                       int shift)
+{
+    size_t suffix, period, i, j, memory;
+    int c, k;
+
+    suffix = two_way_factorize(needle, needle_len, shift, &period);
+    c = TW_GET(needle, suffix);
+    j = 0;
+    if (!memcmp(needle, (const uint8_t *)needle + (period << shift),
+                suffix << shift)) {
+        /* periodic needle: remember the length of the prefix which
+           is already known to match after a shift by the period */
+        memory = 0;
+        while (j <= hay_len - needle_len) {
+            if (memory == 0 && TW_GET(hay, j + suffix) != c) {
+                k = two_way_skip(hay, hay_len, needle_len, suffix, c, j, shift);
+                if (k < 0)
+                    break;
+                j += k;
+            }
+            i = suffix > memory ? suffix : memory;
+            while (i < needle_len && TW_GET(needle, i) == TW_GET(hay, i + j))
+                i++;
+            if (i >= needle_len) {
+                i = suffix - 1;
+                while (memory < i + 1 && TW_GET(needle, i) == TW_GET(hay, i + j))
+                    i--;
+                if (i + 1 < memory + 1)
+                    return j;
+                j += period;
+                memory = needle_len - period;
+            } else {
+                j += i - suffix + 1;
+                memory = 0;
+            }
+        }
+    } else {
+        period = (suffix > needle_len - suffix ? suffix : needle_len - suffix) + 1;
+        while (j <= hay_len - needle_len) {
+            if (TW_GET(hay, j + suffix) != c) {
+                k = two_way_skip(hay, hay_len, needle_len, suffix, c, j, shift);
+                if (k < 0)
+                    break;
+                j += k;
+            }
+            i = suffix;
+            while (i < needle_len && TW_GET(needle, i) == TW_GET(hay, i + j))
+                i++;
+            if (i >= needle_len) {
+                i = suffix - 1;
+                while (i != SIZE_MAX && TW_GET(needle, i) == TW_GET(hay, i + j))
+                    i--;
+                if (i == SIZE_MAX)
+                    return j;
+                j += period;
+            } else {
+                j += i - suffix + 1;
+            }
+        }
+    }
+    return -1;
+}
+
+#undef TW_GET
+
+/* return the index of the first occurrence of 'needle' in 'hay' or
+   -1. Short needles are found by comparing their first and last
+   characters at SIMD_SIZE positions at once. */
+int mem_search8(const uint8_t *hay, int hay_len,
+                const uint8_t *needle, int needle_len)
+{
+    int i = 0, n;
+
+    if (needle_len == 0)
+        return 0;
+    if (needle_len > hay_len)
+        return -1;
+    if (needle_len == 1)
+        return mem_chr8(hay, needle[0], hay_len);
+    if (needle_len >= TWO_WAY_MIN_LEN)
+        return two_way_search(hay, hay_len, needle, needle_len, 0);
+    /* number of possible positions */
+    n = hay_len - needle_len + 1;
+#ifdef SIMD_SIZE
+    {
+        simd_t first = simd_splat8(needle[0]);
+        simd_t last = simd_splat8(needle[needle_len - 1]);
+        uint32_t mask;
+        int j;
+
+        for(; i + SIMD_SIZE <= n; i += SIMD_SIZE) {
+            mask = simd_mask(simd_and(simd_eq8(simd_load(hay + i), first),
+                                      simd_eq8(simd_load(hay + i + needle_len - 1), last)));
+            while (mask) {
+                j = i + ctz32(mask);
+                if (!memcmp(hay + j + 1, needle + 1, needle_len - 2))
+                    return j;
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+    for(; i < n; i++) {
+        if (hay[i] == needle[0] &&
+            !memcmp(hay + i + 1, needle + 1, needle_len - 1))
+            return i;
+    }
+    return -1;
+}
+
+int mem_search16(const uint16_t *hay, int hay_len,
+                 const uint16_t *needle, int needle_len)
+{
+    int i = 0, n;
+
+    if (needle_len == 0)
+        return 0;
+    if (needle_len > hay_len)
+        return -1;
+    if (needle_len == 1)
+        return mem_chr16(hay, needle[0], hay_len);
+    if (needle_len >= TWO_WAY_MIN_LEN)
+        return two_way_search(hay, hay_len, needle, needle_len, 1);
+    n = hay_len - needle_len + 1;
+#ifdef SIMD_SIZE
+    {
+        simd_t first = simd_splat16(needle[0]);
+        simd_t last = simd_splat16(needle[needle_len - 1]);
+        uint32_t mask;
+        int j;
+
+        for(; i + SIMD_SIZE / 2 <= n; i += SIMD_SIZE / 2) {
+            mask = simd_mask(simd_and(simd_eq16(simd_load(hay + i), first),
+                                      simd_eq16(simd_load(hay + i + needle_len - 1), last)));
+            while (mask) {
+                j = i + ctz32(mask) / 2;
+                if (!memcmp(hay + j + 1, needle + 1, (needle_len - 2) * 2))
+                    return j;
+                /* two bits per character */
+                mask &= mask - 1;
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+    for(; i < n; i++) {
+        if (hay[i] == needle[0] &&
+            !memcmp(hay + i + 1, needle + 1, (needle_len - 1) * 2))
+            return i;
+    }
+    return -1;
+}
+
+/* UTF-8, Latin-1 and UTF-16 transcoding kernels. ASCII data is
+   processed SIMD_SIZE bytes at a time. */
+
+/* return the number of leading ASCII bytes */
+size_t ascii_prefix_len(const uint8_t *s, size_t len)
+{
+    size_t i = 0;
+#ifdef SIMD_SIZE
+    uint32_t mask;
+
+    for(; i + SIMD_SIZE <= len; i += SIMD_SIZE) {
+        mask = simd_mask(simd_load(s + i));
+        if (mask)
+            return i + ctz32(mask);
+    }
+#endif
+    for(; i < len; i++) {
+        if (s[i] >= 0x80)
+            break;
+    }
+    return i;
+}
+
+/* return the length of the UTF-8 encoding of a Latin-1 string */
+size_t latin1_utf8_len(const uint8_t *s, size_t len)
+{
+    size_t i = 0, n = len;
+#ifdef SIMD_SIZE
+    for(; i + SIMD_SIZE <= len; i += SIMD_SIZE)
+        n += __builtin_popcount(simd_mask(simd_load(s + i)));
+#endif
+    for(; i < len; i++)
+        n += s[i] >> 7;
+    return n;
+}
+
+/* return the number of bytes written to 'dst' */
+size_t latin1_to_utf8(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    uint8_t *q = dst;
+    size_t i = 0;
+    int c;
+
+    while (i < len) {
+#ifdef SIMD_SIZE
+        if (i + SIMD_SIZE <= len) {
+            simd_t v = simd_load(src + i);
+            if (!simd_mask(v)) {
+                simd_store(q, v);
+                q += SIMD_SIZE;
+                i += SIMD_SIZE;
+                continue;
+            }
+        }
+#endif
+        c = src[i++];
+        if (c < 0x80) {
+            *q++ = c;
+        } else {
+            *q++ = (c >> 6) | 0xc0;
+            *q++ = (c & 0x3f) | 0x80;
+        }
+    }
+    return q - dst;
+}
+
+void latin1_to_utf16(uint16_t *dst, const uint8_t *src, size_t len)
+{
+    size_t i = 0;
+#ifdef SIMD_SIZE
+    for(; i + SIMD_SIZE / 2 <= len; i += SIMD_SIZE / 2)
+        simd_store(dst + i, simd_load_u8_u16(src + i));
+#endif
+    for(; i < len; i++)
+        dst[i] = src[i];
+}
+
+/* copy the leading ASCII characters of 'src' to 'dst'. Return their
+   number. */
+size_t utf16_copy_ascii(uint8_t *dst, const uint16_t *src, size_t len)
+{
+    size_t i = 0;
+#ifdef SIMD_SIZE
+    simd_t a, b, m = simd_splat16(0xff80);
+
+    for(; i + SIMD_SIZE <= len; i += SIMD_SIZE) {
+        a = simd_load(src + i);
+        b = simd_load(src + i + SIMD_SIZE / 2);
+        if (!simd_is_zero(simd_and(simd_or(a, b), m)))
+            break;
+        simd_store(dst + i, simd_pack16(a, b));
+    }
+#endif
+    for(; i < len; i++) {
+        if (src[i] >= 0x80)
+            break;
+        dst[i] = src[i];
+    }
+    return i;
+}
+
+/* Check that 'src' is valid UTF-8 in the sense of unicode_from_utf8()
+   with code points <= 0x10FFFF. Return -1 if not. Otherwise return 0,
+   set '*plen' to the number of UTF-16 code units of the decoded string
+   and '*pis_wide' to TRUE if a code point is > 0xFF. */
+int utf8_scan(const uint8_t *src, size_t len, size_t *plen, int *pis_wide)
+{
+    const uint8_t *p_next;
+    size_t i = 0, n = 0, k;
+    int c, is_wide = FALSE;
+
+    while (i < len) {
+        k = ascii_prefix_len(src + i, len - i);
+        i += k;
+        n += k;
+        if (i >= len)
+            break;
+        c = src[i];
+        if (c >= 0xc2 && c <= 0xdf && i + 1 < len &&
+            (src[i + 1] & 0xc0) == 0x80) {
+            is_wide |= (c > 0xc3);
+            i += 2;
+            n++;
+        } else {
+            c = unicode_from_utf8(src + i, min_int(len - i, UTF8_CHAR_LEN_MAX),
+                                  &p_next);
+            if (c < 0 || c > 0x10ffff)
+                return -1;
+            is_wide = TRUE;
+            i = p_next - src;
+            n += 1 + (c >= 0x10000);
+        }
+    }
+    *plen = n;
+    *pis_wide = is_wide;
+    return 0;
+}
+
+/* decode the UTF-8 string 'src' validated by utf8_scan() whose code
+   points are <= 0xFF */
+void utf8_decode_latin1(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    size_t i = 0, k;
+
+    while (i < len) {
+        k = ascii_prefix_len(src + i, len - i);
+        memcpy(dst, src + i, k);
+        dst += k;
+        i += k;
+        if (i >= len)
+            break;
+        *dst++ = ((src[i] & 0x1f) << 6) | (src[i + 1] & 0x3f);
+        i += 2;
+    }
+}
+
+/* decode the UTF-8 string 'src' validated by utf8_scan() */
+void utf8_decode_utf16(uint16_t *dst, const uint8_t *src, size_t len)
+{
+    const uint8_t *p_next = src + len;
+    size_t i = 0, k;
+    int c;
+
+    while (i < len) {
+        k = ascii_prefix_len(src + i, len - i);
+        latin1_to_utf16(dst, src + i, k);
+        dst += k;
+        i += k;
+        if (i >= len)
+            break;
+        c = src[i];
+        if (c <= 0xdf) {
+            *dst++ = ((c & 0x1f) << 6) | (src[i + 1] & 0x3f);
+            i += 2;
+        } else {
+            c = unicode_from_utf8(src + i, min_int(len - i, UTF8_CHAR_LEN_MAX),
+                                  &p_next);
+            i = p_next - src;
+            if (c >= 0x10000) {
+                /* surrogate pair */
+                c -= 0x10000;
+                *dst++ = (c >> 10) + 0xd800;
+                c = (c & 0x3ff) + 0xdc00;
+            }
+            *dst++ = c;
+        }
+    }
+}
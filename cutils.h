@@ -26,6 +26,7 @@
 #define CUTILS_H
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <inttypes.h>
 
 /* set if CPU is big endian */
@@ -290,6 +291,46 @@ static inline int from_hex(int c)
         return -1;
 }
 
+/* Size tracking allocator: the C library cannot report the usable
+   size of a block on these targets, so the requested size is stored in
+   a header before each block. */
+#if defined(EMSCRIPTEN) || defined(__wasi__)
+#define CONFIG_MALLOC_SIZE_HEADER
+#endif
+
+typedef union SizedMallocHeader {
+    size_t size;
+    max_align_t align; /* keep the malloc alignment for the user block */
+} SizedMallocHeader;
+
+#define SIZED_MALLOC_HEADER_SIZE sizeof(SizedMallocHeader)
+
+void *sized_malloc(size_t size);
+void sized_free(void *ptr);
+void *sized_realloc(void *ptr, size_t size);
+size_t sized_malloc_usable_size(const void *ptr);
+
+/* string search and comparison (SIMD when available) */
+int mem_chr8(const uint8_t *s, int c, int len);
+int mem_chr16(const uint16_t *s, int c, int len);
+int mem_mismatch8(const uint8_t *a, const uint8_t *b, int len);
+int mem_mismatch16(const uint16_t *a, const uint16_t *b, int len);
+int mem_mismatch16_8(const uint16_t *a, const uint8_t *b, int len);
+int mem_search8(const uint8_t *hay, int hay_len,
+                const uint8_t *needle, int needle_len);
+int mem_search16(const uint16_t *hay, int hay_len,
+                 const uint16_t *needle, int needle_len);
+
+/* transcoding (SIMD when available) */
+size_t ascii_prefix_len(const uint8_t *s, size_t len);
+size_t latin1_utf8_len(const uint8_t *s, size_t len);
+size_t latin1_to_utf8(uint8_t *dst, const uint8_t *src, size_t len);
+void latin1_to_utf16(uint16_t *dst, const uint8_t *src, size_t len);
+size_t utf16_copy_ascii(uint8_t *dst, const uint16_t *src, size_t len);
+int utf8_scan(const uint8_t *src, size_t len, size_t *plen, int *pis_wide);
+void utf8_decode_latin1(uint8_t *dst, const uint8_t *src, size_t len);
+void utf8_decode_utf16(uint16_t *dst, const uint8_t *src, size_t len);
+
 void rqsort(void *base, size_t nmemb, size_t size,
             int (*cmp)(const void *, const void *, void *),
             void *arg);
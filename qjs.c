@@ -125,6 +125,8 @@ static JSContext *JS_NewCustomContext(JSRuntime *rt)
 
 #if defined(__APPLE__)
 #define MALLOC_OVERHEAD  0
+#elif defined(CONFIG_MALLOC_SIZE_HEADER)
+#define MALLOC_OVERHEAD  (8 + SIZED_MALLOC_HEADER_SIZE)
 #else
 #define MALLOC_OVERHEAD  8
 #endif
@@ -140,9 +142,21 @@ static inline unsigned long long js_trace_malloc_ptr_offset(uint8_t *ptr,
 }
 
 /* default memory allocation functions with memory limitation */
+#ifdef CONFIG_MALLOC_SIZE_HEADER
+#define sys_malloc(size)        sized_malloc(size)
+#define sys_free(ptr)           sized_free(ptr)
+#define sys_realloc(ptr, size)  sized_realloc(ptr, size)
+#else
+#define sys_malloc(size)        malloc(size)
+#define sys_free(ptr)           free(ptr)
+#define sys_realloc(ptr, size)  realloc(ptr, size)
+#endif
+
 static inline size_t js_trace_malloc_usable_size(void *ptr)
 {
-#if defined(__APPLE__)
+#if defined(CONFIG_MALLOC_SIZE_HEADER)
+    return sized_malloc_usable_size(ptr);
+#elif defined(__APPLE__)
     return malloc_size(ptr);
 #elif defined(_WIN32)
     return _msize(ptr);
@@ -210,7 +224,7 @@ static void *js_trace_malloc(JSMallocState *s, size_t size)
 
     if (unlikely(s->malloc_size + size > s->malloc_limit))
         return NULL;
-    ptr = malloc(size);
+    ptr = sys_malloc(size);
     js_trace_malloc_printf(s, "A %zd -> %p\n", size, ptr);
     if (ptr) {
         s->malloc_count++;
@@ -227,7 +241,7 @@ static void js_trace_free(JSMallocState *s, void *ptr)
     js_trace_malloc_printf(s, "F %p\n", ptr);
     s->malloc_count--;
     s->malloc_size -= js_trace_malloc_usable_size(ptr) + MALLOC_OVERHEAD;
-    free(ptr);
+    sys_free(ptr);
 }
 
 static void *js_trace_realloc(JSMallocState *s, void *ptr, size_t size)
@@ -244,7 +258,7 @@ static void *js_trace_realloc(JSMallocState *s, void *ptr, size_t size)
         js_trace_malloc_printf(s, "R %zd %p\n", size, ptr);
         s->malloc_count--;
         s->malloc_size -= old_size + MALLOC_OVERHEAD;
-        free(ptr);
+        sys_free(ptr);
         return NULL;
     }
     if (s->malloc_size + size - old_size > s->malloc_limit)
@@ -252,7 +266,7 @@ static void *js_trace_realloc(JSMallocState *s, void *ptr, size_t size)
 
     js_trace_malloc_printf(s, "R %zd %p", size, ptr);
 
-    ptr = realloc(ptr, size);
+    ptr = sys_realloc(ptr, size);
     js_trace_malloc_printf(s, " -> %p\n", ptr);
     if (ptr) {
         s->malloc_size += js_trace_malloc_usable_size(ptr) - old_size;
@@ -264,7 +278,9 @@ static const JSMallocFunctions trace_mf = {
     js_trace_malloc,
     js_trace_free,
     js_trace_realloc,
-#if defined(__APPLE__)
+#if defined(CONFIG_MALLOC_SIZE_HEADER)
+    sized_malloc_usable_size,
+#elif defined(__APPLE__)
     malloc_size,
 #elif defined(_WIN32)
     (size_t (*)(const void *))_msize,
@@ -278,7 +294,61 @@ static const JSMallocFunctions trace_mf = {
 #endif
 };
 
+/* parse a comma separated list of name=value GC policy parameters */
+static void set_gc_policy(JSRuntime *rt, const char *str)
+{
+    JSGCPolicy pol;
+    const char *p, *val;
+    char name[32];
+    size_t len;
+    double d;
+
+    JS_GetGCPolicy(rt, &pol);
+    p = str;
+    while (*p != '\0') {
+        len = strcspn(p, "=,");
+        if (p[len] != '=' || len >= sizeof(name))
+            goto fail;
+        memcpy(name, p, len);
+        name[len] = '\0';
+        val = p + len + 1;
+        d = strtod(val, (char **)&p);
+        if (p == val || (*p != ',' && *p != '\0'))
+            goto fail;
+        if (*p == ',')
+            p++;
+        if (!strcmp(name, "growth")) {
+            pol.heap_growth = (int)d;
+        } else if (!strcmp(name, "interval")) {
+            pol.target_interval = (int)d;
+        } else if (!strcmp(name, "min-interval")) {
+            pol.min_interval = (int)d;
+        } else if (!strcmp(name, "min-growth")) {
+            pol.min_growth = (size_t)d;
+        } else {
+            goto fail;
+        }
+    }
+    JS_SetGCPolicy(rt, &pol);
+    return;
+ fail:
+    fprintf(stderr, "qjs: invalid GC policy '%s'\n", str);
+    exit(1);
+}
+
 #define PROG_NAME "qjs"
+#define HEAP_PROFILE_INTERVAL 32768
+
+static void write_heap_profile(JSRuntime *rt, const char *filename)
+{
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        perror(filename);
+    } else {
+        JS_DumpHeapProfile(rt, f, TRUE);
+        fclose(f);
+    }
+}
 
 void help(void)
 {
@@ -299,8 +369,19 @@ void help(void)
            "-d  --dump         dump the memory usage stats\n"
            "    --memory-limit n       limit the memory usage to 'n' bytes\n"
            "    --stack-size n         limit the stack size to 'n' bytes\n"
+           "    --slab                 use the slab allocator for small objects\n"
+           "    --gc-generational      only scan the young objects in the automatic GC\n"
+           "    --gc-budget n          limit the automatic GC pauses to 'n' microseconds\n"
+           "    --gc-policy list       automatic GC pacing, comma separated list of:\n"
+           "                           growth=percent, interval=ms, min-interval=ms,\n"
+           "                           min-growth=bytes\n"
+           "    --heap-profile file    write the call stacks of the live objects and\n"
+           "                           strings to 'file' in the flamegraph format\n"
+           "    --heap-profile-interval n\n"
+           "                           sample every 'n' allocated bytes (default=%d)\n"
            "    --unhandled-rejection  dump unhandled promise rejections\n"
-           "-q  --quit         just instantiate the interpreter and quit\n");
+           "-q  --quit         just instantiate the interpreter and quit\n",
+           HEAP_PROFILE_INTERVAL);
     exit(1);
 }
 
@@ -325,6 +406,12 @@ int main(int argc, char **argv)
     int load_jscalc;
 #endif
     size_t stack_size = 0;
+    int use_slab = 0;
+    int gc_generational = 0;
+    int64_t gc_budget = 0;
+    const char *gc_policy = NULL;
+    const char *heap_profile = NULL;
+    size_t heap_profile_interval = HEAP_PROFILE_INTERVAL;
     
 #ifdef CONFIG_BIGNUM
     /* load jscalc runtime if invoked as 'qjscalc' */
@@ -445,6 +532,46 @@ int main(int argc, char **argv)
                 stack_size = (size_t)strtod(argv[optind++], NULL);
                 continue;
             }
+            if (!strcmp(longopt, "slab")) {
+                use_slab = 1;
+                continue;
+            }
+            if (!strcmp(longopt, "gc-generational")) {
+                gc_generational = 1;
+                continue;
+            }
+            if (!strcmp(longopt, "gc-policy")) {
+                if (optind >= argc) {
+                    fprintf(stderr, "expecting GC policy");
+                    exit(1);
+                }
+                gc_policy = argv[optind++];
+                continue;
+            }
+            if (!strcmp(longopt, "gc-budget")) {
+                if (optind >= argc) {
+                    fprintf(stderr, "expecting GC pause budget");
+                    exit(1);
+                }
+                gc_budget = (int64_t)strtod(argv[optind++], NULL);
+                continue;
+            }
+            if (!strcmp(longopt, "heap-profile")) {
+                if (optind >= argc) {
+                    fprintf(stderr, "expecting heap profile filename");
+                    exit(1);
+                }
+                heap_profile = argv[optind++];
+                continue;
+            }
+            if (!strcmp(longopt, "heap-profile-interval")) {
+                if (optind >= argc) {
+                    fprintf(stderr, "expecting heap profile interval");
+                    exit(1);
+                }
+                heap_profile_interval = (size_t)strtod(argv[optind++], NULL);
+                continue;
+            }
             if (opt) {
                 fprintf(stderr, "qjs: unknown option '-%c'\n", opt);
             } else {
@@ -471,6 +598,14 @@ int main(int argc, char **argv)
         JS_SetMemoryLimit(rt, memory_limit);
     if (stack_size != 0)
         JS_SetMaxStackSize(rt, stack_size);
+    if (use_slab)
+        JS_SetSlabAllocator(rt, TRUE);
+    if (gc_generational)
+        JS_SetGCGenerational(rt, TRUE);
+    if (gc_budget != 0)
+        JS_SetGCPauseBudget(rt, gc_budget);
+    if (gc_policy)
+        set_gc_policy(rt, gc_policy);
     js_std_set_worker_new_context_func(JS_NewCustomContext);
     js_std_init_handlers(rt);
     ctx = JS_NewCustomContext(rt);
@@ -486,6 +621,9 @@ int main(int argc, char **argv)
         JS_SetHostPromiseRejectionTracker(rt, js_std_promise_rejection_tracker,
                                           NULL);
     }
+
+    if (heap_profile && heap_profile_interval != 0)
+        JS_SetHeapProfile(rt, heap_profile_interval);
     
     if (!empty_run) {
 #ifdef CONFIG_BIGNUM
@@ -527,6 +665,9 @@ int main(int argc, char **argv)
         }
         js_std_loop(ctx);
     }
+
+    if (heap_profile)
+        write_heap_profile(rt, heap_profile);
     
     if (dump_memory) {
         JSMemoryUsage stats;
@@ -563,6 +704,9 @@ int main(int argc, char **argv)
     }
     return 0;
  fail:
+    /* the profile is also useful when the script failed */
+    if (heap_profile)
+        write_heap_profile(rt, heap_profile);
     js_std_free_handlers(rt);
     JS_FreeContext(ctx);
     JS_FreeRuntime(rt);
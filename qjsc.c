@@ -172,6 +172,1087 @@ static void dump_hex(FILE *f, const uint8_t *buf, size_t len)
         fprintf(f, "\n");
 }
 
+/* Ahead of time compilation ('-O aot'): the bytecode of each function
+   is translated to C using the native code interface of the engine
+   (see JS_SetNativeCode()). The stack slots are C local variables and
+   the jumps are C gotos. Only the opcodes which cannot throw
+   exceptions with the operand types tested at runtime are translated:
+   otherwise the native code bails out to the interpreter. */
+
+/* must be the same as in quickjs.c */
+#define SHORT_OPCODES 1
+
+#include "quickjs-opcode-info.h"
+
+static BOOL aot_output;
+static int aot_func_count;
+
+#define AOT_REACHED 0x01 /* reached by the native code */
+#define AOT_ENTRY   0x02 /* the interpreter may enter the native code here */
+#define AOT_LABEL   0x04
+#define AOT_BAIL    0x08 /* a bailout block is generated for this position */
+
+typedef struct AOTFunction {
+    const uint8_t *bc_buf;
+    int bc_len;
+    int cpool_count;
+    uint16_t *stack_level; /* 0xffff if not reached by the interpreter */
+    uint8_t *flags;
+    int stack_len_used; /* number of stack slots used by the native code */
+    BOOL use_tmp;
+    BOOL use_res;
+    BOOL use_arg_buf;
+    BOOL use_var_buf;
+} AOTFunction;
+
+/* helpers of the generated code. They return 0 if the operand types
+   are not handled, in which case the interpreter is used. */
+static const char aot_helpers[] =
+    "static inline int aot_get_float64(double *pd, JSValueConst v)\n"
+    "{\n"
+    "  int tag = JS_VALUE_GET_TAG(v);\n"
+    "  if (tag == JS_TAG_INT)\n"
+    "    *pd = JS_VALUE_GET_INT(v);\n"
+    "  else if (JS_TAG_IS_FLOAT64(tag))\n"
+    "    *pd = JS_VALUE_GET_FLOAT64(v);\n"
+    "  else\n"
+    "    return 0;\n"
+    "  return 1;\n"
+    "}\n"
+    "\n"
+    "static inline int aot_is_both_int(JSValueConst a, JSValueConst b)\n"
+    "{\n"
+    "  return JS_VALUE_GET_TAG(a) == JS_TAG_INT &&\n"
+    "    JS_VALUE_GET_TAG(b) == JS_TAG_INT;\n"
+    "}\n"
+    "\n"
+    "#define AOT_ADD_SUB(name, op)                                           \\\n"
+    "static inline int aot_ ## name(JSValue *pr, JSValueConst a, JSValueConst b) \\\n"
+    "{                                                                       \\\n"
+    "  double d1, d2;                                                        \\\n"
+    "  if (aot_is_both_int(a, b)) {                                          \\\n"
+    "    *pr = JS_NewInt64(NULL, (int64_t)JS_VALUE_GET_INT(a) op JS_VALUE_GET_INT(b)); \\\n"
+    "    return 1;                                                           \\\n"
+    "  }                                                                     \\\n"
+    "  if (!aot_get_float64(&d1, a) || !aot_get_float64(&d2, b))             \\\n"
+    "    return 0;                                                           \\\n"
+    "  *pr = __JS_NewFloat64(NULL, d1 op d2);                                \\\n"
+    "  return 1;                                                             \\\n"
+    "}\n"
+    "\n"
+    "AOT_ADD_SUB(add, +)\n"
+    "AOT_ADD_SUB(sub, -)\n"
+    "\n"
+    "static inline int aot_mul(JSValue *pr, JSValueConst a, JSValueConst b)\n"
+    "{\n"
+    "  double d1, d2;\n"
+    "  if (aot_is_both_int(a, b)) {\n"
+    "    int32_t v1 = JS_VALUE_GET_INT(a), v2 = JS_VALUE_GET_INT(b);\n"
+    "    int64_t r = (int64_t)v1 * v2;\n"
+    "    if (r == 0 && (v1 | v2) < 0)\n"
+    "      *pr = __JS_NewFloat64(NULL, -0.0);\n"
+    "    else\n"
+    "      *pr = JS_NewInt64(NULL, r);\n"
+    "    return 1;\n"
+    "  }\n"
+    "  if (!aot_get_float64(&d1, a) || !aot_get_float64(&d2, b))\n"
+    "    return 0;\n"
+    "  *pr = __JS_NewFloat64(NULL, d1 * d2);\n"
+    "  return 1;\n"
+    "}\n"
+    "\n"
+    "static inline int aot_div(JSValue *pr, JSValueConst a, JSValueConst b)\n"
+    "{\n"
+    "  double d1, d2;\n"
+    "  if (!aot_get_float64(&d1, a) || !aot_get_float64(&d2, b))\n"
+    "    return 0;\n"
+    "  *pr = JS_NewFloat64(NULL, d1 / d2);\n"
+    "  return 1;\n"
+    "}\n"
+    "\n"
+    "#define AOT_CMP(name, op)                                               \\\n"
+    "static inline int aot_ ## name(int *pres, JSValueConst a, JSValueConst b) \\\n"
+    "{                                                                       \\\n"
+    "  double d1, d2;                                                        \\\n"
+    "  if (aot_is_both_int(a, b)) {                                          \\\n"
+    "    *pres = JS_VALUE_GET_INT(a) op JS_VALUE_GET_INT(b);                 \\\n"
+    "    return 1;                                                           \\\n"
+    "  }                                                                     \\\n"
+    "  if (!aot_get_float64(&d1, a) || !aot_get_float64(&d2, b))             \\\n"
+    "    return 0;                                                           \\\n"
+    "  *pres = d1 op d2;                                                     \\\n"
+    "  return 1;                                                             \\\n"
+    "}\n"
+    "\n"
+    "AOT_CMP(lt, <)\n"
+    "AOT_CMP(lte, <=)\n"
+    "AOT_CMP(gt, >)\n"
+    "AOT_CMP(gte, >=)\n"
+    "AOT_CMP(eq, ==)\n"
+    "\n"
+    "/* strict equality of numbers, booleans, null, undefined and objects */\n"
+    "static inline int aot_strict_eq(JSContext *ctx, int *pres, JSValue a, JSValue b)\n"
+    "{\n"
+    "  int tag1 = JS_VALUE_GET_TAG(a), tag2 = JS_VALUE_GET_TAG(b);\n"
+    "  if (aot_eq(pres, a, b))\n"
+    "    return 1;\n"
+    "  if (tag1 == JS_TAG_OBJECT && tag2 == JS_TAG_OBJECT) {\n"
+    "    *pres = (JS_VALUE_GET_PTR(a) == JS_VALUE_GET_PTR(b));\n"
+    "  } else if (tag1 >= JS_TAG_BOOL && tag1 <= JS_TAG_UNDEFINED &&\n"
+    "             tag2 >= JS_TAG_BOOL && tag2 <= JS_TAG_UNDEFINED) {\n"
+    "    *pres = (tag1 == tag2 && JS_VALUE_GET_INT(a) == JS_VALUE_GET_INT(b));\n"
+    "  } else if ((tag1 == JS_TAG_OBJECT || (tag1 >= JS_TAG_BOOL && tag1 <= JS_TAG_UNDEFINED)) &&\n"
+    "             (tag2 == JS_TAG_OBJECT || (tag2 >= JS_TAG_BOOL && tag2 <= JS_TAG_UNDEFINED))) {\n"
+    "    *pres = 0;\n"
+    "  } else {\n"
+    "    return 0;\n"
+    "  }\n"
+    "  JS_FreeValue(ctx, a);\n"
+    "  JS_FreeValue(ctx, b);\n"
+    "  return 1;\n"
+    "}\n"
+    "\n"
+    "#define AOT_BITWISE(name, expr)                                         \\\n"
+    "static inline int aot_ ## name(JSValue *pr, JSValueConst a, JSValueConst b) \\\n"
+    "{                                                                       \\\n"
+    "  int32_t v1, v2;                                                       \\\n"
+    "  if (!aot_is_both_int(a, b))                                           \\\n"
+    "    return 0;                                                           \\\n"
+    "  v1 = JS_VALUE_GET_INT(a);                                             \\\n"
+    "  v2 = JS_VALUE_GET_INT(b);                                             \\\n"
+    "  *pr = expr;                                                           \\\n"
+    "  return 1;                                                             \\\n"
+    "}\n"
+    "\n"
+    "AOT_BITWISE(and, JS_NewInt32(NULL, v1 & v2))\n"
+    "AOT_BITWISE(or, JS_NewInt32(NULL, v1 | v2))\n"
+    "AOT_BITWISE(xor, JS_NewInt32(NULL, v1 ^ v2))\n"
+    "AOT_BITWISE(shl, JS_NewInt32(NULL, (uint32_t)v1 << (v2 & 0x1f)))\n"
+    "AOT_BITWISE(sar, JS_NewInt32(NULL, v1 >> (v2 & 0x1f)))\n"
+    "AOT_BITWISE(shr, JS_NewUint32(NULL, (uint32_t)v1 >> (v2 & 0x1f)))\n"
+    "\n"
+    "/* 'v' + 'incr' with incr = 1 or -1 */\n"
+    "static inline int aot_inc(JSValue *pr, JSValueConst v, int incr)\n"
+    "{\n"
+    "  double d;\n"
+    "  if (JS_VALUE_GET_TAG(v) == JS_TAG_INT) {\n"
+    "    *pr = JS_NewInt64(NULL, (int64_t)JS_VALUE_GET_INT(v) + incr);\n"
+    "    return 1;\n"
+    "  }\n"
+    "  if (!aot_get_float64(&d, v))\n"
+    "    return 0;\n"
+    "  *pr = __JS_NewFloat64(NULL, d + incr);\n"
+    "  return 1;\n"
+    "}\n"
+    "\n"
+    "static inline int aot_neg(JSValue *pr, JSValueConst v)\n"
+    "{\n"
+    "  double d;\n"
+    "  if (JS_VALUE_GET_TAG(v) == JS_TAG_INT && JS_VALUE_GET_INT(v) != 0) {\n"
+    "    *pr = JS_NewInt64(NULL, -(int64_t)JS_VALUE_GET_INT(v));\n"
+    "    return 1;\n"
+    "  }\n"
+    "  if (!aot_get_float64(&d, v))\n"
+    "    return 0;\n"
+    "  *pr = __JS_NewFloat64(NULL, -d);\n"
+    "  return 1;\n"
+    "}\n"
+    "\n"
+    "static inline int aot_to_bool_free(JSContext *ctx, JSValue v)\n"
+    "{\n"
+    "  int res;\n"
+    "  if ((uint32_t)JS_VALUE_GET_TAG(v) <= JS_TAG_UNDEFINED)\n"
+    "    return JS_VALUE_GET_INT(v) != 0;\n"
+    "  res = JS_ToBool(ctx, v);\n"
+    "  JS_FreeValue(ctx, v);\n"
+    "  return res;\n"
+    "}\n"
+    "\n"
+    "static inline void aot_set_value(JSContext *ctx, JSValue *pval, JSValue v)\n"
+    "{\n"
+    "  JSValue old = *pval;\n"
+    "  *pval = v;\n"
+    "  JS_FreeValue(ctx, old);\n"
+    "}\n"
+    "\n";
+
+/* return the target of the jump at 'pos' or -1 if it is not a jump */
+static int aot_get_jump_target(const uint8_t *bc_buf, int pos)
+{
+    switch(bc_buf[pos]) {
+    case OP_if_false:
+    case OP_if_true:
+    case OP_goto:
+    case OP_catch:
+    case OP_gosub:
+        return pos + 1 + get_i32(bc_buf + pos + 1);
+    case OP_goto16:
+        return pos + 1 + get_i16(bc_buf + pos + 1);
+    case OP_if_false8:
+    case OP_if_true8:
+    case OP_goto8:
+    case OP_lt_if_false8:
+        return pos + 1 + get_i8(bc_buf + pos + 1);
+    case OP_with_get_var:
+    case OP_with_put_var:
+    case OP_with_delete_var:
+    case OP_with_make_ref:
+    case OP_with_get_ref:
+    case OP_with_get_ref_undef:
+        return pos + 5 + get_i32(bc_buf + pos + 5);
+    default:
+        return -1;
+    }
+}
+
+/* return TRUE if the opcode at 'pos' is translated to C */
+static BOOL aot_is_supported(AOTFunction *s, int pos)
+{
+    const uint8_t *bc_buf = s->bc_buf;
+    switch(bc_buf[pos]) {
+    case OP_push_i32:
+    case OP_push_minus1:
+    case OP_push_0:
+    case OP_push_1:
+    case OP_push_2:
+    case OP_push_3:
+    case OP_push_4:
+    case OP_push_5:
+    case OP_push_6:
+    case OP_push_7:
+    case OP_push_i8:
+    case OP_push_i16:
+    case OP_undefined:
+    case OP_null:
+    case OP_push_false:
+    case OP_push_true:
+    case OP_drop:
+    case OP_nip:
+    case OP_nip1:
+    case OP_dup:
+    case OP_dup1:
+    case OP_dup2:
+    case OP_insert2:
+    case OP_insert3:
+    case OP_perm3:
+    case OP_swap:
+    case OP_rot3l:
+    case OP_rot3r:
+    case OP_nop:
+    case OP_get_loc:
+    case OP_put_loc:
+    case OP_set_loc:
+    case OP_get_loc8:
+    case OP_put_loc8:
+    case OP_set_loc8:
+    case OP_get_loc0:
+    case OP_get_loc1:
+    case OP_get_loc2:
+    case OP_get_loc3:
+    case OP_put_loc0:
+    case OP_put_loc1:
+    case OP_put_loc2:
+    case OP_put_loc3:
+    case OP_set_loc0:
+    case OP_set_loc1:
+    case OP_set_loc2:
+    case OP_set_loc3:
+    case OP_get_loc0_loc1:
+    case OP_get_loc_check:
+    case OP_put_loc_check:
+    case OP_put_loc_check_init:
+    case OP_set_loc_uninitialized:
+    case OP_get_arg:
+    case OP_put_arg:
+    case OP_set_arg:
+    case OP_get_arg0:
+    case OP_get_arg1:
+    case OP_get_arg2:
+    case OP_get_arg3:
+    case OP_put_arg0:
+    case OP_put_arg1:
+    case OP_put_arg2:
+    case OP_put_arg3:
+    case OP_set_arg0:
+    case OP_set_arg1:
+    case OP_set_arg2:
+    case OP_set_arg3:
+    case OP_add:
+    case OP_sub:
+    case OP_mul:
+    case OP_div:
+    case OP_and:
+    case OP_or:
+    case OP_xor:
+    case OP_shl:
+    case OP_sar:
+    case OP_shr:
+    case OP_lt:
+    case OP_lte:
+    case OP_gt:
+    case OP_gte:
+    case OP_eq:
+    case OP_neq:
+    case OP_strict_eq:
+    case OP_strict_neq:
+    case OP_inc:
+    case OP_dec:
+    case OP_post_inc:
+    case OP_post_dec:
+    case OP_inc_loc:
+    case OP_dec_loc:
+    case OP_add_loc:
+    case OP_neg:
+    case OP_plus:
+    case OP_not:
+    case OP_lnot:
+    case OP_is_undefined:
+    case OP_is_null:
+    case OP_is_undefined_or_null:
+    case OP_if_false:
+    case OP_if_true:
+    case OP_goto:
+    case OP_if_false8:
+    case OP_if_true8:
+    case OP_goto8:
+    case OP_goto16:
+    case OP_lt_if_false8:
+    case OP_loop:
+    case OP_return:
+    case OP_return_undef:
+        return TRUE;
+    case OP_push_const:
+        return get_u32(bc_buf + pos + 1) < s->cpool_count;
+    case OP_push_const8:
+        return bc_buf[pos + 1] < s->cpool_count;
+    default:
+        return FALSE;
+    }
+}
+
+static BOOL aot_is_terminal(int op)
+{
+    return op == OP_goto || op == OP_goto8 || op == OP_goto16 ||
+        op == OP_return || op == OP_return_undef;
+}
+
+/* set 'reached[pos]' for the positions reached by the native code
+   entered at 'start'. The native code stops at the unsupported
+   opcodes. */
+static void aot_explore(AOTFunction *s, uint8_t *reached, int start)
+{
+    const uint8_t *bc_buf = s->bc_buf;
+    int *pc_stack, sp, pos, op, target;
+
+    pc_stack = malloc(sizeof(pc_stack[0]) * s->bc_len);
+    if (!pc_stack) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    sp = 0;
+    if (!reached[start]) {
+        reached[start] = 1;
+        pc_stack[sp++] = start;
+    }
+    while (sp > 0) {
+        pos = pc_stack[--sp];
+        if (!aot_is_supported(s, pos))
+            continue;
+        op = bc_buf[pos];
+        target = aot_get_jump_target(bc_buf, pos);
+        if (target >= 0 && !reached[target]) {
+            reached[target] = 1;
+            pc_stack[sp++] = target;
+        }
+        if (aot_is_terminal(op))
+            continue;
+        pos += short_opcode_info(op).size;
+        if (!reached[pos]) {
+            reached[pos] = 1;
+            pc_stack[sp++] = pos;
+        }
+    }
+    free(pc_stack);
+}
+
+/* minimum number of opcodes executed by the native code of a
+   function without loop so that calling it is faster than
+   interpreting them */
+#define AOT_MIN_INSN_COUNT 8
+
+/* Return TRUE if the native code entered at 'entry' can loop back to
+   its 'loop' opcode or return without bailing out. Otherwise it is not entered because the
+   bailouts would cost more than what the native code saves. */
+static BOOL aot_is_useful_entry(AOTFunction *s, int entry)
+{
+    const uint8_t *bc_buf = s->bc_buf;
+    uint8_t *reached;
+    int pos, op, insn_count;
+    BOOL has_loop, has_return;
+
+    reached = calloc(s->bc_len + 1, 1);
+    if (!reached) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    aot_explore(s, reached, entry);
+    has_loop = FALSE;
+    has_return = FALSE;
+    insn_count = 0;
+    for(pos = 0; pos < s->bc_len; pos++) {
+        if (!reached[pos] || !aot_is_supported(s, pos))
+            continue;
+        op = bc_buf[pos];
+        if (op == OP_loop && (entry == 0 || pos == entry - 1))
+            has_loop = TRUE;
+        if (op == OP_return || op == OP_return_undef)
+            has_return = TRUE;
+        insn_count++;
+    }
+    free(reached);
+    if (entry == 0)
+        return has_loop || (has_return && insn_count >= AOT_MIN_INSN_COUNT);
+    else
+        return has_loop;
+}
+
+/* compute the flags of the positions reached from the entry points */
+static void aot_mark_reached(AOTFunction *s)
+{
+    const uint8_t *bc_buf = s->bc_buf;
+    uint8_t *reached;
+    int pos, target;
+
+    reached = calloc(s->bc_len + 1, 1);
+    if (!reached) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for(pos = 0; pos < s->bc_len; pos++) {
+        if (s->flags[pos] & AOT_ENTRY) {
+            s->flags[pos] |= AOT_LABEL;
+            aot_explore(s, reached, pos);
+        }
+    }
+    for(pos = 0; pos < s->bc_len; pos++) {
+        if (!reached[pos])
+            continue;
+        s->flags[pos] |= AOT_REACHED;
+        if (!aot_is_supported(s, pos)) {
+            s->flags[pos] |= AOT_BAIL;
+            continue;
+        }
+        target = aot_get_jump_target(bc_buf, pos);
+        if (target >= 0)
+            s->flags[target] |= AOT_LABEL;
+        if (bc_buf[pos] == OP_loop)
+            s->flags[pos] |= AOT_BAIL; /* interrupt check */
+    }
+    free(reached);
+}
+
+/* store the stack slots in the interpreter frame */
+static void aot_emit_flush(DynBuf *d, int stack_len)
+{
+    int i;
+    for(i = 0; i < stack_len; i++)
+        dbuf_printf(d, "  stack_buf[%d] = s%d;\n", i, i);
+    dbuf_printf(d, "  f->sp = stack_buf + %d;\n", stack_len);
+}
+
+static void aot_emit_jump(DynBuf *d, int target, const char *cond)
+{
+    if (cond)
+        dbuf_printf(d, "  if (%s)\n  ", cond);
+    dbuf_printf(d, "  goto L%d;\n", target);
+}
+
+typedef enum {
+    AOT_GET,
+    AOT_PUT,
+    AOT_SET,
+    AOT_GET_CHECK,
+    AOT_PUT_CHECK,
+    AOT_PUT_CHECK_INIT,
+    AOT_SET_UNINITIALIZED,
+} AOTAccessEnum;
+
+/* access to the local variable or argument 'buf[idx]' */
+static void aot_emit_access(AOTFunction *s, DynBuf *d, int pos,
+                            AOTAccessEnum kind, BOOL is_arg, int idx)
+{
+    int sp = s->stack_level[pos];
+    const char *buf;
+
+    if (is_arg) {
+        buf = "arg_buf";
+        s->use_arg_buf = TRUE;
+    } else {
+        buf = "var_buf";
+        s->use_var_buf = TRUE;
+    }
+    if (kind == AOT_GET_CHECK || kind == AOT_PUT_CHECK) {
+        /* the interpreter throws the ReferenceError */
+        dbuf_printf(d, "  if (JS_VALUE_GET_TAG(%s[%d]) == JS_TAG_UNINITIALIZED)\n"
+                    "    goto bail%d;\n", buf, idx, pos);
+        s->flags[pos] |= AOT_BAIL;
+    } else if (kind == AOT_PUT_CHECK_INIT) {
+        /* the interpreter throws the ReferenceError if 'this' is
+           already initialized */
+        dbuf_printf(d, "  if (JS_VALUE_GET_TAG(%s[%d]) != JS_TAG_UNINITIALIZED)\n"
+                    "    goto bail%d;\n", buf, idx, pos);
+        s->flags[pos] |= AOT_BAIL;
+    }
+    switch(kind) {
+    case AOT_GET:
+    case AOT_GET_CHECK:
+        dbuf_printf(d, "  s%d = JS_DupValue(ctx, %s[%d]);\n", sp, buf, idx);
+        break;
+    case AOT_PUT:
+    case AOT_PUT_CHECK:
+    case AOT_PUT_CHECK_INIT:
+        dbuf_printf(d, "  aot_set_value(ctx, &%s[%d], s%d);\n",
+                    buf, idx, sp - 1);
+        break;
+    case AOT_SET:
+        dbuf_printf(d, "  aot_set_value(ctx, &%s[%d], JS_DupValue(ctx, s%d));\n",
+                    buf, idx, sp - 1);
+        break;
+    case AOT_SET_UNINITIALIZED:
+        dbuf_printf(d, "  aot_set_value(ctx, &%s[%d], JS_UNINITIALIZED);\n",
+                    buf, idx);
+        break;
+    }
+}
+
+/* emit the C code of the supported opcode at 'pos' */
+static void aot_emit_insn(AOTFunction *s, DynBuf *d, int pos)
+{
+    const uint8_t *bc_buf = s->bc_buf;
+    int op, sp, idx, target;
+    const char *name;
+    char cond[64];
+
+    op = bc_buf[pos];
+    sp = s->stack_level[pos];
+    switch(op) {
+    case OP_push_i32:
+        dbuf_printf(d, "  s%d = JS_NewInt32(ctx, %d);\n", sp,
+                    get_i32(bc_buf + pos + 1));
+        break;
+    case OP_push_minus1:
+    case OP_push_0:
+    case OP_push_1:
+    case OP_push_2:
+    case OP_push_3:
+    case OP_push_4:
+    case OP_push_5:
+    case OP_push_6:
+    case OP_push_7:
+        dbuf_printf(d, "  s%d = JS_NewInt32(ctx, %d);\n", sp,
+                    op - OP_push_0);
+        break;
+    case OP_push_i8:
+        dbuf_printf(d, "  s%d = JS_NewInt32(ctx, %d);\n", sp,
+                    get_i8(bc_buf + pos + 1));
+        break;
+    case OP_push_i16:
+        dbuf_printf(d, "  s%d = JS_NewInt32(ctx, %d);\n", sp,
+                    get_i16(bc_buf + pos + 1));
+        break;
+    case OP_push_const:
+        dbuf_printf(d, "  s%d = JS_DupValue(ctx, f->cpool[%u]);\n", sp,
+                    get_u32(bc_buf + pos + 1));
+        break;
+    case OP_push_const8:
+        dbuf_printf(d, "  s%d = JS_DupValue(ctx, f->cpool[%u]);\n", sp,
+                    bc_buf[pos + 1]);
+        break;
+    case OP_undefined:
+        dbuf_printf(d, "  s%d = JS_UNDEFINED;\n", sp);
+        break;
+    case OP_null:
+        dbuf_printf(d, "  s%d = JS_NULL;\n", sp);
+        break;
+    case OP_push_false:
+    case OP_push_true:
+        dbuf_printf(d, "  s%d = JS_NewBool(ctx, %d);\n", sp,
+                    op == OP_push_true);
+        break;
+    case OP_drop:
+        dbuf_printf(d, "  JS_FreeValue(ctx, s%d);\n", sp - 1);
+        break;
+    case OP_nip:
+        dbuf_printf(d, "  JS_FreeValue(ctx, s%d);\n"
+                    "  s%d = s%d;\n", sp - 2, sp - 2, sp - 1);
+        break;
+    case OP_nip1:
+        dbuf_printf(d, "  JS_FreeValue(ctx, s%d);\n"
+                    "  s%d = s%d;\n"
+                    "  s%d = s%d;\n",
+                    sp - 3, sp - 3, sp - 2, sp - 2, sp - 1);
+        break;
+    case OP_dup:
+        dbuf_printf(d, "  s%d = JS_DupValue(ctx, s%d);\n", sp, sp - 1);
+        break;
+    case OP_dup1: /* a b -> a a b */
+        dbuf_printf(d, "  s%d = s%d;\n"
+                    "  s%d = JS_DupValue(ctx, s%d);\n",
+                    sp, sp - 1, sp - 1, sp - 2);
+        break;
+    case OP_dup2: /* a b -> a b a b */
+        dbuf_printf(d, "  s%d = JS_DupValue(ctx, s%d);\n"
+                    "  s%d = JS_DupValue(ctx, s%d);\n",
+                    sp, sp - 2, sp + 1, sp - 1);
+        break;
+    case OP_insert2: /* obj a -> a obj a */
+        dbuf_printf(d, "  s%d = s%d;\n"
+                    "  s%d = s%d;\n"
+                    "  s%d = JS_DupValue(ctx, s%d);\n",
+                    sp, sp - 1, sp - 1, sp - 2, sp - 2, sp);
+        break;
+    case OP_insert3: /* obj prop a -> a obj prop a */
+        dbuf_printf(d, "  s%d = s%d;\n"
+                    "  s%d = s%d;\n"
+                    "  s%d = s%d;\n"
+                    "  s%d = JS_DupValue(ctx, s%d);\n",
+                    sp, sp - 1, sp - 1, sp - 2, sp - 2, sp - 3, sp - 3, sp);
+        break;
+    case OP_perm3: /* obj a b -> a obj b */
+    case OP_swap: /* a b -> b a */
+        idx = (op == OP_swap) ? sp - 2 : sp - 3;
+        s->use_tmp = TRUE;
+        dbuf_printf(d, "  tmp = s%d;\n"
+                    "  s%d = s%d;\n"
+                    "  s%d = tmp;\n", idx, idx, idx + 1, idx + 1);
+        break;
+    case OP_rot3l: /* x a b -> a b x */
+        s->use_tmp = TRUE;
+        dbuf_printf(d, "  tmp = s%d;\n"
+                    "  s%d = s%d;\n"
+                    "  s%d = s%d;\n"
+                    "  s%d = tmp;\n",
+                    sp - 3, sp - 3, sp - 2, sp - 2, sp - 1, sp - 1);
+        break;
+    case OP_rot3r: /* a b x -> x a b */
+        s->use_tmp = TRUE;
+        dbuf_printf(d, "  tmp = s%d;\n"
+                    "  s%d = s%d;\n"
+                    "  s%d = s%d;\n"
+                    "  s%d = tmp;\n",
+                    sp - 1, sp - 1, sp - 2, sp - 2, sp - 3, sp - 3);
+        break;
+    case OP_nop:
+        break;
+
+    case OP_get_loc:
+    case OP_put_loc:
+    case OP_set_loc:
+        aot_emit_access(s, d, pos, op - OP_get_loc, FALSE,
+                        get_u16(bc_buf + pos + 1));
+        break;
+    case OP_get_loc8:
+    case OP_put_loc8:
+    case OP_set_loc8:
+        aot_emit_access(s, d, pos, op - OP_get_loc8, FALSE, bc_buf[pos + 1]);
+        break;
+    case OP_get_loc0:
+    case OP_get_loc1:
+    case OP_get_loc2:
+    case OP_get_loc3:
+    case OP_put_loc0:
+    case OP_put_loc1:
+    case OP_put_loc2:
+    case OP_put_loc3:
+    case OP_set_loc0:
+    case OP_set_loc1:
+    case OP_set_loc2:
+    case OP_set_loc3:
+        idx = op - OP_get_loc0;
+        aot_emit_access(s, d, pos, idx / 4, FALSE, idx % 4);
+        break;
+    case OP_get_loc0_loc1:
+        s->use_var_buf = TRUE;
+        dbuf_printf(d, "  s%d = JS_DupValue(ctx, var_buf[0]);\n"
+                    "  s%d = JS_DupValue(ctx, var_buf[1]);\n", sp, sp + 1);
+        break;
+    case OP_get_loc_check:
+        aot_emit_access(s, d, pos, AOT_GET_CHECK, FALSE,
+                        get_u16(bc_buf + pos + 1));
+        break;
+    case OP_put_loc_check:
+        aot_emit_access(s, d, pos, AOT_PUT_CHECK, FALSE,
+                        get_u16(bc_buf + pos + 1));
+        break;
+    case OP_put_loc_check_init:
+        aot_emit_access(s, d, pos, AOT_PUT_CHECK_INIT, FALSE,
+                        get_u16(bc_buf + pos + 1));
+        break;
+    case OP_set_loc_uninitialized:
+        aot_emit_access(s, d, pos, AOT_SET_UNINITIALIZED, FALSE,
+                        get_u16(bc_buf + pos + 1));
+        break;
+    case OP_get_arg:
+    case OP_put_arg:
+    case OP_set_arg:
+        aot_emit_access(s, d, pos, op - OP_get_arg, TRUE,
+                        get_u16(bc_buf + pos + 1));
+        break;
+    case OP_get_arg0:
+    case OP_get_arg1:
+    case OP_get_arg2:
+    case OP_get_arg3:
+    case OP_put_arg0:
+    case OP_put_arg1:
+    case OP_put_arg2:
+    case OP_put_arg3:
+    case OP_set_arg0:
+    case OP_set_arg1:
+    case OP_set_arg2:
+    case OP_set_arg3:
+        idx = op - OP_get_arg0;
+        aot_emit_access(s, d, pos, idx / 4, TRUE, idx % 4);
+        break;
+
+    case OP_add:
+    case OP_sub:
+    case OP_mul:
+    case OP_div:
+    case OP_and:
+    case OP_or:
+    case OP_xor:
+    case OP_shl:
+    case OP_sar:
+    case OP_shr:
+        switch(op) {
+        case OP_add: name = "add"; break;
+        case OP_sub: name = "sub"; break;
+        case OP_mul: name = "mul"; break;
+        case OP_div: name = "div"; break;
+        case OP_and: name = "and"; break;
+        case OP_or: name = "or"; break;
+        case OP_xor: name = "xor"; break;
+        case OP_shl: name = "shl"; break;
+        case OP_sar: name = "sar"; break;
+        default: name = "shr"; break;
+        }
+        dbuf_printf(d, "  if (!aot_%s(&s%d, s%d, s%d))\n"
+                    "    goto bail%d;\n", name, sp - 2, sp - 2, sp - 1, pos);
+        s->flags[pos] |= AOT_BAIL;
+        break;
+    case OP_lt:
+    case OP_lte:
+    case OP_gt:
+    case OP_gte:
+    case OP_eq:
+    case OP_neq:
+        switch(op) {
+        case OP_lt: name = "lt"; break;
+        case OP_lte: name = "lte"; break;
+        case OP_gt: name = "gt"; break;
+        case OP_gte: name = "gte"; break;
+        default: name = "eq"; break;
+        }
+        s->use_res = TRUE;
+        dbuf_printf(d, "  if (!aot_%s(&res, s%d, s%d))\n"
+                    "    goto bail%d;\n"
+                    "  s%d = JS_NewBool(ctx, %sres);\n",
+                    name, sp - 2, sp - 1, pos, sp - 2,
+                    op == OP_neq ? "!" : "");
+        s->flags[pos] |= AOT_BAIL;
+        break;
+    case OP_strict_eq:
+    case OP_strict_neq:
+        s->use_res = TRUE;
+        dbuf_printf(d, "  if (!aot_strict_eq(ctx, &res, s%d, s%d))\n"
+                    "    goto bail%d;\n"
+                    "  s%d = JS_NewBool(ctx, %sres);\n",
+                    sp - 2, sp - 1, pos, sp - 2,
+                    op == OP_strict_neq ? "!" : "");
+        s->flags[pos] |= AOT_BAIL;
+        break;
+    case OP_inc:
+    case OP_dec:
+        dbuf_printf(d, "  if (!aot_inc(&s%d, s%d, %d))\n"
+                    "    goto bail%d;\n", sp - 1, sp - 1,
+                    op == OP_inc ? 1 : -1, pos);
+        s->flags[pos] |= AOT_BAIL;
+        break;
+    case OP_post_inc:
+    case OP_post_dec:
+        dbuf_printf(d, "  if (!aot_inc(&s%d, s%d, %d))\n"
+                    "    goto bail%d;\n", sp, sp - 1,
+                    op == OP_post_inc ? 1 : -1, pos);
+        s->flags[pos] |= AOT_BAIL;
+        break;
+    case OP_inc_loc:
+    case OP_dec_loc:
+        /* numbers are not reference counted */
+        s->use_var_buf = TRUE;
+        idx = bc_buf[pos + 1];
+        dbuf_printf(d, "  if (!aot_inc(&var_buf[%d], var_buf[%d], %d))\n"
+                    "    goto bail%d;\n", idx, idx,
+                    op == OP_inc_loc ? 1 : -1, pos);
+        s->flags[pos] |= AOT_BAIL;
+        break;
+    case OP_add_loc:
+        s->use_var_buf = TRUE;
+        idx = bc_buf[pos + 1];
+        dbuf_printf(d, "  if (!aot_add(&var_buf[%d], var_buf[%d], s%d))\n"
+                    "    goto bail%d;\n", idx, idx, sp - 1, pos);
+        s->flags[pos] |= AOT_BAIL;
+        break;
+    case OP_neg:
+        dbuf_printf(d, "  if (!aot_neg(&s%d, s%d))\n"
+                    "    goto bail%d;\n", sp - 1, sp - 1, pos);
+        s->flags[pos] |= AOT_BAIL;
+        break;
+    case OP_plus:
+        dbuf_printf(d, "  if (!JS_IsNumber(s%d))\n"
+                    "    goto bail%d;\n", sp - 1, pos);
+        s->flags[pos] |= AOT_BAIL;
+        break;
+    case OP_not:
+        dbuf_printf(d, "  if (JS_VALUE_GET_TAG(s%d) != JS_TAG_INT)\n"
+                    "    goto bail%d;\n"
+                    "  s%d = JS_NewInt32(ctx, ~JS_VALUE_GET_INT(s%d));\n",
+                    sp - 1, pos, sp - 1, sp - 1);
+        s->flags[pos] |= AOT_BAIL;
+        break;
+    case OP_lnot:
+        dbuf_printf(d, "  s%d = JS_NewBool(ctx, !aot_to_bool_free(ctx, s%d));\n",
+                    sp - 1, sp - 1);
+        break;
+    case OP_is_undefined:
+    case OP_is_null:
+    case OP_is_undefined_or_null:
+        s->use_res = TRUE;
+        if (op == OP_is_undefined)
+            dbuf_printf(d, "  res = JS_IsUndefined(s%d);\n", sp - 1);
+        else if (op == OP_is_null)
+            dbuf_printf(d, "  res = JS_IsNull(s%d);\n", sp - 1);
+        else
+            dbuf_printf(d, "  res = JS_IsUndefined(s%d) || JS_IsNull(s%d);\n",
+                        sp - 1, sp - 1);
+        dbuf_printf(d, "  JS_FreeValue(ctx, s%d);\n"
+                    "  s%d = JS_NewBool(ctx, res);\n", sp - 1, sp - 1);
+        break;
+
+    case OP_if_false:
+    case OP_if_true:
+    case OP_if_false8:
+    case OP_if_true8:
+        target = aot_get_jump_target(bc_buf, pos);
+        snprintf(cond, sizeof(cond), "%saot_to_bool_free(ctx, s%d)",
+                 (op == OP_if_false || op == OP_if_false8) ? "!" : "",
+                 sp - 1);
+        aot_emit_jump(d, target, cond);
+        break;
+    case OP_lt_if_false8:
+        s->use_res = TRUE;
+        dbuf_printf(d, "  if (!aot_lt(&res, s%d, s%d))\n"
+                    "    goto bail%d;\n", sp - 2, sp - 1, pos);
+        s->flags[pos] |= AOT_BAIL;
+        aot_emit_jump(d, aot_get_jump_target(bc_buf, pos), "!res");
+        break;
+    case OP_goto:
+    case OP_goto8:
+    case OP_goto16:
+        aot_emit_jump(d, aot_get_jump_target(bc_buf, pos), NULL);
+        break;
+    case OP_loop:
+        /* the interpreter calls the interrupt handler and enters
+           again after the 'loop' opcode */
+        dbuf_printf(d, "  if (--*f->interrupt_counter <= 0)\n"
+                    "    goto bail%d;\n", pos);
+        break;
+    case OP_return:
+        dbuf_printf(d, "  f->ret_val = s%d;\n", sp - 1);
+        aot_emit_flush(d, sp - 1);
+        dbuf_printf(d, "  return JS_NATIVE_CODE_RETURN;\n");
+        break;
+    case OP_return_undef:
+        dbuf_printf(d, "  f->ret_val = JS_UNDEFINED;\n");
+        aot_emit_flush(d, sp);
+        dbuf_printf(d, "  return JS_NATIVE_CODE_RETURN;\n");
+        break;
+    default:
+        abort();
+    }
+}
+
+/* translate the function 'b' to the C function 'func_name'. Return
+   FALSE if no native code is useful. */
+static BOOL aot_output_function(JSContext *ctx, DynBuf *out,
+                                const char *func_name, JSValueConst obj,
+                                const JSBytecodeInfo *bi)
+{
+    AOTFunction s_s, *s = &s_s;
+    const uint8_t *bc_buf;
+    DynBuf body_s, *d = &body_s;
+    int pos, op, target, i, stack_len;
+    const JSOpCode *oi;
+    BOOL has_entry;
+
+    memset(s, 0, sizeof(*s));
+    bc_buf = bi->byte_code;
+    s->bc_buf = bc_buf;
+    s->bc_len = bi->byte_code_len;
+    s->cpool_count = bi->cpool_count;
+    if (!bi->native_code_supported || s->bc_len == 0)
+        return FALSE;
+    s->stack_level = malloc(sizeof(s->stack_level[0]) * s->bc_len);
+    s->flags = calloc(s->bc_len + 1, 1);
+    if (!s->stack_level || !s->flags) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    has_entry = FALSE;
+    if (JS_GetBytecodeStackLevels(ctx, obj, s->stack_level) < 0) {
+        JS_FreeValue(ctx, JS_GetException(ctx));
+        goto done;
+    }
+
+    /* the interpreter enters the native code at the start of the
+       function and after the 'loop' opcodes */
+    for(pos = 0; pos < s->bc_len; pos += short_opcode_info(op).size) {
+        op = bc_buf[pos];
+        if (op == OP_invalid || op >= OP_COUNT) {
+            has_entry = FALSE;
+            goto done;
+        }
+        if (s->stack_level[pos] == 0xffff)
+            continue;
+        target = -1;
+        if (pos == 0)
+            target = 0;
+        else if (op == OP_loop)
+            target = pos + 1;
+        if (target >= 0 && target < s->bc_len &&
+            !(s->flags[target] & AOT_ENTRY) &&
+            aot_is_useful_entry(s, target)) {
+            s->flags[target] |= AOT_ENTRY;
+            has_entry = TRUE;
+        }
+    }
+    if (!has_entry)
+        goto done;
+    aot_mark_reached(s);
+
+    dbuf_init(d);
+    for(pos = 0; pos < s->bc_len; pos += short_opcode_info(op).size) {
+        op = bc_buf[pos];
+        if (!(s->flags[pos] & AOT_REACHED))
+            continue;
+        if (s->flags[pos] & AOT_LABEL)
+            dbuf_printf(d, " L%d:\n", pos);
+        stack_len = s->stack_level[pos];
+        oi = &short_opcode_info(op);
+        if (aot_is_supported(s, pos))
+            stack_len += max_int(oi->n_push - oi->n_pop, 0);
+        s->stack_len_used = max_int(s->stack_len_used, stack_len);
+        if (aot_is_supported(s, pos))
+            aot_emit_insn(s, d, pos);
+        else
+            dbuf_printf(d, "  goto bail%d;\n", pos);
+    }
+    for(pos = 0; pos < s->bc_len; pos++) {
+        if (!(s->flags[pos] & AOT_BAIL))
+            continue;
+        dbuf_printf(d, " bail%d:\n", pos);
+        aot_emit_flush(d, s->stack_level[pos]);
+        dbuf_printf(d, "  f->pc = %d;\n"
+                    "  return JS_NATIVE_CODE_BAILOUT;\n", pos);
+    }
+
+    dbuf_printf(out, "static int %s(JSContext *ctx, JSNativeCodeFrame *f)\n"
+                "{\n", func_name);
+    if (s->use_arg_buf)
+        dbuf_printf(out, "  JSValue *arg_buf = f->arg_buf;\n");
+    if (s->use_var_buf)
+        dbuf_printf(out, "  JSValue *var_buf = f->var_buf;\n");
+    dbuf_printf(out, "  JSValue *stack_buf = f->stack_buf;\n");
+    for(i = 0; i < s->stack_len_used; i++)
+        dbuf_printf(out, "  JSValue s%d;\n", i);
+    if (s->use_tmp)
+        dbuf_printf(out, "  JSValue tmp;\n");
+    if (s->use_res)
+        dbuf_printf(out, "  int res;\n");
+    dbuf_printf(out, "\n  switch(f->pc) {\n");
+    for(pos = 0; pos < s->bc_len; pos++) {
+        if (!(s->flags[pos] & AOT_ENTRY))
+            continue;
+        dbuf_printf(out, "  case %d:\n", pos);
+        stack_len = s->stack_level[pos];
+        for(i = 0; i < stack_len; i++)
+            dbuf_printf(out, "    s%d = stack_buf[%d];\n", i, i);
+        dbuf_printf(out, "    goto L%d;\n", pos);
+    }
+    dbuf_printf(out, "  default:\n"
+                "    return JS_NATIVE_CODE_BAILOUT;\n"
+                "  }\n");
+    dbuf_put(out, d->buf, d->size);
+    dbuf_printf(out, "}\n\n");
+    dbuf_free(d);
+ done:
+    free(s->stack_level);
+    free(s->flags);
+    return has_entry;
+}
+
+/* translate 'obj' and the functions in its constant pool in the
+   order expected by JS_SetNativeCodeTable() */
+static void aot_output_functions(JSContext *ctx, DynBuf *out, DynBuf *tab,
+                                 JSValueConst obj, const char *c_name)
+{
+    JSBytecodeInfo bi;
+    char func_name[1100];
+    int i;
+
+    if (JS_GetBytecodeInfo(ctx, obj, &bi) < 0)
+        abort();
+    snprintf(func_name, sizeof(func_name), "%s_aot%d",
+             c_name, aot_func_count++);
+    if (aot_output_function(ctx, out, func_name, obj, &bi))
+        dbuf_printf(tab, "  %s,\n", func_name);
+    else
+        dbuf_printf(tab, "  NULL,\n");
+    for(i = 0; i < bi.cpool_count; i++) {
+        if (JS_VALUE_GET_TAG(bi.cpool[i]) == JS_TAG_FUNCTION_BYTECODE)
+            aot_output_functions(ctx, out, tab, bi.cpool[i], c_name);
+    }
+}
+
+static void output_native_code(JSContext *ctx, FILE *fo, JSValueConst obj,
+                               const char *c_name)
+{
+    static BOOL helpers_output;
+    DynBuf out_s, *out = &out_s;
+    DynBuf tab_s, *tab = &tab_s;
+
+    if (!helpers_output) {
+        fputs(aot_helpers, fo);
+        helpers_output = TRUE;
+    }
+    dbuf_init(out);
+    dbuf_init(tab);
+    aot_func_count = 0;
+    aot_output_functions(ctx, out, tab, obj, c_name);
+    if (dbuf_error(out) || dbuf_error(tab)) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    fwrite(out->buf, 1, out->size, fo);
+    fprintf(fo, "const uint32_t %s_native_count = %d;\n\n",
+            c_name, aot_func_count);
+    fprintf(fo, "JSNativeCodeFunc * const %s_native[%d] = {\n",
+            c_name, aot_func_count);
+    fwrite(tab->buf, 1, tab->size, fo);
+    fprintf(fo, "};\n\n");
+    dbuf_free(out);
+    dbuf_free(tab);
+}
+
 static void output_object_code(JSContext *ctx,
                                FILE *fo, JSValueConst obj, const char *c_name,
                                BOOL load_only)
@@ -198,6 +1279,9 @@ static void output_object_code(JSContext *ctx,
     fprintf(fo, "};\n\n");
 
     js_free(ctx, out_buf);
+
+    if (aot_output)
+        output_native_code(ctx, fo, obj, c_name);
 }
 
 static int js_module_dummy_init(JSContext *ctx, JSModuleDef *m)
@@ -320,6 +1404,17 @@ static void compile_file(JSContext *ctx, FILE *fo,
     JS_FreeValue(ctx, obj);
 }
 
+static void output_eval_binary(FILE *fo, const char *c_name, int load_only)
+{
+    if (aot_output) {
+        fprintf(fo, "  js_std_eval_binary_native(ctx, %s, %s_size, %d, %s_native, %s_native_count);\n",
+                c_name, c_name, load_only, c_name, c_name);
+    } else {
+        fprintf(fo, "  js_std_eval_binary(ctx, %s, %s_size, %d);\n",
+                c_name, c_name, load_only);
+    }
+}
+
 static const char main_c_template1[] =
     "int main(int argc, char **argv)\n"
     "{\n"
@@ -354,7 +1449,8 @@ void help(void)
            "-M module_name[,cname] add initialization code for an external C module\n"
            "-x          byte swapped output\n"
            "-p prefix   set the prefix of the generated C names\n"
-           "-S n        set the maximum stack size to 'n' bytes (default=%d)\n",
+           "-S n        set the maximum stack size to 'n' bytes (default=%d)\n"
+           "-O aot      also translate the bytecode to C (ahead of time compilation)\n",
            JS_DEFAULT_STACK_SIZE);
 #ifdef CONFIG_LTO
     {
@@ -514,7 +1610,7 @@ int main(int argc, char **argv)
     namelist_add(&cmodule_list, "os", "os", 0);
 
     for(;;) {
-        c = getopt(argc, argv, "ho:cN:f:mxevM:p:S:D:");
+        c = getopt(argc, argv, "ho:cN:f:mxevM:p:S:D:O:");
         if (c == -1)
             break;
         switch(c) {
@@ -595,6 +1691,13 @@ int main(int argc, char **argv)
         case 'S':
             stack_size = (size_t)strtod(optarg, NULL);
             break;
+        case 'O':
+            if (strcmp(optarg, "aot")) {
+                fprintf(stderr, "unsupported optimization: %s\n", optarg);
+                exit(1);
+            }
+            aot_output = TRUE;
+            break;
         default:
             break;
         }
@@ -651,6 +1754,10 @@ int main(int argc, char **argv)
         fprintf(fo, "#include \"quickjs-libc.h\"\n"
                 "\n"
                 );
+    } else if (aot_output) {
+        fprintf(fo, "#include \"quickjs.h\"\n"
+                "\n"
+                );
     } else {
         fprintf(fo, "#include <inttypes.h>\n"
                 "\n"
@@ -712,8 +1819,7 @@ int main(int argc, char **argv)
         for(i = 0; i < cname_list.count; i++) {
             namelist_entry_t *e = &cname_list.array[i];
             if (e->flags) {
-                fprintf(fo, "  js_std_eval_binary(ctx, %s, %s_size, 1);\n",
-                        e->name, e->name);
+                output_eval_binary(fo, e->name, 1);
             }
         }
         fprintf(fo,
@@ -739,8 +1845,7 @@ int main(int argc, char **argv)
         for(i = 0; i < cname_list.count; i++) {
             namelist_entry_t *e = &cname_list.array[i];
             if (!e->flags) {
-                fprintf(fo, "  js_std_eval_binary(ctx, %s, %s_size, 0);\n",
-                        e->name, e->name);
+                output_eval_binary(fo, e->name, 0);
             }
         }
         fputs(main_c_template2, fo);
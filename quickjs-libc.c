@@ -129,6 +129,10 @@ typedef struct JSThreadState {
     int eval_script_recurse; /* only used in the main thread */
     /* not used in the main thread */
     JSWorkerMessagePipe *recv_pipe, *send_pipe;
+    JSContext *gc_ctx; /* context of gc_func */
+    JSValue gc_func; /* std.setGCCallback() function */
+    BOOL gc_event_pending; /* a collection finished since the last call */
+    BOOL in_gc_func;
 } JSThreadState;
 
 static uint64_t os_pending_signals;
@@ -716,10 +720,138 @@ static JSValue js_std_getenviron(JSContext *ctx, JSValueConst this_val,
     return JS_EXCEPTION;
 }
 
+static JSValue js_std_new_gc_stats(JSContext *ctx)
+{
+    JSGCStats s;
+    JSValue obj;
+
+    JS_GetGCStats(JS_GetRuntime(ctx), &s);
+    obj = JS_NewObject(ctx);
+    if (JS_IsException(obj))
+        return obj;
+#define GC_STAT(name) \
+    JS_DefinePropertyValueStr(ctx, obj, #name, JS_NewInt64(ctx, s.name), \
+                              JS_PROP_C_W_E)
+    GC_STAT(gc_count);
+    GC_STAT(gc_auto_count);
+    GC_STAT(minor_count);
+    GC_STAT(gc_time);
+    GC_STAT(max_pause);
+    GC_STAT(decref_time);
+    GC_STAT(decref_max_time);
+    GC_STAT(scan_time);
+    GC_STAT(scan_max_time);
+    GC_STAT(free_time);
+    GC_STAT(free_max_time);
+    GC_STAT(scanned_count);
+    GC_STAT(freed_count);
+    GC_STAT(freed_size);
+    GC_STAT(heap_size);
+#undef GC_STAT
+    return obj;
+}
+
+static JSValue js_std_gcStats(JSContext *ctx, JSValueConst this_val,
+                              int argc, JSValueConst *argv)
+{
+    return js_std_new_gc_stats(ctx);
+}
+
+static JSValue js_std_writeHeapSnapshot(JSContext *ctx, JSValueConst this_val,
+                                        int argc, JSValueConst *argv)
+{
+    const char *filename;
+    FILE *f;
+    int err, flags;
+
+    flags = 0;
+    if (argc >= 2 && JS_ToBool(ctx, argv[1]))
+        flags |= JS_HEAP_SNAPSHOT_ADDRESS;
+    filename = JS_ToCString(ctx, argv[0]);
+    if (!filename)
+        return JS_EXCEPTION;
+    f = fopen(filename, "w");
+    JS_FreeCString(ctx, filename);
+    if (!f)
+        return JS_NewInt32(ctx, -errno);
+    err = 0;
+    if (JS_WriteHeapSnapshot(JS_GetRuntime(ctx), f, flags) < 0)
+        err = -EIO;
+    if (fclose(f) != 0 && err == 0)
+        err = -errno;
+    return JS_NewInt32(ctx, err);
+}
+
+/* call the std.setGCCallback() function if a collection finished
+   since the last call */
+static JSValue js_std_call_gc_func(JSThreadState *ts)
+{
+    JSContext *ctx = ts->gc_ctx;
+    JSValue func, stats, ret;
+
+    if (!ts->gc_event_pending || ts->in_gc_func)
+        return JS_UNDEFINED;
+    ts->gc_event_pending = FALSE;
+    if (JS_IsUndefined(ts->gc_func))
+        return JS_UNDEFINED;
+    stats = js_std_new_gc_stats(ctx);
+    if (JS_IsException(stats))
+        return stats;
+    /* the callback may replace itself */
+    func = JS_DupValue(ctx, ts->gc_func);
+    ts->in_gc_func = TRUE;
+    ret = JS_Call(ctx, func, JS_UNDEFINED, 1, (JSValueConst *)&stats);
+    ts->in_gc_func = FALSE;
+    JS_FreeValue(ctx, func);
+    JS_FreeValue(ctx, stats);
+    return ret;
+}
+
+/* Nothing can be allocated and no JS code can be run inside the GC, so
+   the function is called later by std.gc() or by the event loop. */
+static void js_std_gc_callback(JSRuntime *rt, JSGCEventEnum event,
+                               const JSGCStats *stats, void *opaque)
+{
+    JSThreadState *ts = opaque;
+
+    if (event == JS_GC_EVENT_END)
+        ts->gc_event_pending = TRUE;
+}
+
 static JSValue js_std_gc(JSContext *ctx, JSValueConst this_val,
                          int argc, JSValueConst *argv)
 {
-    JS_RunGC(JS_GetRuntime(ctx));
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    JSValue ret;
+
+    JS_RunGC(rt);
+    ret = js_std_call_gc_func(ts);
+    if (JS_IsException(ret))
+        return ret;
+    JS_FreeValue(ctx, ret);
+    return JS_UNDEFINED;
+}
+
+static JSValue js_std_setGCCallback(JSContext *ctx, JSValueConst this_val,
+                                    int argc, JSValueConst *argv)
+{
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
+    JSValueConst func;
+
+    func = argv[0];
+    if (JS_IsNull(func) || JS_IsUndefined(func)) {
+        JS_SetGCCallback(rt, NULL, NULL);
+        func = JS_UNDEFINED;
+    } else {
+        if (!JS_IsFunction(ctx, func))
+            return JS_ThrowTypeError(ctx, "not a function");
+        ts->gc_ctx = ctx;
+        JS_SetGCCallback(rt, js_std_gc_callback, ts);
+    }
+    JS_FreeValue(ctx, ts->gc_func);
+    ts->gc_func = JS_DupValue(ctx, func);
     return JS_UNDEFINED;
 }
 
@@ -1221,12 +1353,11 @@ static JSValue js_std_file_getline(JSContext *ctx, JSValueConst this_val,
     return obj;
 }
 
-/* XXX: could use less memory and go faster */
 static JSValue js_std_file_readAsString(JSContext *ctx, JSValueConst this_val,
                                         int argc, JSValueConst *argv)
 {
     FILE *f = js_std_file_get(ctx, this_val);
-    int c;
+    size_t len, n;
     DynBuf dbuf;
     JSValue obj;
     uint64_t max_size64;
@@ -1250,14 +1381,20 @@ static JSValue js_std_file_readAsString(JSContext *ctx, JSValueConst this_val,
 
     js_std_dbuf_init(ctx, &dbuf);
     while (max_size != 0) {
-        c = fgetc(f);
-        if (c == EOF)
-            break;
-        if (dbuf_putc(&dbuf, c)) {
+        /* read by blocks. fread() only returns less than 'len'
+           bytes at the end of file or on error. */
+        len = max_size;
+        if (len > 4096)
+            len = 4096;
+        if (dbuf_realloc(&dbuf, dbuf.size + len)) {
             dbuf_free(&dbuf);
             return JS_EXCEPTION;
         }
-        max_size--;
+        n = fread(dbuf.buf + dbuf.size, 1, len, f);
+        dbuf.size += n;
+        max_size -= n;
+        if (n < len)
+            break;
     }
     obj = JS_NewStringLen(ctx, (const char *)dbuf.buf, dbuf.size);
     dbuf_free(&dbuf);
@@ -1500,6 +1637,9 @@ static const JSCFunctionListEntry js_std_error_props[] = {
 static const JSCFunctionListEntry js_std_funcs[] = {
     JS_CFUNC_DEF("exit", 1, js_std_exit ),
     JS_CFUNC_DEF("gc", 0, js_std_gc ),
+    JS_CFUNC_DEF("gcStats", 0, js_std_gcStats ),
+    JS_CFUNC_DEF("setGCCallback", 1, js_std_setGCCallback ),
+    JS_CFUNC_DEF("writeHeapSnapshot", 1, js_std_writeHeapSnapshot ),
     JS_CFUNC_DEF("evalScript", 1, js_evalScript ),
     JS_CFUNC_DEF("loadScript", 1, js_loadScript ),
     JS_CFUNC_DEF("getenv", 1, js_std_getenv ),
@@ -3819,6 +3959,7 @@ void js_std_init_handlers(JSRuntime *rt)
     init_list_head(&ts->os_signal_handlers);
     init_list_head(&ts->os_timers);
     init_list_head(&ts->port_list);
+    ts->gc_func = JS_UNDEFINED;
 
     JS_SetRuntimeOpaque(rt, ts);
 
@@ -3857,6 +3998,9 @@ void js_std_free_handlers(JSRuntime *rt)
             free_timer(rt, th);
     }
 
+    JS_SetGCCallback(rt, NULL, NULL);
+    JS_FreeValueRT(rt, ts->gc_func);
+
 #ifdef USE_WORKER
     /* XXX: free port_list ? */
     js_free_message_pipe(ts->recv_pipe);
@@ -3918,13 +4062,23 @@ void js_std_promise_rejection_tracker(JSContext *ctx, JSValueConst promise,
 /* main loop which calls the user JS callbacks */
 void js_std_loop(JSContext *ctx)
 {
+    JSRuntime *rt = JS_GetRuntime(ctx);
+    JSThreadState *ts = JS_GetRuntimeOpaque(rt);
     JSContext *ctx1;
+    JSValue ret;
     int err;
 
     for(;;) {
         /* execute the pending jobs */
         for(;;) {
-            err = JS_ExecutePendingJob(JS_GetRuntime(ctx), &ctx1);
+            /* continue the incremental GC between the jobs */
+            if (JS_IsGCInProgress(rt))
+                JS_RunGCStep(rt, JS_GetGCPauseBudget(rt));
+            ret = js_std_call_gc_func(ts);
+            if (JS_IsException(ret))
+                js_std_dump_error(ts->gc_ctx);
+            JS_FreeValue(ts->gc_ctx, ret);
+            err = JS_ExecutePendingJob(rt, &ctx1);
             if (err <= 0) {
                 if (err < 0) {
                     js_std_dump_error(ctx1);
@@ -3938,13 +4092,20 @@ void js_std_loop(JSContext *ctx)
     }
 }
 
-void js_std_eval_binary(JSContext *ctx, const uint8_t *buf, size_t buf_len,
-                        int load_only)
+void js_std_eval_binary_native(JSContext *ctx, const uint8_t *buf,
+                               size_t buf_len, int load_only,
+                               JSNativeCodeFunc * const *native_code,
+                               int native_code_count)
 {
     JSValue obj, val;
     obj = JS_ReadObject(ctx, buf, buf_len, JS_READ_OBJ_BYTECODE);
     if (JS_IsException(obj))
         goto exception;
+    if (native_code &&
+        JS_SetNativeCodeTable(ctx, obj, native_code, native_code_count) < 0) {
+        JS_FreeValue(ctx, obj);
+        goto exception;
+    }
     if (load_only) {
         if (JS_VALUE_GET_TAG(obj) == JS_TAG_MODULE) {
             js_module_set_import_meta(ctx, obj, FALSE, FALSE);
@@ -3966,3 +4127,9 @@ void js_std_eval_binary(JSContext *ctx, const uint8_t *buf, size_t buf_len,
         JS_FreeValue(ctx, val);
     }
 }
+
+void js_std_eval_binary(JSContext *ctx, const uint8_t *buf, size_t buf_len,
+                        int load_only)
+{
+    js_std_eval_binary_native(ctx, buf, buf_len, load_only, NULL, 0);
+}
@@ -47,6 +47,12 @@ JSModuleDef *js_module_loader(JSContext *ctx,
                               const char *module_name, void *opaque);
 void js_std_eval_binary(JSContext *ctx, const uint8_t *buf, size_t buf_len,
                         int flags);
+/* same as js_std_eval_binary() with the native code generated by
+   'qjsc -O aot' (see JS_SetNativeCodeTable()) */
+void js_std_eval_binary_native(JSContext *ctx, const uint8_t *buf,
+                               size_t buf_len, int flags,
+                               JSNativeCodeFunc * const *native_code,
+                               int native_code_count);
 void js_std_promise_rejection_tracker(JSContext *ctx, JSValueConst promise,
                                       JSValueConst reason,
                                       JS_BOOL is_handled, void *opaque);
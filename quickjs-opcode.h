@@ -182,6 +182,7 @@ DEF(           goto, 5, 0, 0, label) /* must come after if_true */
 DEF(          catch, 5, 0, 1, label)
 DEF(          gosub, 5, 0, 0, label) /* used to execute the finally block */
 DEF(            ret, 1, 1, 0, none) /* used to return from the finally block */
+DEF(           loop, 1, 0, 0, none) /* loop header: poll the interrupts */
 
 DEF(      to_object, 1, 1, 1, none)
 //DEF(      to_string, 1, 1, 1, none)
@@ -256,6 +257,19 @@ DEF(            and, 1, 2, 1, none)
 DEF(            xor, 1, 2, 1, none)
 DEF(             or, 1, 2, 1, none)
 DEF(is_undefined_or_null, 1, 1, 1, none)
+/* get_field, get_field2 and put_field with an inline cache: the
+   operand is an index in JSFunctionBytecode.ic. They are never
+   serialized. */
+DEF(   get_field_ic, 5, 1, 1, u32)
+DEF(  get_field2_ic, 5, 1, 2, u32)
+DEF(   put_field_ic, 5, 2, 0, u32)
+/* quickened opcodes: a generic opcode is rewritten in place to one
+   of them when the types of its operands match, and back to the
+   generic opcode when they do not. They are never serialized. */
+DEF(      add_float, 1, 2, 1, none) /* add of two float64 */
+DEF(     add_string, 1, 2, 1, none) /* add of two strings */
+DEF(      mul_float, 1, 2, 1, none) /* mul of two float64 */
+DEF(  add_loc_float, 2, 1, 0, loc8) /* add_loc of two float64 */
 #ifdef CONFIG_BIGNUM
 DEF(      mul_pow10, 1, 2, 1, none)
 DEF(       math_mod, 1, 2, 1, none)
@@ -358,6 +372,9 @@ DEF(   is_undefined, 1, 1, 1, none)
 DEF(        is_null, 1, 1, 1, none)
 DEF(typeof_is_undefined, 1, 1, 1, none)
 DEF( typeof_is_function, 1, 1, 1, none)
+/* superinstructions for two of the most frequent opcode pairs */
+DEF(  get_loc0_loc1, 1, 0, 2, none)  /* get_loc0 get_loc1 */
+DEF(   lt_if_false8, 2, 2, 0, label8) /* lt if_false8 */
 #endif
 
 #undef DEF
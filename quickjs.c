@@ -50,7 +50,9 @@
 
 #define OPTIMIZE         1
 #define SHORT_OPCODES    1
-#if defined(EMSCRIPTEN) || defined(__wasi__)
+/* CONFIG_SWITCH_DISPATCH can be used to test the switch based
+   dispatch of the wasm builds on native targets */
+#if defined(EMSCRIPTEN) || defined(__wasi__) || defined(CONFIG_SWITCH_DISPATCH)
 #define DIRECT_DISPATCH  0
 #else
 #define DIRECT_DISPATCH  1
@@ -58,6 +60,8 @@
 
 #if defined(__APPLE__)
 #define MALLOC_OVERHEAD  0
+#elif defined(CONFIG_MALLOC_SIZE_HEADER)
+#define MALLOC_OVERHEAD  (8 + SIZED_MALLOC_HEADER_SIZE)
 #else
 #define MALLOC_OVERHEAD  8
 #endif
@@ -109,6 +113,14 @@
 /* test the GC by forcing it before each object allocation */
 //#define FORCE_GC_AT_MALLOC
 
+/* in generational mode, minimum number of promoted objects before a
+   full collection is done */
+#define JS_GC_MIN_PROMOTED_COUNT 10000
+/* in incremental mode, number of freed objects between two time checks */
+#define JS_GC_SLICE_CHECK_COUNT  64
+/* in incremental mode, amount of allocated memory between two slices */
+#define JS_GC_SLICE_ALLOC_SIZE   (64 * 1024)
+
 #ifdef CONFIG_ATOMICS
 #include <pthread.h>
 #include <stdatomic.h>
@@ -203,6 +215,15 @@ typedef enum JSErrorEnum {
 #define JS_MAX_LOCAL_VARS 65536
 #define JS_STACK_SIZE_MAX 65534
 #define JS_STRING_LEN_MAX ((1 << 30) - 1)
+/* shorter concatenations give a flat string */
+#define JS_STRING_ROPE_MIN_LEN 256
+/* deeper ropes are flattened */
+#define JS_STRING_ROPE_MAX_DEPTH 48
+/* shorter substrings are copied */
+#define JS_STRING_SLICE_MIN_LEN 64
+/* substrings of strings more than JS_STRING_SLICE_MAX_RATIO times
+   longer are copied so that they don't keep them alive */
+#define JS_STRING_SLICE_MAX_RATIO 8
 
 #define __exception __attribute__((warn_unused_result))
 
@@ -216,6 +237,16 @@ typedef enum {
     JS_GC_PHASE_REMOVE_CYCLES,
 } JSGCPhaseEnum;
 
+typedef enum {
+    JS_GC_MARK_NONE,
+    JS_GC_MARK_COUNT, /* count the objects of the collected generation */
+    JS_GC_MARK_CLEAR, /* clear the hash table */
+    JS_GC_MARK_DECREF, /* count the references between them */
+    JS_GC_MARK_SCAN, /* visit the objects referenced from outside */
+} JSGCMarkPhaseEnum;
+
+typedef struct JSGCMarkEntry JSGCMarkEntry;
+
 typedef enum OPCodeEnum OPCodeEnum;
 
 #ifdef CONFIG_BIGNUM
@@ -238,9 +269,71 @@ typedef struct {
 } JSNumericOperations;
 #endif
 
+/* Optional slab allocator for the small engine objects (JSObject,
+   JSShape, JSProperty arrays, JSString, JSVarRef, JSMapRecord). The
+   blocks of a given size class are carved from pages allocated with
+   js_malloc_rt() so that the memory accounting is unchanged. The size
+   of a block must be given when freeing it. With
+   JS_RUNTIME_MEMORY_ACCOUNTING, each block starts with a
+   JSSlabAccountHeader so that it is charged to its context. */
+#define JS_SLAB_ALIGN       16
+#define JS_SLAB_MAX_SIZE    256 /* larger blocks use js_malloc_rt() */
+#define JS_SLAB_CLASS_COUNT (JS_SLAB_MAX_SIZE / JS_SLAB_ALIGN)
+#define JS_SLAB_PAGE_SIZE   (16 * 1024)
+/* minimum size of the free blocks before trying to release pages */
+#define JS_SLAB_TRIM_SIZE   (16 * JS_SLAB_PAGE_SIZE)
+
+typedef struct JSSlabBlock {
+    struct JSSlabBlock *next;
+} JSSlabBlock;
+
+/* the blocks start at offset JS_SLAB_ALIGN in the page */
+typedef struct JSSlabPage {
+    struct JSSlabPage *next;
+    int class_idx;
+    int free_count; /* only used in js_slab_trim() */
+} JSSlabPage;
+
+typedef struct JSSlabAllocator {
+    BOOL enabled;
+    JSSlabBlock *free_list[JS_SLAB_CLASS_COUNT];
+    JSSlabPage *page_list;
+    int64_t page_count;
+    int64_t free_size; /* total size of the blocks in the free lists */
+    int64_t trim_size; /* free_size which triggers the next js_slab_trim() */
+} JSSlabAllocator;
+
+/* memory charged to a context when JS_RUNTIME_MEMORY_ACCOUNTING is
+   used. It is freed when the context is freed and all its blocks are
+   freed. */
+typedef struct JSMemoryAccount {
+    struct JSContext *ctx; /* NULL if the context was freed */
+    int64_t malloc_count;
+    int64_t malloc_size;
+    int64_t malloc_limit; /* 0 if no limit */
+} JSMemoryAccount;
+
+/* prepended to each block when JS_RUNTIME_MEMORY_ACCOUNTING is used */
+typedef union JSAccountHeader {
+    struct {
+        JSMemoryAccount *account; /* NULL if not charged to a context */
+        size_t size;
+    } h;
+    max_align_t align;
+} JSAccountHeader;
+
+/* prepended to each slab block when JS_RUNTIME_MEMORY_ACCOUNTING is
+   used. The block size is charged to the account. */
+typedef union JSSlabAccountHeader {
+    JSMemoryAccount *account; /* NULL if not charged to a context */
+    uint8_t align[JS_SLAB_ALIGN];
+} JSSlabAccountHeader;
+
 struct JSRuntime {
     JSMallocFunctions mf;
     JSMallocState malloc_state;
+    JSSlabAllocator slab;
+    BOOL memory_accounting : 8;
     const char *rt_info;
 
     int atom_hash_size; /* power of two */
@@ -250,22 +343,61 @@ struct JSRuntime {
     uint32_t *atom_hash;
     JSAtomStruct **atom_array;
     int atom_free_index; /* 0 = none */
+    /* one character strings for the Latin-1 range, allocated on first
+       use and shared by all the contexts */
+    JSString *char_strings[256];
 
     int class_count;    /* size of class_array */
     JSClass *class_array;
 
     struct list_head context_list; /* list of JSContext.link */
     /* list of JSGCObjectHeader.link. List of allocated GC objects (used
-       by the garbage collector) */
+       by the garbage collector). In generational mode, only the young
+       objects are in this list. */
     struct list_head gc_obj_list;
+    /* list of JSGCObjectHeader.link. GC objects which survived a minor
+       collection. Only used in generational mode. */
+    struct list_head gc_old_obj_list;
+    BOOL gc_generational : 8;
+    int64_t gc_promoted_count; /* objects promoted since the last full GC */
+    int64_t gc_full_survivor_count; /* objects alive after the last full GC */
     /* list of JSGCObjectHeader.link. Used during JS_FreeValueRT() */
     struct list_head gc_zero_ref_count_list; 
     struct list_head tmp_obj_list; /* used during GC */
+    /* list of JSGCObjectHeader.link. Finalized objects waiting for the
+       end of an incremental collection */
+    struct list_head gc_zombie_list;
+    /* list of JSFunctionBytecode.ic_link */
+    struct list_head ic_bytecode_list;
+    int64_t proto_epoch; /* see JSInlineCache */
     JSGCPhaseEnum gc_phase : 8;
+    BOOL gc_in_progress : 8; /* TRUE if tmp_obj_list contains garbage */
+    /* incremental marking (see gc_mark_continue()) */
+    JSGCMarkPhaseEnum gc_mark_phase : 8;
+    BOOL gc_mark_full : 8; /* TRUE if the old generation is collected */
+    /* lists of JSGCObjectHeader.link */
+    struct list_head gc_mark_list; /* objects to visit in the phase */
+    struct list_head gc_mark_done_list; /* objects visited in the phase */
+    struct list_head gc_gray_list; /* alive, children not visited yet */
+    struct list_head gc_white_list; /* candidates for the cycle removal */
+    JSGCMarkEntry *gc_mark_tab; /* hash table of the internal references */
+    uintptr_t gc_mark_tab_mask;
+    uintptr_t gc_mark_tab_pos; /* next entry to clear */
+    int64_t gc_mark_count;
+    int64_t gc_mark_time; /* time spent in the current phase, in us */
+    int64_t gc_pause_budget; /* in us, 0 if the GC is not incremental */
+    JSGCPolicy gc_policy;
+    JSGCStats gc_stats;
+    JSGCCallback *gc_callback;
+    void *gc_callback_opaque;
+    int64_t gc_last_time; /* end of the last collection, in us */
+    size_t gc_start_size; /* malloc_size at the start of the collection */
     size_t malloc_gc_threshold;
 #ifdef DUMP_LEAKS
     struct list_head string_list; /* list of JSString.link */
 #endif
+    struct JSHeapProfile *heap_profile; /* NULL if not profiling */
+    struct JSHeapSnapshot *heap_snapshot; /* used by JS_WriteHeapSnapshot() */
     /* stack limitation */
     uintptr_t stack_size; /* in bytes, 0 if no limit */
     uintptr_t stack_top;
@@ -274,12 +406,41 @@ struct JSRuntime {
     JSValue current_exception;
     /* true if inside an out of memory error, to avoid recursing */
     BOOL in_out_of_memory : 8;
+    /* true if the memory reserve was released by an out of memory
+       error and not yet allocated again */
+    BOOL memory_reserve_used : 8;
+    /* true if the backtrace of the current out of memory error can be
+       allocated */
+    BOOL out_of_memory_backtrace : 8;
+    void *memory_reserve; /* released when out of memory */
+    size_t memory_reserve_size;
+    /* context account whose limit made the last allocation fail */
+    JSMemoryAccount *account_limit_hit;
+    /* context account which can exceed its limit by
+       memory_reserve_size until the pending exception is handled */
+    JSMemoryAccount *account_over_limit;
 
     struct JSStackFrame *current_stack_frame;
+    /* stack of the frames of the bytecode functions called directly
+       from the interpreter loop (see js_alloc_inline_frame()) */
+    struct JSFrameChunk *frame_chunk; /* NULL if no frame was allocated */
+    uint8_t *frame_ptr; /* first free byte in frame_chunk */
+    /* start of frame_chunk. NULL for the first chunk which is kept
+       when it is empty */
+    uint8_t *frame_start;
+    /* end of frame_chunk or of the space allowed by the maximum stack
+       size if it comes first */
+    uint8_t *frame_end;
+    struct JSFrameChunk *frame_chunk_spare; /* unused chunk kept for reuse */
 
     JSInterruptHandler *interrupt_handler;
     void *interrupt_opaque;
 
+    /* native code compilation of the hot bytecode functions */
+    JSCompileFunc *compile_func;
+    void *compile_opaque;
+    uint32_t compile_threshold;
+
     JSHostPromiseRejectionTracker *host_promise_rejection_tracker;
     void *host_promise_rejection_tracker_opaque;
     
@@ -337,6 +498,40 @@ typedef struct JSStackFrame {
     JSValue *cur_sp;
 } JSStackFrame;
 
+#define JS_FRAME_CHUNK_SIZE (32 * 1024)
+
+typedef struct JSFrameChunk {
+    uint8_t *end;
+    /* frame stack state before the allocation of the chunk */
+    struct JSFrameChunk *prev_chunk;
+    uint8_t *prev_ptr;
+    size_t prev_size; /* size of the frames in the previous chunks */
+    JSValue buf[0];
+} JSFrameChunk;
+
+/* Frame of a bytecode function called from the interpreter loop of
+   its caller. It is allocated in the runtime frame stack instead of
+   the C stack so that JS to JS calls do not recurse in
+   JS_CallInternal(). The caller interpreter state is saved in it. */
+typedef struct JSInlineFrame {
+    JSStackFrame sf; /* must come first */
+    /* call parameters. 'this_obj' is argv[-2] if ret_sp = argv - 2 or
+       in a tail call frame, otherwise it is undefined. 'new_target' is
+       always undefined. */
+    JSContext *caller_ctx;
+    int argc;
+    JSValue *argv;
+    /* caller state */
+    JSValue *caller_sp;
+    JSValue *ret_sp; /* position of the function object or 'this_obj'
+                        in the caller stack. NULL if the caller returns
+                        the result of the call (tail call) */
+    JSValue buf[0]; /* arguments, local variables and stack. In a tail
+                       call frame, it starts with 'this_obj', the
+                       function object and the arguments which are
+                       owned by the frame. */
+} JSInlineFrame;
+
 typedef enum {
     JS_GC_OBJ_TYPE_JS_OBJECT,
     JS_GC_OBJ_TYPE_FUNCTION_BYTECODE,
@@ -448,6 +643,7 @@ struct JSContext {
     BOOL is_error_property_enabled;
 
     struct list_head loaded_modules; /* list of JSModuleDef.link */
+    JSMemoryAccount *account; /* NULL if no memory accounting */
 
     /* if NULL, RegExp compilation is not supported */
     JSValue (*compile_regexp)(JSContext *ctx, JSValueConst pattern,
@@ -504,6 +700,22 @@ struct JSString {
     } u;
 };
 
+/* Lazy concatenation of two strings or lazy substring
+   (JS_TAG_STRING_ROPE). The characters are only copied when the string
+   is flattened, which happens on the first access to its contents. */
+typedef struct JSStringRope {
+    JSRefCountHeader header; /* must come first, 32-bit */
+    uint32_t len : 31;
+    uint8_t is_wide_char : 1; /* 0 = 8 bits, 1 = 16 bits characters */
+    /* 0 = leaf: the characters are left[start...start + len - 1] and
+       'right' is undefined. The rope is flattened when 'start' = 0
+       and 'len' is the length of 'left', otherwise it is a slice. */
+    uint8_t depth;
+    uint32_t start;
+    JSValue left;  /* JS_TAG_STRING or JS_TAG_STRING_ROPE */
+    JSValue right;
+} JSStringRope;
+
 typedef struct JSClosureVar {
     uint8_t is_local : 1;
     uint8_t is_arg : 1;
@@ -582,6 +794,31 @@ typedef enum JSFunctionKindEnum {
     JS_FUNC_ASYNC_GENERATOR = (JS_FUNC_GENERATOR | JS_FUNC_ASYNC),
 } JSFunctionKindEnum;
 
+#define JS_IC_SIZE 4 /* maximum number of shapes of a polymorphic cache */
+
+/* Inline cache of a get_field, get_field2 or put_field instruction:
+   index of the property for the last object shapes seen by the
+   instruction. Only hashed shapes are cached. They are never modified
+   in place while they are shared, so a shape change always gives a
+   different shape pointer.
+
+   For get_field and get_field2, the property can also be found in a
+   prototype ('holder'). The shapes of the prototypes are not checked
+   at each access: they are marked as watched and any change of the
+   properties of an object with a watched shape increments
+   JSRuntime.proto_epoch, which invalidates all the prototype
+   entries. */
+typedef struct JSInlineCache {
+    JSAtom atom; /* property name */
+    uint32_t count; /* number of cached shapes */
+    /* value of JSRuntime.proto_epoch when the prototype entries were
+       added */
+    int64_t proto_epoch;
+    JSShape *shapes[JS_IC_SIZE]; /* a reference is held */
+    uint32_t prop_idx[JS_IC_SIZE];
+    JSObject *holders[JS_IC_SIZE]; /* NULL for an own property */
+} JSInlineCache;
+
 typedef struct JSFunctionBytecode {
     JSGCObjectHeader header; /* must come first */
     uint8_t js_mode;
@@ -598,7 +835,8 @@ typedef struct JSFunctionBytecode {
     uint8_t has_debug : 1;
     uint8_t backtrace_barrier : 1; /* stop backtrace on this function */
     uint8_t read_only_bytecode : 1;
-    /* XXX: 4 bits available */
+    uint8_t quicken_miss_count : 3; /* see js_dequicken() */
+    /* XXX: 1 bit available */
     uint8_t *byte_code_buf; /* (self pointer) */
     int byte_code_len;
     JSAtom func_name;
@@ -612,6 +850,14 @@ typedef struct JSFunctionBytecode {
     JSValue *cpool; /* constant pool (self pointer) */
     int cpool_count;
     int closure_var_count;
+    JSNativeCodeFunc *native_code; /* NULL if none */
+    uint32_t call_count; /* calls and loop iterations before compilation */
+    /* 1 + position where the native code bailed out without executing
+       anything, 0 if none */
+    uint32_t native_no_entry;
+    JSInlineCache *ic; /* NULL if read only bytecode */
+    int ic_count;
+    struct list_head ic_link; /* list of the bytecodes with inline caches */
     struct {
         /* debug info, move to separate structure to save memory? */
         JSAtom filename;
@@ -853,6 +1099,9 @@ struct JSShape {
        <= n <= 2^31-1. If false, the shape is guaranteed not to have
        small array index properties */
     uint8_t has_small_array_index;
+    /* true if an inline cache depends on the properties of an object
+       using this shape as a prototype (see JSInlineCache) */
+    uint8_t is_watched;
     uint32_t hash; /* current hash value */
     uint32_t prop_hash_mask;
     int prop_size; /* allocated properties */
@@ -965,41 +1214,17 @@ static const char js_atom_init[] =
 #undef DEF
 ;
 
-typedef enum OPCodeFormat {
-#define FMT(f) OP_FMT_ ## f,
-#define DEF(id, size, n_pop, n_push, f)
-#include "quickjs-opcode.h"
-#undef DEF
-#undef FMT
-} OPCodeFormat;
-
-enum OPCodeEnum {
-#define FMT(f)
-#define DEF(id, size, n_pop, n_push, f) OP_ ## id,
-#define def(id, size, n_pop, n_push, f)
-#include "quickjs-opcode.h"
-#undef def
-#undef DEF
-#undef FMT
-    OP_COUNT, /* excluding temporary opcodes */
-    /* temporary opcodes : overlap with the short opcodes */
-    OP_TEMP_START = OP_nop + 1,
-    OP___dummy = OP_TEMP_START - 1,
-#define FMT(f)
-#define DEF(id, size, n_pop, n_push, f)
-#define def(id, size, n_pop, n_push, f) OP_ ## id,
-#include "quickjs-opcode.h"
-#undef def
-#undef DEF
-#undef FMT
-    OP_TEMP_END,
-};
+#include "quickjs-opcode-info.h"
 
 static int JS_InitAtoms(JSRuntime *rt);
 static JSAtom __JS_NewAtomInit(JSRuntime *rt, const char *str, int len,
                                int atom_type);
 static void JS_FreeAtomStruct(JSRuntime *rt, JSAtomStruct *p);
 static void free_function_bytecode(JSRuntime *rt, JSFunctionBytecode *b);
+static void js_create_inline_caches(JSRuntime *rt, JSFunctionBytecode *b);
+static void js_reset_inline_caches(JSRuntime *rt, JSFunctionBytecode *b);
+static void js_update_frame_end(JSRuntime *rt);
+static int js_slab_move_atoms(JSRuntime *rt, BOOL to_slab);
 static JSValue js_call_c_function(JSContext *ctx, JSValueConst func_obj,
                                   JSValueConst this_obj,
                                   int argc, JSValueConst *argv, int flags);
@@ -1021,6 +1246,10 @@ static __exception int JS_ToArrayLengthFree(JSContext *ctx, uint32_t *plen,
                                             JSValue val, BOOL is_array_ctor);
 static JSValue JS_EvalObject(JSContext *ctx, JSValueConst this_obj,
                              JSValueConst val, int flags, int scope_idx);
+static __exception int compute_stack_levels(JSContext *ctx,
+                                            const uint8_t *bc_buf, int bc_len,
+                                            uint16_t *stack_level_tab,
+                                            int *pstack_size);
 JSValue __attribute__((format(printf, 2, 3))) JS_ThrowInternalError(JSContext *ctx, const char *fmt, ...);
 static __maybe_unused void JS_DumpAtoms(JSRuntime *rt);
 static __maybe_unused void JS_DumpString(JSRuntime *rt,
@@ -1099,6 +1328,11 @@ static JSValue js_compile_regexp(JSContext *ctx, JSValueConst pattern,
 static JSValue js_regexp_constructor_internal(JSContext *ctx, JSValueConst ctor,
                                               JSValue pattern, JSValue bc);
 static void gc_decref(JSRuntime *rt);
+static void js_heap_profile_alloc(JSRuntime *rt, void *ptr, size_t size);
+static void js_heap_profile_free(JSRuntime *rt, void *ptr);
+static void js_heap_profile_cancel(JSRuntime *rt, void *ptr, size_t size);
+static size_t js_map_get_memory_size(struct JSMapState *s);
+static void js_restore_memory_reserve(JSRuntime *rt);
 static int JS_NewClass1(JSRuntime *rt, JSClassID class_id,
                         const JSClassDef *class_def, JSAtom name);
 
@@ -1243,6 +1477,8 @@ static JSAtom js_symbol_to_atom(JSContext *ctx, JSValue val);
 static void add_gc_object(JSRuntime *rt, JSGCObjectHeader *h,
                           JSGCObjectTypeEnum type);
 static void remove_gc_object(JSGCObjectHeader *h);
+static void gc_merge_generations(JSRuntime *rt);
+static void gc_collect_finish(JSRuntime *rt);
 static void js_async_function_free0(JSRuntime *rt, JSAsyncFunctionData *s);
 static JSValue js_instantiate_prototype(JSContext *ctx, JSObject *p, JSAtom atom, void *opaque);
 static JSValue js_module_ns_autoinit(JSContext *ctx, JSObject *p, JSAtom atom,
@@ -1257,9 +1493,51 @@ static const JSClassExoticMethods js_proxy_exotic_methods;
 static const JSClassExoticMethods js_module_ns_exotic_methods;
 static JSClassID js_class_id_alloc = JS_CLASS_INIT_COUNT;
 
+/* monotonic time in microseconds, used to measure the GC pauses */
+#if defined(__linux__) || defined(__APPLE__) || defined(__wasi__)
+static int64_t js_get_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (ts.tv_nsec / 1000);
+}
+#else
+/* more portable, but does not work if the date is updated */
+static int64_t js_get_time_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+#endif
+
+/* amount of allocation before the next automatic collection.
+   'alloc_rate' is in bytes per ms. */
+static size_t gc_next_growth(JSRuntime *rt, double alloc_rate)
+{
+    const JSGCPolicy *pol = &rt->gc_policy;
+    size_t growth;
+
+    if (pol->target_interval > 0 && alloc_rate > 0) {
+        double d = alloc_rate * pol->target_interval;
+        growth = d < (double)(SIZE_MAX / 2) ? (size_t)d : SIZE_MAX / 2;
+    } else {
+        growth = (rt->malloc_state.malloc_size / 100) * pol->heap_growth;
+    }
+    if (growth < pol->min_growth)
+        growth = pol->min_growth;
+    return growth;
+}
+
 static void js_trigger_gc(JSRuntime *rt, size_t size)
 {
     BOOL force_gc;
+
+    /* the memory may have been freed since the reserve could not be
+       allocated again */
+    if (unlikely(rt->memory_reserve_used) &&
+        JS_VALUE_GET_TAG(rt->current_exception) == JS_TAG_NULL)
+        js_restore_memory_reserve(rt);
 #ifdef FORCE_GC_AT_MALLOC
     force_gc = TRUE;
 #else
@@ -1267,13 +1545,46 @@ static void js_trigger_gc(JSRuntime *rt, size_t size)
                 rt->malloc_gc_threshold);
 #endif
     if (force_gc) {
+        const JSGCPolicy *pol = &rt->gc_policy;
+        int64_t elapsed;
+        double alloc_rate;
+
+        elapsed = js_get_time_us() - rt->gc_last_time;
+        if (pol->min_interval > 0 && !JS_IsGCInProgress(rt) &&
+            elapsed < (int64_t)pol->min_interval * 1000) {
+            /* too early: postpone the collection */
+            rt->malloc_gc_threshold = rt->malloc_state.malloc_size +
+                gc_next_growth(rt, 0);
+            return;
+        }
 #ifdef DUMP_GC
         printf("GC: size=%" PRIu64 "\n",
                (uint64_t)rt->malloc_state.malloc_size);
 #endif
-        JS_RunGC(rt);
-        rt->malloc_gc_threshold = rt->malloc_state.malloc_size +
-            (rt->malloc_state.malloc_size >> 1);
+        /* bytes per ms allocated since the last collection */
+        alloc_rate = (double)((int64_t)rt->malloc_state.malloc_size -
+                              rt->gc_stats.heap_size) * 1000.0 /
+            max_int64(elapsed, 1);
+        rt->gc_stats.gc_auto_count++;
+        if (rt->gc_pause_budget > 0) {
+            if (JS_RunGCStep(rt, rt->gc_pause_budget)) {
+                /* run the next slice after some more allocations */
+                rt->malloc_gc_threshold = rt->malloc_state.malloc_size +
+                    JS_GC_SLICE_ALLOC_SIZE;
+                return;
+            }
+        } else if (rt->gc_generational) {
+            JS_RunMinorGC(rt);
+        } else {
+            JS_RunGC(rt);
+        }
+        if (pol->next_threshold) {
+            rt->malloc_gc_threshold = pol->next_threshold(rt, &rt->gc_stats,
+                                                          pol->opaque);
+        } else {
+            rt->malloc_gc_threshold = rt->malloc_state.malloc_size +
+                gc_next_growth(rt, alloc_rate);
+        }
     }
 }
 
@@ -1282,26 +1593,383 @@ static size_t js_malloc_usable_size_unknown(const void *ptr)
     return 0;
 }
 
+static BOOL js_account_check(JSRuntime *rt, JSMemoryAccount *account,
+                             size_t size)
+{
+    int64_t limit;
+    /* the out of memory exception must be allocated */
+    if (!account || account->malloc_limit == 0 || rt->in_out_of_memory)
+        return TRUE;
+    limit = account->malloc_limit;
+    /* the backtrace and the stack unwinding of a quota error can
+       exceed the limit. The runtime memory reserve is not used so that
+       the other contexts are not affected. */
+    if (account == rt->account_over_limit)
+        limit += rt->memory_reserve_size;
+    if (account->malloc_size + size > limit) {
+        rt->account_limit_hit = account;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void js_account_free_account(JSRuntime *rt, JSMemoryAccount *account)
+{
+    if (rt->account_limit_hit == account)
+        rt->account_limit_hit = NULL;
+    if (rt->account_over_limit == account)
+        rt->account_over_limit = NULL;
+    js_free_rt(rt, account);
+}
+
+static void js_account_uncharge(JSRuntime *rt, JSMemoryAccount *account,
+                                size_t size)
+{
+    account->malloc_count--;
+    account->malloc_size -= size;
+    if (!account->ctx && account->malloc_count == 0)
+        js_account_free_account(rt, account);
+}
+
+static void *js_account_malloc(JSRuntime *rt, JSMemoryAccount *account,
+                               size_t size)
+{
+    JSAccountHeader *hdr;
+
+    if (!js_account_check(rt, account, size))
+        return NULL;
+    hdr = rt->mf.js_malloc(&rt->malloc_state, sizeof(*hdr) + size);
+    if (!hdr) {
+        rt->account_limit_hit = NULL;
+        return NULL;
+    }
+    hdr->h.account = account;
+    hdr->h.size = size;
+    if (account) {
+        account->malloc_count++;
+        account->malloc_size += size;
+    }
+    return hdr + 1;
+}
+
+static void js_account_free(JSRuntime *rt, void *ptr)
+{
+    JSAccountHeader *hdr;
+
+    if (!ptr)
+        return;
+    hdr = (JSAccountHeader *)ptr - 1;
+    if (hdr->h.account)
+        js_account_uncharge(rt, hdr->h.account, hdr->h.size);
+    rt->mf.js_free(&rt->malloc_state, hdr);
+}
+
+/* a reallocated block stays charged to its context */
+static void *js_account_realloc(JSRuntime *rt, JSMemoryAccount *account,
+                                void *ptr, size_t size)
+{
+    JSAccountHeader *hdr;
+
+    if (!ptr) {
+        if (size == 0)
+            return NULL;
+        return js_account_malloc(rt, account, size);
+    }
+    if (size == 0) {
+        js_account_free(rt, ptr);
+        return NULL;
+    }
+    hdr = (JSAccountHeader *)ptr - 1;
+    account = hdr->h.account;
+    if (size > hdr->h.size &&
+        !js_account_check(rt, account, size - hdr->h.size))
+        return NULL;
+    hdr = rt->mf.js_realloc(&rt->malloc_state, hdr, sizeof(*hdr) + size);
+    if (!hdr) {
+        rt->account_limit_hit = NULL;
+        return NULL;
+    }
+    if (account)
+        account->malloc_size += (int64_t)size - (int64_t)hdr->h.size;
+    hdr->h.size = size;
+    return hdr + 1;
+}
+
 void *js_malloc_rt(JSRuntime *rt, size_t size)
 {
+    if (unlikely(rt->memory_accounting))
+        return js_account_malloc(rt, NULL, size);
     return rt->mf.js_malloc(&rt->malloc_state, size);
 }
 
 void js_free_rt(JSRuntime *rt, void *ptr)
 {
+    if (unlikely(rt->memory_accounting)) {
+        js_account_free(rt, ptr);
+        return;
+    }
     rt->mf.js_free(&rt->malloc_state, ptr);
 }
 
 void *js_realloc_rt(JSRuntime *rt, void *ptr, size_t size)
 {
+    if (unlikely(rt->memory_accounting))
+        return js_account_realloc(rt, NULL, ptr, size);
     return rt->mf.js_realloc(&rt->malloc_state, ptr, size);
 }
 
 size_t js_malloc_usable_size_rt(JSRuntime *rt, const void *ptr)
 {
+    if (unlikely(rt->memory_accounting)) {
+        size_t size;
+        if (!ptr)
+            return 0;
+        size = rt->mf.js_malloc_usable_size((const JSAccountHeader *)ptr - 1);
+        if (size < sizeof(JSAccountHeader))
+            return 0;
+        return size - sizeof(JSAccountHeader);
+    }
     return rt->mf.js_malloc_usable_size(ptr);
 }
 
+static inline int js_slab_block_count(int class_idx)
+{
+    return (JS_SLAB_PAGE_SIZE - JS_SLAB_ALIGN) /
+        ((class_idx + 1) * JS_SLAB_ALIGN);
+}
+
+static int js_slab_add_page(JSRuntime *rt, int class_idx)
+{
+    JSSlabAllocator *sa = &rt->slab;
+    JSSlabPage *pg;
+    JSSlabBlock *b;
+    size_t block_size;
+    uint8_t *ptr;
+    int i, n;
+
+    pg = js_malloc_rt(rt, JS_SLAB_PAGE_SIZE);
+    if (!pg)
+        return -1;
+    pg->next = sa->page_list;
+    pg->class_idx = class_idx;
+    sa->page_list = pg;
+    sa->page_count++;
+
+    /* carve the whole page into blocks of the size class */
+    block_size = (class_idx + 1) * JS_SLAB_ALIGN;
+    n = js_slab_block_count(class_idx);
+    ptr = (uint8_t *)pg + JS_SLAB_ALIGN;
+    for(i = 0; i < n; i++) {
+        b = (JSSlabBlock *)ptr;
+        b->next = sa->free_list[class_idx];
+        sa->free_list[class_idx] = b;
+        ptr += block_size;
+    }
+    sa->free_size += n * block_size;
+    return 0;
+}
+
+/* size of the slab block holding 'size' bytes */
+static inline size_t js_slab_block_size(JSRuntime *rt, size_t size)
+{
+    if (unlikely(rt->memory_accounting))
+        size += sizeof(JSSlabAccountHeader);
+    return size;
+}
+
+/* return TRUE if a block of 'size' bytes is allocated in the slab
+   pages */
+static inline BOOL js_slab_is_used(JSRuntime *rt, size_t size)
+{
+    return rt->slab.enabled &&
+        js_slab_block_size(rt, size) <= JS_SLAB_MAX_SIZE;
+}
+
+/* 'size' must be known when freeing the block with
+   js_slab_free_rt(). 'account' is the context memory account or
+   NULL. */
+static void *js_slab_alloc_account(JSRuntime *rt, JSMemoryAccount *account,
+                                   size_t size)
+{
+    JSSlabAllocator *sa = &rt->slab;
+    JSSlabBlock *b;
+    JSSlabAccountHeader *hdr;
+    int class_idx, block_size;
+
+    if (!js_slab_is_used(rt, size)) {
+        if (unlikely(account))
+            return js_account_malloc(rt, account, size);
+        return js_malloc_rt(rt, size);
+    }
+    class_idx = (js_slab_block_size(rt, size) - 1) / JS_SLAB_ALIGN;
+    block_size = (class_idx + 1) * JS_SLAB_ALIGN;
+    if (unlikely(account) && !js_account_check(rt, account, block_size))
+        return NULL;
+    b = sa->free_list[class_idx];
+    if (unlikely(!b)) {
+        if (js_slab_add_page(rt, class_idx))
+            return NULL;
+        b = sa->free_list[class_idx];
+    }
+    sa->free_list[class_idx] = b->next;
+    sa->free_size -= block_size;
+    if (unlikely(rt->memory_accounting)) {
+        hdr = (JSSlabAccountHeader *)b;
+        hdr->account = account;
+        if (account) {
+            account->malloc_count++;
+            account->malloc_size += block_size;
+        }
+        return hdr + 1;
+    }
+    return b;
+}
+
+static void *js_slab_alloc_rt(JSRuntime *rt, size_t size)
+{
+    return js_slab_alloc_account(rt, NULL, size);
+}
+
+static void js_slab_free_rt(JSRuntime *rt, void *ptr, size_t size)
+{
+    JSSlabAllocator *sa = &rt->slab;
+    JSSlabBlock *b;
+    JSSlabAccountHeader *hdr;
+    int class_idx, block_size;
+
+    if (!js_slab_is_used(rt, size)) {
+        js_free_rt(rt, ptr);
+        return;
+    }
+    if (!ptr)
+        return;
+    class_idx = (js_slab_block_size(rt, size) - 1) / JS_SLAB_ALIGN;
+    block_size = (class_idx + 1) * JS_SLAB_ALIGN;
+    if (unlikely(rt->memory_accounting)) {
+        hdr = (JSSlabAccountHeader *)ptr - 1;
+        if (hdr->account)
+            js_account_uncharge(rt, hdr->account, block_size);
+        ptr = hdr;
+    }
+    b = ptr;
+    b->next = sa->free_list[class_idx];
+    sa->free_list[class_idx] = b;
+    sa->free_size += block_size;
+}
+
+/* return TRUE if a block of 'size1' bytes can be resized to 'size2'
+   bytes without moving it to another size class */
+static inline BOOL js_slab_same_class(JSRuntime *rt, size_t size1,
+                                      size_t size2)
+{
+    BOOL is_slab1 = js_slab_is_used(rt, size1);
+    BOOL is_slab2 = js_slab_is_used(rt, size2);
+    if (!is_slab1 && !is_slab2)
+        return TRUE;
+    return (is_slab1 && is_slab2 &&
+            (js_slab_block_size(rt, size1) - 1) / JS_SLAB_ALIGN ==
+            (js_slab_block_size(rt, size2) - 1) / JS_SLAB_ALIGN);
+}
+
+static int js_slab_page_cmp(const void *a, const void *b, void *opaque)
+{
+    uintptr_t pa = (uintptr_t)*(JSSlabPage * const *)a;
+    uintptr_t pb = (uintptr_t)*(JSSlabPage * const *)b;
+    return (pa > pb) - (pa < pb);
+}
+
+/* 'tab' is sorted by address */
+static JSSlabPage *js_slab_find_page(JSSlabPage **tab, int count, void *ptr)
+{
+    int a, b, m;
+
+    a = 0;
+    b = count - 1;
+    while (a < b) {
+        m = (a + b + 1) >> 1;
+        if ((uintptr_t)tab[m] <= (uintptr_t)ptr)
+            a = m;
+        else
+            b = m - 1;
+    }
+    return tab[a];
+}
+
+/* release the pages whose blocks are all free. It is called after a
+   garbage collection once enough memory is free. */
+static void js_slab_trim(JSRuntime *rt)
+{
+    JSSlabAllocator *sa = &rt->slab;
+    JSSlabPage **tab, *pg, **ppg;
+    JSSlabBlock *b, **pb;
+    int i, n;
+
+    if (sa->free_size < max_int64(sa->trim_size, JS_SLAB_TRIM_SIZE))
+        return;
+    tab = js_malloc_rt(rt, sizeof(tab[0]) * sa->page_count);
+    if (!tab)
+        return;
+    n = 0;
+    for(pg = sa->page_list; pg != NULL; pg = pg->next) {
+        pg->free_count = 0;
+        tab[n++] = pg;
+    }
+    rqsort(tab, n, sizeof(tab[0]), js_slab_page_cmp, NULL);
+
+    /* count the free blocks of each page */
+    for(i = 0; i < JS_SLAB_CLASS_COUNT; i++) {
+        for(b = sa->free_list[i]; b != NULL; b = b->next)
+            js_slab_find_page(tab, n, b)->free_count++;
+    }
+    /* remove the blocks of the empty pages from the free lists */
+    for(i = 0; i < JS_SLAB_CLASS_COUNT; i++) {
+        pb = &sa->free_list[i];
+        while ((b = *pb) != NULL) {
+            pg = js_slab_find_page(tab, n, b);
+            if (pg->free_count == js_slab_block_count(pg->class_idx)) {
+                *pb = b->next;
+                sa->free_size -= (i + 1) * JS_SLAB_ALIGN;
+            } else {
+                pb = &b->next;
+            }
+        }
+    }
+    js_free_rt(rt, tab);
+
+    ppg = &sa->page_list;
+    while ((pg = *ppg) != NULL) {
+        if (pg->free_count == js_slab_block_count(pg->class_idx)) {
+            *ppg = pg->next;
+            js_free_rt(rt, pg);
+            sa->page_count--;
+        } else {
+            ppg = &pg->next;
+        }
+    }
+    /* avoid scanning the free lists again if the free blocks are
+       scattered in the pages */
+    sa->trim_size = sa->free_size * 2;
+}
+
+/* free all the slab pages at once, whatever blocks they contain */
+static void js_slab_free_all(JSRuntime *rt)
+{
+    JSSlabAllocator *sa = &rt->slab;
+    JSSlabPage *pg, *pg_next;
+    int i;
+
+    for(pg = sa->page_list; pg != NULL; pg = pg_next) {
+        pg_next = pg->next;
+        js_free_rt(rt, pg);
+    }
+    sa->page_list = NULL;
+    sa->page_count = 0;
+    sa->free_size = 0;
+    sa->trim_size = 0;
+    for(i = 0; i < JS_SLAB_CLASS_COUNT; i++)
+        sa->free_list[i] = NULL;
+}
+
 void *js_mallocz_rt(JSRuntime *rt, size_t size)
 {
     void *ptr;
@@ -1324,7 +1992,10 @@ static void *js_bf_realloc(void *opaque, void *ptr, size_t size)
 void *js_malloc(JSContext *ctx, size_t size)
 {
     void *ptr;
-    ptr = js_malloc_rt(ctx->rt, size);
+    if (unlikely(ctx->account))
+        ptr = js_account_malloc(ctx->rt, ctx->account, size);
+    else
+        ptr = js_malloc_rt(ctx->rt, size);
     if (unlikely(!ptr)) {
         JS_ThrowOutOfMemory(ctx);
         return NULL;
@@ -1336,12 +2007,10 @@ void *js_malloc(JSContext *ctx, size_t size)
 void *js_mallocz(JSContext *ctx, size_t size)
 {
     void *ptr;
-    ptr = js_mallocz_rt(ctx->rt, size);
-    if (unlikely(!ptr)) {
-        JS_ThrowOutOfMemory(ctx);
+    ptr = js_malloc(ctx, size);
+    if (unlikely(!ptr))
         return NULL;
-    }
-    return ptr;
+    return memset(ptr, 0, size);
 }
 
 void js_free(JSContext *ctx, void *ptr)
@@ -1353,7 +2022,10 @@ void js_free(JSContext *ctx, void *ptr)
 void *js_realloc(JSContext *ctx, void *ptr, size_t size)
 {
     void *ret;
-    ret = js_realloc_rt(ctx->rt, ptr, size);
+    if (unlikely(ctx->account))
+        ret = js_account_realloc(ctx->rt, ctx->account, ptr, size);
+    else
+        ret = js_realloc_rt(ctx->rt, ptr, size);
     if (unlikely(!ret && size != 0)) {
         JS_ThrowOutOfMemory(ctx);
         return NULL;
@@ -1365,7 +2037,10 @@ void *js_realloc(JSContext *ctx, void *ptr, size_t size)
 void *js_realloc2(JSContext *ctx, void *ptr, size_t size, size_t *pslack)
 {
     void *ret;
-    ret = js_realloc_rt(ctx->rt, ptr, size);
+    if (unlikely(ctx->account))
+        ret = js_account_realloc(ctx->rt, ctx->account, ptr, size);
+    else
+        ret = js_realloc_rt(ctx->rt, ptr, size);
     if (unlikely(!ret && size != 0)) {
         JS_ThrowOutOfMemory(ctx);
         return NULL;
@@ -1399,6 +2074,57 @@ char *js_strdup(JSContext *ctx, const char *str)
     return js_strndup(ctx, str, strlen(str));
 }
 
+/* Throw out of memory in case of error */
+static void *js_slab_alloc(JSContext *ctx, size_t size)
+{
+    void *ptr;
+    if (!ctx->rt->slab.enabled)
+        return js_malloc(ctx, size);
+    ptr = js_slab_alloc_account(ctx->rt, ctx->account, size);
+    if (unlikely(!ptr)) {
+        JS_ThrowOutOfMemory(ctx);
+        return NULL;
+    }
+    return ptr;
+}
+
+/* 'old_size' is the size of the block 'ptr' allocated with
+   js_slab_alloc(). 'ptr' is unchanged if NULL is returned. 'pslack'
+   can be NULL. */
+static void *js_slab_realloc2(JSContext *ctx, void *ptr, size_t old_size,
+                              size_t new_size, size_t *pslack)
+{
+    JSRuntime *rt = ctx->rt;
+    void *new_ptr;
+
+    if (!js_slab_is_used(rt, old_size) && !js_slab_is_used(rt, new_size)) {
+        if (pslack)
+            return js_realloc2(ctx, ptr, new_size, pslack);
+        else
+            return js_realloc(ctx, ptr, new_size);
+    }
+    if (pslack) {
+        if (js_slab_is_used(rt, new_size))
+            *pslack = (-js_slab_block_size(rt, new_size)) & (JS_SLAB_ALIGN - 1);
+        else
+            *pslack = 0;
+    }
+    if (js_slab_same_class(rt, old_size, new_size))
+        return ptr;
+    new_ptr = js_slab_alloc(ctx, new_size);
+    if (!new_ptr)
+        return NULL;
+    memcpy(new_ptr, ptr, min_int(old_size, new_size));
+    js_slab_free_rt(rt, ptr, old_size);
+    return new_ptr;
+}
+
+static void *js_slab_realloc(JSContext *ctx, void *ptr, size_t old_size,
+                             size_t new_size)
+{
+    return js_slab_realloc2(ctx, ptr, old_size, new_size, NULL);
+}
+
 static no_inline int js_realloc_array(JSContext *ctx, void **parray,
                                       int elem_size, int *psize, int req_size)
 {
@@ -1596,7 +2322,8 @@ static inline BOOL js_check_stack_overflow(JSRuntime *rt, size_t alloca_size)
 }
 #endif
 
-JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
+JSRuntime *JS_NewRuntime3(const JSMallocFunctions *mf, void *opaque,
+                          int flags)
 {
     JSRuntime *rt;
     JSMallocState ms;
@@ -1609,6 +2336,7 @@ JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
     if (!rt)
         return NULL;
     memset(rt, 0, sizeof(*rt));
+    rt->memory_accounting = ((flags & JS_RUNTIME_MEMORY_ACCOUNTING) != 0);
     rt->mf = *mf;
     if (!rt->mf.js_malloc_usable_size) {
         /* use dummy function if none provided */
@@ -1616,6 +2344,7 @@ JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
     }
     rt->malloc_state = ms;
     rt->malloc_gc_threshold = 256 * 1024;
+    rt->gc_policy.heap_growth = 50;
 
 #ifdef CONFIG_BIGNUM
     bf_context_init(&rt->bf_ctx, js_bf_realloc, rt);
@@ -1626,7 +2355,14 @@ JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
 
     init_list_head(&rt->context_list);
     init_list_head(&rt->gc_obj_list);
+    init_list_head(&rt->gc_old_obj_list);
     init_list_head(&rt->gc_zero_ref_count_list);
+    init_list_head(&rt->gc_zombie_list);
+    init_list_head(&rt->gc_mark_list);
+    init_list_head(&rt->gc_mark_done_list);
+    init_list_head(&rt->gc_gray_list);
+    init_list_head(&rt->gc_white_list);
+    init_list_head(&rt->ic_bytecode_list);
     rt->gc_phase = JS_GC_PHASE_NONE;
     
 #ifdef DUMP_LEAKS
@@ -1657,6 +2393,8 @@ JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
 
     rt->current_exception = JS_NULL;
 
+    JS_SetMemoryReserve(rt, JS_DEFAULT_MEMORY_RESERVE);
+
     return rt;
  fail:
     JS_FreeRuntime(rt);
@@ -1674,9 +2412,21 @@ void JS_SetRuntimeOpaque(JSRuntime *rt, void *opaque)
 }
 
 /* default memory allocation functions with memory limitation */
+#ifdef CONFIG_MALLOC_SIZE_HEADER
+#define sys_malloc(size)        sized_malloc(size)
+#define sys_free(ptr)           sized_free(ptr)
+#define sys_realloc(ptr, size)  sized_realloc(ptr, size)
+#else
+#define sys_malloc(size)        malloc(size)
+#define sys_free(ptr)           free(ptr)
+#define sys_realloc(ptr, size)  realloc(ptr, size)
+#endif
+
 static inline size_t js_def_malloc_usable_size(void *ptr)
 {
-#if defined(__APPLE__)
+#if defined(CONFIG_MALLOC_SIZE_HEADER)
+    return sized_malloc_usable_size(ptr);
+#elif defined(__APPLE__)
     return malloc_size(ptr);
 #elif defined(_WIN32)
     return _msize(ptr);
@@ -1700,7 +2450,7 @@ static void *js_def_malloc(JSMallocState *s, size_t size)
     if (unlikely(s->malloc_size + size > s->malloc_limit))
         return NULL;
 
-    ptr = malloc(size);
+    ptr = sys_malloc(size);
     if (!ptr)
         return NULL;
 
@@ -1716,7 +2466,7 @@ static void js_def_free(JSMallocState *s, void *ptr)
 
     s->malloc_count--;
     s->malloc_size -= js_def_malloc_usable_size(ptr) + MALLOC_OVERHEAD;
-    free(ptr);
+    sys_free(ptr);
 }
 
 static void *js_def_realloc(JSMallocState *s, void *ptr, size_t size)
@@ -1732,13 +2482,13 @@ static void *js_def_realloc(JSMallocState *s, void *ptr, size_t size)
     if (size == 0) {
         s->malloc_count--;
         s->malloc_size -= old_size + MALLOC_OVERHEAD;
-        free(ptr);
+        sys_free(ptr);
         return NULL;
     }
     if (s->malloc_size + size - old_size > s->malloc_limit)
         return NULL;
 
-    ptr = realloc(ptr, size);
+    ptr = sys_realloc(ptr, size);
     if (!ptr)
         return NULL;
 
@@ -1750,7 +2500,9 @@ static const JSMallocFunctions def_malloc_funcs = {
     js_def_malloc,
     js_def_free,
     js_def_realloc,
-#if defined(__APPLE__)
+#if defined(CONFIG_MALLOC_SIZE_HEADER)
+    sized_malloc_usable_size,
+#elif defined(__APPLE__)
     malloc_size,
 #elif defined(_WIN32)
     (size_t (*)(const void *))_msize,
@@ -1764,6 +2516,11 @@ static const JSMallocFunctions def_malloc_funcs = {
 #endif
 };
 
+JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
+{
+    return JS_NewRuntime3(mf, opaque, 0);
+}
+
 JSRuntime *JS_NewRuntime(void)
 {
     return JS_NewRuntime2(&def_malloc_funcs, NULL);
@@ -1774,6 +2531,108 @@ void JS_SetMemoryLimit(JSRuntime *rt, size_t limit)
     rt->malloc_state.malloc_limit = limit;
 }
 
+/* The memory reserve is an allocated block which is freed when an out
+   of memory error happens, so that the exception object, its
+   backtrace and the code run while unwinding the stack can be
+   allocated. It is allocated again once the exception is caught. */
+int JS_SetMemoryReserve(JSRuntime *rt, size_t size)
+{
+    js_free_rt(rt, rt->memory_reserve);
+    rt->memory_reserve = NULL;
+    rt->memory_reserve_used = FALSE;
+    rt->memory_reserve_size = size;
+    if (size != 0) {
+        rt->memory_reserve = js_malloc_rt(rt, size);
+        if (!rt->memory_reserve)
+            return -1;
+    }
+    return 0;
+}
+
+/* return TRUE if the reserve was available */
+static BOOL js_release_memory_reserve(JSRuntime *rt)
+{
+    if (!rt->memory_reserve)
+        return FALSE;
+    js_free_rt(rt, rt->memory_reserve);
+    rt->memory_reserve = NULL;
+    rt->memory_reserve_used = TRUE;
+    return TRUE;
+}
+
+/* called when the pending exception is handled */
+static void js_restore_memory_reserve(JSRuntime *rt)
+{
+    if (rt->memory_reserve_used && !rt->in_out_of_memory) {
+        rt->memory_reserve = js_malloc_rt(rt, rt->memory_reserve_size);
+        if (rt->memory_reserve)
+            rt->memory_reserve_used = FALSE;
+    }
+}
+
+/* Use the slab allocator for the small engine objects. Must be
+   called before any context is created. Return -1 if error. */
+int JS_SetSlabAllocator(JSRuntime *rt, BOOL enable)
+{
+    enable = (enable != 0);
+    if (!list_empty(&rt->context_list))
+        return -1;
+    if (enable == rt->slab.enabled)
+        return 0;
+    if (js_slab_move_atoms(rt, enable))
+        return -1;
+    if (!enable)
+        js_slab_free_all(rt);
+    return 0;
+}
+
+void JS_GetGCStats(JSRuntime *rt, JSGCStats *s)
+{
+    *s = rt->gc_stats;
+}
+
+void JS_SetGCCallback(JSRuntime *rt, JSGCCallback *cb, void *opaque)
+{
+    rt->gc_callback = cb;
+    rt->gc_callback_opaque = opaque;
+}
+
+void JS_SetGCPolicy(JSRuntime *rt, const JSGCPolicy *policy)
+{
+    rt->gc_policy = *policy;
+    if (rt->gc_policy.heap_growth < 0)
+        rt->gc_policy.heap_growth = 0;
+}
+
+void JS_GetGCPolicy(JSRuntime *rt, JSGCPolicy *policy)
+{
+    *policy = rt->gc_policy;
+}
+
+/* If budget_us > 0, the automatic GC frees the cycles in slices of at
+   most budget_us microseconds. */
+void JS_SetGCPauseBudget(JSRuntime *rt, int64_t budget_us)
+{
+    rt->gc_pause_budget = max_int64(budget_us, 0);
+}
+
+int64_t JS_GetGCPauseBudget(JSRuntime *rt)
+{
+    return rt->gc_pause_budget;
+}
+
+/* In generational mode, the automatic GC only scans the objects
+   allocated since the previous collection. */
+void JS_SetGCGenerational(JSRuntime *rt, BOOL enable)
+{
+    gc_collect_finish(rt);
+    if (!enable)
+        gc_merge_generations(rt);
+    rt->gc_generational = (enable != 0);
+    rt->gc_promoted_count = 0;
+    rt->gc_full_survivor_count = 0;
+}
+
 /* use -1 to disable automatic GC */
 void JS_SetGCThreshold(JSRuntime *rt, size_t gc_threshold)
 {
@@ -1790,6 +2649,14 @@ void JS_SetInterruptHandler(JSRuntime *rt, JSInterruptHandler *cb, void *opaque)
     rt->interrupt_opaque = opaque;
 }
 
+void JS_SetCompileFunc(JSRuntime *rt, JSCompileFunc *compile_func,
+                       int threshold, void *opaque)
+{
+    rt->compile_func = compile_func;
+    rt->compile_threshold = max_int(threshold, 1);
+    rt->compile_opaque = opaque;
+}
+
 void JS_SetCanBlock(JSRuntime *rt, BOOL can_block)
 {
     rt->can_block = can_block;
@@ -1873,11 +2740,30 @@ static inline JSAtomStruct *atom_set_free(uint32_t v)
     return (JSAtomStruct *)(((uintptr_t)v << 1) | 1);
 }
 
+/* size of the allocation of a string of 'len' characters */
+static inline size_t js_string_size(int len, int is_wide_char)
+{
+    return sizeof(JSString) + (len << is_wide_char) + 1 - is_wide_char;
+}
+
+/* usable size of the allocation of 'p' */
+static size_t js_string_usable_size(JSContext *ctx, JSString *p)
+{
+    size_t size = js_string_size(p->len, p->is_wide_char);
+    /* the account header size is a multiple of JS_SLAB_ALIGN */
+    if (js_slab_is_used(ctx->rt, size))
+        return (size + JS_SLAB_ALIGN - 1) & ~(JS_SLAB_ALIGN - 1);
+    return js_malloc_usable_size(ctx, p);
+}
+
 /* Note: the string contents are uninitialized */
-static JSString *js_alloc_string_rt(JSRuntime *rt, int max_len, int is_wide_char)
+/* 'account' is the context memory account or NULL */
+static JSString *js_alloc_string2(JSRuntime *rt, JSMemoryAccount *account,
+                                  int max_len, int is_wide_char)
 {
     JSString *str;
-    str = js_malloc_rt(rt, sizeof(JSString) + (max_len << is_wide_char) + 1 - is_wide_char);
+    size_t size = js_string_size(max_len, is_wide_char);
+    str = js_slab_alloc_account(rt, account, size);
     if (unlikely(!str))
         return NULL;
     str->header.ref_count = 1;
@@ -1889,13 +2775,21 @@ static JSString *js_alloc_string_rt(JSRuntime *rt, int max_len, int is_wide_char
 #ifdef DUMP_LEAKS
     list_add_tail(&str->link, &rt->string_list);
 #endif
+    if (unlikely(rt->heap_profile)) {
+        js_heap_profile_alloc(rt, str, size);
+    }
     return str;
 }
 
+static JSString *js_alloc_string_rt(JSRuntime *rt, int max_len, int is_wide_char)
+{
+    return js_alloc_string2(rt, NULL, max_len, is_wide_char);
+}
+
 static JSString *js_alloc_string(JSContext *ctx, int max_len, int is_wide_char)
 {
     JSString *p;
-    p = js_alloc_string_rt(ctx->rt, max_len, is_wide_char);
+    p = js_alloc_string2(ctx->rt, ctx->account, max_len, is_wide_char);
     if (unlikely(!p)) {
         JS_ThrowOutOfMemory(ctx);
         return NULL;
@@ -1913,11 +2807,70 @@ static inline void js_free_string(JSRuntime *rt, JSString *str)
 #ifdef DUMP_LEAKS
             list_del(&str->link);
 #endif
-            js_free_rt(rt, str);
+            if (unlikely(rt->heap_profile))
+                js_heap_profile_free(rt, str);
+            js_slab_free_rt(rt, str, js_string_size(str->len,
+                                                    str->is_wide_char));
         }
     }
 }
 
+/* The atoms created with the runtime are reallocated when the slab
+   allocator is enabled or disabled so that they are freed with the
+   right allocator. */
+static int js_slab_move_atoms(JSRuntime *rt, BOOL to_slab)
+{
+    JSSlabAllocator *sa = &rt->slab;
+    JSAtomStruct *p, **tab;
+    size_t size;
+    int i, j;
+
+    tab = js_malloc_rt(rt, sizeof(tab[0]) * max_int(rt->atom_size, 1));
+    if (!tab)
+        return -1;
+    /* allocate all the new strings first so that nothing is modified
+       in case of error */
+    sa->enabled = to_slab;
+    for(i = 0; i < rt->atom_size; i++) {
+        p = rt->atom_array[i];
+        tab[i] = NULL;
+        if (atom_is_free(p) || !p)
+            continue;
+        tab[i] = js_slab_alloc_rt(rt, js_string_size(p->len, p->is_wide_char));
+        if (!tab[i]) {
+            for(j = 0; j < i; j++) {
+                p = rt->atom_array[j];
+                if (tab[j]) {
+                    js_slab_free_rt(rt, tab[j],
+                                    js_string_size(p->len, p->is_wide_char));
+                }
+            }
+            sa->enabled = !to_slab;
+            js_free_rt(rt, tab);
+            return -1;
+        }
+    }
+    for(i = 0; i < rt->atom_size; i++) {
+        p = rt->atom_array[i];
+        if (!tab[i])
+            continue;
+        size = js_string_size(p->len, p->is_wide_char);
+        memcpy(tab[i], p, size);
+#ifdef DUMP_LEAKS
+        list_del(&p->link);
+        list_add_tail(&tab[i]->link, &rt->string_list);
+#endif
+        if (unlikely(rt->heap_profile))
+            js_heap_profile_free(rt, p);
+        sa->enabled = !to_slab;
+        js_slab_free_rt(rt, p, size);
+        sa->enabled = to_slab;
+        rt->atom_array[i] = tab[i];
+    }
+    js_free_rt(rt, tab);
+    return 0;
+}
+
 void JS_SetRuntimeInfo(JSRuntime *rt, const char *s)
 {
     if (rt)
@@ -1929,6 +2882,8 @@ void JS_FreeRuntime(JSRuntime *rt)
     struct list_head *el, *el1;
     int i;
 
+    JS_SetHeapProfile(rt, 0);
+    JS_SetMemoryReserve(rt, 0);
     JS_FreeValueRT(rt, rt->current_exception);
 
     list_for_each_safe(el, el1, &rt->job_list) {
@@ -1939,8 +2894,20 @@ void JS_FreeRuntime(JSRuntime *rt)
     }
     init_list_head(&rt->job_list);
 
-    JS_RunGC(rt);
+    for(i = 0; i < countof(rt->char_strings); i++) {
+        if (rt->char_strings[i])
+            JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_STRING, rt->char_strings[i]));
+    }
 
+    JS_RunGC(rt);
+    gc_merge_generations(rt);
+
+    /* only the first chunk may remain */
+    assert(!rt->frame_chunk ||
+           (!rt->frame_chunk->prev_chunk &&
+            rt->frame_ptr == (uint8_t *)rt->frame_chunk->buf));
+    js_free_rt(rt, rt->frame_chunk);
+    js_free_rt(rt, rt->frame_chunk_spare);
 #ifdef DUMP_LEAKS
     /* leaking objects */
     {
@@ -2060,7 +3027,7 @@ void JS_FreeRuntime(JSRuntime *rt)
 #ifdef DUMP_LEAKS
             list_del(&p->link);
 #endif
-            js_free_rt(rt, p);
+            js_slab_free_rt(rt, p, js_string_size(p->len, p->is_wide_char));
         }
     }
     js_free_rt(rt, rt->atom_array);
@@ -2089,11 +3056,15 @@ void JS_FreeRuntime(JSRuntime *rt)
                 printf("\n");
             }
             list_del(&str->link);
-            js_free_rt(rt, str);
+            js_slab_free_rt(rt, str, js_string_size(str->len,
+                                                    str->is_wide_char));
         }
         if (rt->rt_info)
             printf("\n");
     }
+#endif
+    js_slab_free_all(rt);
+#ifdef DUMP_LEAKS
     {
         JSMallocState *s = &rt->malloc_state;
         if (s->malloc_count > 1) {
@@ -2129,6 +3100,15 @@ JSContext *JS_NewContextRaw(JSRuntime *rt)
         js_free_rt(rt, ctx);
         return NULL;
     }
+    if (rt->memory_accounting) {
+        ctx->account = js_mallocz_rt(rt, sizeof(JSMemoryAccount));
+        if (!ctx->account) {
+            js_free_rt(rt, ctx->class_proto);
+            js_free_rt(rt, ctx);
+            return NULL;
+        }
+        ctx->account->ctx = ctx;
+    }
     ctx->rt = rt;
     list_add_tail(&ctx->link, &rt->context_list);
 #ifdef CONFIG_BIGNUM
@@ -2291,6 +3271,8 @@ void JS_FreeContext(JSContext *ctx)
         JSGCObjectHeader *p;
         printf("JSObjects: {\n");
         JS_DumpObjectHeader(ctx->rt);
+        gc_collect_finish(rt);
+        gc_merge_generations(rt);
         list_for_each(el, &rt->gc_obj_list) {
             p = list_entry(el, JSGCObjectHeader, link);
             JS_DumpGCObject(rt, p);
@@ -2334,9 +3316,30 @@ void JS_FreeContext(JSContext *ctx)
 
     list_del(&ctx->link);
     remove_gc_object(&ctx->header);
+    if (ctx->account) {
+        /* the account is freed with the last block charged to it */
+        ctx->account->ctx = NULL;
+        if (ctx->account->malloc_count == 0)
+            js_account_free_account(rt, ctx->account);
+    }
     js_free_rt(ctx->rt, ctx);
 }
 
+void JS_SetContextMemoryLimit(JSContext *ctx, size_t limit)
+{
+    if (ctx->account)
+        ctx->account->malloc_limit = limit;
+}
+
+/* Return the number of bytes allocated by the context or -1 if the
+   runtime does not use JS_RUNTIME_MEMORY_ACCOUNTING. */
+int64_t JS_GetContextMemoryUsage(JSContext *ctx)
+{
+    if (!ctx->account)
+        return -1;
+    return ctx->account->malloc_size;
+}
+
 JSRuntime *JS_GetRuntime(JSContext *ctx)
 {
     return ctx->rt;
@@ -2349,6 +3352,7 @@ static void update_stack_limit(JSRuntime *rt)
     } else {
         rt->stack_limit = rt->stack_top - rt->stack_size;
     }
+    js_update_frame_end(rt);
 }
 
 void JS_SetMaxStackSize(JSRuntime *rt, size_t stack_size)
@@ -2754,7 +3758,7 @@ static JSAtom __JS_NewAtom(JSRuntime *rt, JSString *str, int atom_type)
         start = rt->atom_size;
         if (start == 0) {
             /* JS_ATOM_NULL entry */
-            p = js_mallocz_rt(rt, sizeof(JSAtomStruct));
+            p = js_mallocz_rt(rt, js_string_size(0, 0));
             if (!p) {
                 js_free_rt(rt, new_array);
                 goto fail;
@@ -2786,9 +3790,8 @@ static JSAtom __JS_NewAtom(JSRuntime *rt, JSString *str, int atom_type)
             p = str;
             p->atom_type = atom_type;
         } else {
-            p = js_malloc_rt(rt, sizeof(JSString) +
-                             (str->len << str->is_wide_char) +
-                             1 - str->is_wide_char);
+            p = js_slab_alloc_rt(rt, js_string_size(str->len,
+                                                    str->is_wide_char));
             if (unlikely(!p))
                 goto fail;
             p->header.ref_count = 1;
@@ -2802,7 +3805,7 @@ static JSAtom __JS_NewAtom(JSRuntime *rt, JSString *str, int atom_type)
             js_free_string(rt, str);
         }
     } else {
-        p = js_malloc_rt(rt, sizeof(JSAtomStruct)); /* empty wide string */
+        p = js_slab_alloc_rt(rt, js_string_size(0, 1)); /* empty wide string */
         if (!p)
             return JS_ATOM_NULL;
         p->header.ref_count = 1;
@@ -2919,7 +3922,9 @@ static void JS_FreeAtomStruct(JSRuntime *rt, JSAtomStruct *p)
 #ifdef DUMP_LEAKS
     list_del(&p->link);
 #endif
-    js_free_rt(rt, p);
+    if (unlikely(rt->heap_profile))
+        js_heap_profile_free(rt, p);
+    js_slab_free_rt(rt, p, js_string_size(p->len, p->is_wide_char));
     rt->atom_count--;
     assert(rt->atom_count >= 0);
 }
@@ -3028,6 +4033,43 @@ static JSValue JS_NewSymbolFromAtom(JSContext *ctx, JSAtom descr,
 
 #define ATOM_GET_STR_BUF_SIZE 64
 
+/* return a UTF-8 version of 'str', truncated to 'buf_size' bytes. The
+   returned pointer may point to the string itself. */
+static const char *JS_StringGetStrRT(const JSString *str, char *buf,
+                                     int buf_size)
+{
+    int i, c;
+    char *q;
+
+    q = buf;
+    if (str) {
+        if (!str->is_wide_char) {
+            /* special case ASCII strings */
+            c = 0;
+            for(i = 0; i < str->len; i++) {
+                c |= str->u.str8[i];
+            }
+            if (c < 0x80)
+                return (const char *)str->u.str8;
+        }
+        for(i = 0; i < str->len; i++) {
+            if (str->is_wide_char)
+                c = str->u.str16[i];
+            else
+                c = str->u.str8[i];
+            if ((q - buf) >= buf_size - UTF8_CHAR_LEN_MAX)
+                break;
+            if (c < 128) {
+                *q++ = c;
+            } else {
+                q += unicode_to_utf8((uint8_t *)q, c);
+            }
+        }
+    }
+    *q = '\0';
+    return buf;
+}
+
 /* Should only be used for debug. */
 static const char *JS_AtomGetStrRT(JSRuntime *rt, char *buf, int buf_size,
                                    JSAtom atom)
@@ -3040,39 +4082,9 @@ static const char *JS_AtomGetStrRT(JSRuntime *rt, char *buf, int buf_size,
         if (atom == JS_ATOM_NULL) {
             snprintf(buf, buf_size, "<null>");
         } else {
-            int i, c;
-            char *q;
-            JSString *str;
-
-            q = buf;
             p = rt->atom_array[atom];
             assert(!atom_is_free(p));
-            str = p;
-            if (str) {
-                if (!str->is_wide_char) {
-                    /* special case ASCII strings */
-                    c = 0;
-                    for(i = 0; i < str->len; i++) {
-                        c |= str->u.str8[i];
-                    }
-                    if (c < 0x80)
-                        return (const char *)str->u.str8;
-                }
-                for(i = 0; i < str->len; i++) {
-                    if (str->is_wide_char)
-                        c = str->u.str16[i];
-                    else
-                        c = str->u.str8[i];
-                    if ((q - buf) >= buf_size - UTF8_CHAR_LEN_MAX)
-                        break;
-                    if (c < 128) {
-                        *q++ = c;
-                    } else {
-                        q += unicode_to_utf8((uint8_t *)q, c);
-                    }
-                }
-            }
-            *q = '\0';
+            return JS_StringGetStrRT(p, buf, buf_size);
         }
     }
     return buf;
@@ -3484,20 +4496,35 @@ static JSValue js_new_string16(JSContext *ctx, const uint16_t *buf, int len)
 static JSValue js_new_string_char(JSContext *ctx, uint16_t c)
 {
     if (c < 0x100) {
-        uint8_t ch8 = c;
-        return js_new_string8(ctx, &ch8, 1);
+        JSString *p = ctx->rt->char_strings[c];
+        if (unlikely(!p)) {
+            /* not charged to the context: the reference is owned by
+               the runtime */
+            p = js_alloc_string_rt(ctx->rt, 1, 0);
+            if (!p)
+                return JS_ThrowOutOfMemory(ctx);
+            p->u.str8[0] = c;
+            p->u.str8[1] = '\0';
+            ctx->rt->char_strings[c] = p;
+        }
+        return JS_DupValue(ctx, JS_MKPTR(JS_TAG_STRING, p));
     } else {
         uint16_t ch16 = c;
         return js_new_string16(ctx, &ch16, 1);
     }
 }
 
-static JSValue js_sub_string(JSContext *ctx, JSString *p, int start, int end)
+static JSValue js_sub_string_copy(JSContext *ctx, JSString *p,
+                                  int start, int end)
 {
     int len = end - start;
     if (start == 0 && end == p->len) {
         return JS_DupValue(ctx, JS_MKPTR(JS_TAG_STRING, p));
     }
+    if (len == 1) {
+        return js_new_string_char(ctx, p->is_wide_char ? p->u.str16[start] :
+                                  p->u.str8[start]);
+    }
     if (p->is_wide_char && len > 0) {
         JSString *str;
         int i;
@@ -3551,6 +4578,11 @@ static int string_buffer_init2(JSContext *ctx, StringBuffer *s, int size,
     /* the StringBuffer may reallocate the JSString, only link it at the end */
     list_del(&s->str->link);
 #endif
+    if (unlikely(ctx->rt->heap_profile)) {
+        /* same for the heap profiler */
+        js_heap_profile_cancel(ctx->rt, s->str, sizeof(JSString) +
+                               (size << is_wide) + 1 - is_wide);
+    }
     return 0;
 }
 
@@ -3561,14 +4593,14 @@ static inline int string_buffer_init(JSContext *ctx, StringBuffer *s, int size)
 
 static void string_buffer_free(StringBuffer *s)
 {
-    js_free(s->ctx, s->str);
+    js_slab_free_rt(s->ctx->rt, s->str,
+                    js_string_size(s->size, s->is_wide_char));
     s->str = NULL;
 }
 
 static int string_buffer_set_error(StringBuffer *s)
 {
-    js_free(s->ctx, s->str);
-    s->str = NULL;
+    string_buffer_free(s);
     s->size = 0;
     s->len = 0;
     return s->error_status = -1;
@@ -3583,7 +4615,8 @@ static no_inline int string_buffer_widen(StringBuffer *s, int size)
     if (s->error_status)
         return -1;
 
-    str = js_realloc2(s->ctx, s->str, sizeof(JSString) + (size << 1), &slack);
+    str = js_slab_realloc2(s->ctx, s->str, js_string_size(s->size, 0),
+                           js_string_size(size, 1), &slack);
     if (!str)
         return string_buffer_set_error(s);
     size += slack >> 1;
@@ -3613,8 +4646,10 @@ static no_inline int string_buffer_realloc(StringBuffer *s, int new_len, int c)
     if (!s->is_wide_char && c >= 0x100) {
         return string_buffer_widen(s, new_size);
     }
-    new_size_bytes = sizeof(JSString) + (new_size << s->is_wide_char) + 1 - s->is_wide_char;
-    new_str = js_realloc2(s->ctx, s->str, new_size_bytes, &slack);
+    new_size_bytes = js_string_size(new_size, s->is_wide_char);
+    new_str = js_slab_realloc2(s->ctx, s->str,
+                               js_string_size(s->size, s->is_wide_char),
+                               new_size_bytes, &slack);
     if (!new_str)
         return string_buffer_set_error(s);
     new_size = min_int(new_size + (slack >> s->is_wide_char), JS_STRING_LEN_MAX);
@@ -3710,16 +4745,12 @@ static int string_getc(const JSString *p, int *pidx)
 
 static int string_buffer_write8(StringBuffer *s, const uint8_t *p, int len)
 {
-    int i;
-
     if (s->len + len > s->size) {
         if (string_buffer_realloc(s, s->len + len, 0))
             return -1;
     }
     if (s->is_wide_char) {
-        for (i = 0; i < len; i++) {
-            s->str->u.str16[s->len + i] = p[i];
-        }
+        latin1_to_utf16(s->str->u.str16 + s->len, p, len);
         s->len += len;
     } else {
         memcpy(&s->str->u.str8[s->len], p, len);
@@ -3836,18 +4867,28 @@ static JSValue string_buffer_end(StringBuffer *s)
     if (s->error_status)
         return JS_EXCEPTION;
     if (s->len == 0) {
-        js_free(s->ctx, str);
-        s->str = NULL;
+        string_buffer_free(s);
         return JS_AtomToString(s->ctx, JS_ATOM_empty_string);
     }
     if (s->len < s->size) {
-        /* smaller size so js_realloc should not fail, but OK if it does */
-        /* XXX: should add some slack to avoid unnecessary calls */
-        /* XXX: might need to use malloc+free to ensure smaller size */
-        str = js_realloc_rt(s->ctx->rt, str, sizeof(JSString) +
-                            (s->len << s->is_wide_char) + 1 - s->is_wide_char);
-        if (str == NULL)
-            str = s->str;
+        if (s->ctx->rt->slab.enabled) {
+            /* the block must match the final string size */
+            str = js_slab_realloc(s->ctx, str,
+                                  js_string_size(s->size, s->is_wide_char),
+                                  js_string_size(s->len, s->is_wide_char));
+            if (str == NULL) {
+                string_buffer_set_error(s);
+                return JS_EXCEPTION;
+            }
+        } else {
+            /* smaller size so js_realloc should not fail, but OK if it does */
+            /* XXX: should add some slack to avoid unnecessary calls */
+            /* XXX: might need to use malloc+free to ensure smaller size */
+            str = js_realloc_rt(s->ctx->rt, str, sizeof(JSString) +
+                                (s->len << s->is_wide_char) + 1 - s->is_wide_char);
+            if (str == NULL)
+                str = s->str;
+        }
         s->str = str;
     }
     if (!s->is_wide_char)
@@ -3855,6 +4896,11 @@ static JSValue string_buffer_end(StringBuffer *s)
 #ifdef DUMP_LEAKS
     list_add_tail(&str->link, &s->ctx->rt->string_list);
 #endif
+    if (unlikely(s->ctx->rt->heap_profile)) {
+        js_heap_profile_alloc(s->ctx->rt, str, sizeof(JSString) +
+                              (s->len << s->is_wide_char) + 1 -
+                              s->is_wide_char);
+    }
     str->is_wide_char = s->is_wide_char;
     str->len = s->len;
     s->str = NULL;
@@ -3867,19 +4913,36 @@ JSValue JS_NewStringLen(JSContext *ctx, const char *buf, size_t buf_len)
     const uint8_t *p, *p_end, *p_start, *p_next;
     uint32_t c;
     StringBuffer b_s, *b = &b_s;
-    size_t len1;
+    size_t len1, len;
+    int is_wide_char;
+    JSString *str;
     
     p_start = (const uint8_t *)buf;
     p_end = p_start + buf_len;
-    p = p_start;
-    while (p < p_end && *p < 128)
-        p++;
-    len1 = p - p_start;
+    len1 = ascii_prefix_len(p_start, buf_len);
+    p = p_start + len1;
     if (len1 > JS_STRING_LEN_MAX)
         return JS_ThrowInternalError(ctx, "string too long");
     if (p == p_end) {
         /* ASCII string */
         return js_new_string8(ctx, (const uint8_t *)buf, buf_len);
+    } else if (utf8_scan(p, p_end - p, &len, &is_wide_char) == 0) {
+        /* valid UTF-8: the exact length is known */
+        len += len1;
+        if (len > JS_STRING_LEN_MAX)
+            return JS_ThrowInternalError(ctx, "string too long");
+        str = js_alloc_string(ctx, len, is_wide_char);
+        if (!str)
+            return JS_EXCEPTION;
+        if (is_wide_char) {
+            latin1_to_utf16(str->u.str16, p_start, len1);
+            utf8_decode_utf16(str->u.str16 + len1, p, p_end - p);
+        } else {
+            memcpy(str->u.str8, p_start, len1);
+            utf8_decode_latin1(str->u.str8 + len1, p, p_end - p);
+            str->u.str8[len] = '\0';
+        }
+        return JS_MKPTR(JS_TAG_STRING, str);
     } else {
         if (string_buffer_init(ctx, b, buf_len))
             goto fail;
@@ -3998,10 +5061,7 @@ const char *JS_ToCStringLen2(JSContext *ctx, size_t *plen, JSValueConst val1, BO
            than testing each byte, hence this method is faster for ASCII
            strings, which is the most common case.
          */
-        count = 0;
-        for (pos = 0; pos < len; pos++) {
-            count += src[pos] >> 7;
-        }
+        count = latin1_utf8_len(src, len) - len;
         if (count == 0) {
             if (plen)
                 *plen = len;
@@ -4011,15 +5071,7 @@ const char *JS_ToCStringLen2(JSContext *ctx, size_t *plen, JSValueConst val1, BO
         if (!str_new)
             goto fail;
         q = str_new->u.str8;
-        for (pos = 0; pos < len; pos++) {
-            c = src[pos];
-            if (c < 0x80) {
-                *q++ = c;
-            } else {
-                *q++ = (c >> 6) | 0xc0;
-                *q++ = (c & 0x3f) | 0x80;
-            }
-        }
+        q += latin1_to_utf8(q, src, len);
     } else {
         const uint16_t *src = str->u.str16;
         /* Allocate 3 bytes per 16 bit code point. Surrogate pairs may
@@ -4031,10 +5083,14 @@ const char *JS_ToCStringLen2(JSContext *ctx, size_t *plen, JSValueConst val1, BO
         q = str_new->u.str8;
         pos = 0;
         while (pos < len) {
-            c = src[pos++];
+            c = src[pos];
             if (c < 0x80) {
-                *q++ = c;
+                /* copy the ASCII run */
+                size_t n = utf16_copy_ascii(q, src + pos, len - pos);
+                q += n;
+                pos += n;
             } else {
+                pos++;
                 if (c >= 0xd800 && c < 0xdc00) {
                     if (pos < len && !cesu8) {
                         c1 = src[pos];
@@ -4057,7 +5113,20 @@ const char *JS_ToCStringLen2(JSContext *ctx, size_t *plen, JSValueConst val1, BO
     }
 
     *q = '\0';
-    str_new->len = q - str_new->u.str8;
+    len = q - str_new->u.str8;
+    if (!js_slab_same_class(ctx->rt, js_string_size(str_new->len, 0),
+                            js_string_size(len, 0))) {
+        /* the slab block must match the final string size */
+        str = js_slab_realloc(ctx, str_new, js_string_size(str_new->len, 0),
+                              js_string_size(len, 0));
+        if (!str) {
+            js_free_string(ctx->rt, str_new);
+            JS_FreeValue(ctx, val);
+            goto fail;
+        }
+        str_new = str;
+    }
+    str_new->len = len;
     JS_FreeValue(ctx, val);
     if (plen)
         *plen = str_new->len;
@@ -4078,46 +5147,54 @@ void JS_FreeCString(JSContext *ctx, const char *ptr)
     JS_FreeValue(ctx, JS_MKPTR(JS_TAG_STRING, p));
 }
 
+static int memcmp8(const uint8_t *src1, const uint8_t *src2, int len)
+{
+    int i = mem_mismatch8(src1, src2, len);
+    if (i == len)
+        return 0;
+    return src1[i] - src2[i];
+}
+
 static int memcmp16_8(const uint16_t *src1, const uint8_t *src2, int len)
 {
-    int c, i;
-    for(i = 0; i < len; i++) {
-        c = src1[i] - src2[i];
-        if (c != 0)
-            return c;
-    }
-    return 0;
+    int i = mem_mismatch16_8(src1, src2, len);
+    if (i == len)
+        return 0;
+    return src1[i] - src2[i];
 }
 
 static int memcmp16(const uint16_t *src1, const uint16_t *src2, int len)
 {
-    int c, i;
-    for(i = 0; i < len; i++) {
-        c = src1[i] - src2[i];
-        if (c != 0)
-            return c;
-    }
-    return 0;
+    int i = mem_mismatch16(src1, src2, len);
+    if (i == len)
+        return 0;
+    return src1[i] - src2[i];
 }
 
-static int js_string_memcmp(const JSString *p1, const JSString *p2, int len)
+static int js_string_memcmp_pos(const JSString *p1, int pos1,
+                                const JSString *p2, int pos2, int len)
 {
     int res;
 
     if (likely(!p1->is_wide_char)) {
         if (likely(!p2->is_wide_char))
-            res = memcmp(p1->u.str8, p2->u.str8, len);
+            res = memcmp8(p1->u.str8 + pos1, p2->u.str8 + pos2, len);
         else
-            res = -memcmp16_8(p2->u.str16, p1->u.str8, len);
+            res = -memcmp16_8(p2->u.str16 + pos2, p1->u.str8 + pos1, len);
     } else {
         if (!p2->is_wide_char)
-            res = memcmp16_8(p1->u.str16, p2->u.str8, len);
+            res = memcmp16_8(p1->u.str16 + pos1, p2->u.str8 + pos2, len);
         else
-            res = memcmp16(p1->u.str16, p2->u.str16, len);
+            res = memcmp16(p1->u.str16 + pos1, p2->u.str16 + pos2, len);
     }
     return res;
 }
 
+static int js_string_memcmp(const JSString *p1, const JSString *p2, int len)
+{
+    return js_string_memcmp_pos(p1, 0, p2, 0, len);
+}
+
 /* return < 0, 0 or > 0 */
 static int js_string_compare(JSContext *ctx,
                              const JSString *p1, const JSString *p2)
@@ -4141,11 +5218,7 @@ static void copy_str16(uint16_t *dst, const JSString *p, int offset, int len)
     if (p->is_wide_char) {
         memcpy(dst, p->u.str16 + offset, len * 2);
     } else {
-        const uint8_t *src1 = p->u.str8 + offset;
-        int i;
-
-        for(i = 0; i < len; i++)
-            dst[i] = src1[i];
+        latin1_to_utf16(dst, p->u.str8 + offset, len);
     }
 }
 
@@ -4174,6 +5247,599 @@ static JSValue JS_ConcatString1(JSContext *ctx,
     return JS_MKPTR(JS_TAG_STRING, p);
 }
 
+/* Ropes */
+
+static inline BOOL tag_is_string(uint32_t tag)
+{
+    return tag == JS_TAG_STRING || tag == JS_TAG_STRING_ROPE;
+}
+
+/* same as JS_IsString() but also accept the ropes */
+static inline BOOL js_is_string(JSValueConst v)
+{
+    return tag_is_string(JS_VALUE_GET_TAG(v));
+}
+
+/* 'val' must be a string or a rope */
+static inline uint32_t js_string_value_len(JSValueConst val)
+{
+    if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING_ROPE)
+        return ((JSStringRope *)JS_VALUE_GET_PTR(val))->len;
+    else
+        return JS_VALUE_GET_STRING(val)->len;
+}
+
+static inline int js_string_value_is_wide_char(JSValueConst val)
+{
+    if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING_ROPE)
+        return ((JSStringRope *)JS_VALUE_GET_PTR(val))->is_wide_char;
+    else
+        return JS_VALUE_GET_STRING(val)->is_wide_char;
+}
+
+static inline int js_string_rope_depth(JSValueConst val)
+{
+    if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING_ROPE)
+        return ((JSStringRope *)JS_VALUE_GET_PTR(val))->depth;
+    else
+        return 0;
+}
+
+/* iterate over the flat strings of a rope without allocating memory */
+typedef struct JSStringRopeIter {
+    int sp;
+    JSValueConst stack[JS_STRING_ROPE_MAX_DEPTH + 1];
+} JSStringRopeIter;
+
+static void js_string_rope_iter_init(JSStringRopeIter *it, JSValueConst val)
+{
+    it->stack[0] = val;
+    it->sp = 1;
+}
+
+/* return the next flat string and set its characters to
+   [*pstart, *pstart + *plen). Return NULL at the end. */
+static JSString *js_string_rope_iter_next(JSStringRopeIter *it,
+                                          uint32_t *pstart, uint32_t *plen)
+{
+    JSValueConst val;
+    JSStringRope *r;
+    JSString *p;
+
+    if (it->sp == 0)
+        return NULL;
+    val = it->stack[--it->sp];
+    while (JS_VALUE_GET_TAG(val) == JS_TAG_STRING_ROPE) {
+        r = JS_VALUE_GET_PTR(val);
+        if (r->depth == 0) {
+            *pstart = r->start;
+            *plen = r->len;
+            return JS_VALUE_GET_STRING(r->left);
+        }
+        it->stack[it->sp++] = r->right;
+        val = r->left;
+    }
+    p = JS_VALUE_GET_STRING(val);
+    *pstart = 0;
+    *plen = p->len;
+    return p;
+}
+
+/* Same as JS_StringGetStrRT() for a string or a rope. No memory is
+   allocated. Should only be used for debug. */
+static const char *js_string_value_get_str_rt(JSValueConst val, char *buf,
+                                              int buf_size)
+{
+    JSStringRopeIter it;
+    JSString *p;
+    uint32_t start, len, i;
+    int c;
+    char *q;
+
+    if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING)
+        return JS_StringGetStrRT(JS_VALUE_GET_STRING(val), buf, buf_size);
+    q = buf;
+    js_string_rope_iter_init(&it, val);
+    while ((p = js_string_rope_iter_next(&it, &start, &len)) != NULL) {
+        for(i = start; i < start + len; i++) {
+            c = string_get(p, i);
+            if ((q - buf) >= buf_size - UTF8_CHAR_LEN_MAX)
+                goto done;
+            if (c < 128) {
+                *q++ = c;
+            } else {
+                q += unicode_to_utf8((uint8_t *)q, c);
+            }
+        }
+    }
+ done:
+    *q = '\0';
+    return buf;
+}
+
+/* Flatten the rope in place. Return the flat string (its reference is
+   owned by the rope) or NULL if exception. */
+static JSString *js_string_rope_flatten(JSContext *ctx, JSValueConst val)
+{
+    JSStringRope *r = JS_VALUE_GET_PTR(val);
+    JSStringRopeIter it;
+    JSString *p, *p1;
+    JSValue str;
+    uint32_t pos, start, len;
+
+    if (r->depth == 0) {
+        p = JS_VALUE_GET_STRING(r->left);
+        if (r->start == 0 && r->len == p->len)
+            return p;
+        /* slice: the parent string is released */
+        str = js_sub_string_copy(ctx, p, r->start, r->start + r->len);
+        if (JS_IsException(str))
+            return NULL;
+        p = JS_VALUE_GET_STRING(str);
+        JS_FreeValue(ctx, r->left);
+        r->left = str;
+        r->start = 0;
+        r->is_wide_char = p->is_wide_char;
+        return p;
+    }
+    p = js_alloc_string(ctx, r->len, r->is_wide_char);
+    if (!p)
+        return NULL;
+    pos = 0;
+    js_string_rope_iter_init(&it, val);
+    while ((p1 = js_string_rope_iter_next(&it, &start, &len)) != NULL) {
+        if (p->is_wide_char)
+            copy_str16(p->u.str16 + pos, p1, start, len);
+        else
+            memcpy(p->u.str8 + pos, p1->u.str8 + start, len);
+        pos += len;
+    }
+    if (!p->is_wide_char)
+        p->u.str8[pos] = '\0';
+    JS_FreeValue(ctx, r->left);
+    JS_FreeValue(ctx, r->right);
+    r->left = JS_MKPTR(JS_TAG_STRING, p);
+    r->right = JS_UNDEFINED;
+    r->depth = 0;
+    r->start = 0;
+    return p;
+}
+
+/* compare two strings or ropes without flattening them. Return < 0, 0
+   or > 0 */
+static int js_string_rope_compare(JSValueConst op1, JSValueConst op2)
+{
+    JSStringRopeIter it1, it2;
+    JSString *p1, *p2;
+    uint32_t pos1, pos2, end1, end2;
+    int len, res;
+
+    js_string_rope_iter_init(&it1, op1);
+    js_string_rope_iter_init(&it2, op2);
+    p1 = js_string_rope_iter_next(&it1, &pos1, &end1);
+    end1 += pos1;
+    p2 = js_string_rope_iter_next(&it2, &pos2, &end2);
+    end2 += pos2;
+    for(;;) {
+        while (p1 && pos1 == end1) {
+            p1 = js_string_rope_iter_next(&it1, &pos1, &end1);
+            end1 += pos1;
+        }
+        while (p2 && pos2 == end2) {
+            p2 = js_string_rope_iter_next(&it2, &pos2, &end2);
+            end2 += pos2;
+        }
+        if (!p1 || !p2)
+            break;
+        len = min_uint32(end1 - pos1, end2 - pos2);
+        res = js_string_memcmp_pos(p1, pos1, p2, pos2, len);
+        if (res != 0)
+            return res;
+        pos1 += len;
+        pos2 += len;
+    }
+    if (p1)
+        return 1;
+    else if (p2)
+        return -1;
+    else
+        return 0;
+}
+
+/* same result as hash_string() on the flattened rope */
+static uint32_t js_string_rope_hash(JSValueConst val, uint32_t h)
+{
+    JSStringRopeIter it;
+    JSString *p;
+    uint32_t start, len;
+
+    js_string_rope_iter_init(&it, val);
+    while ((p = js_string_rope_iter_next(&it, &start, &len)) != NULL) {
+        if (p->is_wide_char)
+            h = hash_string16(p->u.str16 + start, len, h);
+        else
+            h = hash_string8(p->u.str8 + start, len, h);
+    }
+    return h;
+}
+
+/* replace a flattened rope by its flat string */
+static JSValue js_string_rope_unwrap(JSContext *ctx, JSValue val)
+{
+    JSStringRope *r;
+    JSValue str;
+
+    if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING_ROPE) {
+        r = JS_VALUE_GET_PTR(val);
+        if (r->depth == 0 && r->len == JS_VALUE_GET_STRING(r->left)->len) {
+            str = JS_DupValue(ctx, r->left);
+            JS_FreeValue(ctx, val);
+            return str;
+        }
+    }
+    return val;
+}
+
+/* The ropes are not visible from the C API: the values given to the C
+   functions or returned by the API are flat strings. Return the flat
+   string of the rope 'val', whose reference is owned by the rope, or
+   JS_EXCEPTION. */
+static JSValueConst js_string_rope_get_flat(JSContext *ctx, JSValueConst val)
+{
+    JSString *p;
+
+    p = js_string_rope_flatten(ctx, val);
+    if (!p)
+        return JS_EXCEPTION;
+    return JS_MKPTR(JS_TAG_STRING, p);
+}
+
+/* same as js_string_rope_get_flat() for any value. 'val' is freed. */
+static JSValue js_string_rope_flatten_free(JSContext *ctx, JSValue val)
+{
+    if (unlikely(JS_VALUE_GET_TAG(val) == JS_TAG_STRING_ROPE)) {
+        if (!js_string_rope_flatten(ctx, val)) {
+            JS_FreeValue(ctx, val);
+            return JS_EXCEPTION;
+        }
+        val = js_string_rope_unwrap(ctx, val);
+    }
+    return val;
+}
+
+static BOOL js_has_string_rope(int argc, JSValueConst *argv)
+{
+    int i;
+    for(i = 0; i < argc; i++) {
+        if (JS_VALUE_GET_TAG(argv[i]) == JS_TAG_STRING_ROPE)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/* copy the arguments of a C function to 'arg_buf', replacing the ropes
+   by their flat string. Return -1 if exception. */
+static int js_get_flat_args(JSContext *ctx, JSValueConst *arg_buf,
+                            int argc, JSValueConst *argv)
+{
+    int i;
+    for(i = 0; i < argc; i++) {
+        arg_buf[i] = argv[i];
+        if (JS_VALUE_GET_TAG(argv[i]) == JS_TAG_STRING_ROPE) {
+            arg_buf[i] = js_string_rope_get_flat(ctx, argv[i]);
+            if (JS_IsException(arg_buf[i]))
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/* 'left' and 'right' are freed */
+static JSValue js_new_string_rope(JSContext *ctx, JSValue left, JSValue right)
+{
+    JSStringRope *r;
+    JSValue val;
+    uint32_t len;
+
+    left = js_string_rope_unwrap(ctx, left);
+    right = js_string_rope_unwrap(ctx, right);
+    len = js_string_value_len(left) + js_string_value_len(right);
+    if (len > JS_STRING_LEN_MAX) {
+        JS_ThrowInternalError(ctx, "string too long");
+        goto fail;
+    }
+    r = js_malloc(ctx, sizeof(*r));
+    if (!r)
+        goto fail;
+    r->header.ref_count = 1;
+    r->len = len;
+    r->is_wide_char = js_string_value_is_wide_char(left) |
+        js_string_value_is_wide_char(right);
+    r->depth = max_int(js_string_rope_depth(left),
+                       js_string_rope_depth(right)) + 1;
+    r->start = 0;
+    r->left = left;
+    r->right = right;
+    if (unlikely(ctx->rt->heap_profile))
+        js_heap_profile_alloc(ctx->rt, r, sizeof(*r));
+    val = JS_MKPTR(JS_TAG_STRING_ROPE, r);
+    /* short ropes only come from slices */
+    if (r->depth > JS_STRING_ROPE_MAX_DEPTH || len < JS_STRING_ROPE_MIN_LEN) {
+        if (!js_string_rope_flatten(ctx, val)) {
+            JS_FreeValue(ctx, val);
+            return JS_EXCEPTION;
+        }
+        val = js_string_rope_unwrap(ctx, val);
+    }
+    return val;
+ fail:
+    JS_FreeValue(ctx, left);
+    JS_FreeValue(ctx, right);
+    return JS_EXCEPTION;
+}
+
+/* Return the substring [start, end) of the flat string 'p'. Long
+   substrings are slices referencing 'p' instead of a copy. */
+static JSValue js_sub_string(JSContext *ctx, JSString *p, int start, int end)
+{
+    JSStringRope *r;
+    int len = end - start;
+
+    if (len < JS_STRING_SLICE_MIN_LEN || len == p->len ||
+        p->len / JS_STRING_SLICE_MAX_RATIO > len)
+        return js_sub_string_copy(ctx, p, start, end);
+    r = js_malloc(ctx, sizeof(*r));
+    if (!r)
+        return JS_EXCEPTION;
+    r->header.ref_count = 1;
+    r->len = len;
+    r->is_wide_char = p->is_wide_char;
+    r->depth = 0;
+    r->start = start;
+    r->left = JS_DupValue(ctx, JS_MKPTR(JS_TAG_STRING, p));
+    r->right = JS_UNDEFINED;
+    if (unlikely(ctx->rt->heap_profile))
+        js_heap_profile_alloc(ctx->rt, r, sizeof(*r));
+    return JS_MKPTR(JS_TAG_STRING_ROPE, r);
+}
+
+static JSValue js_string_rope_join(JSContext *ctx, JSValue op1, JSValue op2);
+
+/* Rebuild the top of a rope whose subtrees have too different depths
+   (e.g. because a short string was kept at its top). 'val' is
+   freed. */
+static JSValue js_string_rope_rebalance(JSContext *ctx, JSValue val)
+{
+    JSStringRope *r;
+    int depth1, depth2;
+
+    if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING_ROPE) {
+        r = JS_VALUE_GET_PTR(val);
+        if (r->depth != 0) {
+            depth1 = js_string_rope_depth(r->left);
+            depth2 = js_string_rope_depth(r->right);
+            if (depth1 > depth2 + 1 || depth2 > depth1 + 1) {
+                JSValue left = JS_DupValue(ctx, r->left);
+                JSValue right = JS_DupValue(ctx, r->right);
+                JS_FreeValue(ctx, val);
+                return js_string_rope_join(ctx, left, right);
+            }
+        }
+    }
+    return val;
+}
+
+/* Concatenate two strings or ropes and keep the resulting rope
+   balanced as in an AVL tree so that its depth stays logarithmic in
+   the number of concatenations. op1 and op2 are freed. */
+static JSValue js_string_rope_join(JSContext *ctx, JSValue op1, JSValue op2)
+{
+    JSStringRope *r, *r1;
+    JSValue left, right, t;
+    int depth1, depth2;
+
+    op1 = js_string_rope_rebalance(ctx, op1);
+    if (JS_IsException(op1)) {
+        JS_FreeValue(ctx, op2);
+        return JS_EXCEPTION;
+    }
+    op2 = js_string_rope_rebalance(ctx, op2);
+    if (JS_IsException(op2)) {
+        JS_FreeValue(ctx, op1);
+        return JS_EXCEPTION;
+    }
+    depth1 = js_string_rope_depth(op1);
+    depth2 = js_string_rope_depth(op2);
+    if (depth1 > depth2 + 1) {
+        r = JS_VALUE_GET_PTR(op1);
+        left = JS_DupValue(ctx, r->left);
+        right = JS_DupValue(ctx, r->right);
+        JS_FreeValue(ctx, op1);
+        right = js_string_rope_join(ctx, right, op2);
+        if (JS_IsException(right))
+            goto fail;
+        if (js_string_rope_depth(right) > js_string_rope_depth(left) + 1) {
+            r = JS_VALUE_GET_PTR(right);
+            if (js_string_rope_depth(r->left) > js_string_rope_depth(r->right)) {
+                /* double rotation */
+                r1 = JS_VALUE_GET_PTR(r->left);
+                t = js_new_string_rope(ctx, JS_DupValue(ctx, r1->right),
+                                       JS_DupValue(ctx, r->right));
+                left = js_new_string_rope(ctx, left, JS_DupValue(ctx, r1->left));
+            } else {
+                /* rotate left */
+                t = JS_DupValue(ctx, r->right);
+                left = js_new_string_rope(ctx, left, JS_DupValue(ctx, r->left));
+            }
+            JS_FreeValue(ctx, right);
+            right = t;
+            if (JS_IsException(left) || JS_IsException(right))
+                goto fail;
+        }
+    } else if (depth2 > depth1 + 1) {
+        r = JS_VALUE_GET_PTR(op2);
+        left = JS_DupValue(ctx, r->left);
+        right = JS_DupValue(ctx, r->right);
+        JS_FreeValue(ctx, op2);
+        left = js_string_rope_join(ctx, op1, left);
+        if (JS_IsException(left))
+            goto fail;
+        if (js_string_rope_depth(left) > js_string_rope_depth(right) + 1) {
+            r = JS_VALUE_GET_PTR(left);
+            if (js_string_rope_depth(r->right) > js_string_rope_depth(r->left)) {
+                /* double rotation */
+                r1 = JS_VALUE_GET_PTR(r->right);
+                t = js_new_string_rope(ctx, JS_DupValue(ctx, r->left),
+                                       JS_DupValue(ctx, r1->left));
+                right = js_new_string_rope(ctx, JS_DupValue(ctx, r1->right), right);
+            } else {
+                /* rotate right */
+                t = JS_DupValue(ctx, r->left);
+                right = js_new_string_rope(ctx, JS_DupValue(ctx, r->right), right);
+            }
+            JS_FreeValue(ctx, left);
+            left = t;
+            if (JS_IsException(left) || JS_IsException(right))
+                goto fail;
+        }
+    } else {
+        if (JS_VALUE_GET_TAG(op1) == JS_TAG_STRING &&
+            JS_VALUE_GET_TAG(op2) == JS_TAG_STRING &&
+            js_string_value_len(op1) + js_string_value_len(op2) <
+            JS_STRING_ROPE_MIN_LEN) {
+            t = JS_ConcatString1(ctx, JS_VALUE_GET_STRING(op1),
+                                 JS_VALUE_GET_STRING(op2));
+            JS_FreeValue(ctx, op1);
+            JS_FreeValue(ctx, op2);
+            return t;
+        }
+        left = op1;
+        right = op2;
+    }
+    return js_new_string_rope(ctx, left, right);
+ fail:
+    JS_FreeValue(ctx, left);
+    JS_FreeValue(ctx, right);
+    return JS_EXCEPTION;
+}
+
+/* op1 and op2 are strings or ropes. They are freed. */
+static JSValue js_concat_string_rope(JSContext *ctx, JSValue op1, JSValue op2)
+{
+    JSStringRope *r;
+    JSString *p1, *p2;
+    JSValue str, ret;
+
+    if (js_string_value_len(op2) == 0) {
+        JS_FreeValue(ctx, op2);
+        return op1;
+    }
+    if (js_string_value_len(op1) == 0) {
+        JS_FreeValue(ctx, op1);
+        return op2;
+    }
+    /* When a short string is appended, it is kept in a flat string at
+       the top of the rope so that the next short strings are merged
+       with it without walking down the rope. The balanced part is only
+       rebuilt when this string is full. */
+    if (JS_VALUE_GET_TAG(op1) == JS_TAG_STRING_ROPE &&
+        JS_VALUE_GET_TAG(op2) == JS_TAG_STRING &&
+        JS_VALUE_GET_STRING(op2)->len < JS_STRING_ROPE_MIN_LEN) {
+        r = JS_VALUE_GET_PTR(op1);
+        if (r->depth == 0)
+            return js_new_string_rope(ctx, op1, op2);
+        if (JS_VALUE_GET_TAG(r->right) != JS_TAG_STRING) {
+            /* no new level if 'op1' already has a short string at its
+               other end */
+            if (JS_VALUE_GET_TAG(r->left) == JS_TAG_STRING)
+                return js_string_rope_join(ctx, op1, op2);
+            else
+                return js_new_string_rope(ctx, op1, op2);
+        }
+        p1 = JS_VALUE_GET_STRING(r->right);
+        p2 = JS_VALUE_GET_STRING(op2);
+        if (p1->len + p2->len < JS_STRING_ROPE_MIN_LEN) {
+            str = JS_ConcatString1(ctx, p1, p2);
+            JS_FreeValue(ctx, op2);
+            if (JS_IsException(str)) {
+                JS_FreeValue(ctx, op1);
+                return JS_EXCEPTION;
+            }
+            ret = js_new_string_rope(ctx, JS_DupValue(ctx, r->left), str);
+        } else {
+            str = js_string_rope_join(ctx, JS_DupValue(ctx, r->left),
+                                      JS_DupValue(ctx, r->right));
+            if (JS_IsException(str)) {
+                JS_FreeValue(ctx, op1);
+                JS_FreeValue(ctx, op2);
+                return JS_EXCEPTION;
+            }
+            ret = js_new_string_rope(ctx, str, op2);
+        }
+        JS_FreeValue(ctx, op1);
+        return ret;
+    }
+    /* same for the prepended short strings */
+    if (JS_VALUE_GET_TAG(op1) == JS_TAG_STRING &&
+        JS_VALUE_GET_TAG(op2) == JS_TAG_STRING_ROPE &&
+        JS_VALUE_GET_STRING(op1)->len < JS_STRING_ROPE_MIN_LEN) {
+        r = JS_VALUE_GET_PTR(op2);
+        if (r->depth == 0)
+            return js_new_string_rope(ctx, op1, op2);
+        if (JS_VALUE_GET_TAG(r->left) != JS_TAG_STRING) {
+            if (JS_VALUE_GET_TAG(r->right) == JS_TAG_STRING)
+                return js_string_rope_join(ctx, op1, op2);
+            else
+                return js_new_string_rope(ctx, op1, op2);
+        }
+        p1 = JS_VALUE_GET_STRING(op1);
+        p2 = JS_VALUE_GET_STRING(r->left);
+        if (p1->len + p2->len < JS_STRING_ROPE_MIN_LEN) {
+            str = JS_ConcatString1(ctx, p1, p2);
+            JS_FreeValue(ctx, op1);
+            if (JS_IsException(str)) {
+                JS_FreeValue(ctx, op2);
+                return JS_EXCEPTION;
+            }
+            ret = js_new_string_rope(ctx, str, JS_DupValue(ctx, r->right));
+        } else {
+            str = js_string_rope_join(ctx, JS_DupValue(ctx, r->left),
+                                      JS_DupValue(ctx, r->right));
+            if (JS_IsException(str)) {
+                JS_FreeValue(ctx, op1);
+                JS_FreeValue(ctx, op2);
+                return JS_EXCEPTION;
+            }
+            ret = js_new_string_rope(ctx, op1, str);
+        }
+        JS_FreeValue(ctx, op2);
+        return ret;
+    }
+    return js_string_rope_join(ctx, op1, op2);
+}
+
+/* replace the rope operands by flat strings. Both operands are freed
+   in case of exception. */
+static __exception int js_string_rope_flatten2(JSContext *ctx, JSValue *pop1,
+                                               JSValue *pop2)
+{
+    if (JS_VALUE_GET_TAG(*pop1) == JS_TAG_STRING_ROPE) {
+        *pop1 = JS_ToStringFree(ctx, *pop1);
+        if (JS_IsException(*pop1)) {
+            JS_FreeValue(ctx, *pop2);
+            return -1;
+        }
+    }
+    if (JS_VALUE_GET_TAG(*pop2) == JS_TAG_STRING_ROPE) {
+        *pop2 = JS_ToStringFree(ctx, *pop2);
+        if (JS_IsException(*pop2)) {
+            JS_FreeValue(ctx, *pop1);
+            return -1;
+        }
+    }
+    return 0;
+}
+
 /* op1 and op2 are converted to strings. For convience, op1 or op2 =
    JS_EXCEPTION are accepted and return JS_EXCEPTION.  */
 static JSValue JS_ConcatString(JSContext *ctx, JSValue op1, JSValue op2)
@@ -4181,20 +5847,23 @@ static JSValue JS_ConcatString(JSContext *ctx, JSValue op1, JSValue op2)
     JSValue ret;
     JSString *p1, *p2;
 
-    if (unlikely(JS_VALUE_GET_TAG(op1) != JS_TAG_STRING)) {
+    if (unlikely(!tag_is_string(JS_VALUE_GET_TAG(op1)))) {
         op1 = JS_ToStringFree(ctx, op1);
         if (JS_IsException(op1)) {
             JS_FreeValue(ctx, op2);
             return JS_EXCEPTION;
         }
     }
-    if (unlikely(JS_VALUE_GET_TAG(op2) != JS_TAG_STRING)) {
+    if (unlikely(!tag_is_string(JS_VALUE_GET_TAG(op2)))) {
         op2 = JS_ToStringFree(ctx, op2);
         if (JS_IsException(op2)) {
             JS_FreeValue(ctx, op1);
             return JS_EXCEPTION;
         }
     }
+    if (JS_VALUE_GET_TAG(op1) == JS_TAG_STRING_ROPE ||
+        JS_VALUE_GET_TAG(op2) == JS_TAG_STRING_ROPE)
+        return js_concat_string_rope(ctx, op1, op2);
     p1 = JS_VALUE_GET_STRING(op1);
     p2 = JS_VALUE_GET_STRING(op2);
 
@@ -4203,7 +5872,7 @@ static JSValue JS_ConcatString(JSContext *ctx, JSValue op1, JSValue op2)
         goto ret_op1;
     }
     if (p1->header.ref_count == 1 && p1->is_wide_char == p2->is_wide_char
-    &&  js_malloc_usable_size(ctx, p1) >= sizeof(*p1) + ((p1->len + p2->len) << p2->is_wide_char) + 1 - p1->is_wide_char) {
+    &&  js_string_usable_size(ctx, p1) >= sizeof(*p1) + ((p1->len + p2->len) << p2->is_wide_char) + 1 - p1->is_wide_char) {
         /* Concatenate in place in available space at the end of p1 */
         if (p1->is_wide_char) {
             memcpy(p1->u.str16 + p1->len, p2->u.str16, p2->len << 1);
@@ -4217,6 +5886,9 @@ static JSValue JS_ConcatString(JSContext *ctx, JSValue op1, JSValue op2)
         JS_FreeValue(ctx, op2);
         return op1;
     }
+    /* long strings are concatenated lazily */
+    if (p1->len + p2->len >= JS_STRING_ROPE_MIN_LEN)
+        return js_concat_string_rope(ctx, op1, op2);
     ret = JS_ConcatString1(ctx, p1, p2);
     JS_FreeValue(ctx, op1);
     JS_FreeValue(ctx, op2);
@@ -4345,7 +6017,7 @@ static no_inline JSShape *js_new_shape2(JSContext *ctx, JSObject *proto,
         resize_shape_hash(rt, rt->shape_hash_bits + 1);
     }
 
-    sh_alloc = js_malloc(ctx, get_shape_size(hash_size, prop_size));
+    sh_alloc = js_slab_alloc(ctx, get_shape_size(hash_size, prop_size));
     if (!sh_alloc)
         return NULL;
     sh = get_shape_from_alloc(sh_alloc, hash_size);
@@ -4365,6 +6037,7 @@ static no_inline JSShape *js_new_shape2(JSContext *ctx, JSObject *proto,
     sh->hash = shape_initial_hash(proto);
     sh->is_hashed = TRUE;
     sh->has_small_array_index = FALSE;
+    sh->is_watched = FALSE;
     js_shape_hash_link(ctx->rt, sh);
     return sh;
 }
@@ -4387,7 +6060,7 @@ static JSShape *js_clone_shape(JSContext *ctx, JSShape *sh1)
 
     hash_size = sh1->prop_hash_mask + 1;
     size = get_shape_size(hash_size, sh1->prop_size);
-    sh_alloc = js_malloc(ctx, size);
+    sh_alloc = js_slab_alloc(ctx, size);
     if (!sh_alloc)
         return NULL;
     sh_alloc1 = get_alloc_from_shape(sh1);
@@ -4428,7 +6101,8 @@ static void js_free_shape0(JSRuntime *rt, JSShape *sh)
         pr++;
     }
     remove_gc_object(&sh->header);
-    js_free_rt(rt, get_alloc_from_shape(sh));
+    js_slab_free_rt(rt, get_alloc_from_shape(sh),
+                    get_shape_size(sh->prop_hash_mask + 1, sh->prop_size));
 }
 
 static void js_free_shape(JSRuntime *rt, JSShape *sh)
@@ -4460,7 +6134,9 @@ static no_inline int resize_properties(JSContext *ctx, JSShape **psh,
        in case of memory allocation failure */
     if (p) {
         JSProperty *new_prop;
-        new_prop = js_realloc(ctx, p->prop, sizeof(new_prop[0]) * new_size);
+        new_prop = js_slab_realloc(ctx, p->prop,
+                                   sizeof(new_prop[0]) * sh->prop_size,
+                                   sizeof(new_prop[0]) * new_size);
         if (unlikely(!new_prop))
             return -1;
         p->prop = new_prop;
@@ -4472,7 +6148,7 @@ static no_inline int resize_properties(JSContext *ctx, JSShape **psh,
         JSShape *old_sh;
         /* resize the hash table and the properties */
         old_sh = sh;
-        sh_alloc = js_malloc(ctx, get_shape_size(new_hash_size, new_size));
+        sh_alloc = js_slab_alloc(ctx, get_shape_size(new_hash_size, new_size));
         if (!sh_alloc)
             return -1;
         sh = get_shape_from_alloc(sh_alloc, new_hash_size);
@@ -4480,7 +6156,9 @@ static no_inline int resize_properties(JSContext *ctx, JSShape **psh,
         /* copy all the fields and the properties */
         memcpy(sh, old_sh,
                sizeof(JSShape) + sizeof(sh->prop[0]) * old_sh->prop_count);
-        list_add_tail(&sh->header.link, &ctx->rt->gc_obj_list);
+        /* the shape leaves the lists of an incremental marking in
+           progress: it is then considered as alive */
+        add_gc_object(ctx->rt, &sh->header, JS_GC_OBJ_TYPE_SHAPE);
         new_hash_mask = new_hash_size - 1;
         sh->prop_hash_mask = new_hash_mask;
         memset(prop_hash_end(sh) - new_hash_size, 0,
@@ -4492,19 +6170,22 @@ static no_inline int resize_properties(JSContext *ctx, JSShape **psh,
                 prop_hash_end(sh)[-h - 1] = i + 1;
             }
         }
-        js_free(ctx, get_alloc_from_shape(old_sh));
+        js_slab_free_rt(ctx->rt, get_alloc_from_shape(old_sh),
+                        get_shape_size(old_sh->prop_hash_mask + 1,
+                                       old_sh->prop_size));
     } else {
         /* only resize the properties */
         list_del(&sh->header.link);
-        sh_alloc = js_realloc(ctx, get_alloc_from_shape(sh),
-                              get_shape_size(new_hash_size, new_size));
+        sh_alloc = js_slab_realloc(ctx, get_alloc_from_shape(sh),
+                                   get_shape_size(new_hash_size, sh->prop_size),
+                                   get_shape_size(new_hash_size, new_size));
         if (unlikely(!sh_alloc)) {
             /* insert again in the GC list */
-            list_add_tail(&sh->header.link, &ctx->rt->gc_obj_list);
+            add_gc_object(ctx->rt, &sh->header, JS_GC_OBJ_TYPE_SHAPE);
             return -1;
         }
         sh = get_shape_from_alloc(sh_alloc, new_hash_size);
-        list_add_tail(&sh->header.link, &ctx->rt->gc_obj_list);
+        add_gc_object(ctx->rt, &sh->header, JS_GC_OBJ_TYPE_SHAPE);
     }
     *psh = sh;
     sh->prop_size = new_size;
@@ -4535,13 +6216,18 @@ static int compact_properties(JSContext *ctx, JSObject *p)
 
     /* resize the hash table and the properties */
     old_sh = sh;
-    sh_alloc = js_malloc(ctx, get_shape_size(new_hash_size, new_size));
-    if (!sh_alloc)
+    new_prop = js_slab_alloc(ctx, sizeof(new_prop[0]) * new_size);
+    if (!new_prop)
         return -1;
+    sh_alloc = js_slab_alloc(ctx, get_shape_size(new_hash_size, new_size));
+    if (!sh_alloc) {
+        js_slab_free_rt(ctx->rt, new_prop, sizeof(new_prop[0]) * new_size);
+        return -1;
+    }
     sh = get_shape_from_alloc(sh_alloc, new_hash_size);
     list_del(&old_sh->header.link);
     memcpy(sh, old_sh, sizeof(JSShape));
-    list_add_tail(&sh->header.link, &ctx->rt->gc_obj_list);
+    add_gc_object(ctx->rt, &sh->header, JS_GC_OBJ_TYPE_SHAPE);
     
     memset(prop_hash_end(sh) - new_hash_size, 0,
            sizeof(prop_hash_end(sh)[0]) * new_hash_size);
@@ -4557,7 +6243,7 @@ static int compact_properties(JSContext *ctx, JSObject *p)
             h = ((uintptr_t)old_pr->atom & new_hash_mask);
             pr->hash_next = prop_hash_end(sh)[-h - 1];
             prop_hash_end(sh)[-h - 1] = j + 1;
-            prop[j] = prop[i];
+            new_prop[j] = prop[i];
             j++;
             pr++;
         }
@@ -4570,12 +6256,11 @@ static int compact_properties(JSContext *ctx, JSObject *p)
     sh->prop_count = j;
 
     p->shape = sh;
-    js_free(ctx, get_alloc_from_shape(old_sh));
-    
-    /* reduce the size of the object properties */
-    new_prop = js_realloc(ctx, p->prop, sizeof(new_prop[0]) * new_size);
-    if (new_prop)
-        p->prop = new_prop;
+    p->prop = new_prop;
+    js_slab_free_rt(ctx->rt, prop, sizeof(prop[0]) * old_sh->prop_size);
+    js_slab_free_rt(ctx->rt, get_alloc_from_shape(old_sh),
+                    get_shape_size(old_sh->prop_hash_mask + 1,
+                                   old_sh->prop_size));
     return 0;
 }
 
@@ -4708,6 +6393,8 @@ static __maybe_unused void JS_DumpShapes(JSRuntime *rt)
         }
     }
     /* dump non-hashed shapes */
+    gc_collect_finish(rt);
+    gc_merge_generations(rt);
     list_for_each(el, &rt->gc_obj_list) {
         gp = list_entry(el, JSGCObjectHeader, link);
         if (gp->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT) {
@@ -4725,7 +6412,7 @@ static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID clas
     JSObject *p;
 
     js_trigger_gc(ctx->rt, sizeof(JSObject));
-    p = js_malloc(ctx, sizeof(JSObject));
+    p = js_slab_alloc(ctx, sizeof(JSObject));
     if (unlikely(!p))
         goto fail;
     p->class_id = class_id;
@@ -4740,13 +6427,17 @@ static JSValue JS_NewObjectFromShape(JSContext *ctx, JSShape *sh, JSClassID clas
     p->first_weak_ref = NULL;
     p->u.opaque = NULL;
     p->shape = sh;
-    p->prop = js_malloc(ctx, sizeof(JSProperty) * sh->prop_size);
+    p->prop = js_slab_alloc(ctx, sizeof(JSProperty) * sh->prop_size);
     if (unlikely(!p->prop)) {
-        js_free(ctx, p);
+        js_slab_free_rt(ctx->rt, p, sizeof(JSObject));
     fail:
         js_free_shape(ctx->rt, sh);
         return JS_EXCEPTION;
     }
+    if (unlikely(ctx->rt->heap_profile)) {
+        js_heap_profile_alloc(ctx->rt, p, sizeof(JSObject) +
+                              sizeof(JSProperty) * sh->prop_size);
+    }
 
     switch(class_id) {
     case JS_CLASS_OBJECT:
@@ -5241,7 +6932,7 @@ static void free_var_ref(JSRuntime *rt, JSVarRef *var_ref)
             } else {
                 list_del(&var_ref->header.link); /* still on the stack */
             }
-            js_free_rt(rt, var_ref);
+            js_slab_free_rt(rt, var_ref, sizeof(JSVarRef));
         }
     }
 }
@@ -5401,6 +7092,8 @@ static void free_object(JSRuntime *rt, JSObject *p)
 
     p->free_mark = 1; /* used to tell the object is invalid when
                          freeing cycles */
+    if (unlikely(rt->heap_profile))
+        js_heap_profile_free(rt, p);
     /* free all the fields */
     sh = p->shape;
     pr = get_shape_prop(sh);
@@ -5408,7 +7101,7 @@ static void free_object(JSRuntime *rt, JSObject *p)
         free_property(rt, &p->prop[i], pr->flags);
         pr++;
     }
-    js_free_rt(rt, p->prop);
+    js_slab_free_rt(rt, p->prop, sizeof(JSProperty) * sh->prop_size);
     /* as an optimization we destroy the shape immediately without
        putting it in gc_zero_ref_count_list */
     js_free_shape(rt, sh);
@@ -5435,7 +7128,7 @@ static void free_object(JSRuntime *rt, JSObject *p)
     if (rt->gc_phase == JS_GC_PHASE_REMOVE_CYCLES && p->header.ref_count != 0) {
         list_add_tail(&p->header.link, &rt->gc_zero_ref_count_list);
     } else {
-        js_free_rt(rt, p);
+        js_slab_free_rt(rt, p, sizeof(JSObject));
     }
 }
 
@@ -5497,10 +7190,24 @@ void __JS_FreeValueRT(JSRuntime *rt, JSValue v)
 #ifdef DUMP_LEAKS
                 list_del(&p->link);
 #endif
-                js_free_rt(rt, p);
+                if (unlikely(rt->heap_profile))
+                    js_heap_profile_free(rt, p);
+                js_slab_free_rt(rt, p, js_string_size(p->len,
+                                                      p->is_wide_char));
             }
         }
         break;
+    case JS_TAG_STRING_ROPE:
+        {
+            JSStringRope *r = JS_VALUE_GET_PTR(v);
+            /* the recursion is bounded by JS_STRING_ROPE_MAX_DEPTH */
+            JS_FreeValueRT(rt, r->left);
+            JS_FreeValueRT(rt, r->right);
+            if (unlikely(rt->heap_profile))
+                js_heap_profile_free(rt, r);
+            js_free_rt(rt, r);
+        }
+        break;
     case JS_TAG_OBJECT:
     case JS_TAG_FUNCTION_BYTECODE:
         {
@@ -5511,6 +7218,12 @@ void __JS_FreeValueRT(JSRuntime *rt, JSValue v)
                 if (rt->gc_phase == JS_GC_PHASE_NONE) {
                     free_zero_refcount(rt);
                 }
+            } else if (p->mark == 0) {
+                /* object outside of the collected generation which
+                   was only referenced by the freed cycles:
+                   gc_free_cycles() frees it too */
+                list_del(&p->link);
+                list_add_tail(&p->link, &rt->tmp_obj_list);
             }
         }
         break;
@@ -5566,6 +7279,28 @@ static void remove_gc_object(JSGCObjectHeader *h)
     list_del(&h->link);
 }
 
+/* move the old generation back to gc_obj_list so that it contains
+   all the GC objects. */
+static void gc_merge_generations(JSRuntime *rt)
+{
+    list_splice_tail(&rt->gc_old_obj_list, &rt->gc_obj_list);
+}
+
+#define JS_GC_OBJ_LIST_COUNT 6
+
+/* get the lists of the GC objects, except the garbage of a
+   collection in progress */
+static void gc_get_obj_lists(JSRuntime *rt,
+                             struct list_head *tab[JS_GC_OBJ_LIST_COUNT])
+{
+    tab[0] = &rt->gc_obj_list;
+    tab[1] = &rt->gc_old_obj_list;
+    tab[2] = &rt->gc_mark_list;
+    tab[3] = &rt->gc_mark_done_list;
+    tab[4] = &rt->gc_gray_list;
+    tab[5] = &rt->gc_white_list;
+}
+
 void JS_MarkValue(JSRuntime *rt, JSValueConst val, JS_MarkFunc *mark_func)
 {
     if (JS_VALUE_HAS_REF_COUNT(val)) {
@@ -5635,6 +7370,12 @@ static void mark_children(JSRuntime *rt, JSGCObjectHeader *gp,
             for(i = 0; i < b->cpool_count; i++) {
                 JS_MarkValue(rt, b->cpool[i], mark_func);
             }
+            for(i = 0; i < b->ic_count; i++) {
+                JSInlineCache *ic = &b->ic[i];
+                int j;
+                for(j = 0; j < ic->count; j++)
+                    mark_func(rt, &ic->shapes[j]->header);
+            }
             if (b->realm)
                 mark_func(rt, &b->realm->header);
         }
@@ -5689,12 +7430,14 @@ static void gc_decref(JSRuntime *rt)
 {
     struct list_head *el, *el1;
     JSGCObjectHeader *p;
+    int64_t count;
     
     init_list_head(&rt->tmp_obj_list);
 
     /* decrement the refcount of all the children of all the GC
        objects and move the GC objects with zero refcount to
        tmp_obj_list */
+    count = 0;
     list_for_each_safe(el, el1, &rt->gc_obj_list) {
         p = list_entry(el, JSGCObjectHeader, link);
         assert(p->mark == 0);
@@ -5704,13 +7447,16 @@ static void gc_decref(JSRuntime *rt)
             list_del(&p->link);
             list_add_tail(&p->link, &rt->tmp_obj_list);
         }
+        count++;
     }
+    rt->gc_stats.scanned_count += count;
 }
 
 static void gc_scan_incref_child(JSRuntime *rt, JSGCObjectHeader *p)
 {
     p->ref_count++;
-    if (p->ref_count == 1) {
+    /* mark = 0 for the objects outside of the collected generation */
+    if (p->ref_count == 1 && p->mark == 1) {
         /* ref_count was 0: remove from tmp_obj_list and add at the
            end of gc_obj_list */
         list_del(&p->link);
@@ -5744,20 +7490,35 @@ static void gc_scan(JSRuntime *rt)
     }
 }
 
-static void gc_free_cycles(JSRuntime *rt)
+/* Free the GC objects of tmp_obj_list. If 'deadline' is not zero, stop
+   when it is reached and return FALSE. The remaining objects are only
+   referenced by other garbage objects, so the program can run before
+   the next call. */
+static BOOL gc_free_cycles(JSRuntime *rt, int64_t deadline)
 {
     struct list_head *el, *el1;
     JSGCObjectHeader *p;
+    int count;
 #ifdef DUMP_GC_FREE
     BOOL header_done = FALSE;
 #endif
 
     rt->gc_phase = JS_GC_PHASE_REMOVE_CYCLES;
 
+    count = 0;
     for(;;) {
         el = rt->tmp_obj_list.next;
         if (el == &rt->tmp_obj_list)
             break;
+        if (deadline != 0 && (++count % JS_GC_SLICE_CHECK_COUNT) == 0 &&
+            js_get_time_us() >= deadline) {
+            /* the finalized objects still referenced by the remaining
+               garbage objects are freed at the end */
+            list_splice_tail(&rt->gc_zero_ref_count_list,
+                             &rt->gc_zombie_list);
+            rt->gc_phase = JS_GC_PHASE_NONE;
+            return FALSE;
+        }
         p = list_entry(el, JSGCObjectHeader, link);
         /* Only need to free the GC object associated with JS
            values. The rest will be automatically removed because they
@@ -5774,36 +7535,492 @@ static void gc_free_cycles(JSRuntime *rt)
             JS_DumpGCObject(rt, p);
 #endif
             free_gc_object(rt, p);
+            rt->gc_stats.freed_count++;
             break;
         default:
+            /* they are freed when their reference count reaches
+               zero. The hashed shapes can still be reused by the
+               program between two slices. */
+            p->mark = 0;
             list_del(&p->link);
-            list_add_tail(&p->link, &rt->gc_zero_ref_count_list);
+            list_add_tail(&p->link, &rt->gc_obj_list);
             break;
         }
     }
     rt->gc_phase = JS_GC_PHASE_NONE;
-           
+
+    list_splice_tail(&rt->gc_zombie_list, &rt->gc_zero_ref_count_list);
     list_for_each_safe(el, el1, &rt->gc_zero_ref_count_list) {
         p = list_entry(el, JSGCObjectHeader, link);
         assert(p->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT ||
                p->gc_obj_type == JS_GC_OBJ_TYPE_FUNCTION_BYTECODE);
-        js_free_rt(rt, p);
+        if (p->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT)
+            js_slab_free_rt(rt, p, sizeof(JSObject));
+        else
+            js_free_rt(rt, p);
     }
 
     init_list_head(&rt->gc_zero_ref_count_list);
+    return TRUE;
 }
 
-void JS_RunGC(JSRuntime *rt)
+/* move the surviving young objects to the old generation and return
+   their number */
+static int64_t gc_promote(JSRuntime *rt)
+{
+    struct list_head *el;
+    int64_t count;
+
+    count = 0;
+    list_for_each(el, &rt->gc_obj_list) {
+        count++;
+    }
+    list_splice_tail(&rt->gc_obj_list, &rt->gc_old_obj_list);
+    return count;
+}
+
+static void gc_add_time(int64_t *ptotal, int64_t *pmax, int64_t t)
+{
+    *ptotal += t;
+    if (t > *pmax)
+        *pmax = t;
+}
+
+/* In generational mode, a full collection is done when the old
+   generation has grown too much since the last one. */
+static BOOL gc_need_full(JSRuntime *rt)
+{
+    return !rt->gc_generational ||
+        rt->gc_promoted_count >= max_int64(rt->gc_full_survivor_count,
+                                           JS_GC_MIN_PROMOTED_COUNT);
+}
+
+/* The inline caches keep their shapes alive and the shapes keep their
+   prototype. They are emptied before a full collection so that these
+   objects can be freed. */
+static void gc_reset_inline_caches(JSRuntime *rt)
+{
+    struct list_head *el;
+    JSFunctionBytecode *b;
+
+    /* the objects whose reference count reaches zero are only queued
+       so that no function bytecode is removed from the list */
+    rt->gc_phase = JS_GC_PHASE_DECREF;
+    list_for_each(el, &rt->ic_bytecode_list) {
+        b = list_entry(el, JSFunctionBytecode, ic_link);
+        js_reset_inline_caches(rt, b);
+    }
+    free_zero_refcount(rt);
+}
+
+/* start a collection */
+static void gc_collect_begin(JSRuntime *rt, BOOL is_full)
+{
+    rt->gc_stats.gc_count++;
+    if (!is_full)
+        rt->gc_stats.minor_count++;
+    rt->gc_start_size = rt->malloc_state.malloc_size;
+    if (rt->gc_callback)
+        rt->gc_callback(rt, JS_GC_EVENT_START, &rt->gc_stats,
+                        rt->gc_callback_opaque);
+
+    if (is_full) {
+        /* the old generation is collected too */
+        gc_merge_generations(rt);
+        gc_reset_inline_caches(rt);
+    }
+}
+
+/* end the search of the cycles. 'count' is the number of surviving
+   objects of the collected generation. */
+static void gc_collect_end_scan(JSRuntime *rt, BOOL is_full, int64_t count)
 {
+    if (rt->gc_generational) {
+        if (is_full) {
+            rt->gc_full_survivor_count = count;
+            rt->gc_promoted_count = 0;
+        } else {
+            rt->gc_promoted_count += count;
+        }
+    }
+    rt->gc_in_progress = TRUE;
+}
+
+/* Find the cycles among the objects of gc_obj_list and move them to
+   tmp_obj_list. The objects outside of this list are considered as
+   alive. The reference counts are modified during this phase, so it
+   cannot be interrupted by the program. */
+static void gc_collect_scan(JSRuntime *rt, BOOL is_full, int64_t t0)
+{
+    int64_t count, t1, t2;
+
     /* decrement the reference of the children of each object. mark =
        1 after this pass. */
     gc_decref(rt);
+    t1 = js_get_time_us();
+    gc_add_time(&rt->gc_stats.decref_time, &rt->gc_stats.decref_max_time,
+                t1 - t0);
 
     /* keep the GC objects with a non zero refcount and their childs */
     gc_scan(rt);
+    t2 = js_get_time_us();
+    gc_add_time(&rt->gc_stats.scan_time, &rt->gc_stats.scan_max_time,
+                t2 - t1);
+
+    count = 0;
+    if (rt->gc_generational)
+        count = gc_promote(rt);
+    gc_collect_end_scan(rt, is_full, count);
+}
+
+static void gc_collect_start(JSRuntime *rt, BOOL is_full)
+{
+    int64_t t0;
+
+    t0 = js_get_time_us();
+    gc_collect_begin(rt, is_full);
+    gc_collect_scan(rt, is_full, t0);
+}
+
+/* Incremental search of the cycles
+
+   The reference counts cannot be modified while the program runs
+   between two slices, so the references between the objects of the
+   collected generation are counted in a hash table. The objects
+   having more references are referenced from outside, so they and
+   all the objects they reference are alive. The remaining 'white'
+   objects are only candidates because the program may have modified
+   the references since they were counted: the cycles are searched
+   among them with gc_decref() and gc_scan() in a single pause, all
+   the other objects being considered as alive. Its duration is
+   proportional to the amount of cyclic garbage.
 
-    /* free the GC objects in a cycle */
-    gc_free_cycles(rt);
+   mark = 1 after the COUNT phase, 2 after the DECREF phase, 3 for the
+   gray objects. The objects allocated during the collection and the
+   objects found alive have mark = 0. */
+
+struct JSGCMarkEntry {
+    JSGCObjectHeader *obj;
+    int count; /* references from the collected objects */
+};
+
+/* return the entry of 'p' or the free entry where it can be added */
+static JSGCMarkEntry *gc_mark_find(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    JSGCMarkEntry *e;
+    uintptr_t h;
+
+    h = ((uintptr_t)p >> 4) * 0x9e3779b1;
+    for(;;) {
+        e = &rt->gc_mark_tab[h & rt->gc_mark_tab_mask];
+        if (e->obj == p || e->obj == NULL)
+            return e;
+        h++;
+    }
+}
+
+static void gc_mark_decref_child(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    JSGCMarkEntry *e;
+
+    if (p->mark == 1 || p->mark == 2) {
+        e = gc_mark_find(rt, p);
+        e->obj = p;
+        e->count++;
+    }
+}
+
+static void gc_mark_scan_child(JSRuntime *rt, JSGCObjectHeader *p)
+{
+    if (p->mark == 2) {
+        p->mark = 3;
+        list_del(&p->link);
+        list_add_tail(&p->link, &rt->gc_gray_list);
+    }
+}
+
+/* list of the objects found alive */
+static struct list_head *gc_mark_alive_list(JSRuntime *rt)
+{
+    if (rt->gc_generational)
+        return &rt->gc_old_obj_list;
+    else
+        return &rt->gc_obj_list;
+}
+
+static void gc_mark_start(JSRuntime *rt, BOOL is_full)
+{
+    int64_t t0;
+
+    t0 = js_get_time_us();
+    gc_collect_begin(rt, is_full);
+    list_splice_tail(&rt->gc_obj_list, &rt->gc_mark_list);
+    rt->gc_mark_phase = JS_GC_MARK_COUNT;
+    rt->gc_mark_full = is_full;
+    rt->gc_mark_count = 0;
+    rt->gc_mark_time = js_get_time_us() - t0;
+}
+
+/* end of the COUNT phase: allocate the hash table. It is cleared in
+   the CLEAR phase because it can be large. Return FALSE if there is
+   not enough memory. */
+static BOOL gc_mark_alloc_tab(JSRuntime *rt)
+{
+    uintptr_t size;
+
+    /* multiple of the size cleared at each step */
+    size = 1024;
+    while (size < rt->gc_mark_count + rt->gc_mark_count / 2)
+        size *= 2;
+    rt->gc_mark_tab = js_malloc_rt(rt, sizeof(rt->gc_mark_tab[0]) * size);
+    if (!rt->gc_mark_tab)
+        return FALSE;
+    rt->gc_mark_tab_mask = size - 1;
+    rt->gc_mark_tab_pos = 0;
+    return TRUE;
+}
+
+/* search the cycles among the white objects */
+static void gc_mark_end(JSRuntime *rt, int64_t t0)
+{
+    struct list_head *el, new_obj_list;
+    JSGCObjectHeader *p;
+    int64_t count, t1;
+
+    js_free_rt(rt, rt->gc_mark_tab);
+    rt->gc_mark_tab = NULL;
+    rt->gc_mark_phase = JS_GC_MARK_NONE;
+    list_for_each(el, &rt->gc_white_list) {
+        p = list_entry(el, JSGCObjectHeader, link);
+        p->mark = 0;
+    }
+    /* the objects allocated during the collection are not collected */
+    init_list_head(&new_obj_list);
+    list_splice_tail(&rt->gc_obj_list, &new_obj_list);
+    list_splice_tail(&rt->gc_white_list, &rt->gc_obj_list);
+
+    gc_decref(rt);
+    gc_scan(rt);
+    t1 = js_get_time_us();
+    gc_add_time(&rt->gc_stats.scan_time, &rt->gc_stats.scan_max_time,
+                rt->gc_mark_time + t1 - t0);
+
+    count = rt->gc_mark_count;
+    list_for_each(el, &rt->gc_obj_list) {
+        count++;
+    }
+    if (rt->gc_generational)
+        list_splice_tail(&rt->gc_obj_list, &rt->gc_old_obj_list);
+    list_splice_tail(&new_obj_list, &rt->gc_obj_list);
+    gc_collect_end_scan(rt, rt->gc_mark_full, count);
+}
+
+/* Not enough memory for the incremental search: it is done in a
+   single pause. */
+static void gc_mark_abort(JSRuntime *rt, int64_t t0)
+{
+    struct list_head *el;
+    JSGCObjectHeader *p;
+
+    rt->gc_mark_phase = JS_GC_MARK_NONE;
+    list_for_each(el, &rt->gc_mark_list) {
+        p = list_entry(el, JSGCObjectHeader, link);
+        p->mark = 0;
+    }
+    list_splice_tail(&rt->gc_mark_list, &rt->gc_obj_list);
+    gc_collect_scan(rt, rt->gc_mark_full, t0 - rt->gc_mark_time);
+}
+
+/* Run the search of the cycles until 'deadline' if not zero. Return
+   TRUE if it is finished. */
+static BOOL gc_mark_continue(JSRuntime *rt, int64_t deadline)
+{
+    struct list_head *el;
+    JSGCObjectHeader *p;
+    int64_t t0, t1;
+    int count;
+
+    t0 = js_get_time_us();
+    count = 0;
+    for(;;) {
+        if (deadline != 0 && (++count % JS_GC_SLICE_CHECK_COUNT) == 0) {
+            t1 = js_get_time_us();
+            if (t1 >= deadline) {
+                rt->gc_mark_time += t1 - t0;
+                return FALSE;
+            }
+        }
+        switch(rt->gc_mark_phase) {
+        case JS_GC_MARK_COUNT:
+            el = rt->gc_mark_list.next;
+            if (el == &rt->gc_mark_list) {
+                list_splice_tail(&rt->gc_mark_done_list, &rt->gc_mark_list);
+                if (!gc_mark_alloc_tab(rt)) {
+                    gc_mark_abort(rt, t0);
+                    return TRUE;
+                }
+                rt->gc_stats.scanned_count += rt->gc_mark_count;
+                rt->gc_mark_phase = JS_GC_MARK_CLEAR;
+                break;
+            }
+            p = list_entry(el, JSGCObjectHeader, link);
+            p->mark = 1;
+            list_del(&p->link);
+            list_add_tail(&p->link, &rt->gc_mark_done_list);
+            rt->gc_mark_count++;
+            break;
+        case JS_GC_MARK_CLEAR:
+            if (rt->gc_mark_tab_pos > rt->gc_mark_tab_mask) {
+                rt->gc_mark_phase = JS_GC_MARK_DECREF;
+                break;
+            }
+            memset(&rt->gc_mark_tab[rt->gc_mark_tab_pos], 0,
+                   sizeof(rt->gc_mark_tab[0]) * 1024);
+            rt->gc_mark_tab_pos += 1024;
+            break;
+        case JS_GC_MARK_DECREF:
+            el = rt->gc_mark_list.next;
+            if (el == &rt->gc_mark_list) {
+                list_splice_tail(&rt->gc_mark_done_list, &rt->gc_mark_list);
+                t1 = js_get_time_us();
+                gc_add_time(&rt->gc_stats.decref_time,
+                            &rt->gc_stats.decref_max_time,
+                            rt->gc_mark_time + t1 - t0);
+                rt->gc_mark_time = 0;
+                t0 = t1;
+                /* now the number of objects found alive */
+                rt->gc_mark_count = 0;
+                rt->gc_mark_phase = JS_GC_MARK_SCAN;
+                break;
+            }
+            p = list_entry(el, JSGCObjectHeader, link);
+            mark_children(rt, p, gc_mark_decref_child);
+            p->mark = 2;
+            list_del(&p->link);
+            list_add_tail(&p->link, &rt->gc_mark_done_list);
+            break;
+        case JS_GC_MARK_SCAN:
+            el = rt->gc_gray_list.next;
+            if (el != &rt->gc_gray_list) {
+                /* alive: visit its children */
+                p = list_entry(el, JSGCObjectHeader, link);
+                mark_children(rt, p, gc_mark_scan_child);
+                p->mark = 0;
+                list_del(&p->link);
+                list_add_tail(&p->link, gc_mark_alive_list(rt));
+                rt->gc_mark_count++;
+                break;
+            }
+            el = rt->gc_mark_list.next;
+            if (el == &rt->gc_mark_list) {
+                gc_mark_end(rt, t0);
+                return TRUE;
+            }
+            p = list_entry(el, JSGCObjectHeader, link);
+            list_del(&p->link);
+            if (p->ref_count > gc_mark_find(rt, p)->count) {
+                p->mark = 3;
+                list_add_tail(&p->link, &rt->gc_gray_list);
+            } else {
+                list_add_tail(&p->link, &rt->gc_white_list);
+            }
+            break;
+        default:
+            abort();
+        }
+    }
+}
+
+/* free the GC objects in a cycle. Return TRUE if the collection is
+   finished. */
+static BOOL gc_collect_continue(JSRuntime *rt, int64_t deadline)
+{
+    int64_t start_time;
+    BOOL done;
+
+    start_time = js_get_time_us();
+    done = gc_free_cycles(rt, deadline);
+    gc_add_time(&rt->gc_stats.free_time, &rt->gc_stats.free_max_time,
+                js_get_time_us() - start_time);
+    if (!done)
+        return FALSE;
+    rt->gc_in_progress = FALSE;
+    if (rt->slab.enabled)
+        js_slab_trim(rt);
+    rt->gc_stats.heap_size = rt->malloc_state.malloc_size;
+    rt->gc_stats.freed_size += max_int64((int64_t)rt->gc_start_size -
+                                         rt->gc_stats.heap_size, 0);
+    if (unlikely(rt->memory_reserve_used))
+        js_restore_memory_reserve(rt);
+    if (rt->gc_callback)
+        rt->gc_callback(rt, JS_GC_EVENT_END, &rt->gc_stats,
+                        rt->gc_callback_opaque);
+    return TRUE;
+}
+
+/* finish the pending incremental collection if any */
+static void gc_collect_finish(JSRuntime *rt)
+{
+    if (rt->gc_mark_phase != JS_GC_MARK_NONE)
+        gc_mark_continue(rt, 0);
+    if (rt->gc_in_progress)
+        gc_collect_continue(rt, 0);
+}
+
+/* account a pause of the program which started at 'start_time' */
+static void gc_end_pause(JSRuntime *rt, int64_t start_time)
+{
+    rt->gc_last_time = js_get_time_us();
+    gc_add_time(&rt->gc_stats.gc_time, &rt->gc_stats.max_pause,
+                rt->gc_last_time - start_time);
+}
+
+void JS_RunGC(JSRuntime *rt)
+{
+    int64_t start_time = js_get_time_us();
+    gc_collect_finish(rt);
+    gc_collect_start(rt, TRUE);
+    gc_collect_continue(rt, 0);
+    gc_end_pause(rt, start_time);
+}
+
+/* Only collect the cycles among the objects allocated since the
+   previous collection. */
+void JS_RunMinorGC(JSRuntime *rt)
+{
+    int64_t start_time = js_get_time_us();
+    gc_collect_finish(rt);
+    gc_collect_start(rt, gc_need_full(rt));
+    gc_collect_continue(rt, 0);
+    gc_end_pause(rt, start_time);
+}
+
+/* Run a slice of at most 'budget_us' microseconds of the incremental
+   GC, starting a new collection if none is in progress. The search of
+   the cycles is sliced except for its last step, which is
+   proportional to the amount of cyclic garbage. Return TRUE if the
+   collection is not finished. */
+BOOL JS_RunGCStep(JSRuntime *rt, int64_t budget_us)
+{
+    int64_t start_time, deadline;
+    BOOL done;
+
+    start_time = js_get_time_us();
+    deadline = start_time + max_int64(budget_us, 1);
+    if (!JS_IsGCInProgress(rt))
+        gc_mark_start(rt, gc_need_full(rt));
+    done = FALSE;
+    if (rt->gc_mark_phase == JS_GC_MARK_NONE ||
+        gc_mark_continue(rt, deadline)) {
+        done = gc_collect_continue(rt, deadline);
+    }
+    gc_end_pause(rt, start_time);
+    return !done;
+}
+
+BOOL JS_IsGCInProgress(JSRuntime *rt)
+{
+    return rt->gc_in_progress || rt->gc_mark_phase != JS_GC_MARK_NONE;
 }
 
 /* Return false if not an object or if the object has already been
@@ -5865,6 +8082,10 @@ static void compute_bytecode_size(JSFunctionBytecode *b, JSMemoryUsage_helper *h
     if (!b->read_only_bytecode && b->byte_code_buf) {
         hp->js_func_code_size += b->byte_code_len;
     }
+    if (b->ic) {
+        memory_used_count++;
+        js_func_size += b->ic_count * sizeof(*b->ic);
+    }
     if (b->has_debug) {
         js_func_size += sizeof(*b) - offsetof(JSFunctionBytecode, debug);
         if (b->debug.source) {
@@ -5888,6 +8109,16 @@ static void compute_value_size(JSValueConst val, JSMemoryUsage_helper *hp)
     case JS_TAG_STRING:
         compute_jsstring_size(JS_VALUE_GET_STRING(val), hp);
         break;
+    case JS_TAG_STRING_ROPE:
+        {
+            JSStringRope *r = JS_VALUE_GET_PTR(val);
+            double s_ref_count = r->header.ref_count;
+            hp->str_count += 1 / s_ref_count;
+            hp->str_size += sizeof(*r) / s_ref_count;
+            compute_value_size(r->left, hp);
+            compute_value_size(r->right, hp);
+        }
+        break;
 #ifdef CONFIG_BIGNUM
     case JS_TAG_BIG_INT:
     case JS_TAG_BIG_FLOAT:
@@ -5898,9 +8129,198 @@ static void compute_value_size(JSValueConst val, JSMemoryUsage_helper *hp)
     }
 }
 
+static void compute_gc_object_size(JSMemoryUsage *s, JSMemoryUsage_helper *hp,
+                                   JSGCObjectHeader *gp)
+{
+    JSObject *p;
+    JSShape *sh;
+    JSShapeProperty *prs;
+    int i;
+
+    /* XXX: could count the other GC object types too */
+    if (gp->gc_obj_type == JS_GC_OBJ_TYPE_FUNCTION_BYTECODE) {
+        compute_bytecode_size((JSFunctionBytecode *)gp, hp);
+        return;
+    } else if (gp->gc_obj_type != JS_GC_OBJ_TYPE_JS_OBJECT) {
+        return;
+    }
+    p = (JSObject *)gp;
+    sh = p->shape;
+    s->obj_count++;
+    if (p->prop) {
+        s->memory_used_count++;
+        s->prop_size += sh->prop_size * sizeof(*p->prop);
+        s->prop_count += sh->prop_count;
+        prs = get_shape_prop(sh);
+        for(i = 0; i < sh->prop_count; i++) {
+            JSProperty *pr = &p->prop[i];
+            if (prs->atom != JS_ATOM_NULL && !(prs->flags & JS_PROP_TMASK)) {
+                compute_value_size(pr->u.value, hp);
+            }
+            prs++;
+        }
+    }
+    /* the hashed shapes are counted separately */
+    if (!sh->is_hashed) {
+        int hash_size = sh->prop_hash_mask + 1;
+        s->shape_count++;
+        s->shape_size += get_shape_size(hash_size, sh->prop_size);
+    }
+
+    switch(p->class_id) {
+    case JS_CLASS_ARRAY:             /* u.array | length */
+    case JS_CLASS_ARGUMENTS:         /* u.array | length */
+        s->array_count++;
+        if (p->fast_array) {
+            s->fast_array_count++;
+            if (p->u.array.u.values) {
+                s->memory_used_count++;
+                s->memory_used_size += p->u.array.count *
+                    sizeof(*p->u.array.u.values);
+                s->fast_array_elements += p->u.array.count;
+                for (i = 0; i < p->u.array.count; i++) {
+                    compute_value_size(p->u.array.u.values[i], hp);
+                }
+            }
+        }
+        break;
+    case JS_CLASS_NUMBER:            /* u.object_data */
+    case JS_CLASS_STRING:            /* u.object_data */
+    case JS_CLASS_BOOLEAN:           /* u.object_data */
+    case JS_CLASS_SYMBOL:            /* u.object_data */
+    case JS_CLASS_DATE:              /* u.object_data */
+#ifdef CONFIG_BIGNUM
+    case JS_CLASS_BIG_INT:           /* u.object_data */
+    case JS_CLASS_BIG_FLOAT:         /* u.object_data */
+    case JS_CLASS_BIG_DECIMAL:         /* u.object_data */
+#endif
+        compute_value_size(p->u.object_data, hp);
+        break;
+    case JS_CLASS_C_FUNCTION:        /* u.cfunc */
+        s->c_func_count++;
+        break;
+    case JS_CLASS_BYTECODE_FUNCTION: /* u.func */
+        {
+            JSFunctionBytecode *b = p->u.func.function_bytecode;
+            JSVarRef **var_refs = p->u.func.var_refs;
+            /* home_object: object will be accounted for in list scan */
+            if (var_refs) {
+                s->memory_used_count++;
+                s->js_func_size += b->closure_var_count * sizeof(*var_refs);
+                for (i = 0; i < b->closure_var_count; i++) {
+                    if (var_refs[i]) {
+                        double ref_count = var_refs[i]->header.ref_count;
+                        s->memory_used_count += 1 / ref_count;
+                        s->js_func_size += sizeof(*var_refs[i]) / ref_count;
+                        /* handle non object closed values */
+                        if (var_refs[i]->pvalue == &var_refs[i]->value) {
+                            /* potential multiple count */
+                            compute_value_size(var_refs[i]->value, hp);
+                        }
+                    }
+                }
+            }
+        }
+        break;
+    case JS_CLASS_BOUND_FUNCTION:    /* u.bound_function */
+        {
+            JSBoundFunction *bf = p->u.bound_function;
+            /* func_obj and this_val are objects */
+            for (i = 0; i < bf->argc; i++) {
+                compute_value_size(bf->argv[i], hp);
+            }
+            s->memory_used_count += 1;
+            s->memory_used_size += sizeof(*bf) + bf->argc * sizeof(*bf->argv);
+        }
+        break;
+    case JS_CLASS_C_FUNCTION_DATA:   /* u.c_function_data_record */
+        {
+            JSCFunctionDataRecord *fd = p->u.c_function_data_record;
+            if (fd) {
+                for (i = 0; i < fd->data_len; i++) {
+                    compute_value_size(fd->data[i], hp);
+                }
+                s->memory_used_count += 1;
+                s->memory_used_size += sizeof(*fd) + fd->data_len * sizeof(*fd->data);
+            }
+        }
+        break;
+    case JS_CLASS_REGEXP:            /* u.regexp */
+        compute_jsstring_size(p->u.regexp.pattern, hp);
+        compute_jsstring_size(p->u.regexp.bytecode, hp);
+        break;
+
+    case JS_CLASS_FOR_IN_ITERATOR:   /* u.for_in_iterator */
+        {
+            JSForInIterator *it = p->u.for_in_iterator;
+            if (it) {
+                compute_value_size(it->obj, hp);
+                s->memory_used_count += 1;
+                s->memory_used_size += sizeof(*it);
+            }
+        }
+        break;
+    case JS_CLASS_ARRAY_BUFFER:      /* u.array_buffer */
+    case JS_CLASS_SHARED_ARRAY_BUFFER: /* u.array_buffer */
+        {
+            JSArrayBuffer *abuf = p->u.array_buffer;
+            if (abuf) {
+                s->memory_used_count += 1;
+                s->memory_used_size += sizeof(*abuf);
+                if (abuf->data) {
+                    s->memory_used_count += 1;
+                    s->memory_used_size += abuf->byte_length;
+                }
+            }
+        }
+        break;
+    case JS_CLASS_GENERATOR:         /* u.generator_data */
+    case JS_CLASS_UINT8C_ARRAY:      /* u.typed_array / u.array */
+    case JS_CLASS_INT8_ARRAY:        /* u.typed_array / u.array */
+    case JS_CLASS_UINT8_ARRAY:       /* u.typed_array / u.array */
+    case JS_CLASS_INT16_ARRAY:       /* u.typed_array / u.array */
+    case JS_CLASS_UINT16_ARRAY:      /* u.typed_array / u.array */
+    case JS_CLASS_INT32_ARRAY:       /* u.typed_array / u.array */
+    case JS_CLASS_UINT32_ARRAY:      /* u.typed_array / u.array */
+#ifdef CONFIG_BIGNUM
+    case JS_CLASS_BIG_INT64_ARRAY:   /* u.typed_array / u.array */
+    case JS_CLASS_BIG_UINT64_ARRAY:  /* u.typed_array / u.array */
+#endif
+    case JS_CLASS_FLOAT32_ARRAY:     /* u.typed_array / u.array */
+    case JS_CLASS_FLOAT64_ARRAY:     /* u.typed_array / u.array */
+    case JS_CLASS_DATAVIEW:          /* u.typed_array */
+#ifdef CONFIG_BIGNUM
+    case JS_CLASS_FLOAT_ENV:         /* u.float_env */
+#endif
+    case JS_CLASS_MAP:               /* u.map_state */
+    case JS_CLASS_SET:               /* u.map_state */
+    case JS_CLASS_WEAKMAP:           /* u.map_state */
+    case JS_CLASS_WEAKSET:           /* u.map_state */
+    case JS_CLASS_MAP_ITERATOR:      /* u.map_iterator_data */
+    case JS_CLASS_SET_ITERATOR:      /* u.map_iterator_data */
+    case JS_CLASS_ARRAY_ITERATOR:    /* u.array_iterator_data */
+    case JS_CLASS_STRING_ITERATOR:   /* u.array_iterator_data */
+    case JS_CLASS_PROXY:             /* u.proxy_data */
+    case JS_CLASS_PROMISE:           /* u.promise_data */
+    case JS_CLASS_PROMISE_RESOLVE_FUNCTION:  /* u.promise_function_data */
+    case JS_CLASS_PROMISE_REJECT_FUNCTION:   /* u.promise_function_data */
+    case JS_CLASS_ASYNC_FUNCTION_RESOLVE:    /* u.async_function_data */
+    case JS_CLASS_ASYNC_FUNCTION_REJECT:     /* u.async_function_data */
+    case JS_CLASS_ASYNC_FROM_SYNC_ITERATOR:  /* u.async_from_sync_iterator_data */
+    case JS_CLASS_ASYNC_GENERATOR:   /* u.async_generator_data */
+        /* TODO */
+    default:
+        /* XXX: class definition should have an opaque block size */
+        if (p->u.opaque) {
+            s->memory_used_count += 1;
+        }
+        break;
+    }
+}
+
 void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s)
 {
-    struct list_head *el, *el1;
+    struct list_head *el, *el1, *gc_lists[JS_GC_OBJ_LIST_COUNT];
     int i;
     JSMemoryUsage_helper mem = { 0 }, *hp = &mem;
 
@@ -5960,190 +8380,13 @@ void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s)
         }
     }
 
-    list_for_each(el, &rt->gc_obj_list) {
-        JSGCObjectHeader *gp = list_entry(el, JSGCObjectHeader, link);
-        JSObject *p;
-        JSShape *sh;
-        JSShapeProperty *prs;
-
-        /* XXX: could count the other GC object types too */
-        if (gp->gc_obj_type == JS_GC_OBJ_TYPE_FUNCTION_BYTECODE) {
-            compute_bytecode_size((JSFunctionBytecode *)gp, hp);
-            continue;
-        } else if (gp->gc_obj_type != JS_GC_OBJ_TYPE_JS_OBJECT) {
-            continue;
-        }
-        p = (JSObject *)gp;
-        sh = p->shape;
-        s->obj_count++;
-        if (p->prop) {
-            s->memory_used_count++;
-            s->prop_size += sh->prop_size * sizeof(*p->prop);
-            s->prop_count += sh->prop_count;
-            prs = get_shape_prop(sh);
-            for(i = 0; i < sh->prop_count; i++) {
-                JSProperty *pr = &p->prop[i];
-                if (prs->atom != JS_ATOM_NULL && !(prs->flags & JS_PROP_TMASK)) {
-                    compute_value_size(pr->u.value, hp);
-                }
-                prs++;
-            }
-        }
-        /* the hashed shapes are counted separately */
-        if (!sh->is_hashed) {
-            int hash_size = sh->prop_hash_mask + 1;
-            s->shape_count++;
-            s->shape_size += get_shape_size(hash_size, sh->prop_size);
-        }
-
-        switch(p->class_id) {
-        case JS_CLASS_ARRAY:             /* u.array | length */
-        case JS_CLASS_ARGUMENTS:         /* u.array | length */
-            s->array_count++;
-            if (p->fast_array) {
-                s->fast_array_count++;
-                if (p->u.array.u.values) {
-                    s->memory_used_count++;
-                    s->memory_used_size += p->u.array.count *
-                        sizeof(*p->u.array.u.values);
-                    s->fast_array_elements += p->u.array.count;
-                    for (i = 0; i < p->u.array.count; i++) {
-                        compute_value_size(p->u.array.u.values[i], hp);
-                    }
-                }
-            }
-            break;
-        case JS_CLASS_NUMBER:            /* u.object_data */
-        case JS_CLASS_STRING:            /* u.object_data */
-        case JS_CLASS_BOOLEAN:           /* u.object_data */
-        case JS_CLASS_SYMBOL:            /* u.object_data */
-        case JS_CLASS_DATE:              /* u.object_data */
-#ifdef CONFIG_BIGNUM
-        case JS_CLASS_BIG_INT:           /* u.object_data */
-        case JS_CLASS_BIG_FLOAT:         /* u.object_data */
-        case JS_CLASS_BIG_DECIMAL:         /* u.object_data */
-#endif
-            compute_value_size(p->u.object_data, hp);
-            break;
-        case JS_CLASS_C_FUNCTION:        /* u.cfunc */
-            s->c_func_count++;
-            break;
-        case JS_CLASS_BYTECODE_FUNCTION: /* u.func */
-            {
-                JSFunctionBytecode *b = p->u.func.function_bytecode;
-                JSVarRef **var_refs = p->u.func.var_refs;
-                /* home_object: object will be accounted for in list scan */
-                if (var_refs) {
-                    s->memory_used_count++;
-                    s->js_func_size += b->closure_var_count * sizeof(*var_refs);
-                    for (i = 0; i < b->closure_var_count; i++) {
-                        if (var_refs[i]) {
-                            double ref_count = var_refs[i]->header.ref_count;
-                            s->memory_used_count += 1 / ref_count;
-                            s->js_func_size += sizeof(*var_refs[i]) / ref_count;
-                            /* handle non object closed values */
-                            if (var_refs[i]->pvalue == &var_refs[i]->value) {
-                                /* potential multiple count */
-                                compute_value_size(var_refs[i]->value, hp);
-                            }
-                        }
-                    }
-                }
-            }
-            break;
-        case JS_CLASS_BOUND_FUNCTION:    /* u.bound_function */
-            {
-                JSBoundFunction *bf = p->u.bound_function;
-                /* func_obj and this_val are objects */
-                for (i = 0; i < bf->argc; i++) {
-                    compute_value_size(bf->argv[i], hp);
-                }
-                s->memory_used_count += 1;
-                s->memory_used_size += sizeof(*bf) + bf->argc * sizeof(*bf->argv);
-            }
-            break;
-        case JS_CLASS_C_FUNCTION_DATA:   /* u.c_function_data_record */
-            {
-                JSCFunctionDataRecord *fd = p->u.c_function_data_record;
-                if (fd) {
-                    for (i = 0; i < fd->data_len; i++) {
-                        compute_value_size(fd->data[i], hp);
-                    }
-                    s->memory_used_count += 1;
-                    s->memory_used_size += sizeof(*fd) + fd->data_len * sizeof(*fd->data);
-                }
-            }
-            break;
-        case JS_CLASS_REGEXP:            /* u.regexp */
-            compute_jsstring_size(p->u.regexp.pattern, hp);
-            compute_jsstring_size(p->u.regexp.bytecode, hp);
-            break;
-
-        case JS_CLASS_FOR_IN_ITERATOR:   /* u.for_in_iterator */
-            {
-                JSForInIterator *it = p->u.for_in_iterator;
-                if (it) {
-                    compute_value_size(it->obj, hp);
-                    s->memory_used_count += 1;
-                    s->memory_used_size += sizeof(*it);
-                }
-            }
-            break;
-        case JS_CLASS_ARRAY_BUFFER:      /* u.array_buffer */
-        case JS_CLASS_SHARED_ARRAY_BUFFER: /* u.array_buffer */
-            {
-                JSArrayBuffer *abuf = p->u.array_buffer;
-                if (abuf) {
-                    s->memory_used_count += 1;
-                    s->memory_used_size += sizeof(*abuf);
-                    if (abuf->data) {
-                        s->memory_used_count += 1;
-                        s->memory_used_size += abuf->byte_length;
-                    }
-                }
-            }
-            break;
-        case JS_CLASS_GENERATOR:         /* u.generator_data */
-        case JS_CLASS_UINT8C_ARRAY:      /* u.typed_array / u.array */
-        case JS_CLASS_INT8_ARRAY:        /* u.typed_array / u.array */
-        case JS_CLASS_UINT8_ARRAY:       /* u.typed_array / u.array */
-        case JS_CLASS_INT16_ARRAY:       /* u.typed_array / u.array */
-        case JS_CLASS_UINT16_ARRAY:      /* u.typed_array / u.array */
-        case JS_CLASS_INT32_ARRAY:       /* u.typed_array / u.array */
-        case JS_CLASS_UINT32_ARRAY:      /* u.typed_array / u.array */
-#ifdef CONFIG_BIGNUM
-        case JS_CLASS_BIG_INT64_ARRAY:   /* u.typed_array / u.array */
-        case JS_CLASS_BIG_UINT64_ARRAY:  /* u.typed_array / u.array */
-#endif
-        case JS_CLASS_FLOAT32_ARRAY:     /* u.typed_array / u.array */
-        case JS_CLASS_FLOAT64_ARRAY:     /* u.typed_array / u.array */
-        case JS_CLASS_DATAVIEW:          /* u.typed_array */
-#ifdef CONFIG_BIGNUM
-        case JS_CLASS_FLOAT_ENV:         /* u.float_env */
-#endif
-        case JS_CLASS_MAP:               /* u.map_state */
-        case JS_CLASS_SET:               /* u.map_state */
-        case JS_CLASS_WEAKMAP:           /* u.map_state */
-        case JS_CLASS_WEAKSET:           /* u.map_state */
-        case JS_CLASS_MAP_ITERATOR:      /* u.map_iterator_data */
-        case JS_CLASS_SET_ITERATOR:      /* u.map_iterator_data */
-        case JS_CLASS_ARRAY_ITERATOR:    /* u.array_iterator_data */
-        case JS_CLASS_STRING_ITERATOR:   /* u.array_iterator_data */
-        case JS_CLASS_PROXY:             /* u.proxy_data */
-        case JS_CLASS_PROMISE:           /* u.promise_data */
-        case JS_CLASS_PROMISE_RESOLVE_FUNCTION:  /* u.promise_function_data */
-        case JS_CLASS_PROMISE_REJECT_FUNCTION:   /* u.promise_function_data */
-        case JS_CLASS_ASYNC_FUNCTION_RESOLVE:    /* u.async_function_data */
-        case JS_CLASS_ASYNC_FUNCTION_REJECT:     /* u.async_function_data */
-        case JS_CLASS_ASYNC_FROM_SYNC_ITERATOR:  /* u.async_from_sync_iterator_data */
-        case JS_CLASS_ASYNC_GENERATOR:   /* u.async_generator_data */
-            /* TODO */
-        default:
-            /* XXX: class definition should have an opaque block size */
-            if (p->u.opaque) {
-                s->memory_used_count += 1;
-            }
-            break;
+    /* the generations are not merged so that the next minor
+       collection still only scans the young objects */
+    gc_get_obj_lists(rt, gc_lists);
+    for(i = 0; i < JS_GC_OBJ_LIST_COUNT; i++) {
+        list_for_each(el, gc_lists[i]) {
+            compute_gc_object_size(s, hp,
+                                   list_entry(el, JSGCObjectHeader, link));
         }
     }
     s->obj_size += s->obj_count * sizeof(JSObject);
@@ -6228,13 +8471,17 @@ void JS_DumpMemoryUsage(FILE *fp, const JSMemoryUsage *s, JSRuntime *rt)
         {
             int obj_classes[JS_CLASS_INIT_COUNT + 1] = { 0 };
             int class_id;
-            struct list_head *el;
-            list_for_each(el, &rt->gc_obj_list) {
-                JSGCObjectHeader *gp = list_entry(el, JSGCObjectHeader, link);
-                JSObject *p;
-                if (gp->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT) {
-                    p = (JSObject *)gp;
-                    obj_classes[min_uint32(p->class_id, JS_CLASS_INIT_COUNT)]++;
+            struct list_head *el, *gc_lists[JS_GC_OBJ_LIST_COUNT];
+            int j;
+            gc_get_obj_lists(rt, gc_lists);
+            for(j = 0; j < JS_GC_OBJ_LIST_COUNT; j++) {
+                list_for_each(el, gc_lists[j]) {
+                    JSGCObjectHeader *gp = list_entry(el, JSGCObjectHeader, link);
+                    JSObject *p;
+                    if (gp->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT) {
+                        p = (JSObject *)gp;
+                        obj_classes[min_uint32(p->class_id, JS_CLASS_INIT_COUNT)]++;
+                    }
                 }
             }
             fprintf(fp, "\n" "JSObject classes\n");
@@ -6250,6 +8497,17 @@ void JS_DumpMemoryUsage(FILE *fp, const JSMemoryUsage *s, JSRuntime *rt)
             if (obj_classes[JS_CLASS_INIT_COUNT])
                 fprintf(fp, "  %5d  %2.0d %s\n", obj_classes[JS_CLASS_INIT_COUNT], 0, "other");
         }
+        if (rt->memory_accounting) {
+            struct list_head *el;
+            fprintf(fp, "\n" "JSContext memory\n");
+            list_for_each(el, &rt->context_list) {
+                JSContext *ctx = list_entry(el, JSContext, link);
+                JSMemoryAccount *account = ctx->account;
+                fprintf(fp, "  %p  %8"PRId64" %8"PRId64"  limit: %"PRId64"\n",
+                        (void *)ctx, account->malloc_count,
+                        account->malloc_size, account->malloc_limit);
+            }
+        }
         fprintf(fp, "\n");
     }
 #endif
@@ -6315,6 +8573,295 @@ void JS_DumpMemoryUsage(FILE *fp, const JSMemoryUsage *s, JSRuntime *rt)
         fprintf(fp, "%-20s %8"PRId64" %8"PRId64"\n",
                 "binary objects", s->binary_object_count, s->binary_object_size);
     }
+    if (rt && rt->gc_stats.gc_count) {
+        const JSGCStats *gs = &rt->gc_stats;
+        fprintf(fp, "%-20s %8"PRId64" %8"PRId64"  (%"PRId64" automatic, %0.3f ms)\n",
+                "GC freed", gs->gc_count, gs->freed_size, gs->gc_auto_count,
+                (double)gs->gc_time / 1000);
+        fprintf(fp, "%-20s %8"PRId64" %8"PRId64"  (%0.3f ms max pause)\n",
+                "  GC cycles", gs->scanned_count, gs->freed_count,
+                (double)gs->max_pause / 1000);
+    }
+}
+
+/* Heap snapshot. The roots are the GC objects which are referenced
+   from outside the GC objects (stack, C code, atoms...): their
+   reference count is larger than the number of references found by
+   mark_children(). The retainer of an object is its predecessor on a
+   shortest path from a root. The objects are numbered in the order of
+   the GC object lists so that the ids do not depend on the addresses
+   and the snapshots of two runs can be compared. */
+
+#define JS_HEAP_SNAPSHOT_ROOT        (-1)
+#define JS_HEAP_SNAPSHOT_UNREACHABLE (-2)
+
+typedef struct JSHeapSnapshot {
+    JSGCObjectHeader **objs; /* index = id of the object */
+    int *sorted; /* object ids sorted by address */
+    int count;
+    int *edge_count; /* number of references from the GC objects */
+    int *retainer; /* index of the retainer or JS_HEAP_SNAPSHOT_x */
+    int *queue;
+    int queue_len;
+    int cur; /* index of the object whose children are visited */
+    FILE *fp;
+} JSHeapSnapshot;
+
+static int js_heap_snapshot_cmp(const void *a, const void *b, void *opaque)
+{
+    JSHeapSnapshot *hs = opaque;
+    uintptr_t pa = (uintptr_t)hs->objs[*(const int *)a];
+    uintptr_t pb = (uintptr_t)hs->objs[*(const int *)b];
+    return (pa > pb) - (pa < pb);
+}
+
+/* return the id of 'gp' or -1 if not found */
+static int js_heap_snapshot_find(JSHeapSnapshot *hs, JSGCObjectHeader *gp)
+{
+    int a, b, m;
+    JSGCObjectHeader *gp1;
+
+    a = 0;
+    b = hs->count - 1;
+    while (a <= b) {
+        m = (a + b) >> 1;
+        gp1 = hs->objs[hs->sorted[m]];
+        if (gp1 == gp)
+            return hs->sorted[m];
+        if ((uintptr_t)gp1 < (uintptr_t)gp)
+            a = m + 1;
+        else
+            b = m - 1;
+    }
+    return -1;
+}
+
+static void js_heap_snapshot_count_child(JSRuntime *rt, JSGCObjectHeader *gp)
+{
+    JSHeapSnapshot *hs = rt->heap_snapshot;
+    int idx = js_heap_snapshot_find(hs, gp);
+    if (idx >= 0)
+        hs->edge_count[idx]++;
+}
+
+static void js_heap_snapshot_visit_child(JSRuntime *rt, JSGCObjectHeader *gp)
+{
+    JSHeapSnapshot *hs = rt->heap_snapshot;
+    int idx = js_heap_snapshot_find(hs, gp);
+    if (idx >= 0 && hs->retainer[idx] == JS_HEAP_SNAPSHOT_UNREACHABLE) {
+        hs->retainer[idx] = hs->cur;
+        hs->queue[hs->queue_len++] = idx;
+    }
+}
+
+static void js_heap_snapshot_write_child(JSRuntime *rt, JSGCObjectHeader *gp)
+{
+    JSHeapSnapshot *hs = rt->heap_snapshot;
+    int idx = js_heap_snapshot_find(hs, gp);
+    if (idx >= 0)
+        fprintf(hs->fp, " %d", idx);
+}
+
+/* approximate size of the memory owned by a GC object */
+static size_t js_heap_snapshot_get_size(JSRuntime *rt, JSGCObjectHeader *gp)
+{
+    size_t size;
+
+    switch(gp->gc_obj_type) {
+    case JS_GC_OBJ_TYPE_JS_OBJECT:
+        {
+            JSObject *p = (JSObject *)gp;
+            size = sizeof(JSObject) + p->shape->prop_size * sizeof(JSProperty);
+            switch(p->class_id) {
+            case JS_CLASS_ARRAY:
+            case JS_CLASS_ARGUMENTS:
+                if (p->fast_array)
+                    size += p->u.array.count * sizeof(*p->u.array.u.values);
+                break;
+            case JS_CLASS_ARRAY_BUFFER:
+            case JS_CLASS_SHARED_ARRAY_BUFFER:
+                if (p->u.array_buffer) {
+                    size += sizeof(*p->u.array_buffer) +
+                        p->u.array_buffer->byte_length;
+                }
+                break;
+            case JS_CLASS_MAP:
+            case JS_CLASS_SET:
+            case JS_CLASS_WEAKMAP:
+            case JS_CLASS_WEAKSET:
+                if (p->u.map_state)
+                    size += js_map_get_memory_size(p->u.map_state);
+                break;
+            default:
+                break;
+            }
+        }
+        break;
+    case JS_GC_OBJ_TYPE_FUNCTION_BYTECODE:
+        {
+            JSFunctionBytecode *b = (JSFunctionBytecode *)gp;
+            size = sizeof(*b) + b->byte_code_len +
+                b->cpool_count * sizeof(*b->cpool);
+        }
+        break;
+    case JS_GC_OBJ_TYPE_SHAPE:
+        {
+            JSShape *sh = (JSShape *)gp;
+            size = get_shape_size(sh->prop_hash_mask + 1, sh->prop_size);
+        }
+        break;
+    case JS_GC_OBJ_TYPE_VAR_REF:
+        size = sizeof(JSVarRef);
+        break;
+    case JS_GC_OBJ_TYPE_ASYNC_FUNCTION:
+        size = sizeof(JSAsyncFunctionData);
+        break;
+    case JS_GC_OBJ_TYPE_JS_CONTEXT:
+        size = sizeof(JSContext);
+        break;
+    default:
+        size = 0;
+        break;
+    }
+    return size;
+}
+
+static void js_heap_snapshot_write_name(JSRuntime *rt, FILE *fp, JSAtom atom)
+{
+    char buf[ATOM_GET_STR_BUF_SIZE];
+    const char *str;
+
+    fputc(' ', fp);
+    for(str = JS_AtomGetStrRT(rt, buf, sizeof(buf), atom); *str; str++) {
+        /* one line per object */
+        fputc((uint8_t)*str < ' ' ? '?' : *str, fp);
+    }
+}
+
+static void js_heap_snapshot_write_object(JSRuntime *rt, JSHeapSnapshot *hs,
+                                          int idx, int flags)
+{
+    JSGCObjectHeader *gp = hs->objs[idx];
+    FILE *fp = hs->fp;
+    char buf[ATOM_GET_STR_BUF_SIZE];
+    const char *type_str;
+    int retainer;
+
+    switch(gp->gc_obj_type) {
+    case JS_GC_OBJ_TYPE_JS_OBJECT:
+        type_str = JS_AtomGetStrRT(rt, buf, sizeof(buf),
+            rt->class_array[((JSObject *)gp)->class_id].class_name);
+        break;
+    case JS_GC_OBJ_TYPE_FUNCTION_BYTECODE:
+        type_str = "[function_bytecode]";
+        break;
+    case JS_GC_OBJ_TYPE_SHAPE:
+        type_str = "[shape]";
+        break;
+    case JS_GC_OBJ_TYPE_VAR_REF:
+        type_str = "[var_ref]";
+        break;
+    case JS_GC_OBJ_TYPE_ASYNC_FUNCTION:
+        type_str = "[async_function]";
+        break;
+    case JS_GC_OBJ_TYPE_JS_CONTEXT:
+        type_str = "[js_context]";
+        break;
+    default:
+        type_str = "[unknown]";
+        break;
+    }
+    fprintf(fp, "N %d %s %"PRId64" %d %d ", idx, type_str,
+            (int64_t)js_heap_snapshot_get_size(rt, gp), gp->ref_count,
+            gp->ref_count - hs->edge_count[idx]);
+    retainer = hs->retainer[idx];
+    if (retainer == JS_HEAP_SNAPSHOT_ROOT)
+        fprintf(fp, "root");
+    else if (retainer == JS_HEAP_SNAPSHOT_UNREACHABLE)
+        fprintf(fp, "-");
+    else
+        fprintf(fp, "%d", retainer);
+    if (flags & JS_HEAP_SNAPSHOT_ADDRESS)
+        fprintf(fp, " @%p", (void *)gp);
+    if (gp->gc_obj_type == JS_GC_OBJ_TYPE_FUNCTION_BYTECODE) {
+        js_heap_snapshot_write_name(rt, fp,
+            ((JSFunctionBytecode *)gp)->func_name);
+    } else if (gp->gc_obj_type == JS_GC_OBJ_TYPE_JS_OBJECT &&
+               js_class_has_bytecode(((JSObject *)gp)->class_id)) {
+        js_heap_snapshot_write_name(rt, fp,
+            ((JSObject *)gp)->u.func.function_bytecode->func_name);
+    }
+    fputc('\n', fp);
+
+    fprintf(fp, "E");
+    mark_children(rt, gp, js_heap_snapshot_write_child);
+    fputc('\n', fp);
+}
+
+int JS_WriteHeapSnapshot(JSRuntime *rt, FILE *fp, int flags)
+{
+    JSHeapSnapshot hs_s, *hs = &hs_s;
+    struct list_head *el;
+    int i, n, ret;
+
+    /* the lists only contain live objects outside of a collection */
+    gc_collect_finish(rt);
+
+    memset(hs, 0, sizeof(*hs));
+    hs->fp = fp;
+    n = 0;
+    list_for_each(el, &rt->gc_obj_list)
+        n++;
+    list_for_each(el, &rt->gc_old_obj_list)
+        n++;
+    ret = -1;
+    hs->objs = js_malloc_rt(rt, sizeof(hs->objs[0]) * max_int(n, 1));
+    hs->sorted = js_malloc_rt(rt, sizeof(hs->sorted[0]) * max_int(n, 1));
+    hs->edge_count = js_mallocz_rt(rt, sizeof(hs->edge_count[0]) * max_int(n, 1));
+    hs->retainer = js_malloc_rt(rt, sizeof(hs->retainer[0]) * max_int(n, 1));
+    hs->queue = js_malloc_rt(rt, sizeof(hs->queue[0]) * max_int(n, 1));
+    if (!hs->objs || !hs->sorted || !hs->edge_count || !hs->retainer ||
+        !hs->queue)
+        goto done;
+    list_for_each(el, &rt->gc_obj_list)
+        hs->objs[hs->count++] = list_entry(el, JSGCObjectHeader, link);
+    list_for_each(el, &rt->gc_old_obj_list)
+        hs->objs[hs->count++] = list_entry(el, JSGCObjectHeader, link);
+    for(i = 0; i < n; i++)
+        hs->sorted[i] = i;
+    rqsort(hs->sorted, n, sizeof(hs->sorted[0]), js_heap_snapshot_cmp, hs);
+
+    rt->heap_snapshot = hs;
+    /* count the references between the GC objects */
+    for(i = 0; i < n; i++)
+        mark_children(rt, hs->objs[i], js_heap_snapshot_count_child);
+
+    /* breadth first search from the roots */
+    for(i = 0; i < n; i++) {
+        if (hs->objs[i]->ref_count > hs->edge_count[i]) {
+            hs->retainer[i] = JS_HEAP_SNAPSHOT_ROOT;
+            hs->queue[hs->queue_len++] = i;
+        } else {
+            hs->retainer[i] = JS_HEAP_SNAPSHOT_UNREACHABLE;
+        }
+    }
+    for(i = 0; i < hs->queue_len; i++) {
+        hs->cur = hs->queue[i];
+        mark_children(rt, hs->objs[hs->cur], js_heap_snapshot_visit_child);
+    }
+
+    fprintf(fp, "quickjs-heap-snapshot 2 %d\n", n);
+    for(i = 0; i < n; i++)
+        js_heap_snapshot_write_object(rt, hs, i, flags);
+    rt->heap_snapshot = NULL;
+    ret = ferror(fp) ? -1 : 0;
+ done:
+    js_free_rt(rt, hs->objs);
+    js_free_rt(rt, hs->sorted);
+    js_free_rt(rt, hs->edge_count);
+    js_free_rt(rt, hs->retainer);
+    js_free_rt(rt, hs->queue);
+    return ret;
 }
 
 JSValue JS_GetGlobalObject(JSContext *ctx)
@@ -6338,6 +8885,17 @@ JSValue JS_GetException(JSContext *ctx)
     JSRuntime *rt = ctx->rt;
     val = rt->current_exception;
     rt->current_exception = JS_NULL;
+    rt->account_over_limit = NULL;
+    if (unlikely(rt->memory_reserve_used))
+        js_restore_memory_reserve(rt);
+    if (unlikely(JS_VALUE_GET_TAG(val) == JS_TAG_STRING_ROPE)) {
+        val = js_string_rope_flatten_free(ctx, val);
+        if (JS_IsException(val)) {
+            /* out of memory error */
+            val = rt->current_exception;
+            rt->current_exception = JS_NULL;
+        }
+    }
     return val;
 }
 
@@ -6458,7 +9016,7 @@ static const char *get_func_name(JSContext *ctx, JSValueConst func)
     if ((prs->flags & JS_PROP_TMASK) != JS_PROP_NORMAL)
         return NULL;
     val = pr->u.value;
-    if (JS_VALUE_GET_TAG(val) != JS_TAG_STRING)
+    if (!tag_is_string(JS_VALUE_GET_TAG(val)))
         return NULL;
     return JS_ToCString(ctx, val);
 }
@@ -6547,6 +9105,375 @@ static void build_backtrace(JSContext *ctx, JSValueConst error_obj,
                            JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
 }
 
+/* Sampling heap profiler: one object or string allocation is sampled
+   every 'interval' allocated bytes on average. The sample records the
+   call stack and is accounted for the bytes allocated since the
+   previous sample. The live samples are kept in a hash table indexed
+   by the object address so that the retained memory can be
+   reported. */
+
+#define JS_HEAP_PROFILE_MAX_DEPTH 64
+
+typedef struct JSHeapProfileSite {
+    struct JSHeapProfileSite *hash_next;
+    uint32_t hash;
+    int64_t alloc_count; /* number of samples */
+    int64_t alloc_size; /* estimated allocated bytes */
+    int64_t live_count;
+    int64_t live_size;
+    char stack[0]; /* frames separated by ';', outermost first */
+} JSHeapProfileSite;
+
+typedef struct JSHeapProfileSample {
+    struct JSHeapProfileSample *hash_next;
+    void *ptr;
+    JSHeapProfileSite *site;
+    int64_t size; /* bytes accounted to this sample */
+} JSHeapProfileSample;
+
+typedef struct JSHeapProfile {
+    int64_t interval;
+    int64_t allocated; /* bytes allocated since the last sample */
+    int64_t threshold; /* next sample when allocated >= threshold */
+    uint64_t random_state;
+    int site_hash_bits;
+    int site_count;
+    JSHeapProfileSite **site_hash;
+    int sample_hash_bits;
+    int sample_count;
+    JSHeapProfileSample **sample_hash;
+} JSHeapProfile;
+
+/* randomize the sampling interval to avoid aliasing with periodic
+   allocation patterns */
+static void js_heap_profile_next_threshold(JSHeapProfile *hp)
+{
+    uint64_t x = hp->random_state;
+    /* xorshift64 */
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    hp->random_state = x;
+    hp->threshold = hp->interval / 2 + (int64_t)(x % (uint64_t)hp->interval);
+}
+
+static inline uint32_t js_heap_profile_ptr_hash(void *ptr, int bits)
+{
+    return ((uint64_t)(uintptr_t)ptr * 0x9E3779B97F4A7C15) >> (64 - bits);
+}
+
+static int js_heap_profile_resize_samples(JSRuntime *rt, JSHeapProfile *hp)
+{
+    JSHeapProfileSample **new_hash, *e, *e_next;
+    int i, new_bits;
+    uint32_t h;
+
+    new_bits = hp->sample_hash_bits + 1;
+    new_hash = js_mallocz_rt(rt, sizeof(new_hash[0]) << new_bits);
+    if (!new_hash)
+        return -1;
+    for(i = 0; i < (1 << hp->sample_hash_bits); i++) {
+        for(e = hp->sample_hash[i]; e != NULL; e = e_next) {
+            e_next = e->hash_next;
+            h = js_heap_profile_ptr_hash(e->ptr, new_bits);
+            e->hash_next = new_hash[h];
+            new_hash[h] = e;
+        }
+    }
+    js_free_rt(rt, hp->sample_hash);
+    hp->sample_hash = new_hash;
+    hp->sample_hash_bits = new_bits;
+    return 0;
+}
+
+static int js_heap_profile_resize_sites(JSRuntime *rt, JSHeapProfile *hp)
+{
+    JSHeapProfileSite **new_hash, *e, *e_next;
+    int i, new_bits;
+    uint32_t h;
+
+    new_bits = hp->site_hash_bits + 1;
+    new_hash = js_mallocz_rt(rt, sizeof(new_hash[0]) << new_bits);
+    if (!new_hash)
+        return -1;
+    for(i = 0; i < (1 << hp->site_hash_bits); i++) {
+        for(e = hp->site_hash[i]; e != NULL; e = e_next) {
+            e_next = e->hash_next;
+            h = e->hash & ((1 << new_bits) - 1);
+            e->hash_next = new_hash[h];
+            new_hash[h] = e;
+        }
+    }
+    js_free_rt(rt, hp->site_hash);
+    hp->site_hash = new_hash;
+    hp->site_hash_bits = new_bits;
+    return 0;
+}
+
+static void js_heap_profile_put_frame(DynBuf *dbuf, const char *str)
+{
+    /* ';' is the frame separator */
+    for(; *str != '\0'; str++)
+        dbuf_putc(dbuf, *str == ';' ? ',' : *str);
+}
+
+/* Build the call stack of the current frame. The PC of the bytecode
+   functions is saved before the calls and the opcodes allocating
+   objects, closures and strings. */
+static void js_heap_profile_get_stack(JSRuntime *rt, DynBuf *dbuf)
+{
+    JSStackFrame *frames[JS_HEAP_PROFILE_MAX_DEPTH], *sf;
+    char buf[ATOM_GET_STR_BUF_SIZE];
+    const char *str;
+    JSObject *p;
+    JSProperty *pr;
+    JSShapeProperty *prs;
+    int n, i, line_num;
+
+    n = 0;
+    for(sf = rt->current_stack_frame;
+        sf != NULL && n < JS_HEAP_PROFILE_MAX_DEPTH; sf = sf->prev_frame) {
+        if (JS_VALUE_GET_TAG(sf->cur_func) == JS_TAG_OBJECT)
+            frames[n++] = sf;
+    }
+    if (n == 0) {
+        dbuf_putstr(dbuf, "<host>");
+        return;
+    }
+    for(i = n - 1; i >= 0; i--) {
+        sf = frames[i];
+        p = JS_VALUE_GET_OBJ(sf->cur_func);
+        if (js_class_has_bytecode(p->class_id)) {
+            JSFunctionBytecode *b = p->u.func.function_bytecode;
+            if (b->func_name == JS_ATOM_NULL)
+                str = "<anonymous>";
+            else
+                str = JS_AtomGetStrRT(rt, buf, sizeof(buf), b->func_name);
+            js_heap_profile_put_frame(dbuf, str);
+            if (b->has_debug) {
+                line_num = -1;
+                /* no PC is saved before the first instruction */
+                if (sf->cur_pc > b->byte_code_buf) {
+                    line_num = find_line_num(b->realm, b,
+                                             sf->cur_pc - b->byte_code_buf - 1);
+                }
+                if (line_num < 0)
+                    line_num = b->debug.line_num;
+                dbuf_putstr(dbuf, " (");
+                js_heap_profile_put_frame(dbuf,
+                                          JS_AtomGetStrRT(rt, buf, sizeof(buf),
+                                                          b->debug.filename));
+                dbuf_printf(dbuf, ":%d)", line_num);
+            }
+        } else {
+            /* only look at the own data property to avoid running JS code */
+            str = "<anonymous>";
+            prs = find_own_property(&pr, p, JS_ATOM_name);
+            if (prs && (prs->flags & JS_PROP_TMASK) == JS_PROP_NORMAL &&
+                tag_is_string(JS_VALUE_GET_TAG(pr->u.value))) {
+                str = js_string_value_get_str_rt(pr->u.value, buf, sizeof(buf));
+            }
+            js_heap_profile_put_frame(dbuf, str);
+            dbuf_putstr(dbuf, " (native)");
+        }
+        if (i != 0)
+            dbuf_putc(dbuf, ';');
+    }
+}
+
+static JSHeapProfileSite *js_heap_profile_get_site(JSRuntime *rt,
+                                                   JSHeapProfile *hp)
+{
+    JSHeapProfileSite *site;
+    DynBuf dbuf;
+    uint32_t h;
+    size_t i;
+
+    dbuf_init2(&dbuf, rt, (DynBufReallocFunc *)js_realloc_rt);
+    js_heap_profile_get_stack(rt, &dbuf);
+    if (dbuf_putc(&dbuf, '\0'))
+        goto fail;
+    h = 0;
+    for(i = 0; i < dbuf.size; i++)
+        h = h * 263 + dbuf.buf[i];
+    for(site = hp->site_hash[h & ((1 << hp->site_hash_bits) - 1)];
+        site != NULL; site = site->hash_next) {
+        if (site->hash == h && !strcmp(site->stack, (char *)dbuf.buf))
+            goto done;
+    }
+    if (hp->site_count >= (1 << hp->site_hash_bits) &&
+        js_heap_profile_resize_sites(rt, hp))
+        goto fail;
+    site = js_mallocz_rt(rt, sizeof(*site) + dbuf.size);
+    if (!site)
+        goto fail;
+    site->hash = h;
+    memcpy(site->stack, dbuf.buf, dbuf.size);
+    h &= (1 << hp->site_hash_bits) - 1;
+    site->hash_next = hp->site_hash[h];
+    hp->site_hash[h] = site;
+    hp->site_count++;
+ done:
+    dbuf_free(&dbuf);
+    return site;
+ fail:
+    dbuf_free(&dbuf);
+    return NULL;
+}
+
+static void js_heap_profile_alloc(JSRuntime *rt, void *ptr, size_t size)
+{
+    JSHeapProfile *hp = rt->heap_profile;
+    JSHeapProfileSample *e;
+    uint32_t h;
+
+    hp->allocated += size;
+    if (hp->allocated < hp->threshold)
+        return;
+    if (hp->sample_count >= (2 << hp->sample_hash_bits) &&
+        js_heap_profile_resize_samples(rt, hp))
+        return;
+    e = js_malloc_rt(rt, sizeof(*e));
+    if (!e)
+        return;
+    e->site = js_heap_profile_get_site(rt, hp);
+    if (!e->site) {
+        js_free_rt(rt, e);
+        return;
+    }
+    e->ptr = ptr;
+    e->size = hp->allocated;
+    e->site->alloc_count++;
+    e->site->alloc_size += e->size;
+    e->site->live_count++;
+    e->site->live_size += e->size;
+    h = js_heap_profile_ptr_hash(ptr, hp->sample_hash_bits);
+    e->hash_next = hp->sample_hash[h];
+    hp->sample_hash[h] = e;
+    hp->sample_count++;
+    hp->allocated = 0;
+    js_heap_profile_next_threshold(hp);
+}
+
+/* remove the sample of 'ptr' if any */
+static JSHeapProfileSample *js_heap_profile_remove(JSHeapProfile *hp,
+                                                   void *ptr)
+{
+    JSHeapProfileSample *e, **pe;
+
+    pe = &hp->sample_hash[js_heap_profile_ptr_hash(ptr, hp->sample_hash_bits)];
+    for(;;) {
+        e = *pe;
+        if (!e)
+            return NULL;
+        if (e->ptr == ptr)
+            break;
+        pe = &e->hash_next;
+    }
+    *pe = e->hash_next;
+    hp->sample_count--;
+    e->site->live_count--;
+    e->site->live_size -= e->size;
+    return e;
+}
+
+static void js_heap_profile_free(JSRuntime *rt, void *ptr)
+{
+    JSHeapProfileSample *e;
+
+    e = js_heap_profile_remove(rt->heap_profile, ptr);
+    if (e)
+        js_free_rt(rt, e);
+}
+
+/* undo js_heap_profile_alloc() for a block which is not yet visible
+   to the program */
+static void js_heap_profile_cancel(JSRuntime *rt, void *ptr, size_t size)
+{
+    JSHeapProfile *hp = rt->heap_profile;
+    JSHeapProfileSample *e;
+
+    e = js_heap_profile_remove(hp, ptr);
+    if (e) {
+        e->site->alloc_count--;
+        e->site->alloc_size -= e->size;
+        hp->allocated = e->size;
+        js_free_rt(rt, e);
+    }
+    hp->allocated = max_int64(hp->allocated - size, 0);
+}
+
+static void js_heap_profile_free_all(JSRuntime *rt, JSHeapProfile *hp)
+{
+    JSHeapProfileSample *e, *e_next;
+    JSHeapProfileSite *site, *site_next;
+    int i;
+
+    for(i = 0; i < (1 << hp->sample_hash_bits); i++) {
+        for(e = hp->sample_hash[i]; e != NULL; e = e_next) {
+            e_next = e->hash_next;
+            js_free_rt(rt, e);
+        }
+    }
+    for(i = 0; i < (1 << hp->site_hash_bits); i++) {
+        for(site = hp->site_hash[i]; site != NULL; site = site_next) {
+            site_next = site->hash_next;
+            js_free_rt(rt, site);
+        }
+    }
+    js_free_rt(rt, hp->sample_hash);
+    js_free_rt(rt, hp->site_hash);
+    js_free_rt(rt, hp);
+}
+
+int JS_SetHeapProfile(JSRuntime *rt, size_t interval)
+{
+    JSHeapProfile *hp;
+
+    if (rt->heap_profile) {
+        js_heap_profile_free_all(rt, rt->heap_profile);
+        rt->heap_profile = NULL;
+    }
+    if (interval == 0)
+        return 0;
+    hp = js_mallocz_rt(rt, sizeof(*hp));
+    if (!hp)
+        return -1;
+    hp->interval = interval;
+    hp->random_state = 0x2545F4914F6CDD1D;
+    hp->site_hash_bits = 8;
+    hp->site_hash = js_mallocz_rt(rt, sizeof(hp->site_hash[0]) <<
+                                  hp->site_hash_bits);
+    hp->sample_hash_bits = 10;
+    hp->sample_hash = js_mallocz_rt(rt, sizeof(hp->sample_hash[0]) <<
+                                    hp->sample_hash_bits);
+    if (!hp->site_hash || !hp->sample_hash) {
+        js_heap_profile_free_all(rt, hp);
+        return -1;
+    }
+    js_heap_profile_next_threshold(hp);
+    rt->heap_profile = hp;
+    return 0;
+}
+
+void JS_DumpHeapProfile(JSRuntime *rt, FILE *fp, BOOL live)
+{
+    JSHeapProfile *hp = rt->heap_profile;
+    JSHeapProfileSite *site;
+    int64_t size;
+    int i;
+
+    if (!hp)
+        return;
+    for(i = 0; i < (1 << hp->site_hash_bits); i++) {
+        for(site = hp->site_hash[i]; site != NULL; site = site->hash_next) {
+            size = live ? site->live_size : site->alloc_size;
+            if (size > 0)
+                fprintf(fp, "%s %"PRId64"\n", site->stack, size);
+        }
+    }
+}
+
 /* Note: it is important that no exception is returned by this function */
 static BOOL is_backtrace_needed(JSContext *ctx, JSValueConst obj)
 {
@@ -6599,7 +9526,7 @@ static JSValue JS_ThrowError(JSContext *ctx, JSErrorEnum error_num,
 
     /* the backtrace is added later if called from a bytecode function */
     sf = rt->current_stack_frame;
-    add_backtrace = !rt->in_out_of_memory &&
+    add_backtrace = (!rt->in_out_of_memory || rt->out_of_memory_backtrace) &&
         (!sf || (JS_GetFunctionBytecode(sf->cur_func) == NULL));
     return JS_ThrowError2(ctx, error_num, fmt, ap, add_backtrace);
 }
@@ -6711,7 +9638,19 @@ JSValue JS_ThrowOutOfMemory(JSContext *ctx)
     JSRuntime *rt = ctx->rt;
     if (!rt->in_out_of_memory) {
         rt->in_out_of_memory = TRUE;
+        if (rt->account_limit_hit) {
+            /* only a context quota is exceeded: the runtime memory
+               is available */
+            rt->account_over_limit = rt->account_limit_hit;
+            rt->account_limit_hit = NULL;
+            rt->out_of_memory_backtrace = TRUE;
+        } else {
+            /* the reserve may not have been allocated again since
+               the previous out of memory error */
+            rt->out_of_memory_backtrace = js_release_memory_reserve(rt);
+        }
         JS_ThrowInternalError(ctx, "out of memory");
+        rt->out_of_memory_backtrace = FALSE;
         rt->in_out_of_memory = FALSE;
     }
     return JS_EXCEPTION;
@@ -6894,6 +9833,7 @@ static JSValueConst JS_GetPrototypePrimitive(JSContext *ctx, JSValueConst val)
         val = ctx->class_proto[JS_CLASS_BOOLEAN];
         break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         val = ctx->class_proto[JS_CLASS_STRING];
         break;
     case JS_TAG_SYMBOL:
@@ -7071,9 +10011,11 @@ static int JS_AutoInitProperty(JSContext *ctx, JSObject *p, JSAtom prop,
     return 0;
 }
 
-JSValue JS_GetPropertyInternal(JSContext *ctx, JSValueConst obj,
-                               JSAtom prop, JSValueConst this_obj,
-                               BOOL throw_ref_error)
+/* same as JS_GetPropertyInternal() but a rope value is returned as
+   is */
+static JSValue JS_GetPropertyInternal2(JSContext *ctx, JSValueConst obj,
+                                       JSAtom prop, JSValueConst this_obj,
+                                       BOOL throw_ref_error)
 {
     JSObject *p;
     JSProperty *pr;
@@ -7107,6 +10049,27 @@ JSValue JS_GetPropertyInternal(JSContext *ctx, JSValueConst obj,
                 }
             }
             break;
+        case JS_TAG_STRING_ROPE:
+            {
+                JSStringRope *r = JS_VALUE_GET_PTR(obj);
+                if (__JS_AtomIsTaggedInt(prop) && r->depth == 0) {
+                    /* read the character in the parent string of the slice */
+                    uint32_t idx = __JS_AtomToUInt32(prop);
+                    if (idx < r->len) {
+                        return js_new_string_char(ctx,
+                            string_get(JS_VALUE_GET_STRING(r->left), r->start + idx));
+                    }
+                } else if (__JS_AtomIsTaggedInt(prop)) {
+                    JSString *p1 = js_string_rope_flatten(ctx, obj);
+                    if (!p1)
+                        return JS_EXCEPTION;
+                    return JS_GetPropertyInternal2(ctx, JS_MKPTR(JS_TAG_STRING, p1),
+                                                  prop, this_obj, throw_ref_error);
+                } else if (prop == JS_ATOM_length) {
+                    return JS_NewInt32(ctx, r->len);
+                }
+            }
+            break;
         default:
             break;
         }
@@ -7217,6 +10180,21 @@ JSValue JS_GetPropertyInternal(JSContext *ctx, JSValueConst obj,
     }
 }
 
+JSValue JS_GetPropertyInternal(JSContext *ctx, JSValueConst obj,
+                               JSAtom prop, JSValueConst this_obj,
+                               BOOL throw_ref_error)
+{
+    return js_string_rope_flatten_free(ctx,
+        JS_GetPropertyInternal2(ctx, obj, prop, this_obj, throw_ref_error));
+}
+
+/* used by the interpreter: a rope value is returned as is */
+static inline JSValue js_get_property(JSContext *ctx, JSValueConst obj,
+                                      JSAtom prop)
+{
+    return JS_GetPropertyInternal2(ctx, obj, prop, obj, FALSE);
+}
+
 static JSValue JS_ThrowTypeErrorPrivateNotFound(JSContext *ctx, JSAtom atom)
 {
     return JS_ThrowTypeErrorAtom(ctx, "private class field '%s' does not exist",
@@ -7731,11 +10709,21 @@ retry:
 int JS_GetOwnProperty(JSContext *ctx, JSPropertyDescriptor *desc,
                       JSValueConst obj, JSAtom prop)
 {
+    int ret;
+
     if (JS_VALUE_GET_TAG(obj) != JS_TAG_OBJECT) {
         JS_ThrowTypeErrorNotAnObject(ctx);
         return -1;
     }
-    return JS_GetOwnPropertyInternal(ctx, desc, JS_VALUE_GET_OBJ(obj), prop);
+    ret = JS_GetOwnPropertyInternal(ctx, desc, JS_VALUE_GET_OBJ(obj), prop);
+    if (ret > 0 && desc) {
+        desc->value = js_string_rope_flatten_free(ctx, desc->value);
+        if (JS_IsException(desc->value)) {
+            js_free_desc(ctx, desc);
+            return -1;
+        }
+    }
+    return ret;
 }
 
 /* return -1 if exception (Proxy object only) or TRUE/FALSE */
@@ -7895,7 +10883,7 @@ static JSValue JS_GetPropertyValue(JSContext *ctx, JSValueConst this_obj,
         JS_FreeValue(ctx, prop);
         if (unlikely(atom == JS_ATOM_NULL))
             return JS_EXCEPTION;
-        ret = JS_GetProperty(ctx, this_obj, atom);
+        ret = js_get_property(ctx, this_obj, atom);
         JS_FreeAtom(ctx, atom);
         return ret;
     }
@@ -7904,7 +10892,8 @@ static JSValue JS_GetPropertyValue(JSContext *ctx, JSValueConst this_obj,
 JSValue JS_GetPropertyUint32(JSContext *ctx, JSValueConst this_obj,
                              uint32_t idx)
 {
-    return JS_GetPropertyValue(ctx, this_obj, JS_NewUint32(ctx, idx));
+    return js_string_rope_flatten_free(ctx,
+        JS_GetPropertyValue(ctx, this_obj, JS_NewUint32(ctx, idx)));
 }
 
 /* Check if an object has a generalized numeric property. Return value:
@@ -7980,6 +10969,8 @@ static JSProperty *add_property(JSContext *ctx,
     JSShape *sh, *new_sh;
 
     sh = p->shape;
+    if (unlikely(sh->is_watched))
+        ctx->rt->proto_epoch++;
     if (sh->is_hashed) {
         /* try to find an existing shape */
         new_sh = find_hashed_shape_prop(ctx->rt, sh, prop, prop_flags);
@@ -7988,8 +10979,10 @@ static JSProperty *add_property(JSContext *ctx,
             /*  the property array may need to be resized */
             if (new_sh->prop_size != sh->prop_size) {
                 JSProperty *new_prop;
-                new_prop = js_realloc(ctx, p->prop, sizeof(p->prop[0]) *
-                                      new_sh->prop_size);
+                new_prop = js_slab_realloc(ctx, p->prop,
+                                           sizeof(p->prop[0]) * sh->prop_size,
+                                           sizeof(p->prop[0]) *
+                                           new_sh->prop_size);
                 if (!new_prop)
                     return NULL;
                 p->prop = new_prop;
@@ -8327,6 +11320,11 @@ static int JS_SetPropertyGeneric(JSContext *ctx,
         if (p->is_exotic) {
             const JSClassExoticMethods *em = ctx->rt->class_array[p->class_id].exotic;
             if (em && em->set_property) {
+                val = js_string_rope_flatten_free(ctx, val);
+                if (JS_IsException(val)) {
+                    JS_FreeValue(ctx, obj1);
+                    return -1;
+                }
                 ret = em->set_property(ctx, obj1, prop,
                                        val, this_obj, flags);
                 JS_FreeValue(ctx, obj1);
@@ -8521,6 +11519,9 @@ retry:
                 if (em) {
                     JSValue obj1;
                     if (em->set_property) {
+                        val = js_string_rope_flatten_free(ctx, val);
+                        if (JS_IsException(val))
+                            return -1;
                         /* set_property can free the prototype */
                         obj1 = JS_DupValue(ctx, JS_MKPTR(JS_TAG_OBJECT, p1));
                         ret = em->set_property(ctx, obj1, prop,
@@ -8888,6 +11889,11 @@ static int JS_CreateProperty(JSContext *ctx, JSObject *p,
             const JSClassExoticMethods *em = ctx->rt->class_array[p->class_id].exotic;
             if (em) {
                 if (em->define_own_property) {
+                    if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING_ROPE) {
+                        val = js_string_rope_get_flat(ctx, val);
+                        if (JS_IsException(val))
+                            return -1;
+                    }
                     return em->define_own_property(ctx, JS_MKPTR(JS_TAG_OBJECT, p),
                                                    prop, val, getter, setter, flags);
                 }
@@ -8975,6 +11981,8 @@ static int js_shape_prepare_update(JSContext *ctx, JSObject *p,
     uint32_t idx = 0;    /* prevent warning */
 
     sh = p->shape;
+    if (unlikely(sh->is_watched))
+        ctx->rt->proto_epoch++;
     if (sh->is_hashed) {
         if (sh->header.ref_count != 1) {
             if (pprs)
@@ -9563,7 +12571,7 @@ static JSValue JS_GetGlobalVar(JSContext *ctx, JSAtom prop,
             return JS_ThrowReferenceErrorUninitialized(ctx, prs->atom);
         return JS_DupValue(ctx, pr->u.value);
     }
-    return JS_GetPropertyInternal(ctx, ctx->global_obj, prop,
+    return JS_GetPropertyInternal2(ctx, ctx->global_obj, prop,
                                  ctx->global_obj, throw_ref_error);
 }
 
@@ -9935,6 +12943,10 @@ static int JS_ToBoolFree(JSContext *ctx, JSValue val)
             JS_FreeValue(ctx, val);
             return ret;
         }
+    case JS_TAG_STRING_ROPE:
+        /* a rope is never empty */
+        JS_FreeValue(ctx, val);
+        return TRUE;
 #ifdef CONFIG_BIGNUM
     case JS_TAG_BIG_INT:
     case JS_TAG_BIG_FLOAT:
@@ -10456,6 +13468,7 @@ static JSValue JS_ToNumberHintFree(JSContext *ctx, JSValue val,
             return JS_EXCEPTION;
         goto redo;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         {
             const char *str;
             const char *p;
@@ -11549,6 +14562,13 @@ JSValue JS_ToStringInternal(JSContext *ctx, JSValueConst val, BOOL is_ToProperty
     switch(tag) {
     case JS_TAG_STRING:
         return JS_DupValue(ctx, val);
+    case JS_TAG_STRING_ROPE:
+        {
+            JSString *p = js_string_rope_flatten(ctx, val);
+            if (!p)
+                return JS_EXCEPTION;
+            return JS_DupValue(ctx, JS_MKPTR(JS_TAG_STRING, p));
+        }
     case JS_TAG_INT:
         snprintf(buf, sizeof(buf), "%d", JS_VALUE_GET_INT(val));
         str = buf;
@@ -11917,6 +14937,12 @@ static __maybe_unused void JS_DumpValueShort(JSRuntime *rt,
             JS_DumpString(rt, p);
         }
         break;
+    case JS_TAG_STRING_ROPE:
+        {
+            JSStringRope *r = JS_VALUE_GET_PTR(val);
+            printf("[rope len=%u]", r->len);
+        }
+        break;
     case JS_TAG_FUNCTION_BYTECODE:
         {
             JSFunctionBytecode *b = JS_VALUE_GET_PTR(val);
@@ -12192,6 +15218,7 @@ static bf_t *JS_ToBigIntFree(JSContext *ctx, bf_t *buf, JSValue val)
         JS_FreeValue(ctx, val);
         break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         val = JS_StringToBigIntErr(ctx, val);
         if (JS_IsException(val))
             return NULL;
@@ -13476,10 +16503,10 @@ static no_inline __exception int js_add_slow(JSContext *ctx, JSValue *sp)
         /* try to call an overloaded operator */
         if ((tag1 == JS_TAG_OBJECT &&
              (tag2 != JS_TAG_NULL && tag2 != JS_TAG_UNDEFINED &&
-              tag2 != JS_TAG_STRING)) ||
+              !tag_is_string(tag2))) ||
             (tag2 == JS_TAG_OBJECT &&
              (tag1 != JS_TAG_NULL && tag1 != JS_TAG_UNDEFINED &&
-              tag1 != JS_TAG_STRING))) {
+              !tag_is_string(tag1)))) {
             ret = js_call_binary_op_fallback(ctx, &res, op1, op2, OP_add,
                                              FALSE, HINT_NONE);
             if (ret != 0) {
@@ -13509,7 +16536,7 @@ static no_inline __exception int js_add_slow(JSContext *ctx, JSValue *sp)
         tag2 = JS_VALUE_GET_NORM_TAG(op2);
     }
 
-    if (tag1 == JS_TAG_STRING || tag2 == JS_TAG_STRING) {
+    if (tag_is_string(tag1) || tag_is_string(tag2)) {
         sp[-2] = JS_ConcatString(ctx, op1, op2);
         if (JS_IsException(sp[-2]))
             goto exception;
@@ -13792,6 +16819,8 @@ static no_inline int js_relational_slow(JSContext *ctx, JSValue *sp,
         JS_FreeValue(ctx, op1);
         goto exception;
     }
+    if (js_string_rope_flatten2(ctx, &op1, &op2))
+        goto exception;
     tag1 = JS_VALUE_GET_NORM_TAG(op1);
     tag2 = JS_VALUE_GET_NORM_TAG(op2);
 
@@ -13928,6 +16957,11 @@ static no_inline __exception int js_eq_slow(JSContext *ctx, JSValue *sp,
  redo:
     tag1 = JS_VALUE_GET_NORM_TAG(op1);
     tag2 = JS_VALUE_GET_NORM_TAG(op2);
+    if (unlikely(tag1 == JS_TAG_STRING_ROPE || tag2 == JS_TAG_STRING_ROPE)) {
+        if (js_string_rope_flatten2(ctx, &op1, &op2))
+            goto exception;
+        goto redo;
+    }
     if (tag_is_number(tag1) && tag_is_number(tag2)) {
         if (tag1 == JS_TAG_INT && tag2 == JS_TAG_INT) {
             res = JS_VALUE_GET_INT(op1) == JS_VALUE_GET_INT(op2);
@@ -14308,7 +17342,7 @@ static no_inline __exception int js_add_slow(JSContext *ctx, JSValue *sp)
         }
         tag1 = JS_VALUE_GET_TAG(op1);
         tag2 = JS_VALUE_GET_TAG(op2);
-        if (tag1 == JS_TAG_STRING || tag2 == JS_TAG_STRING) {
+        if (tag_is_string(tag1) || tag_is_string(tag2)) {
             sp[-2] = JS_ConcatString(ctx, op1, op2);
             if (JS_IsException(sp[-2]))
                 goto exception;
@@ -14403,6 +17437,8 @@ static no_inline int js_relational_slow(JSContext *ctx, JSValue *sp,
         JS_FreeValue(ctx, op1);
         goto exception;
     }
+    if (js_string_rope_flatten2(ctx, &op1, &op2))
+        goto exception;
     if (JS_VALUE_GET_TAG(op1) == JS_TAG_STRING &&
         JS_VALUE_GET_TAG(op2) == JS_TAG_STRING) {
         JSString *p1, *p2;
@@ -14470,6 +17506,11 @@ static no_inline __exception int js_eq_slow(JSContext *ctx, JSValue *sp,
  redo:
     tag1 = JS_VALUE_GET_NORM_TAG(op1);
     tag2 = JS_VALUE_GET_NORM_TAG(op2);
+    if (unlikely(tag1 == JS_TAG_STRING_ROPE || tag2 == JS_TAG_STRING_ROPE)) {
+        if (js_string_rope_flatten2(ctx, &op1, &op2))
+            goto exception;
+        goto redo;
+    }
     if (tag1 == tag2 ||
         (tag1 == JS_TAG_INT && tag2 == JS_TAG_FLOAT64) ||
         (tag2 == JS_TAG_INT && tag1 == JS_TAG_FLOAT64)) {
@@ -14581,14 +17622,19 @@ static BOOL js_strict_eq2(JSContext *ctx, JSValue op1, JSValue op2,
         res = (tag1 == tag2);
         break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         {
             JSString *p1, *p2;
-            if (tag1 != tag2) {
+            if (!tag_is_string(tag2)) {
                 res = FALSE;
-            } else {
+            } else if (tag1 == JS_TAG_STRING && tag2 == JS_TAG_STRING) {
                 p1 = JS_VALUE_GET_STRING(op1);
                 p2 = JS_VALUE_GET_STRING(op2);
                 res = (js_string_compare(ctx, p1, p2) == 0);
+            } else if (js_string_value_len(op1) != js_string_value_len(op2)) {
+                res = FALSE;
+            } else {
+                res = (js_string_rope_compare(op1, op2) == 0);
             }
         }
         break;
@@ -14833,6 +17879,7 @@ static __exception int js_operator_typeof(JSContext *ctx, JSValueConst op1)
         atom = JS_ATOM_boolean;
         break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         atom = JS_ATOM_string;
         break;
     case JS_TAG_OBJECT:
@@ -15729,7 +18776,7 @@ static JSVarRef *get_var_ref(JSContext *ctx, JSStackFrame *sf,
         }
     }
     /* create a new one */
-    var_ref = js_malloc(ctx, sizeof(JSVarRef));
+    var_ref = js_slab_alloc(ctx, sizeof(JSVarRef));
     if (!var_ref)
         return NULL;
     var_ref->header.ref_count = 1;
@@ -16007,6 +19054,32 @@ static void close_lexical_var(JSContext *ctx, JSStackFrame *sf, int idx, int is_
 #define JS_CALL_FLAG_COPY_ARGV   (1 << 1)
 #define JS_CALL_FLAG_GENERATOR   (1 << 2)
 
+/* The functions implemented in C only see flat strings: call
+   'call_func' with the ropes of 'this_obj' and 'argv' replaced by their
+   flat string. */
+static JSValue js_call_class_flat(JSContext *ctx, JSClassCall *call_func,
+                                  JSValueConst func_obj,
+                                  JSValueConst this_obj,
+                                  int argc, JSValueConst *argv, int flags)
+{
+    JSValueConst *arg_buf;
+
+    if (unlikely(JS_VALUE_GET_TAG(this_obj) == JS_TAG_STRING_ROPE)) {
+        this_obj = js_string_rope_get_flat(ctx, this_obj);
+        if (JS_IsException(this_obj))
+            return JS_EXCEPTION;
+    }
+    if (unlikely(js_has_string_rope(argc, argv))) {
+        if (js_check_stack_overflow(ctx->rt, sizeof(arg_buf[0]) * argc))
+            return JS_ThrowStackOverflow(ctx);
+        arg_buf = alloca(sizeof(arg_buf[0]) * argc);
+        if (js_get_flat_args(ctx, arg_buf, argc, argv))
+            return JS_EXCEPTION;
+        argv = arg_buf;
+    }
+    return call_func(ctx, func_obj, this_obj, argc, argv, flags);
+}
+
 static JSValue js_call_c_function(JSContext *ctx, JSValueConst func_obj,
                                   JSValueConst this_obj,
                                   int argc, JSValueConst *argv, int flags)
@@ -16179,6 +19252,172 @@ static JSValue js_call_bound_function(JSContext *ctx, JSValueConst func_obj,
     }
 }
 
+/* return the property index or -1 if 'sh' is not in the cache */
+static inline int js_ic_find(const JSInlineCache *ic, const JSShape *sh)
+{
+    int i;
+    /* the unused entries are NULL */
+    for(i = 0; i < JS_IC_SIZE; i++) {
+        if (ic->shapes[i] == sh)
+            return ic->prop_idx[i];
+    }
+    return -1;
+}
+
+/* 'holder' is the object containing the property if it is not 'sh' */
+static void js_ic_add(JSRuntime *rt, JSInlineCache *ic, JSShape *sh,
+                      JSObject *holder, JSShapeProperty *prs)
+{
+    int i, j;
+
+    if (holder && ic->proto_epoch != rt->proto_epoch) {
+        /* remove the invalid prototype entries */
+        for(i = j = 0; i < ic->count; i++) {
+            if (ic->holders[i]) {
+                js_free_shape(rt, ic->shapes[i]);
+            } else {
+                ic->shapes[j] = ic->shapes[i];
+                ic->prop_idx[j] = ic->prop_idx[i];
+                ic->holders[j] = NULL;
+                j++;
+            }
+        }
+        for(i = j; i < ic->count; i++) {
+            ic->shapes[i] = NULL;
+            ic->holders[i] = NULL;
+        }
+        ic->count = j;
+        ic->proto_epoch = rt->proto_epoch;
+    }
+    /* the unhashed shapes can be modified in place. When the cache is
+       full, the site is considered as megamorphic and the cache is no
+       longer modified. */
+    if (!sh->is_hashed || ic->count >= JS_IC_SIZE)
+        return;
+    ic->shapes[ic->count] = js_dup_shape(sh);
+    ic->prop_idx[ic->count] = prs - get_shape_prop(holder ? holder->shape : sh);
+    ic->holders[ic->count] = holder;
+    ic->count++;
+}
+
+/* TRUE if the lookup of the non index property 'atom' in 'p' only
+   depends on its shape. The Array objects are accepted because their
+   exotic behavior only concerns the array indexes. */
+static inline BOOL js_ic_is_plain_object(JSObject *p)
+{
+    return !p->is_exotic || p->class_id == JS_CLASS_ARRAY;
+}
+
+static no_inline JSValue js_get_field_ic_miss(JSContext *ctx,
+                                              JSInlineCache *ic,
+                                              JSValueConst obj)
+{
+    JSObject *p, *p1;
+    JSShapeProperty *prs;
+    JSProperty *pr;
+
+    if (JS_VALUE_GET_TAG(obj) != JS_TAG_OBJECT)
+        goto generic;
+    p = JS_VALUE_GET_OBJ(obj);
+    prs = find_own_property(&pr, p, ic->atom);
+    if (prs) {
+        if ((prs->flags & JS_PROP_TMASK) != JS_PROP_NORMAL)
+            goto generic;
+        js_ic_add(ctx->rt, ic, p->shape, NULL, prs);
+        return JS_DupValue(ctx, pr->u.value);
+    }
+    if (__JS_AtomIsTaggedInt(ic->atom) || !js_ic_is_plain_object(p))
+        goto generic;
+    /* look for the property in the prototypes */
+    for(p1 = p->shape->proto; p1 != NULL; p1 = p1->shape->proto) {
+        if (!js_ic_is_plain_object(p1))
+            break;
+        prs = find_own_property(&pr, p1, ic->atom);
+        if (prs) {
+            JSObject *p2;
+            if ((prs->flags & JS_PROP_TMASK) != JS_PROP_NORMAL)
+                break;
+            /* any change of the prototypes up to the holder
+               invalidates the entry */
+            for(p2 = p->shape->proto; p2 != p1; p2 = p2->shape->proto)
+                p2->shape->is_watched = TRUE;
+            p1->shape->is_watched = TRUE;
+            js_ic_add(ctx->rt, ic, p->shape, p1, prs);
+            return JS_DupValue(ctx, pr->u.value);
+        }
+    }
+ generic:
+    return JS_GetProperty(ctx, obj, ic->atom);
+}
+
+/* same as JS_GetProperty(ctx, obj, ic->atom) */
+static inline JSValue js_get_field_ic(JSContext *ctx, JSInlineCache *ic,
+                                      JSValueConst obj)
+{
+    JSObject *p, *holder;
+    JSShape *sh;
+    int i;
+
+    if (likely(JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT)) {
+        p = JS_VALUE_GET_OBJ(obj);
+        sh = p->shape;
+        /* the unused entries are NULL */
+        for(i = 0; i < JS_IC_SIZE; i++) {
+            if (ic->shapes[i] == sh) {
+                holder = ic->holders[i];
+                if (likely(!holder))
+                    return JS_DupValue(ctx, p->prop[ic->prop_idx[i]].u.value);
+                if (likely(ic->proto_epoch == ctx->rt->proto_epoch &&
+                           js_ic_is_plain_object(p)))
+                    return JS_DupValue(ctx, holder->prop[ic->prop_idx[i]].u.value);
+                break;
+            }
+        }
+    }
+    return js_get_field_ic_miss(ctx, ic, obj);
+}
+
+static no_inline int js_put_field_ic_miss(JSContext *ctx, JSInlineCache *ic,
+                                          JSValueConst obj, JSValue val)
+{
+    JSObject *p;
+    JSShapeProperty *prs;
+    JSProperty *pr;
+
+    if (JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT) {
+        p = JS_VALUE_GET_OBJ(obj);
+        prs = find_own_property(&pr, p, ic->atom);
+        /* same fast case as JS_SetPropertyInternal() */
+        if (prs && (prs->flags & (JS_PROP_TMASK | JS_PROP_WRITABLE |
+                                  JS_PROP_LENGTH)) == JS_PROP_WRITABLE) {
+            js_ic_add(ctx->rt, ic, p->shape, NULL, prs);
+            set_value(ctx, &pr->u.value, val);
+            return TRUE;
+        }
+    }
+    return JS_SetPropertyInternal(ctx, obj, ic->atom, val,
+                                  JS_PROP_THROW_STRICT);
+}
+
+/* same as JS_SetPropertyInternal(ctx, obj, ic->atom, val,
+   JS_PROP_THROW_STRICT) */
+static inline int js_put_field_ic(JSContext *ctx, JSInlineCache *ic,
+                                  JSValueConst obj, JSValue val)
+{
+    JSObject *p;
+    int idx;
+
+    if (likely(JS_VALUE_GET_TAG(obj) == JS_TAG_OBJECT)) {
+        p = JS_VALUE_GET_OBJ(obj);
+        idx = js_ic_find(ic, p->shape);
+        if (likely(idx >= 0)) {
+            set_value(ctx, &p->prop[idx].u.value, val);
+            return TRUE;
+        }
+    }
+    return js_put_field_ic_miss(ctx, ic, obj, val);
+}
+
 /* argument of OP_special_object */
 typedef enum {
     OP_SPECIAL_OBJECT_ARGUMENTS,
@@ -16194,6 +19433,506 @@ typedef enum {
 #define FUNC_RET_YIELD      1
 #define FUNC_RET_YIELD_STAR 2
 
+/* return the bytecode of a function object, of a compiled function
+   or of a module, or NULL */
+static JSFunctionBytecode *js_get_bytecode(JSValueConst obj)
+{
+    JSObject *p;
+
+    if (JS_VALUE_GET_TAG(obj) == JS_TAG_MODULE) {
+        JSModuleDef *m = JS_VALUE_GET_PTR(obj);
+        obj = m->func_obj;
+    }
+    switch(JS_VALUE_GET_TAG(obj)) {
+    case JS_TAG_FUNCTION_BYTECODE:
+        return JS_VALUE_GET_PTR(obj);
+    case JS_TAG_OBJECT:
+        p = JS_VALUE_GET_OBJ(obj);
+        if (p->class_id != JS_CLASS_BYTECODE_FUNCTION)
+            return NULL;
+        return p->u.func.function_bytecode;
+    default:
+        return NULL;
+    }
+}
+
+/* the native code does not support the generators, the async
+   functions and the 'use math' mode */
+static BOOL js_native_code_supported(JSFunctionBytecode *b)
+{
+    return b->func_kind == JS_FUNC_NORMAL && !(b->js_mode & JS_MODE_MATH);
+}
+
+int JS_SetNativeCode(JSContext *ctx, JSValueConst func_obj,
+                     JSNativeCodeFunc *code)
+{
+    JSFunctionBytecode *b = js_get_bytecode(func_obj);
+    if (!b || !js_native_code_supported(b))
+        return -1;
+    b->native_code = code;
+    b->native_no_entry = 0;
+    return 0;
+}
+
+static int js_set_native_code_table(JSFunctionBytecode *b,
+                                    JSNativeCodeFunc * const *tab,
+                                    int count, int idx)
+{
+    int i;
+
+    if (idx >= count)
+        return -1;
+    if (tab[idx] && js_native_code_supported(b)) {
+        b->native_code = tab[idx];
+        b->native_no_entry = 0;
+    }
+    idx++;
+    for(i = 0; i < b->cpool_count; i++) {
+        if (JS_VALUE_GET_TAG(b->cpool[i]) == JS_TAG_FUNCTION_BYTECODE) {
+            idx = js_set_native_code_table(JS_VALUE_GET_PTR(b->cpool[i]),
+                                           tab, count, idx);
+            if (idx < 0)
+                return -1;
+        }
+    }
+    return idx;
+}
+
+int JS_SetNativeCodeTable(JSContext *ctx, JSValueConst obj,
+                          JSNativeCodeFunc * const *tab, int count)
+{
+    JSFunctionBytecode *b = js_get_bytecode(obj);
+    if (!b || js_set_native_code_table(b, tab, count, 0) != count) {
+        JS_ThrowTypeError(ctx, "native code table does not match the bytecode");
+        return -1;
+    }
+    return 0;
+}
+
+int JS_GetBytecodeInfo(JSContext *ctx, JSValueConst func_obj,
+                       JSBytecodeInfo *info)
+{
+    JSFunctionBytecode *b = js_get_bytecode(func_obj);
+    if (!b)
+        return -1;
+    info->byte_code = b->byte_code_buf;
+    info->byte_code_len = b->byte_code_len;
+    info->arg_count = b->arg_count;
+    info->var_count = b->var_count;
+    info->stack_size = b->stack_size;
+    info->cpool = b->cpool;
+    info->cpool_count = b->cpool_count;
+    info->native_code_supported = js_native_code_supported(b);
+    return 0;
+}
+
+int JS_GetBytecodeStackLevels(JSContext *ctx, JSValueConst func_obj,
+                              uint16_t *stack_levels)
+{
+    JSFunctionBytecode *b = js_get_bytecode(func_obj);
+    int stack_size;
+    if (!b)
+        return -1;
+    return compute_stack_levels(ctx, b->byte_code_buf, b->byte_code_len,
+                                stack_levels, &stack_size);
+}
+
+/* Native code used to count the calls and the loop iterations of a
+   function until it is compiled. */
+static int js_native_code_counter(JSContext *ctx, JSNativeCodeFrame *nf)
+{
+    JSRuntime *rt = ctx->rt;
+    JSValueConst func_obj = rt->current_stack_frame->cur_func;
+    JSFunctionBytecode *b;
+    JSNativeCodeFunc *code;
+
+    b = JS_VALUE_GET_OBJ(func_obj)->u.func.function_bytecode;
+    if (unlikely(!rt->compile_func)) {
+        /* the compile function was removed */
+        b->native_code = NULL;
+        return JS_NATIVE_CODE_BAILOUT;
+    }
+    if (++b->call_count < rt->compile_threshold)
+        return JS_NATIVE_CODE_BAILOUT;
+    /* the function is compiled only once */
+    b->native_code = NULL;
+    code = rt->compile_func(ctx, func_obj, rt->compile_opaque);
+    if (!code)
+        return JS_NATIVE_CODE_BAILOUT;
+    b->native_code = code;
+    b->native_no_entry = 0;
+    return code(ctx, nf);
+}
+
+static void js_init_native_code(JSRuntime *rt, JSFunctionBytecode *b)
+{
+    if (rt->compile_func && js_native_code_supported(b))
+        b->native_code = js_native_code_counter;
+}
+
+/* run the native code of 'b' from 'pc' with the frame 'nf'. Return
+   JS_NATIVE_CODE_BAILOUT, JS_NATIVE_CODE_RETURN or -1 if exception */
+static int js_call_native_code(JSContext *ctx, JSFunctionBytecode *b,
+                               JSNativeCodeFrame *nf, JSValue *arg_buf,
+                               JSValue *var_buf, JSValue *sp,
+                               const uint8_t *pc)
+{
+    JSNativeCodeFunc *code = b->native_code;
+    uint32_t pos = pc - b->byte_code_buf;
+    int ret;
+
+    nf->sp = sp;
+    nf->pc = pos;
+    /* do not enter again the native code at a position where it
+       immediately bailed out, such as a loop it does not handle */
+    if (pos + 1 == b->native_no_entry)
+        return JS_NATIVE_CODE_BAILOUT;
+    nf->arg_buf = arg_buf;
+    nf->var_buf = var_buf;
+    nf->stack_buf = var_buf + b->var_count;
+    nf->cpool = b->cpool;
+    nf->interrupt_counter = &ctx->interrupt_counter;
+    ret = code(ctx, nf);
+    if (ret == JS_NATIVE_CODE_BAILOUT) {
+        if (nf->pc == pos && nf->sp == sp &&
+            code != js_native_code_counter)
+            b->native_no_entry = pos + 1;
+        if (unlikely(ctx->interrupt_counter <= 0)) {
+            if (__js_poll_interrupts(ctx))
+                return -1;
+        }
+    }
+    return ret;
+}
+
+/* number of times the quickened opcodes of a function may be
+   rewritten back to the generic ones before quickening is disabled in
+   it, so that polymorphic sites do not keep rewriting the bytecode */
+#define JS_QUICKEN_MISS_MAX 7
+
+static inline BOOL js_can_quicken(JSFunctionBytecode *b)
+{
+    return !b->read_only_bytecode &&
+        b->quicken_miss_count < JS_QUICKEN_MISS_MAX;
+}
+
+/* rewrite the opcode at 'pc' to its generic form 'op' */
+static no_inline void js_dequicken(JSFunctionBytecode *b, const uint8_t *pc,
+                                   int op)
+{
+    *(uint8_t *)pc = op;
+    /* saturate so that the sites quickened before the limit was
+       reached do not enable the quickening again */
+    if (b->quicken_miss_count < JS_QUICKEN_MISS_MAX)
+        b->quicken_miss_count++;
+}
+
+/* return the generic opcode of a quickened opcode */
+static int js_generic_opcode(int op)
+{
+    switch(op) {
+    case OP_add_float:
+    case OP_add_string:
+        return OP_add;
+    case OP_mul_float:
+        return OP_mul;
+    case OP_add_loc_float:
+        return OP_add_loc;
+    default:
+        return op;
+    }
+}
+
+/* update rt->frame_start and rt->frame_end after a change of the
+   current frame chunk or of the maximum stack size */
+static void js_update_frame_end(JSRuntime *rt)
+{
+    JSFrameChunk *chunk = rt->frame_chunk;
+    uint8_t *end;
+
+    if (!chunk) {
+        rt->frame_start = NULL;
+        rt->frame_end = NULL;
+        return;
+    }
+    rt->frame_start = chunk->prev_chunk ? (uint8_t *)chunk->buf : NULL;
+    end = chunk->end;
+    if (rt->stack_size != 0) {
+        if (chunk->prev_size >= rt->stack_size)
+            end = (uint8_t *)chunk->buf;
+        else if (rt->stack_size - chunk->prev_size < end - (uint8_t *)chunk->buf)
+            end = (uint8_t *)chunk->buf + rt->stack_size - chunk->prev_size;
+    }
+    rt->frame_end = end;
+}
+
+/* called when a frame of 'size' bytes does not fit before
+   rt->frame_end: throw a stack overflow if the maximum stack size is
+   reached, otherwise add a chunk to the frame stack. Return -1 if
+   error. */
+static no_inline int js_new_frame_chunk(JSContext *ctx, size_t size)
+{
+    JSRuntime *rt = ctx->rt;
+    JSFrameChunk *chunk;
+    size_t chunk_size, prev_size;
+
+    prev_size = 0;
+    if (rt->frame_chunk) {
+        prev_size = rt->frame_chunk->prev_size +
+            (rt->frame_ptr - (uint8_t *)rt->frame_chunk->buf);
+    }
+    if (rt->stack_size != 0 && prev_size + size > rt->stack_size) {
+        JS_ThrowStackOverflow(ctx);
+        return -1;
+    }
+    chunk_size = max_int(size, JS_FRAME_CHUNK_SIZE);
+    if (chunk_size == JS_FRAME_CHUNK_SIZE && rt->frame_chunk_spare) {
+        chunk = rt->frame_chunk_spare;
+        rt->frame_chunk_spare = NULL;
+    } else {
+        chunk = js_malloc(ctx, sizeof(JSFrameChunk) + chunk_size);
+        if (!chunk)
+            return -1;
+        chunk->end = (uint8_t *)chunk->buf + chunk_size;
+    }
+    chunk->prev_chunk = rt->frame_chunk;
+    chunk->prev_ptr = rt->frame_ptr;
+    chunk->prev_size = prev_size;
+    rt->frame_chunk = chunk;
+    rt->frame_ptr = (uint8_t *)chunk->buf;
+    js_update_frame_end(rt);
+    return 0;
+}
+
+/* remove the last chunk of the frame stack */
+static no_inline void js_free_frame_chunk(JSRuntime *rt)
+{
+    JSFrameChunk *chunk = rt->frame_chunk;
+
+    rt->frame_chunk = chunk->prev_chunk;
+    rt->frame_ptr = chunk->prev_ptr;
+    /* keep one chunk to avoid reallocating it at each call */
+    if (chunk->end - (uint8_t *)chunk->buf == JS_FRAME_CHUNK_SIZE &&
+        !rt->frame_chunk_spare) {
+        rt->frame_chunk_spare = chunk;
+    } else {
+        js_free_rt(rt, chunk);
+    }
+    js_update_frame_end(rt);
+}
+
+/* allocate a frame with 'local_count' values in the runtime frame
+   stack. Its size is limited by the maximum stack size. The frames
+   are freed in reverse order so that their size is not stored: it is
+   the distance to the frame stack pointer. */
+static force_inline JSInlineFrame *js_alloc_inline_frame(JSContext *ctx,
+                                                         int local_count)
+{
+    JSRuntime *rt = ctx->rt;
+    JSInlineFrame *ifr;
+    size_t size;
+
+    size = sizeof(JSInlineFrame) + sizeof(JSValue) * local_count;
+    if (unlikely(rt->frame_end - rt->frame_ptr < (ptrdiff_t)size)) {
+        if (js_new_frame_chunk(ctx, size))
+            return NULL;
+    }
+    ifr = (JSInlineFrame *)rt->frame_ptr;
+    rt->frame_ptr += size;
+    return ifr;
+}
+
+static force_inline void js_free_inline_frame(JSRuntime *rt,
+                                              JSInlineFrame *ifr)
+{
+    rt->frame_ptr = (uint8_t *)ifr;
+    if (unlikely((uint8_t *)ifr == rt->frame_start))
+        js_free_frame_chunk(rt);
+}
+
+/* return TRUE if 'func_obj' can be called with an inline frame */
+static inline BOOL js_is_inline_callable(JSValueConst func_obj)
+{
+    JSObject *p;
+    if (JS_VALUE_GET_TAG(func_obj) != JS_TAG_OBJECT)
+        return FALSE;
+    p = JS_VALUE_GET_OBJ(func_obj);
+    return p->class_id == JS_CLASS_BYTECODE_FUNCTION &&
+        p->u.func.function_bytecode->func_kind == JS_FUNC_NORMAL;
+}
+
+/* allocate and initialize the frame of a call of the bytecode
+   function sp[-argc - 1] and make it the current stack frame */
+static force_inline JSInlineFrame *js_push_inline_frame(JSContext *ctx,
+                                                     JSValue *sp, int argc,
+                                                     JSValue *ret_sp)
+{
+    JSRuntime *rt = ctx->rt;
+    JSInlineFrame *ifr;
+    JSStackFrame *sf;
+    JSObject *p;
+    JSFunctionBytecode *b;
+    JSValue *argv, *arg_buf, *var_buf;
+    int i, arg_allocated_size;
+
+    argv = sp - argc;
+    p = JS_VALUE_GET_OBJ(argv[-1]);
+    b = p->u.func.function_bytecode;
+    if (unlikely(argc < b->arg_count))
+        arg_allocated_size = b->arg_count;
+    else
+        arg_allocated_size = 0;
+    ifr = js_alloc_inline_frame(ctx, arg_allocated_size + b->var_count +
+                                b->stack_size);
+    if (unlikely(!ifr))
+        return NULL;
+    ifr->caller_ctx = ctx;
+    ifr->argc = argc;
+    ifr->argv = argv;
+    ifr->caller_sp = sp;
+    ifr->ret_sp = ret_sp;
+
+    sf = &ifr->sf;
+    sf->js_mode = b->js_mode;
+    arg_buf = argv;
+    sf->arg_count = argc;
+    sf->cur_func = JS_MKPTR(JS_TAG_OBJECT, p);
+    sf->cur_pc = b->byte_code_buf;
+    init_list_head(&sf->var_ref_list);
+    if (unlikely(arg_allocated_size)) {
+        int n = min_int(argc, b->arg_count);
+        arg_buf = ifr->buf;
+        for(i = 0; i < n; i++)
+            arg_buf[i] = JS_DupValue(ctx, argv[i]);
+        for(; i < b->arg_count; i++)
+            arg_buf[i] = JS_UNDEFINED;
+        sf->arg_count = b->arg_count;
+    }
+    var_buf = ifr->buf + arg_allocated_size;
+    sf->var_buf = var_buf;
+    sf->arg_buf = arg_buf;
+    for(i = 0; i < b->var_count; i++)
+        var_buf[i] = JS_UNDEFINED;
+    sf->prev_frame = rt->current_stack_frame;
+    rt->current_stack_frame = sf;
+    return ifr;
+}
+
+/* free the frame of a function called with js_push_inline_frame()
+   and push its return value on the caller stack. Return the new
+   caller stack pointer. */
+static force_inline JSValue *js_pop_inline_frame(JSRuntime *rt, JSInlineFrame *ifr,
+                                              JSValue ret_val)
+{
+    JSValue *sp, *ret_sp;
+
+    sp = ifr->caller_sp;
+    ret_sp = ifr->ret_sp;
+    rt->current_stack_frame = ifr->sf.prev_frame;
+    js_free_inline_frame(rt, ifr);
+    /* in case of exception, the function and its arguments are freed
+       by the caller exception handler */
+    if (unlikely(JS_IsException(ret_val) || !ret_sp))
+        return sp;
+    while (sp > ret_sp) {
+        JS_FreeValueRT(rt, *--sp);
+    }
+    *sp++ = ret_val;
+    return sp;
+}
+
+/* number of values in the tail call frame of 'b' */
+static inline int js_tail_frame_local_count(JSFunctionBytecode *b, int argc)
+{
+    return 2 + max_int(argc, b->arg_count) + b->var_count + b->stack_size;
+}
+
+/* initialize a tail call frame by moving to it the function object
+   argv[-1], 'this_obj' (argv[-2] if 'is_method') and the arguments.
+   'argv' may point inside the frame. */
+static void js_init_tail_frame(JSInlineFrame *ifr, JSValue *argv, int argc,
+                               BOOL is_method)
+{
+    JSStackFrame *sf = &ifr->sf;
+    JSFunctionBytecode *b;
+    JSValue func_obj, this_obj, *arg_buf, *var_buf;
+    int i, arg_count;
+
+    func_obj = argv[-1];
+    this_obj = is_method ? argv[-2] : JS_UNDEFINED;
+    b = JS_VALUE_GET_OBJ(func_obj)->u.func.function_bytecode;
+    arg_buf = ifr->buf + 2;
+    memmove(arg_buf, argv, sizeof(JSValue) * argc);
+    ifr->buf[0] = this_obj;
+    ifr->buf[1] = func_obj;
+    arg_count = max_int(argc, b->arg_count);
+    for(i = argc; i < arg_count; i++)
+        arg_buf[i] = JS_UNDEFINED;
+    var_buf = arg_buf + arg_count;
+    for(i = 0; i < b->var_count; i++)
+        var_buf[i] = JS_UNDEFINED;
+    /* the caller may no longer exist */
+    ifr->caller_ctx = b->realm;
+    ifr->argc = argc;
+    ifr->argv = arg_buf;
+
+    sf->js_mode = b->js_mode;
+    sf->arg_count = arg_count;
+    sf->cur_func = func_obj;
+    sf->cur_pc = b->byte_code_buf;
+    init_list_head(&sf->var_ref_list);
+    sf->arg_buf = arg_buf;
+    sf->var_buf = var_buf;
+}
+
+/* allocate a tail call frame for the call of argv[-1] and make it the
+   current stack frame. The call values are removed from the caller
+   stack, which returns the result of the call. */
+static JSInlineFrame *js_push_tail_frame(JSContext *ctx, JSValue *argv,
+                                         int argc, BOOL is_method)
+{
+    JSRuntime *rt = ctx->rt;
+    JSInlineFrame *ifr;
+    JSFunctionBytecode *b;
+
+    b = JS_VALUE_GET_OBJ(argv[-1])->u.func.function_bytecode;
+    ifr = js_alloc_inline_frame(ctx, js_tail_frame_local_count(b, argc));
+    if (unlikely(!ifr))
+        return NULL;
+    ifr->caller_sp = argv - 1 - is_method;
+    ifr->ret_sp = NULL;
+    js_init_tail_frame(ifr, argv, argc, is_method);
+    ifr->sf.prev_frame = rt->current_stack_frame;
+    rt->current_stack_frame = &ifr->sf;
+    return ifr;
+}
+
+/* replace the current frame 'ifr' by the frame of the tail call of
+   argv[-1]. Return FALSE if the new frame does not fit in place. */
+static BOOL js_reuse_inline_frame(JSContext *ctx, JSInlineFrame *ifr,
+                                  JSValue *argv, int argc, BOOL is_method)
+{
+    JSRuntime *rt = ctx->rt;
+    JSFunctionBytecode *b;
+    JSValue *pval, *call_sp;
+    size_t size;
+
+    b = JS_VALUE_GET_OBJ(argv[-1])->u.func.function_bytecode;
+    size = sizeof(JSInlineFrame) +
+        sizeof(JSValue) * js_tail_frame_local_count(b, argc);
+    if (unlikely(rt->frame_end - (uint8_t *)ifr < (ptrdiff_t)size))
+        return FALSE;
+    /* free the current frame except the call values */
+    if (unlikely(!list_empty(&ifr->sf.var_ref_list)))
+        close_var_refs(rt, &ifr->sf);
+    call_sp = argv - 1 - is_method;
+    for(pval = ifr->buf; pval < call_sp; pval++)
+        JS_FreeValueRT(rt, *pval);
+    rt->frame_ptr = (uint8_t *)ifr + size;
+    js_init_tail_frame(ifr, argv, argc, is_method);
+    return TRUE;
+}
+
 /* argv[] is modified if (flags & JS_CALL_FLAG_COPY_ARGV) = 0. */
 static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                                JSValueConst this_obj, JSValueConst new_target,
@@ -16209,12 +19948,25 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
     JSValue *local_buf, *stack_buf, *var_buf, *arg_buf, *sp, ret_val, *pval;
     JSVarRef **var_refs;
     size_t alloca_size;
+    JSStackFrame *base_sf; /* frames above it are JSInlineFrame */
 
 #if !DIRECT_DISPATCH
 #define SWITCH(pc)      switch (opcode = *pc++)
 #define CASE(op)        case op
-#define DEFAULT         default
+#define DEFAULT         default:
 #define BREAK           break
+#ifdef CONFIG_SWITCH_DISPATCH
+/* Some opcodes are nearly always followed by the same opcode
+   (e.g. a comparison followed by a conditional jump). PREDICT(op)
+   directly jumps to the code of 'op' if it is the next opcode, which
+   avoids a dispatch through the switch. XXX: only enabled for the
+   native switch dispatch because it was not measured on wasm. */
+#define PREDICT(op)     do { if (*pc == op) { opcode = op; pc++; goto predicted_ ## op; } } while (0)
+#define PREDICTED(op)   predicted_ ## op:
+#else
+#define PREDICT(op)     do { } while (0)
+#define PREDICTED(op)
+#endif
 #else
     static const void * const dispatch_table[256] = {
 #define DEF(id, size, n_pop, n_push, f) && case_OP_ ## id,
@@ -16224,12 +19976,32 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
 #define def(id, size, n_pop, n_push, f) && case_default,
 #endif
 #include "quickjs-opcode.h"
+#if !defined(CONFIG_BIGNUM) || !SHORT_OPCODES
+        /* all the 256 slots are used otherwise */
         [ OP_COUNT ... 255 ] = &&case_default
+#endif
     };
 #define SWITCH(pc)      goto *dispatch_table[opcode = *pc++];
 #define CASE(op)        case_ ## op
-#define DEFAULT         case_default
+/* may be unused when all the opcode slots are used */
+#define DEFAULT         case_default: __attribute__((unused));
 #define BREAK           SWITCH(pc)
+/* the threaded dispatch is already predicted by the CPU */
+#define PREDICT(op)     do { } while (0)
+#define PREDICTED(op)
+#endif
+/* save the PC before an allocation so that the heap profiler reports
+   its line. It is only needed when profiling. */
+#define HEAP_PROFILE_SAVE_PC(pc1) \
+    do { if (unlikely(rt->heap_profile)) sf->cur_pc = (pc1); } while (0)
+#if SHORT_OPCODES
+/* comparison followed by a conditional jump */
+#define PREDICT_COND_JUMP() do { PREDICT(OP_if_false8); PREDICT(OP_if_true8); } while (0)
+/* update of a loop variable followed by the jump to the loop start */
+#define PREDICT_LOOP_JUMP() PREDICT(OP_goto8)
+#else
+#define PREDICT_COND_JUMP() do { } while (0)
+#define PREDICT_LOOP_JUMP() do { } while (0)
 #endif
 
     if (js_poll_interrupts(caller_ctx))
@@ -16252,6 +20024,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             pc = sf->cur_pc;
             sf->prev_frame = rt->current_stack_frame;
             rt->current_stack_frame = sf;
+            base_sf = sf;
             if (s->throw_flag)
                 goto exception;
             else
@@ -16268,6 +20041,12 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
         not_a_function:
             return JS_ThrowTypeError(caller_ctx, "not a function");
         }
+        if (unlikely(JS_VALUE_GET_TAG(this_obj) == JS_TAG_STRING_ROPE ||
+                     js_has_string_rope(argc, (JSValueConst *)argv))) {
+            return js_call_class_flat(caller_ctx, call_func, func_obj,
+                                      this_obj, argc, (JSValueConst *)argv,
+                                      flags);
+        }
         return call_func(caller_ctx, func_obj, this_obj, argc,
                          (JSValueConst *)argv, flags);
     }
@@ -16288,6 +20067,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
     arg_buf = argv;
     sf->arg_count = argc;
     sf->cur_func = (JSValue)func_obj;
+    sf->cur_pc = b->byte_code_buf;
     init_list_head(&sf->var_ref_list);
     var_refs = p->u.func.var_refs;
 
@@ -16313,12 +20093,15 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
     pc = b->byte_code_buf;
     sf->prev_frame = rt->current_stack_frame;
     rt->current_stack_frame = sf;
+    base_sf = sf;
     ctx = b->realm; /* set the current realm */
-    
+    if (unlikely(b->native_code != NULL))
+        goto native_code_entry;
+
  restart:
     for(;;) {
         int call_argc;
-        JSValue *call_argv;
+        JSValue *call_argv, *call_ret_sp;
 
         SWITCH(pc) {
         CASE(OP_push_i32):
@@ -16353,6 +20136,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             *sp++ = JS_DupValue(ctx, b->cpool[*pc++]);
             BREAK;
         CASE(OP_fclosure8):
+            HEAP_PROFILE_SAVE_PC(pc + 1);
             *sp++ = js_closure(ctx, JS_DupValue(ctx, b->cpool[*pc++]), var_refs, sf);
             if (unlikely(JS_IsException(sp[-1])))
                 goto exception;
@@ -16386,20 +20170,29 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             /* OP_push_this is only called at the start of a function */
             {
                 JSValue val;
+                JSValueConst this_val = this_obj;
+                if (sf != base_sf) {
+                    JSInlineFrame *ifr = (JSInlineFrame *)sf;
+                    if (ifr->ret_sp == ifr->argv - 2 ||
+                        ifr->argv == ifr->buf + 2)
+                        this_val = ifr->argv[-2];
+                    else
+                        this_val = JS_UNDEFINED;
+                }
                 if (!(b->js_mode & JS_MODE_STRICT)) {
-                    uint32_t tag = JS_VALUE_GET_TAG(this_obj);
+                    uint32_t tag = JS_VALUE_GET_TAG(this_val);
                     if (likely(tag == JS_TAG_OBJECT))
                         goto normal_this;
                     if (tag == JS_TAG_NULL || tag == JS_TAG_UNDEFINED) {
                         val = JS_DupValue(ctx, ctx->global_obj);
                     } else {
-                        val = JS_ToObject(ctx, this_obj);
+                        val = JS_ToObject(ctx, this_val);
                         if (JS_IsException(val))
                             goto exception;
                     }
                 } else {
                 normal_this:
-                    val = JS_DupValue(ctx, this_obj);
+                    val = JS_DupValue(ctx, this_val);
                 }
                 *sp++ = val;
             }
@@ -16411,6 +20204,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             *sp++ = JS_TRUE;
             BREAK;
         CASE(OP_object):
+            HEAP_PROFILE_SAVE_PC(pc);
             *sp++ = JS_NewObject(ctx);
             if (unlikely(JS_IsException(sp[-1])))
                 goto exception;
@@ -16418,15 +20212,26 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
         CASE(OP_special_object):
             {
                 int arg = *pc++;
+                HEAP_PROFILE_SAVE_PC(pc);
                 switch(arg) {
                 case OP_SPECIAL_OBJECT_ARGUMENTS:
-                    *sp++ = js_build_arguments(ctx, argc, (JSValueConst *)argv);
+                    if (sf != base_sf)
+                        *sp++ = js_build_arguments(ctx, ((JSInlineFrame *)sf)->argc,
+                                                   (JSValueConst *)((JSInlineFrame *)sf)->argv);
+                    else
+                        *sp++ = js_build_arguments(ctx, argc, (JSValueConst *)argv);
                     if (unlikely(JS_IsException(sp[-1])))
                         goto exception;
                     break;
                 case OP_SPECIAL_OBJECT_MAPPED_ARGUMENTS:
-                    *sp++ = js_build_mapped_arguments(ctx, argc, (JSValueConst *)argv,
-                                                      sf, min_int(argc, b->arg_count));
+                    if (sf != base_sf) {
+                        JSInlineFrame *ifr = (JSInlineFrame *)sf;
+                        *sp++ = js_build_mapped_arguments(ctx, ifr->argc, (JSValueConst *)ifr->argv,
+                                                          sf, min_int(ifr->argc, b->arg_count));
+                    } else {
+                        *sp++ = js_build_mapped_arguments(ctx, argc, (JSValueConst *)argv,
+                                                          sf, min_int(argc, b->arg_count));
+                    }
                     if (unlikely(JS_IsException(sp[-1])))
                         goto exception;
                     break;
@@ -16434,12 +20239,15 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                     *sp++ = JS_DupValue(ctx, sf->cur_func);
                     break;
                 case OP_SPECIAL_OBJECT_NEW_TARGET:
-                    *sp++ = JS_DupValue(ctx, new_target);
+                    if (sf != base_sf)
+                        *sp++ = JS_UNDEFINED;
+                    else
+                        *sp++ = JS_DupValue(ctx, new_target);
                     break;
                 case OP_SPECIAL_OBJECT_HOME_OBJECT:
                     {
                         JSObject *p1;
-                        p1 = p->u.func.home_object;
+                        p1 = JS_VALUE_GET_OBJ(sf->cur_func)->u.func.home_object;
                         if (unlikely(!p1))
                             *sp++ = JS_UNDEFINED;
                         else
@@ -16465,7 +20273,12 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 int first = get_u16(pc);
                 pc += 2;
-                *sp++ = js_build_rest(ctx, first, argc, (JSValueConst *)argv);
+                HEAP_PROFILE_SAVE_PC(pc);
+                if (sf != base_sf)
+                    *sp++ = js_build_rest(ctx, first, ((JSInlineFrame *)sf)->argc,
+                                          (JSValueConst *)((JSInlineFrame *)sf)->argv);
+                else
+                    *sp++ = js_build_rest(ctx, first, argc, (JSValueConst *)argv);
                 if (unlikely(JS_IsException(sp[-1])))
                     goto exception;
             }
@@ -16617,6 +20430,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             {
                 JSValue bfunc = JS_DupValue(ctx, b->cpool[get_u32(pc)]);
                 pc += 4;
+                HEAP_PROFILE_SAVE_PC(pc);
                 *sp++ = js_closure(ctx, bfunc, var_refs, sf);
                 if (unlikely(JS_IsException(sp[-1])))
                     goto exception;
@@ -16639,6 +20453,12 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             has_call_argc:
                 call_argv = sp - call_argc;
                 sf->cur_pc = pc;
+                if (js_is_inline_callable(call_argv[-1])) {
+                    call_ret_sp = call_argv - 1;
+                    if (opcode == OP_tail_call)
+                        goto inline_tail_call;
+                    goto inline_call;
+                }
                 ret_val = JS_CallInternal(ctx, call_argv[-1], JS_UNDEFINED,
                                           JS_UNDEFINED, call_argc, call_argv, 0);
                 if (unlikely(JS_IsException(ret_val)))
@@ -16675,6 +20495,12 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 pc += 2;
                 call_argv = sp - call_argc;
                 sf->cur_pc = pc;
+                if (js_is_inline_callable(call_argv[-1])) {
+                    call_ret_sp = call_argv - 2;
+                    if (opcode == OP_tail_call_method)
+                        goto inline_tail_call;
+                    goto inline_call;
+                }
                 ret_val = JS_CallInternal(ctx, call_argv[-1], call_argv[-2],
                                           JS_UNDEFINED, call_argc, call_argv, 0);
                 if (unlikely(JS_IsException(ret_val)))
@@ -16687,12 +20513,93 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 *sp++ = ret_val;
             }
             BREAK;
+        inline_call:
+            /* call a bytecode function without recursing in
+               JS_CallInternal(): the caller state is saved in the new
+               frame and restored when the function returns */
+            {
+                JSInlineFrame *ifr;
+                JSObject *p1;
+
+                if (js_poll_interrupts(ctx))
+                    goto exception;
+                ifr = js_push_inline_frame(ctx, sp, call_argc, call_ret_sp);
+                if (unlikely(!ifr))
+                    goto exception;
+                sf = &ifr->sf;
+                p1 = JS_VALUE_GET_OBJ(call_argv[-1]);
+                b = p1->u.func.function_bytecode;
+                ctx = b->realm;
+                var_refs = p1->u.func.var_refs;
+                arg_buf = sf->arg_buf;
+                var_buf = sf->var_buf;
+                stack_buf = var_buf + b->var_count;
+                sp = stack_buf;
+                pc = b->byte_code_buf;
+                if (unlikely(b->native_code != NULL))
+                    goto native_code;
+            }
+            BREAK;
+        inline_tail_call:
+            /* the current frame is replaced by the frame of the called
+               function so that tail calls run in constant space. The
+               frame of JS_CallInternal() cannot be reused: it returns
+               the result of a new frame instead. In sloppy mode, the
+               current frame is kept so that it remains in the
+               backtraces. */
+            {
+                BOOL is_method = (call_ret_sp == call_argv - 2);
+                JSObject *p1;
+
+                if (js_poll_interrupts(ctx))
+                    goto exception;
+                if (sf == base_sf || !(b->js_mode & JS_MODE_STRICT) ||
+                    !js_reuse_inline_frame(ctx, (JSInlineFrame *)sf,
+                                           call_argv, call_argc, is_method)) {
+                    JSInlineFrame *ifr;
+                    ifr = js_push_tail_frame(ctx, call_argv, call_argc,
+                                             is_method);
+                    if (unlikely(!ifr))
+                        goto exception;
+                    sf = &ifr->sf;
+                }
+                p1 = JS_VALUE_GET_OBJ(sf->cur_func);
+                b = p1->u.func.function_bytecode;
+                ctx = b->realm;
+                var_refs = p1->u.func.var_refs;
+                arg_buf = sf->arg_buf;
+                var_buf = sf->var_buf;
+                stack_buf = var_buf + b->var_count;
+                sp = stack_buf;
+                pc = b->byte_code_buf;
+                if (unlikely(b->native_code != NULL))
+                    goto native_code;
+            }
+            BREAK;
+        native_code:
+            /* run the native code of the function until it returns or
+               bails out */
+            {
+                JSNativeCodeFrame nf;
+                int ret;
+                ret = js_call_native_code(ctx, b, &nf, arg_buf, var_buf, sp, pc);
+                sp = nf.sp;
+                pc = b->byte_code_buf + nf.pc;
+                if (ret < 0)
+                    goto exception;
+                if (ret == JS_NATIVE_CODE_RETURN) {
+                    ret_val = nf.ret_val;
+                    goto done;
+                }
+            }
+            BREAK;
         CASE(OP_array_from):
             {
                 int i, ret;
 
                 call_argc = get_u16(pc);
                 pc += 2;
+                HEAP_PROFILE_SAVE_PC(pc);
                 ret_val = JS_NewArray(ctx);
                 if (unlikely(JS_IsException(ret_val)))
                     goto exception;
@@ -16716,6 +20623,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 int magic;
                 magic = get_u16(pc);
                 pc += 2;
+                HEAP_PROFILE_SAVE_PC(pc);
 
                 ret_val = js_function_apply(ctx, sp[-3], 2, (JSValueConst *)&sp[-2], magic);
                 if (unlikely(JS_IsException(ret_val)))
@@ -16738,7 +20646,8 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             /* return TRUE if 'this' should be returned */
             if (!JS_IsObject(sp[-1])) {
                 if (!JS_IsUndefined(sp[-1])) {
-                    JS_ThrowTypeError(caller_ctx, "derived class constructor must return an object or undefined");
+                    JS_ThrowTypeError(sf != base_sf ? ((JSInlineFrame *)sf)->caller_ctx : caller_ctx,
+                                      "derived class constructor must return an object or undefined");
                     goto exception;
                 }
                 sp[0] = JS_TRUE;
@@ -16748,7 +20657,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             sp++;
             BREAK;
         CASE(OP_check_ctor):
-            if (JS_IsUndefined(new_target)) {
+            if (sf != base_sf || JS_IsUndefined(new_target)) {
                 JS_ThrowTypeError(ctx, "class constructors must be invoked with 'new'");
                 goto exception;
             }
@@ -16864,6 +20773,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
 
         CASE(OP_regexp):
             {
+                HEAP_PROFILE_SAVE_PC(pc);
                 sp[-2] = js_regexp_constructor_internal(ctx, JS_UNDEFINED,
                                                         sp[-2], sp[-1]);
                 sp--;
@@ -17053,6 +20963,11 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
         CASE(OP_get_loc1): *sp++ = JS_DupValue(ctx, var_buf[1]); BREAK;
         CASE(OP_get_loc2): *sp++ = JS_DupValue(ctx, var_buf[2]); BREAK;
         CASE(OP_get_loc3): *sp++ = JS_DupValue(ctx, var_buf[3]); BREAK;
+        CASE(OP_get_loc0_loc1):
+            sp[0] = JS_DupValue(ctx, var_buf[0]);
+            sp[1] = JS_DupValue(ctx, var_buf[1]);
+            sp += 2;
+            BREAK;
         CASE(OP_put_loc0): set_value(ctx, &var_buf[0], *--sp); BREAK;
         CASE(OP_put_loc1): set_value(ctx, &var_buf[1], *--sp); BREAK;
         CASE(OP_put_loc2): set_value(ctx, &var_buf[2], *--sp); BREAK;
@@ -17257,20 +21172,33 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             BREAK;
 
         CASE(OP_goto):
-            pc += (int32_t)get_u32(pc);
+            {
+                int32_t diff = get_u32(pc);
+                pc += diff;
+            }
+            BREAK;
+        CASE(OP_loop):
+            /* the interrupts are only polled at the loop headers
+               (see resolve_labels()) */
             if (unlikely(js_poll_interrupts(ctx)))
                 goto exception;
+            /* enter the native code again at the loop start */
+            if (unlikely(b->native_code != NULL))
+                goto native_code;
             BREAK;
 #if SHORT_OPCODES
         CASE(OP_goto16):
-            pc += (int16_t)get_u16(pc);
-            if (unlikely(js_poll_interrupts(ctx)))
-                goto exception;
+            {
+                int16_t diff = get_u16(pc);
+                pc += diff;
+            }
             BREAK;
         CASE(OP_goto8):
-            pc += (int8_t)pc[0];
-            if (unlikely(js_poll_interrupts(ctx)))
-                goto exception;
+        PREDICTED(OP_goto8)
+            {
+                int8_t diff = pc[0];
+                pc += diff;
+            }
             BREAK;
 #endif
         CASE(OP_if_true):
@@ -17289,8 +21217,6 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 if (res) {
                     pc += (int32_t)get_u32(pc - 4) - 4;
                 }
-                if (unlikely(js_poll_interrupts(ctx)))
-                    goto exception;
             }
             BREAK;
         CASE(OP_if_false):
@@ -17309,12 +21235,11 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 if (!res) {
                     pc += (int32_t)get_u32(pc - 4) - 4;
                 }
-                if (unlikely(js_poll_interrupts(ctx)))
-                    goto exception;
             }
             BREAK;
 #if SHORT_OPCODES
         CASE(OP_if_true8):
+        PREDICTED(OP_if_true8)
             {
                 int res;
                 JSValue op1;
@@ -17330,11 +21255,11 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 if (res) {
                     pc += (int8_t)pc[-1] - 1;
                 }
-                if (unlikely(js_poll_interrupts(ctx)))
-                    goto exception;
             }
             BREAK;
         CASE(OP_if_false8):
+        PREDICTED(OP_if_false8)
+        if_false8:
             {
                 int res;
                 JSValue op1;
@@ -17350,8 +21275,6 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 if (!res) {
                     pc += (int8_t)pc[-1] - 1;
                 }
-                if (unlikely(js_poll_interrupts(ctx)))
-                    goto exception;
             }
             BREAK;
 #endif
@@ -17537,7 +21460,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 atom = get_u32(pc);
                 pc += 4;
 
-                val = JS_GetProperty(ctx, sp[-1], atom);
+                val = js_get_property(ctx, sp[-1], atom);
                 if (unlikely(JS_IsException(val)))
                     goto exception;
                 JS_FreeValue(ctx, sp[-1]);
@@ -17552,7 +21475,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 atom = get_u32(pc);
                 pc += 4;
 
-                val = JS_GetProperty(ctx, sp[-1], atom);
+                val = js_get_property(ctx, sp[-1], atom);
                 if (unlikely(JS_IsException(val)))
                     goto exception;
                 *sp++ = val;
@@ -17575,6 +21498,50 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             }
             BREAK;
 
+        CASE(OP_get_field_ic):
+            {
+                JSValue val;
+                JSInlineCache *ic;
+                ic = &b->ic[get_u32(pc)];
+                pc += 4;
+
+                val = js_get_field_ic(ctx, ic, sp[-1]);
+                if (unlikely(JS_IsException(val)))
+                    goto exception;
+                JS_FreeValue(ctx, sp[-1]);
+                sp[-1] = val;
+            }
+            BREAK;
+
+        CASE(OP_get_field2_ic):
+            {
+                JSValue val;
+                JSInlineCache *ic;
+                ic = &b->ic[get_u32(pc)];
+                pc += 4;
+
+                val = js_get_field_ic(ctx, ic, sp[-1]);
+                if (unlikely(JS_IsException(val)))
+                    goto exception;
+                *sp++ = val;
+            }
+            BREAK;
+
+        CASE(OP_put_field_ic):
+            {
+                int ret;
+                JSInlineCache *ic;
+                ic = &b->ic[get_u32(pc)];
+                pc += 4;
+
+                ret = js_put_field_ic(ctx, ic, sp[-2], sp[-1]);
+                JS_FreeValue(ctx, sp[-2]);
+                sp -= 2;
+                if (unlikely(ret < 0))
+                    goto exception;
+            }
+            BREAK;
+
         CASE(OP_private_symbol):
             {
                 JSAtom atom;
@@ -17745,6 +21712,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 atom = get_u32(pc);
                 class_flags = pc[4];
                 pc += 5;
+                HEAP_PROFILE_SAVE_PC(pc);
                 if (js_op_define_class(ctx, sp, atom, class_flags,
                                        var_refs, sf,
                                        (opcode == OP_define_class_computed)) < 0)
@@ -17803,7 +21771,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 atom = JS_ValueToAtom(ctx, sp[-1]);
                 if (unlikely(atom == JS_ATOM_NULL))
                     goto exception;
-                val = JS_GetPropertyInternal(ctx, sp[-2], atom, sp[-3], FALSE);
+                val = JS_GetPropertyInternal2(ctx, sp[-2], atom, sp[-3], FALSE);
                 JS_FreeAtom(ctx, atom);
                 if (unlikely(JS_IsException(val)))
                     goto exception;
@@ -17890,6 +21858,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
 
         CASE(OP_append):    /* array pos enumobj -- array pos */
             {
+                HEAP_PROFILE_SAVE_PC(pc);
                 if (js_append_enumerate(ctx, sp))
                     goto exception;
                 JS_FreeValue(ctx, *--sp);
@@ -17905,6 +21874,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 int mask;
 
                 mask = *pc++;
+                HEAP_PROFILE_SAVE_PC(pc);
                 if (JS_CopyDataProperties(ctx, sp[-1 - (mask & 3)],
                                           sp[-1 - ((mask >> 2) & 7)],
                                           sp[-1 - ((mask >> 5) & 7)], 0))
@@ -17913,6 +21883,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             BREAK;
 
         CASE(OP_add):
+        add_generic:
             {
                 JSValue op1, op2;
                 op1 = sp[-2];
@@ -17925,18 +21896,59 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                     sp[-2] = JS_NewInt32(ctx, r);
                     sp--;
                 } else if (JS_VALUE_IS_BOTH_FLOAT(op1, op2)) {
+                    if (js_can_quicken(b))
+                        *(uint8_t *)(pc - 1) = OP_add_float;
                     sp[-2] = __JS_NewFloat64(ctx, JS_VALUE_GET_FLOAT64(op1) +
                                              JS_VALUE_GET_FLOAT64(op2));
                     sp--;
                 } else {
                 add_slow:
+                    HEAP_PROFILE_SAVE_PC(pc);
+                    if (tag_is_string(JS_VALUE_GET_TAG(op1)) &&
+                        tag_is_string(JS_VALUE_GET_TAG(op2)) &&
+                        js_can_quicken(b))
+                        *(uint8_t *)(pc - 1) = OP_add_string;
                     if (js_add_slow(ctx, sp))
                         goto exception;
                     sp--;
                 }
             }
             BREAK;
+        CASE(OP_add_float):
+            {
+                JSValue op1, op2;
+                op1 = sp[-2];
+                op2 = sp[-1];
+                if (unlikely(!JS_VALUE_IS_BOTH_FLOAT(op1, op2))) {
+                    js_dequicken(b, pc - 1, OP_add);
+                    opcode = OP_add;
+                    goto add_generic;
+                }
+                sp[-2] = __JS_NewFloat64(ctx, JS_VALUE_GET_FLOAT64(op1) +
+                                         JS_VALUE_GET_FLOAT64(op2));
+                sp--;
+            }
+            BREAK;
+        CASE(OP_add_string):
+            {
+                JSValue op1, op2;
+                op1 = sp[-2];
+                op2 = sp[-1];
+                if (unlikely(!tag_is_string(JS_VALUE_GET_TAG(op1)) ||
+                             !tag_is_string(JS_VALUE_GET_TAG(op2)))) {
+                    js_dequicken(b, pc - 1, OP_add);
+                    opcode = OP_add;
+                    goto add_generic;
+                }
+                HEAP_PROFILE_SAVE_PC(pc);
+                sp[-2] = JS_ConcatString(ctx, op1, op2);
+                sp--;
+                if (JS_IsException(sp[-1]))
+                    goto exception;
+            }
+            BREAK;
         CASE(OP_add_loc):
+        add_loc_generic:
             {
                 JSValue *pv;
                 int idx;
@@ -17952,8 +21964,15 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                         goto add_loc_slow;
                     *pv = JS_NewInt32(ctx, r);
                     sp--;
-                } else if (JS_VALUE_GET_TAG(*pv) == JS_TAG_STRING) {
+                } else if (JS_VALUE_IS_BOTH_FLOAT(*pv, sp[-1])) {
+                    if (js_can_quicken(b))
+                        *(uint8_t *)(pc - 2) = OP_add_loc_float;
+                    *pv = __JS_NewFloat64(ctx, JS_VALUE_GET_FLOAT64(*pv) +
+                                          JS_VALUE_GET_FLOAT64(sp[-1]));
+                    sp--;
+                } else if (tag_is_string(JS_VALUE_GET_TAG(*pv))) {
                     JSValue op1;
+                    HEAP_PROFILE_SAVE_PC(pc);
                     op1 = sp[-1];
                     sp--;
                     op1 = JS_ToPrimitiveFree(ctx, op1, HINT_NONE);
@@ -17966,6 +21985,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 } else {
                     JSValue ops[2];
                 add_loc_slow:
+                    HEAP_PROFILE_SAVE_PC(pc);
                     /* In case of exception, js_add_slow frees ops[0]
                        and ops[1], so we must duplicate *pv */
                     ops[0] = JS_DupValue(ctx, *pv);
@@ -17977,6 +21997,21 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 }
             }
             BREAK;
+        CASE(OP_add_loc_float):
+            {
+                JSValue *pv;
+                pv = &var_buf[*pc];
+                if (unlikely(!JS_VALUE_IS_BOTH_FLOAT(*pv, sp[-1]))) {
+                    js_dequicken(b, pc - 1, OP_add_loc);
+                    opcode = OP_add_loc;
+                    goto add_loc_generic;
+                }
+                pc += 1;
+                *pv = __JS_NewFloat64(ctx, JS_VALUE_GET_FLOAT64(*pv) +
+                                      JS_VALUE_GET_FLOAT64(sp[-1]));
+                sp--;
+            }
+            BREAK;
         CASE(OP_sub):
             {
                 JSValue op1, op2;
@@ -17999,6 +22034,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             }
             BREAK;
         CASE(OP_mul):
+        mul_generic:
             {
                 JSValue op1, op2;
                 double d;
@@ -18031,6 +22067,8 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                     if (unlikely(sf->js_mode & JS_MODE_MATH))
                         goto binary_arith_slow;
 #endif
+                    if (js_can_quicken(b))
+                        *(uint8_t *)(pc - 1) = OP_mul_float;
                     d = JS_VALUE_GET_FLOAT64(op1) * JS_VALUE_GET_FLOAT64(op2);
                 mul_fp_res:
                     sp[-2] = __JS_NewFloat64(ctx, d);
@@ -18040,6 +22078,21 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 }
             }
             BREAK;
+        CASE(OP_mul_float):
+            {
+                JSValue op1, op2;
+                op1 = sp[-2];
+                op2 = sp[-1];
+                if (unlikely(!JS_VALUE_IS_BOTH_FLOAT(op1, op2))) {
+                    js_dequicken(b, pc - 1, OP_mul);
+                    opcode = OP_mul;
+                    goto mul_generic;
+                }
+                sp[-2] = __JS_NewFloat64(ctx, JS_VALUE_GET_FLOAT64(op1) *
+                                         JS_VALUE_GET_FLOAT64(op2));
+                sp--;
+            }
+            BREAK;
         CASE(OP_div):
             {
                 JSValue op1, op2;
@@ -18196,6 +22249,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                     set_value(ctx, &var_buf[idx], op1);
                 }
             }
+            PREDICT_LOOP_JUMP();
             BREAK;
         CASE(OP_dec_loc):
             {
@@ -18221,6 +22275,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                     set_value(ctx, &var_buf[idx], op1);
                 }
             }
+            PREDICT_LOOP_JUMP();
             BREAK;
         CASE(OP_not):
             {
@@ -18377,12 +22432,11 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             BREAK;
 
 
-#define OP_CMP(opcode, binary_op, slow_call)              \
-            CASE(opcode):                                 \
-                {                                         \
-                JSValue op1, op2;                         \
-                op1 = sp[-2];                             \
-                op2 = sp[-1];                                   \
+#define OP_CMP_BODY(binary_op, slow_call)                               \
+                {                                                       \
+                JSValue op1, op2;                                       \
+                op1 = sp[-2];                                           \
+                op2 = sp[-1];                                           \
                 if (likely(JS_VALUE_IS_BOTH_INT(op1, op2))) {           \
                     sp[-2] = JS_NewBool(ctx, JS_VALUE_GET_INT(op1) binary_op JS_VALUE_GET_INT(op2)); \
                     sp--;                                               \
@@ -18391,10 +22445,21 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                         goto exception;                                 \
                     sp--;                                               \
                 }                                                       \
-                }                                                       \
+                }
+
+#define OP_CMP(opcode, binary_op, slow_call)              \
+            CASE(opcode):                                 \
+                OP_CMP_BODY(binary_op, slow_call);        \
+                PREDICT_COND_JUMP();                      \
             BREAK
 
             OP_CMP(OP_lt, <, js_relational_slow(ctx, sp, opcode));
+#if SHORT_OPCODES
+        CASE(OP_lt_if_false8):
+            /* lt if_false8 */
+            OP_CMP_BODY(<, js_relational_slow(ctx, sp, OP_lt));
+            goto if_false8;
+#endif
             OP_CMP(OP_lte, <=, js_relational_slow(ctx, sp, opcode));
             OP_CMP(OP_gt, >, js_relational_slow(ctx, sp, opcode));
             OP_CMP(OP_gte, >=, js_relational_slow(ctx, sp, opcode));
@@ -18538,7 +22603,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                     }
                     switch (opcode) {
                     case OP_with_get_var:
-                        val = JS_GetProperty(ctx, obj, atom);
+                        val = js_get_property(ctx, obj, atom);
                         if (unlikely(JS_IsException(val)))
                             goto exception;
                         set_value(ctx, &sp[-1], val);
@@ -18565,14 +22630,14 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                         break;
                     case OP_with_get_ref:
                         /* produce a pair object/method on the stack */
-                        val = JS_GetProperty(ctx, obj, atom);
+                        val = js_get_property(ctx, obj, atom);
                         if (unlikely(JS_IsException(val)))
                             goto exception;
                         *sp++ = val;
                         break;
                     case OP_with_get_ref_undef:
                         /* produce a pair undefined/function on the stack */
-                        val = JS_GetProperty(ctx, obj, atom);
+                        val = js_get_property(ctx, obj, atom);
                         if (unlikely(JS_IsException(val)))
                             goto exception;
                         JS_FreeValue(ctx, sp[-1]);
@@ -18652,12 +22717,28 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             sp[-1] = JS_FALSE;
             BREAK;
         CASE(OP_invalid):
-        DEFAULT:
+        DEFAULT
             JS_ThrowInternalError(ctx, "invalid opcode: pc=%u opcode=0x%02x",
                                   (int)(pc - b->byte_code_buf - 1), opcode);
             goto exception;
         }
     }
+ native_code_entry:
+    /* run the native code of the function until it returns or bails
+       out */
+    {
+        JSNativeCodeFrame nf;
+        int ret;
+        ret = js_call_native_code(ctx, b, &nf, arg_buf, var_buf, sp, pc);
+        sp = nf.sp;
+        pc = b->byte_code_buf + nf.pc;
+        if (ret == JS_NATIVE_CODE_BAILOUT)
+            goto restart;
+        if (ret < 0)
+            goto exception;
+        ret_val = nf.ret_val;
+        goto done;
+    }
  exception:
     if (is_backtrace_needed(ctx, rt->current_exception)) {
         /* add the backtrace information now (it is not done
@@ -18680,6 +22761,9 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                 } else {
                     *sp++ = rt->current_exception;
                     rt->current_exception = JS_NULL;
+                    rt->account_over_limit = NULL;
+                    if (unlikely(rt->memory_reserve_used))
+                        js_restore_memory_reserve(rt);
                     pc = b->byte_code_buf + pos;
                     goto restart;
                 }
@@ -18701,19 +22785,44 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
             close_var_refs(rt, sf);
         }
         /* free the local variables and stack */
-        for(pval = local_buf; pval < sp; pval++) {
+        pval = local_buf;
+        if (sf != base_sf)
+            pval = ((JSInlineFrame *)sf)->buf;
+        for(; pval < sp; pval++) {
             JS_FreeValue(ctx, *pval);
         }
     }
     rt->current_stack_frame = sf->prev_frame;
+    if (sf != base_sf) {
+        /* return to the caller of an inlined frame */
+        JSObject *p1;
+        BOOL is_tail_call = (((JSInlineFrame *)sf)->ret_sp == NULL);
+
+        sp = js_pop_inline_frame(rt, (JSInlineFrame *)sf, ret_val);
+        sf = rt->current_stack_frame;
+        p1 = JS_VALUE_GET_OBJ(sf->cur_func);
+        b = p1->u.func.function_bytecode;
+        ctx = b->realm;
+        var_refs = p1->u.func.var_refs;
+        arg_buf = sf->arg_buf;
+        var_buf = sf->var_buf;
+        stack_buf = var_buf + b->var_count;
+        pc = sf->cur_pc;
+        if (unlikely(JS_IsException(ret_val)))
+            goto exception;
+        if (unlikely(is_tail_call))
+            goto done; /* the caller returns the same value */
+        goto restart;
+    }
     return ret_val;
 }
 
 JSValue JS_Call(JSContext *ctx, JSValueConst func_obj, JSValueConst this_obj,
                 int argc, JSValueConst *argv)
 {
-    return JS_CallInternal(ctx, func_obj, this_obj, JS_UNDEFINED,
-                           argc, (JSValue *)argv, JS_CALL_FLAG_COPY_ARGV);
+    return js_string_rope_flatten_free(ctx,
+        JS_CallInternal(ctx, func_obj, this_obj, JS_UNDEFINED,
+                        argc, (JSValue *)argv, JS_CALL_FLAG_COPY_ARGV));
 }
 
 static JSValue JS_CallFree(JSContext *ctx, JSValue func_obj, JSValueConst this_obj,
@@ -18824,6 +22933,10 @@ static JSValue JS_CallConstructorInternal(JSContext *ctx,
         not_a_function:
             return JS_ThrowTypeError(ctx, "not a function");
         }
+        if (unlikely(js_has_string_rope(argc, (JSValueConst *)argv))) {
+            return js_call_class_flat(ctx, call_func, func_obj, new_target,
+                                      argc, (JSValueConst *)argv, flags);
+        }
         return call_func(ctx, func_obj, new_target, argc,
                          (JSValueConst *)argv, flags);
     }
@@ -18873,7 +22986,8 @@ JSValue JS_Invoke(JSContext *ctx, JSValueConst this_val, JSAtom atom,
     func_obj = JS_GetProperty(ctx, this_val, atom);
     if (JS_IsException(func_obj))
         return func_obj;
-    return JS_CallFree(ctx, func_obj, this_val, argc, argv);
+    return js_string_rope_flatten_free(ctx,
+        JS_CallFree(ctx, func_obj, this_val, argc, argv));
 }
 
 static JSValue JS_InvokeFree(JSContext *ctx, JSValue this_val, JSAtom atom,
@@ -19920,6 +24034,8 @@ typedef struct LabelSlot {
     int pos;    /* phase 1 address, -1 means not resolved yet */
     int pos2;   /* phase 2 address, -1 means not resolved yet */
     int addr;   /* phase 3 address, -1 means not resolved yet */
+    BOOL is_loop; /* target of a backward jump: a 'loop' opcode is
+                     emitted at the label in phase 3 */
     RelocEntry *first_reloc;
 } LabelSlot;
 
@@ -20102,42 +24218,6 @@ typedef struct JSParseState {
     BOOL ext_json; /* true if accepting JSON superset */
 } JSParseState;
 
-typedef struct JSOpCode {
-#ifdef DUMP_BYTECODE
-    const char *name;
-#endif
-    uint8_t size; /* in bytes */
-    /* the opcodes remove n_pop items from the top of the stack, then
-       pushes n_push items */
-    uint8_t n_pop;
-    uint8_t n_push;
-    uint8_t fmt;
-} JSOpCode;
-
-static const JSOpCode opcode_info[OP_COUNT + (OP_TEMP_END - OP_TEMP_START)] = {
-#define FMT(f)
-#ifdef DUMP_BYTECODE
-#define DEF(id, size, n_pop, n_push, f) { #id, size, n_pop, n_push, OP_FMT_ ## f },
-#else
-#define DEF(id, size, n_pop, n_push, f) { size, n_pop, n_push, OP_FMT_ ## f },
-#endif
-#include "quickjs-opcode.h"
-#undef DEF
-#undef FMT
-};
-
-#if SHORT_OPCODES
-/* After the final compilation pass, short opcodes are used. Their
-   opcodes overlap with the temporary opcodes which cannot appear in
-   the final bytecode. Their description is after the temporary
-   opcodes in opcode_info[]. */
-#define short_opcode_info(op)           \
-    opcode_info[(op) >= OP_TEMP_START ? \
-                (op) + (OP_TEMP_END - OP_TEMP_START) : (op)]
-#else
-#define short_opcode_info(op) opcode_info[op]
-#endif
-
 static __exception int next_token(JSParseState *s);
 
 static void free_token(JSParseState *s, JSToken *token)
@@ -21595,6 +25675,7 @@ static int new_label_fd(JSFunctionDef *fd, int label)
         ls->pos = -1;
         ls->pos2 = -1;
         ls->addr = -1;
+        ls->is_loop = FALSE;
         ls->first_reloc = NULL;
     }
     return label;
@@ -23582,6 +27663,8 @@ static __exception int get_lvalue(JSParseState *s, int *popcode, int *pscope,
         switch(opcode) {
         case OP_scope_get_var:
             label = new_label(s);
+            if (label < 0)
+                return -1;
             emit_op(s, OP_scope_make_ref);
             emit_atom(s, name);
             emit_u32(s, label);
@@ -23617,6 +27700,8 @@ static __exception int get_lvalue(JSParseState *s, int *popcode, int *pscope,
         switch(opcode) {
         case OP_scope_get_var:
             label = new_label(s);
+            if (label < 0)
+                return -1;
             emit_op(s, OP_scope_make_ref);
             emit_atom(s, name);
             emit_u32(s, label);
@@ -27843,7 +31928,7 @@ static int js_resolve_module(JSContext *ctx, JSModuleDef *m)
 static JSVarRef *js_create_module_var(JSContext *ctx, BOOL is_lexical)
 {
     JSVarRef *var_ref;
-    var_ref = js_malloc(ctx, sizeof(JSVarRef));
+    var_ref = js_slab_alloc(ctx, sizeof(JSVarRef));
     if (!var_ref)
         return NULL;
     var_ref->header.ref_count = 1;
@@ -28214,7 +32299,7 @@ static JSValue js_dynamic_import_job(JSContext *ctx,
     const char *basename = NULL, *filename;
     JSValue ret, err, ns;
 
-    if (!JS_IsString(basename_val)) {
+    if (!js_is_string(basename_val)) {
         JS_ThrowTypeError(ctx, "no function filename for import()");
         goto exception;
     }
@@ -31262,6 +35347,33 @@ static int find_jump_target(JSFunctionDef *s, int label, int *pop, int *pline)
     return label;
 }
 
+/* return TRUE if the code at 'pos' returns the value on the top of
+   the stack, possibly after jumps */
+static BOOL code_is_return(JSFunctionDef *s, int pos)
+{
+    const uint8_t *bc_buf = s->byte_code.buf;
+    int op, jumps = 0;
+
+    while (pos < s->byte_code.size) {
+        op = bc_buf[pos];
+        switch(op) {
+        case OP_line_num:
+        case OP_label:
+            pos += opcode_info[op].size;
+            break;
+        case OP_goto:
+            /* limit the number of jumps in case of cycle */
+            if (++jumps > 10)
+                return FALSE;
+            pos = s->label_slots[get_u32(bc_buf + pos + 1)].pos2;
+            break;
+        default:
+            return (op == OP_return);
+        }
+    }
+    return FALSE;
+}
+
 static void push_short_int(DynBuf *bc_out, int val)
 {
 #if SHORT_OPCODES
@@ -31343,6 +35455,17 @@ static void put_short_code(DynBuf *bc_out, int op, int idx)
 }
 
 /* peephole optimizations and resolve goto/labels */
+/* return TRUE if a jump to 'ls' goes backward to a position which is
+   not a 'loop' opcode. It happens when find_jump_target() redirects a
+   jump to a label which is not a loop header: the interrupts are then
+   polled before the jump. */
+static BOOL jump_needs_loop(DynBuf *bc_out, LabelSlot *ls)
+{
+    if (ls->addr == -1)
+        return FALSE;
+    return ls->addr == bc_out->size || bc_out->buf[ls->addr] != OP_loop;
+}
+
 static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
 {
     int pos, pos_next, bc_len, op, op1, len, i, line_num;
@@ -31352,8 +35475,13 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
     RelocEntry *re, *re_next;
     CodeContext cc;
     int label;
+    /* position after the last 'loop' opcode */
+    int loop_end = -1;
 #if SHORT_OPCODES
     JumpSlot *jp;
+    /* position of the last 'lt' or 'get_loc0' opcode if it can be
+       merged with the next instruction in a superinstruction */
+    int lt_pos = -1, get_loc0_pos = -1;
 #endif
 
     label_slots = s->label_slots;
@@ -31440,6 +35568,32 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
         put_short_code(&bc_out, OP_put_loc, s->arg_var_object_idx);
     }
 
+    /* mark the loop headers. A 'loop' opcode polling the interrupts
+       is emitted at them so that the other jumps do not need to. */
+    for (pos = 0; pos < bc_len; pos = pos_next) {
+        op = bc_buf[pos];
+        pos_next = pos + opcode_info[op].size;
+        switch(op) {
+        case OP_goto:
+        case OP_if_true:
+        case OP_if_false:
+            label = get_u32(bc_buf + pos + 1);
+            goto has_jump;
+        case OP_with_get_var:
+        case OP_with_put_var:
+        case OP_with_delete_var:
+        case OP_with_make_ref:
+        case OP_with_get_ref:
+        case OP_with_get_ref_undef:
+            label = get_u32(bc_buf + pos + 5);
+        has_jump:
+            assert(label >= 0 && label < s->label_count);
+            if (label_slots[label].pos2 <= pos)
+                label_slots[label].is_loop = TRUE;
+            break;
+        }
+    }
+
     for (pos = 0; pos < bc_len; pos = pos_next) {
         int val;
         op = bc_buf[pos];
@@ -31460,6 +35614,15 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                 ls = &label_slots[label];
                 assert(ls->addr == -1);
                 ls->addr = bc_out.size;
+                if (ls->is_loop && ls->ref_count > 0) {
+                    if (ls->addr == loop_end) {
+                        /* share the previous 'loop' opcode */
+                        ls->addr--;
+                    } else {
+                        dbuf_putc(&bc_out, OP_loop);
+                        loop_end = bc_out.size;
+                    }
+                }
                 /* resolve the relocation entries */
                 for(re = ls->first_reloc; re != NULL; re = re_next) {
                     int diff = ls->addr - re->addr;
@@ -31489,11 +35652,10 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                 /* detect and transform tail calls */
                 int argc;
                 argc = get_u16(bc_buf + pos + 1);
-                if (code_match(&cc, pos_next, OP_return, -1)) {
-                    if (cc.line_num >= 0) line_num = cc.line_num;
+                if (code_is_return(s, pos_next)) {
                     add_pc2line_info(s, bc_out.size, line_num);
                     put_short_code(&bc_out, op + 1, argc);
-                    pos_next = skip_dead_code(s, bc_buf, bc_len, cc.pos, &line_num);
+                    pos_next = skip_dead_code(s, bc_buf, bc_len, pos_next, &line_num);
                     break;
                 }
                 add_pc2line_info(s, bc_out.size, line_num);
@@ -31588,6 +35750,8 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
             }
             assert(label >= 0 && label < s->label_count);
             ls = &label_slots[label];
+            if (jump_needs_loop(&bc_out, ls))
+                dbuf_putc(&bc_out, OP_loop);
 #if SHORT_OPCODES
             jp = &s->jump_slots[s->jump_count++];
             jp->op = op;
@@ -31597,6 +35761,17 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
 
             if (ls->addr == -1) {
                 int diff = ls->pos2 - pos - 1;
+                if (diff < 128 && op == OP_if_false && lt_pos == bc_out.size - 1) {
+                    /* lt if_false8 -> lt_if_false8 */
+                    jp->size = 1;
+                    jp->op = OP_lt_if_false8;
+                    jp->pos = bc_out.size;
+                    bc_out.buf[lt_pos] = OP_lt_if_false8;
+                    dbuf_putc(&bc_out, 0);
+                    if (!add_reloc(ctx, ls, bc_out.size - 1, 1))
+                        goto fail;
+                    break;
+                }
                 if (diff < 128 && (op == OP_if_false || op == OP_if_true || op == OP_goto)) {
                     jp->size = 1;
                     jp->op = OP_if_false8 + (op - OP_if_false);
@@ -31617,6 +35792,16 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                 }
             } else {
                 int diff = ls->addr - bc_out.size - 1;
+                if (diff + 1 == (int8_t)(diff + 1) && op == OP_if_false &&
+                    lt_pos == bc_out.size - 1) {
+                    /* lt if_false8 -> lt_if_false8 */
+                    jp->size = 1;
+                    jp->op = OP_lt_if_false8;
+                    jp->pos = bc_out.size;
+                    bc_out.buf[lt_pos] = OP_lt_if_false8;
+                    dbuf_putc(&bc_out, diff + 1);
+                    break;
+                }
                 if (diff == (int8_t)diff && (op == OP_if_false || op == OP_if_true || op == OP_goto)) {
                     jp->size = 1;
                     jp->op = OP_if_false8 + (op - OP_if_false);
@@ -31660,6 +35845,8 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                 assert(label >= 0 && label < s->label_count);
                 ls = &label_slots[label];
                 add_pc2line_info(s, bc_out.size, line_num);
+                if (jump_needs_loop(&bc_out, ls))
+                    dbuf_putc(&bc_out, OP_loop);
 #if SHORT_OPCODES
                 jp = &s->jump_slots[s->jump_count++];
                 jp->op = op;
@@ -31798,6 +35985,14 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                 }
             }
             goto no_change;
+
+        case OP_lt:
+            if (OPTIMIZE) {
+                /* lt if_false8 may be merged when the jump is emitted */
+                if (code_match(&cc, pos_next, OP_if_false, -1))
+                    lt_pos = bc_out.size;
+            }
+            goto no_change;
 #endif
         case OP_push_atom_value:
             if (OPTIMIZE) {
@@ -31809,6 +36004,11 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                     pos_next = cc.pos;
                     break;
                 }
+                /* transform push_atom_value(x) to_propkey -> push_atom_value(x) */
+                if (code_match(&cc, pos_next, OP_to_propkey, -1)) {
+                    if (cc.line_num >= 0) line_num = cc.line_num;
+                    pos_next = cc.pos;
+                }
 #if SHORT_OPCODES
                 if (atom == JS_ATOM_empty_string) {
                     JS_FreeAtom(ctx, atom);
@@ -31964,6 +36164,10 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                 }
                 /* transformation:
                    get_loc(n) push_i32(x) add dup put_loc(n) drop -> push_i32(x) add_loc(n)
+                   push_i32(x) is emitted as a short push (push_i8 for
+                   small constants). XXX: a single add_loc_i8(n, x)
+                   opcode would save a dispatch but no opcode slot is
+                   left when CONFIG_BIGNUM is defined.
                  */
                 if (code_match(&cc, pos_next, OP_push_i32, OP_add, OP_dup, OP_put_loc, idx, OP_drop, -1)) {
                     if (cc.line_num >= 0) line_num = cc.line_num;
@@ -31988,6 +36192,16 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
                     pos_next = cc.pos;
                     break;
                 }
+#if SHORT_OPCODES
+                /* transformation: get_loc(0) get_loc(1) -> get_loc0_loc1 */
+                if (idx == 1 && get_loc0_pos == bc_out.size - 1) {
+                    bc_out.buf[get_loc0_pos] = OP_get_loc0_loc1;
+                    get_loc0_pos = -1;
+                    break;
+                }
+                if (idx == 0 && code_match(&cc, pos_next, OP_get_loc, 1, -1))
+                    get_loc0_pos = bc_out.size;
+#endif
                 add_pc2line_info(s, bc_out.size, line_num);
                 put_short_code(&bc_out, op, idx);
                 break;
@@ -32010,9 +36224,12 @@ static __exception int resolve_labels(JSContext *ctx, JSFunctionDef *s)
         case OP_put_var_ref:
             if (OPTIMIZE) {
                 /* transformation: put_x(n) get_x(n) -> set_x(n) */
+                /* transformation: put_loc(n) get_loc_check(n) -> set_loc(n) */
                 int idx;
                 idx = get_u16(bc_buf + pos + 1);
-                if (code_match(&cc, pos_next, op - 1, idx, -1)) {
+                if (code_match(&cc, pos_next, op - 1, idx, -1) ||
+                    (op == OP_put_loc &&
+                     code_match(&cc, pos_next, OP_get_loc_check, idx, -1))) {
                     if (cc.line_num >= 0) line_num = cc.line_num;
                     add_pc2line_info(s, bc_out.size, line_num);
                     put_short_code(&bc_out, op + 1, idx);
@@ -32272,22 +36489,20 @@ static __exception int ss_check(JSContext *ctx, StackSizeState *s,
     return 0;
 }
 
-static __exception int compute_stack_size(JSContext *ctx,
-                                          JSFunctionDef *fd,
-                                          int *pstack_size)
+/* 'stack_level_tab' has 'bc_len' entries. It is set to the stack size
+   before each opcode or to 0xffff if the opcode is not reachable. */
+static __exception int compute_stack_levels(JSContext *ctx,
+                                            const uint8_t *bc_buf, int bc_len,
+                                            uint16_t *stack_level_tab,
+                                            int *pstack_size)
 {
     StackSizeState s_s, *s = &s_s;
     int i, diff, n_pop, pos_next, stack_len, pos, op;
     const JSOpCode *oi;
-    const uint8_t *bc_buf;
 
-    bc_buf = fd->byte_code.buf;
-    s->bc_len = fd->byte_code.size;
+    s->bc_len = bc_len;
     /* bc_len > 0 */
-    s->stack_level_tab = js_malloc(ctx, sizeof(s->stack_level_tab[0]) *
-                                   s->bc_len);
-    if (!s->stack_level_tab)
-        return -1;
+    s->stack_level_tab = stack_level_tab;
     for(i = 0; i < s->bc_len; i++)
         s->stack_level_tab[i] = 0xffff;
     s->stack_len_max = 0;
@@ -32362,6 +36577,7 @@ static __exception int compute_stack_size(JSContext *ctx,
             break;
         case OP_if_true8:
         case OP_if_false8:
+        case OP_lt_if_false8:
             diff = (int8_t)bc_buf[pos + 1];
             if (ss_check(ctx, s, pos + 1 + diff, op, stack_len))
                 goto fail;
@@ -32405,17 +36621,34 @@ static __exception int compute_stack_size(JSContext *ctx,
             goto fail;
     done_insn: ;
     }
-    js_free(ctx, s->stack_level_tab);
     js_free(ctx, s->pc_stack);
     *pstack_size = s->stack_len_max;
     return 0;
  fail:
-    js_free(ctx, s->stack_level_tab);
     js_free(ctx, s->pc_stack);
     *pstack_size = 0;
     return -1;
 }
 
+static __exception int compute_stack_size(JSContext *ctx,
+                                          JSFunctionDef *fd,
+                                          int *pstack_size)
+{
+    uint16_t *stack_level_tab;
+    int ret;
+
+    stack_level_tab = js_malloc(ctx, sizeof(stack_level_tab[0]) *
+                                fd->byte_code.size);
+    if (!stack_level_tab) {
+        *pstack_size = 0;
+        return -1;
+    }
+    ret = compute_stack_levels(ctx, fd->byte_code.buf, fd->byte_code.size,
+                               stack_level_tab, pstack_size);
+    js_free(ctx, stack_level_tab);
+    return ret;
+}
+
 static int add_module_variables(JSContext *ctx, JSFunctionDef *fd)
 {
     int i, idx;
@@ -32665,6 +36898,8 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
         js_dump_function_bytecode(ctx, b);
     }
 #endif
+    js_create_inline_caches(ctx->rt, b);
+    js_init_native_code(ctx->rt, b);
 
     if (fd->parent) {
         /* remove from parent list */
@@ -32678,6 +36913,81 @@ static JSValue js_create_function(JSContext *ctx, JSFunctionDef *fd)
     return JS_EXCEPTION;
 }
 
+/* Replace the get_field, get_field2 and put_field instructions with
+   their inline cached version. The atoms are moved to the caches. The
+   generic instructions are kept if there is not enough memory. */
+static void js_create_inline_caches(JSRuntime *rt, JSFunctionBytecode *b)
+{
+    uint8_t *bc_buf = b->byte_code_buf;
+    int pos, op, ic_count;
+    JSInlineCache *ic;
+
+    if (b->read_only_bytecode)
+        return;
+    ic_count = 0;
+    for(pos = 0; pos < b->byte_code_len;
+        pos += short_opcode_info(bc_buf[pos]).size) {
+        op = bc_buf[pos];
+        if (op == OP_get_field || op == OP_get_field2 || op == OP_put_field)
+            ic_count++;
+    }
+    if (ic_count == 0)
+        return;
+    b->ic = js_mallocz_rt(rt, sizeof(b->ic[0]) * ic_count);
+    if (!b->ic)
+        return;
+    b->ic_count = ic_count;
+    list_add_tail(&b->ic_link, &rt->ic_bytecode_list);
+    ic = b->ic;
+    for(pos = 0; pos < b->byte_code_len;
+        pos += short_opcode_info(bc_buf[pos]).size) {
+        switch(bc_buf[pos]) {
+        case OP_get_field:
+            bc_buf[pos] = OP_get_field_ic;
+            break;
+        case OP_get_field2:
+            bc_buf[pos] = OP_get_field2_ic;
+            break;
+        case OP_put_field:
+            bc_buf[pos] = OP_put_field_ic;
+            break;
+        default:
+            continue;
+        }
+        ic->atom = get_u32(bc_buf + pos + 1);
+        put_u32(bc_buf + pos + 1, ic - b->ic);
+        ic++;
+    }
+}
+
+/* release the cached shapes */
+static void js_reset_inline_caches(JSRuntime *rt, JSFunctionBytecode *b)
+{
+    JSInlineCache *ic;
+    int i, j;
+
+    for(i = 0; i < b->ic_count; i++) {
+        ic = &b->ic[i];
+        for(j = 0; j < ic->count; j++) {
+            js_free_shape(rt, ic->shapes[j]);
+            ic->shapes[j] = NULL;
+            ic->holders[j] = NULL;
+        }
+        ic->count = 0;
+    }
+}
+
+static void js_free_inline_caches(JSRuntime *rt, JSFunctionBytecode *b)
+{
+    int i;
+
+    js_reset_inline_caches(rt, b);
+    for(i = 0; i < b->ic_count; i++)
+        JS_FreeAtomRT(rt, b->ic[i].atom);
+    list_del(&b->ic_link);
+    js_free_rt(rt, b->ic);
+}
+
 static void free_function_bytecode(JSRuntime *rt, JSFunctionBytecode *b)
 {
     int i;
@@ -32690,6 +37000,8 @@ static void free_function_bytecode(JSRuntime *rt, JSFunctionBytecode *b)
     }
 #endif
     free_bytecode_atoms(rt, b->byte_code_buf, b->byte_code_len, TRUE);
+    if (b->ic)
+        js_free_inline_caches(rt, b);
 
     if (b->vardefs) {
         for(i = 0; i < b->arg_count + b->var_count; i++) {
@@ -33544,7 +37856,8 @@ static JSValue JS_EvalFunctionInternal(JSContext *ctx, JSValue fun_obj,
 
 JSValue JS_EvalFunction(JSContext *ctx, JSValue fun_obj)
 {
-    return JS_EvalFunctionInternal(ctx, fun_obj, ctx->global_obj, NULL, NULL);
+    return js_string_rope_flatten_free(ctx,
+        JS_EvalFunctionInternal(ctx, fun_obj, ctx->global_obj, NULL, NULL));
 }
 
 static void skip_shebang(JSParseState *s)
@@ -33702,7 +38015,7 @@ static JSValue JS_EvalObject(JSContext *ctx, JSValueConst this_obj,
     const char *str;
     size_t len;
 
-    if (!JS_IsString(val))
+    if (!js_is_string(val))
         return JS_DupValue(ctx, val);
     str = JS_ToCStringLen(ctx, &len, val);
     if (!str)
@@ -33724,7 +38037,7 @@ JSValue JS_EvalThis(JSContext *ctx, JSValueConst this_obj,
            eval_type == JS_EVAL_TYPE_MODULE);
     ret = JS_EvalInternal(ctx, this_obj, input, input_len, filename,
                           eval_flags, -1);
-    return ret;
+    return js_string_rope_flatten_free(ctx, ret);
 }
 
 JSValue JS_Eval(JSContext *ctx, const char *input, size_t input_len,
@@ -33878,9 +38191,9 @@ typedef enum BCTagEnum {
 } BCTagEnum;
 
 #ifdef CONFIG_BIGNUM
-#define BC_BASE_VERSION 2
+#define BC_BASE_VERSION 7
 #else
-#define BC_BASE_VERSION 1
+#define BC_BASE_VERSION 6
 #endif
 #define BC_BE_VERSION 0x40
 #ifdef WORDS_BIGENDIAN
@@ -34094,9 +38407,9 @@ static void bc_byte_swap(uint8_t *bc_buf, int bc_len)
 }
 
 static int JS_WriteFunctionBytecode(BCWriterState *s,
-                                    const uint8_t *bc_buf1, int bc_len)
+                                    const JSFunctionBytecode *b)
 {
-    int pos, len, op;
+    int pos, len, op, bc_len = b->byte_code_len;
     JSAtom atom;
     uint8_t *bc_buf;
     uint32_t val;
@@ -34104,11 +38417,20 @@ static int JS_WriteFunctionBytecode(BCWriterState *s,
     bc_buf = js_malloc(s->ctx, bc_len);
     if (!bc_buf)
         return -1;
-    memcpy(bc_buf, bc_buf1, bc_len);
+    memcpy(bc_buf, b->byte_code_buf, bc_len);
 
     pos = 0;
     while (pos < bc_len) {
         op = bc_buf[pos];
+        if (op >= OP_get_field_ic && op <= OP_put_field_ic) {
+            /* write the generic instruction */
+            op = op - OP_get_field_ic + OP_get_field;
+            bc_buf[pos] = op;
+            put_u32(bc_buf + pos + 1, b->ic[get_u32(bc_buf + pos + 1)].atom);
+        } else if (op >= OP_add_float && op <= OP_add_loc_float) {
+            op = js_generic_opcode(op);
+            bc_buf[pos] = op;
+        }
         len = short_opcode_info(op).size;
         switch(short_opcode_info(op).fmt) {
         case OP_FMT_atom:
@@ -34355,7 +38677,7 @@ static int JS_WriteFunctionTag(BCWriterState *s, JSValueConst obj)
         bc_put_u8(s, flags);
     }
     
-    if (JS_WriteFunctionBytecode(s, b->byte_code_buf, b->byte_code_len))
+    if (JS_WriteFunctionBytecode(s, b))
         goto fail;
     
     if (b->has_debug) {
@@ -34587,6 +38909,15 @@ static int JS_WriteObjectRec(BCWriterState *s, JSValueConst obj)
             JS_WriteString(s, p);
         }
         break;
+    case JS_TAG_STRING_ROPE:
+        {
+            JSString *p = js_string_rope_flatten(s->ctx, obj);
+            if (!p)
+                goto fail;
+            bc_put_u8(s, BC_TAG_STRING);
+            JS_WriteString(s, p);
+        }
+        break;
     case JS_TAG_FUNCTION_BYTECODE:
         if (!s->allow_bytecode)
             goto invalid_tag;
@@ -35367,6 +39698,8 @@ static JSValue JS_ReadFunctionTag(BCReaderState *s)
         bc_read_trace(s, "bytecode {\n");
         if (JS_ReadFunctionBytecode(s, b, byte_code_offset, b->byte_code_len))
             goto fail;
+        js_create_inline_caches(ctx->rt, b);
+        js_init_native_code(ctx->rt, b);
         bc_read_trace(s, "}\n");
     }
     if (b->has_debug) {
@@ -36275,6 +40608,13 @@ static JSValue JS_ToObject(JSContext *ctx, JSValueConst val)
     case JS_TAG_FLOAT64:
         obj = JS_NewObjectClass(ctx, JS_CLASS_NUMBER);
         goto set_value;
+    case JS_TAG_STRING_ROPE:
+        {
+            JSString *p1 = js_string_rope_flatten(ctx, val);
+            if (!p1)
+                return JS_EXCEPTION;
+            return JS_ToObject(ctx, JS_MKPTR(JS_TAG_STRING, p1));
+        }
     case JS_TAG_STRING:
         /* XXX: should call the string constructor */
         {
@@ -36961,7 +41301,7 @@ static JSValue js_object_toString(JSContext *ctx, JSValueConst this_val,
         JS_FreeValue(ctx, obj);
         if (JS_IsException(tag))
             return JS_EXCEPTION;
-        if (!JS_IsString(tag)) {
+        if (!js_is_string(tag)) {
             JS_FreeValue(ctx, tag);
             tag = JS_AtomToString(ctx, atom);
         }
@@ -37761,7 +42101,7 @@ static JSValue js_function_bind(JSContext *ctx, JSValueConst this_val,
     name1 = JS_GetProperty(ctx, this_val, JS_ATOM_name);
     if (JS_IsException(name1))
         goto exception;
-    if (!JS_IsString(name1)) {
+    if (!js_is_string(name1)) {
         JS_FreeValue(ctx, name1);
         name1 = JS_AtomToString(ctx, JS_ATOM_empty_string);
     }
@@ -40206,6 +44546,8 @@ static JSValue js_thisStringValue(JSContext *ctx, JSValueConst this_val)
 {
     if (JS_VALUE_GET_TAG(this_val) == JS_TAG_STRING)
         return JS_DupValue(ctx, this_val);
+    if (JS_VALUE_GET_TAG(this_val) == JS_TAG_STRING_ROPE)
+        return JS_ToString(ctx, this_val);
 
     if (JS_VALUE_GET_TAG(this_val) == JS_TAG_OBJECT) {
         JSObject *p = JS_VALUE_GET_OBJ(this_val);
@@ -40448,12 +44790,7 @@ static JSValue js_string_concat(JSContext *ctx, JSValueConst this_val,
 
 static int string_cmp(JSString *p1, JSString *p2, int x1, int x2, int len)
 {
-    int i, c1, c2;
-    for (i = 0; i < len; i++) {
-        if ((c1 = string_get(p1, x1 + i)) != (c2 = string_get(p2, x2 + i)))
-            return c1 - c2;
-    }
-    return 0;
+    return js_string_memcmp_pos(p1, x1, p2, x2, len);
 }
 
 static int string_indexof_char(JSString *p, int c, int from)
@@ -40461,19 +44798,15 @@ static int string_indexof_char(JSString *p, int c, int from)
     /* assuming 0 <= from <= p->len */
     int i, len = p->len;
     if (p->is_wide_char) {
-        for (i = from; i < len; i++) {
-            if (p->u.str16[i] == c)
-                return i;
-        }
+        i = mem_chr16(p->u.str16 + from, c, len - from);
     } else {
-        if ((c & ~0xff) == 0) {
-            for (i = from; i < len; i++) {
-                if (p->u.str8[i] == (uint8_t)c)
-                    return i;
-            }
-        }
+        if ((c & ~0xff) != 0)
+            return -1;
+        i = mem_chr8(p->u.str8 + from, c, len - from);
     }
-    return -1;
+    if (i < 0)
+        return -1;
+    return from + i;
 }
 
 static int string_indexof(JSString *p1, JSString *p2, int from)
@@ -40482,6 +44815,15 @@ static int string_indexof(JSString *p1, JSString *p2, int from)
     int c, i, j, len1 = p1->len, len2 = p2->len;
     if (len2 == 0)
         return from;
+    if (p1->is_wide_char == p2->is_wide_char) {
+        if (p1->is_wide_char)
+            i = mem_search16(p1->u.str16 + from, len1 - from, p2->u.str16, len2);
+        else
+            i = mem_search8(p1->u.str8 + from, len1 - from, p2->u.str8, len2);
+        if (i < 0)
+            return -1;
+        return from + i;
+    }
     for (i = from, c = string_get(p2, 0); i + len2 <= len1; i = j + 1) {
         j = string_indexof_char(p1, c, i);
         if (j < 0 || j + len2 > len1)
@@ -40550,13 +44892,17 @@ static JSValue js_string_indexOf(JSContext *ctx, JSValueConst this_val,
     }
     ret = -1;
     if (len >= v_len && inc * (stop - start) >= 0) {
-        for (i = start;; i += inc) {
-            if (!string_cmp(p, p1, i, 0, v_len)) {
-                ret = i;
-                break;
+        if (!lastIndexOf) {
+            ret = string_indexof(p, p1, start);
+        } else {
+            for (i = start;; i += inc) {
+                if (!string_cmp(p, p1, i, 0, v_len)) {
+                    ret = i;
+                    break;
+                }
+                if (i == stop)
+                    break;
             }
-            if (i == stop)
-                break;
         }
     }
     JS_FreeValue(ctx, str);
@@ -40576,7 +44922,7 @@ static JSValue js_string_includes(JSContext *ctx, JSValueConst this_val,
                                   int argc, JSValueConst *argv, int magic)
 {
     JSValue str, v = JS_UNDEFINED;
-    int i, len, v_len, pos, start, stop, ret;
+    int len, v_len, pos, start, stop, ret;
     JSString *p;
     JSString *p1;
 
@@ -40616,14 +44962,10 @@ static JSValue js_string_includes(JSContext *ctx, JSValueConst this_val,
         start = stop = pos;
     }
     if (start >= 0 && start <= stop) {
-        for (i = start;; i++) {
-            if (!string_cmp(p, p1, i, 0, v_len)) {
-                ret = 1;
-                break;
-            }
-            if (i == stop)
-                break;
-        }
+        if (magic == 0)
+            ret = string_indexof(p, p1, start) >= 0;
+        else
+            ret = !string_cmp(p, p1, start, 0, v_len);
     }
  done:
     JS_FreeValue(ctx, str);
@@ -40733,7 +45075,8 @@ static JSValue js_string___GetSubstitution(JSContext *ctx, JSValueConst this_val
     namedCaptures = argv[4];
     rep = argv[5];
 
-    if (!JS_IsString(rep) || !JS_IsString(str))
+    if (JS_VALUE_GET_TAG(rep) != JS_TAG_STRING ||
+        JS_VALUE_GET_TAG(str) != JS_TAG_STRING)
         return JS_ThrowTypeError(ctx, "not a string");
 
     sp = JS_VALUE_GET_STRING(str);
@@ -43868,6 +48211,7 @@ static JSValue js_json_check(JSContext *ctx, JSONStringifyContext *jsc,
         if (JS_IsFunction(ctx, val))
             break;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
     case JS_TAG_INT:
     case JS_TAG_FLOAT64:
 #ifdef CONFIG_BIGNUM
@@ -44049,6 +48393,7 @@ static int js_json_to_str(JSContext *ctx, JSONStringifyContext *jsc,
         JS_FreeValue(ctx, prop);
         return 0;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         val = JS_ToQuotedStringFree(ctx, val);
         if (JS_IsException(val))
             goto exception;
@@ -44141,7 +48486,7 @@ JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
                     v = JS_ToStringFree(ctx, v);
                     if (JS_IsException(v))
                         goto exception;
-                } else if (!JS_IsString(v)) {
+                } else if (!js_is_string(v)) {
                     JS_FreeValue(ctx, v);
                     continue;
                 }
@@ -44171,13 +48516,17 @@ JSValue JS_JSONStringify(JSContext *ctx, JSValueConst obj,
             JS_FreeValue(ctx, space);
             goto exception;
         }
+    } else if (JS_VALUE_GET_TAG(space) == JS_TAG_STRING_ROPE) {
+        space = JS_ToStringFree(ctx, space);
+        if (JS_IsException(space))
+            goto exception;
     }
     if (JS_IsNumber(space)) {
         int n;
         if (JS_ToInt32Clamp(ctx, &n, space, 0, 10, 0))
             goto exception;
         jsc->gap = JS_NewStringLen(ctx, "          ", n);
-    } else if (JS_IsString(space)) {
+    } else if (js_is_string(space)) {
         JSString *p = JS_VALUE_GET_STRING(space);
         jsc->gap = js_sub_string(ctx, p, 0, min_int(p->len, 10));
     } else {
@@ -44314,7 +48663,7 @@ static JSValue js_reflect_get(JSContext *ctx, JSValueConst this_val,
     atom = JS_ValueToAtom(ctx, prop);
     if (unlikely(atom == JS_ATOM_NULL))
         return JS_EXCEPTION;
-    ret = JS_GetPropertyInternal(ctx, obj, atom, receiver, FALSE);
+    ret = JS_GetPropertyInternal2(ctx, obj, atom, receiver, FALSE);
     JS_FreeAtom(ctx, atom);
     return ret;
 }
@@ -44662,7 +49011,7 @@ static JSValue js_proxy_get(JSContext *ctx, JSValueConst obj, JSAtom atom,
         return JS_EXCEPTION;
     /* Note: recursion is possible thru the prototype of s->target */
     if (JS_IsUndefined(method))
-        return JS_GetPropertyInternal(ctx, s->target, atom, receiver, FALSE);
+        return JS_GetPropertyInternal2(ctx, s->target, atom, receiver, FALSE);
     atom_val = JS_AtomToValue(ctx, atom);
     if (JS_IsException(atom_val)) {
         JS_FreeValue(ctx, method);
@@ -45090,7 +49439,7 @@ static int js_proxy_get_own_property_names(JSContext *ctx,
         val = JS_GetPropertyUint32(ctx, prop_array, i);
         if (JS_IsException(val))
             goto fail;
-        if (!JS_IsString(val) && !JS_IsSymbol(val)) {
+        if (!js_is_string(val) && !JS_IsSymbol(val)) {
             JS_FreeValue(ctx, val);
             JS_ThrowTypeError(ctx, "proxy: properties must be strings or symbols");
             goto fail;
@@ -45501,6 +49850,12 @@ typedef struct JSMapState {
 #define MAGIC_SET (1 << 0)
 #define MAGIC_WEAK (1 << 1)
 
+static size_t js_map_get_memory_size(JSMapState *s)
+{
+    return sizeof(*s) + s->hash_size * sizeof(s->hash_table[0]) +
+        s->record_count * sizeof(JSMapRecord);
+}
+
 static JSValue js_map_constructor(JSContext *ctx, JSValueConst new_target,
                                   int argc, JSValueConst *argv, int magic)
 {
@@ -45637,6 +49992,10 @@ static uint32_t map_hash_key(JSContext *ctx, JSValueConst key)
     case JS_TAG_STRING:
         h = hash_string(JS_VALUE_GET_STRING(key), 0);
         break;
+    case JS_TAG_STRING_ROPE:
+        h = js_string_rope_hash(key, 0);
+        tag = JS_TAG_STRING; /* same hash as the flat string */
+        break;
     case JS_TAG_OBJECT:
     case JS_TAG_SYMBOL:
         h = (uintptr_t)JS_VALUE_GET_PTR(key) * 3163;
@@ -45715,7 +50074,7 @@ static JSMapRecord *map_add_record(JSContext *ctx, JSMapState *s,
     uint32_t h;
     JSMapRecord *mr;
 
-    mr = js_malloc(ctx, sizeof(*mr));
+    mr = js_slab_alloc(ctx, sizeof(*mr));
     if (!mr)
         return NULL;
     mr->ref_count = 1;
@@ -45774,7 +50133,7 @@ static void map_delete_record(JSRuntime *rt, JSMapState *s, JSMapRecord *mr)
     JS_FreeValueRT(rt, mr->value);
     if (--mr->ref_count == 0) {
         list_del(&mr->link);
-        js_free_rt(rt, mr);
+        js_slab_free_rt(rt, mr, sizeof(*mr));
     } else {
         /* keep a zombie record for iterators */
         mr->empty = TRUE;
@@ -45790,7 +50149,7 @@ static void map_decref_record(JSRuntime *rt, JSMapRecord *mr)
         /* the record can be safely removed */
         assert(mr->empty);
         list_del(&mr->link);
-        js_free_rt(rt, mr);
+        js_slab_free_rt(rt, mr, sizeof(*mr));
     }
 }
 
@@ -45814,7 +50173,7 @@ static void reset_weak_ref(JSRuntime *rt, JSObject *p)
     for(mr = p->first_weak_ref; mr != NULL; mr = mr_next) {
         mr_next = mr->next_weak_ref;
         JS_FreeValueRT(rt, mr->value);
-        js_free_rt(rt, mr);
+        js_slab_free_rt(rt, mr, sizeof(*mr));
     }
 
     p->first_weak_ref = NULL; /* fail safe */
@@ -45989,7 +50348,7 @@ static void js_map_finalizer(JSRuntime *rt, JSValue val)
                     JS_FreeValueRT(rt, mr->key);
                 JS_FreeValueRT(rt, mr->value);
             }
-            js_free_rt(rt, mr);
+            js_slab_free_rt(rt, mr, sizeof(*mr));
         }
         js_free_rt(rt, s->hash_table);
         js_free_rt(rt, s);
@@ -46360,6 +50719,23 @@ void JS_SetHostPromiseRejectionTracker(JSRuntime *rt,
     rt->host_promise_rejection_tracker_opaque = opaque;
 }
 
+static void js_track_promise_rejection(JSContext *ctx, JSValueConst promise,
+                                       JSValueConst reason, BOOL is_handled)
+{
+    JSRuntime *rt = ctx->rt;
+
+    if (JS_VALUE_GET_TAG(reason) == JS_TAG_STRING_ROPE) {
+        reason = js_string_rope_get_flat(ctx, reason);
+        if (JS_IsException(reason)) {
+            /* out of memory: the reason is lost */
+            JS_FreeValue(ctx, JS_GetException(ctx));
+            reason = JS_UNDEFINED;
+        }
+    }
+    rt->host_promise_rejection_tracker(ctx, promise, reason, is_handled,
+                                       rt->host_promise_rejection_tracker_opaque);
+}
+
 static void fulfill_or_reject_promise(JSContext *ctx, JSValueConst promise,
                                       JSValueConst value, BOOL is_reject)
 {
@@ -46378,8 +50754,7 @@ static void fulfill_or_reject_promise(JSContext *ctx, JSValueConst promise,
     if (s->promise_state == JS_PROMISE_REJECTED && !s->is_handled) {
         JSRuntime *rt = ctx->rt;
         if (rt->host_promise_rejection_tracker) {
-            rt->host_promise_rejection_tracker(ctx, promise, value, FALSE,
-                                               rt->host_promise_rejection_tracker_opaque);
+            js_track_promise_rejection(ctx, promise, value, FALSE);
         }
     }
 
@@ -47114,8 +51489,8 @@ static __exception int perform_promise_then(JSContext *ctx,
         if (s->promise_state == JS_PROMISE_REJECTED && !s->is_handled) {
             JSRuntime *rt = ctx->rt;
             if (rt->host_promise_rejection_tracker) {
-                rt->host_promise_rejection_tracker(ctx, promise, s->promise_result,
-                                                   TRUE, rt->host_promise_rejection_tracker_opaque);
+                js_track_promise_rejection(ctx, promise, s->promise_result,
+                                           TRUE);
             }
         }
         i = s->promise_state - JS_PROMISE_FULFILLED;
@@ -48245,7 +52620,7 @@ static JSValue js_date_constructor(JSContext *ctx, JSValueConst new_target,
             }
         }
         v = JS_ToPrimitive(ctx, argv[0], HINT_NONE);
-        if (JS_IsString(v)) {
+        if (js_is_string(v)) {
             dv = js_Date_parse(ctx, JS_UNDEFINED, 1, (JSValueConst *)&v);
             JS_FreeValue(ctx, v);
             if (JS_IsException(dv))
@@ -48625,7 +53000,7 @@ static JSValue js_date_Symbol_toPrimitive(JSContext *ctx, JSValueConst this_val,
     if (!JS_IsObject(obj))
         return JS_ThrowTypeErrorNotAnObject(ctx);
 
-    if (JS_IsString(argv[0])) {
+    if (js_is_string(argv[0])) {
         hint = JS_ValueToAtom(ctx, argv[0]);
         if (hint == JS_ATOM_NULL)
             return JS_EXCEPTION;
@@ -49173,6 +53548,7 @@ static JSValue JS_ToBigIntCtorFree(JSContext *ctx, JSValue val)
             break;
         goto redo;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         val = JS_StringToBigIntErr(ctx, val);
         break;
     case JS_TAG_OBJECT:
@@ -49727,6 +54103,7 @@ static JSValue js_bigfloat_constructor(JSContext *ctx,
                 break;
             goto redo;
         case JS_TAG_STRING:
+        case JS_TAG_STRING_ROPE:
             {
                 const char *str, *p;
                 size_t len;
@@ -50405,6 +54782,7 @@ static JSValue JS_ToBigDecimalFree(JSContext *ctx, JSValue val,
             break;
         goto redo;
     case JS_TAG_STRING:
+    case JS_TAG_STRING_ROPE:
         {
             const char *str, *p;
             size_t len;
@@ -72,6 +72,7 @@ enum {
     JS_TAG_BIG_FLOAT   = -9,
     JS_TAG_SYMBOL      = -8,
     JS_TAG_STRING      = -7,
+    JS_TAG_STRING_ROPE = -6, /* used internally */
     JS_TAG_MODULE      = -3, /* used internally */
     JS_TAG_FUNCTION_BYTECODE = -2, /* used internally */
     JS_TAG_OBJECT      = -1,
@@ -291,6 +292,7 @@ static inline JS_BOOL JS_VALUE_IS_NAN(JSValue v)
 #define JS_PROP_NO_EXOTIC        (1 << 17) /* internal use */
 
 #define JS_DEFAULT_STACK_SIZE (256 * 1024)
+#define JS_DEFAULT_MEMORY_RESERVE (32 * 1024)
 
 /* JS_Eval() flags */
 #define JS_EVAL_TYPE_GLOBAL   (0 << 0) /* global code (default) */
@@ -332,24 +334,107 @@ JSRuntime *JS_NewRuntime(void);
 /* info lifetime must exceed that of rt */
 void JS_SetRuntimeInfo(JSRuntime *rt, const char *info);
 void JS_SetMemoryLimit(JSRuntime *rt, size_t limit);
+/* size of the memory kept to handle the out of memory errors. It is
+   included in the memory limit. 0 disables it. */
+int JS_SetMemoryReserve(JSRuntime *rt, size_t size);
 void JS_SetGCThreshold(JSRuntime *rt, size_t gc_threshold);
+/* use a slab allocator for the small objects, shapes, property arrays
+   and strings. The empty pages are released after the garbage
+   collections. Must be called before creating any context. Return -1
+   if error. */
+int JS_SetSlabAllocator(JSRuntime *rt, JS_BOOL enable);
 /* use 0 to disable maximum stack size check */
 void JS_SetMaxStackSize(JSRuntime *rt, size_t stack_size);
 /* should be called when changing thread to update the stack top value
    used to check stack overflow. */
 void JS_UpdateStackTop(JSRuntime *rt);
 JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque);
+/* charge each allocation to the context doing it so that per context
+   memory limits can be set. It adds a small header to each block,
+   including the blocks of the slab allocator. */
+#define JS_RUNTIME_MEMORY_ACCOUNTING (1 << 0)
+JSRuntime *JS_NewRuntime3(const JSMallocFunctions *mf, void *opaque,
+                          int flags);
 void JS_FreeRuntime(JSRuntime *rt);
 void *JS_GetRuntimeOpaque(JSRuntime *rt);
 void JS_SetRuntimeOpaque(JSRuntime *rt, void *opaque);
 typedef void JS_MarkFunc(JSRuntime *rt, JSGCObjectHeader *gp);
 void JS_MarkValue(JSRuntime *rt, JSValueConst val, JS_MarkFunc *mark_func);
 void JS_RunGC(JSRuntime *rt);
+/* only collect the objects allocated since the previous collection if
+   the generational mode is enabled */
+void JS_RunMinorGC(JSRuntime *rt);
+void JS_SetGCGenerational(JSRuntime *rt, JS_BOOL enable);
+/* incremental GC: run a slice of at most 'budget_us' microseconds.
+   The last step of the search of the cycles is not sliced: its
+   duration is proportional to the amount of cyclic garbage. Return
+   TRUE if the collection is not finished. */
+JS_BOOL JS_RunGCStep(JSRuntime *rt, int64_t budget_us);
+JS_BOOL JS_IsGCInProgress(JSRuntime *rt);
+/* use 0 to run the automatic GC in a single pause (default) */
+void JS_SetGCPauseBudget(JSRuntime *rt, int64_t budget_us);
+int64_t JS_GetGCPauseBudget(JSRuntime *rt);
+
+typedef struct JSGCStats {
+    int64_t gc_count; /* number of collections */
+    int64_t gc_auto_count; /* collections triggered by the allocations */
+    int64_t gc_time; /* total time spent in the GC, in us */
+    int64_t freed_size; /* bytes reclaimed by the GC */
+    int64_t heap_size; /* allocated bytes after the last collection */
+    int64_t minor_count; /* collections of the young generation only */
+    int64_t max_pause; /* longest pause of the program, in us */
+    /* time spent in each phase, in us */
+    int64_t decref_time;
+    int64_t decref_max_time;
+    int64_t scan_time;
+    int64_t scan_max_time;
+    int64_t free_time;
+    int64_t free_max_time; /* longest free slice */
+    int64_t scanned_count; /* GC objects visited */
+    int64_t freed_count; /* objects and functions freed in cycles */
+} JSGCStats;
+
+void JS_GetGCStats(JSRuntime *rt, JSGCStats *s);
+
+typedef enum JSGCEventEnum {
+    JS_GC_EVENT_START, /* a collection is starting */
+    JS_GC_EVENT_END, /* the collection is finished */
+} JSGCEventEnum;
+
+/* Called at the start and at the end of each collection. The callback
+   must not allocate or free JS values. */
+typedef void JSGCCallback(JSRuntime *rt, JSGCEventEnum event,
+                          const JSGCStats *stats, void *opaque);
+void JS_SetGCCallback(JSRuntime *rt, JSGCCallback *cb, void *opaque);
+
+/* Pacing of the automatic GC. The next collection is triggered when
+   the heap has grown by 'heap_growth' percent since the previous one,
+   or, if 'target_interval' is not zero, by the amount allocated at the
+   current rate during 'target_interval' ms. */
+typedef struct JSGCPolicy {
+    int heap_growth; /* in percent (default = 50) */
+    int target_interval; /* in ms, 0 to use heap_growth */
+    int min_interval; /* in ms, minimum delay between two collections */
+    size_t min_growth; /* minimum allocated bytes between two collections */
+    /* if not NULL, replaces the above heuristics: return the next GC
+       threshold in bytes */
+    size_t (*next_threshold)(JSRuntime *rt, const JSGCStats *stats,
+                             void *opaque);
+    void *opaque;
+} JSGCPolicy;
+
+void JS_SetGCPolicy(JSRuntime *rt, const JSGCPolicy *policy);
+void JS_GetGCPolicy(JSRuntime *rt, JSGCPolicy *policy);
 JS_BOOL JS_IsLiveObject(JSRuntime *rt, JSValueConst obj);
 
 JSContext *JS_NewContext(JSRuntime *rt);
 void JS_FreeContext(JSContext *s);
 JSContext *JS_DupContext(JSContext *ctx);
+/* only with JS_RUNTIME_MEMORY_ACCOUNTING. 0 means no limit. Exceeding
+   the limit raises an out of memory exception in the context. */
+void JS_SetContextMemoryLimit(JSContext *ctx, size_t limit);
+/* return -1 if no memory accounting */
+int64_t JS_GetContextMemoryUsage(JSContext *ctx);
 void *JS_GetContextOpaque(JSContext *ctx);
 void JS_SetContextOpaque(JSContext *ctx, void *opaque);
 JSRuntime *JS_GetRuntime(JSContext *ctx);
@@ -415,6 +500,18 @@ typedef struct JSMemoryUsage {
 void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s);
 void JS_DumpMemoryUsage(FILE *fp, const JSMemoryUsage *s, JSRuntime *rt);
 
+/* Sample the object and string allocations every 'interval' bytes on
+   average and record their call stack. 0 disables the profiler. */
+int JS_SetHeapProfile(JSRuntime *rt, size_t interval);
+/* Dump the sampled allocations in the "collapsed stacks" format of
+   flamegraph.pl: one line per call stack followed by the estimated
+   number of bytes. If 'live' is TRUE, only the objects and strings
+   which are still allocated are taken into account. */
+void JS_DumpHeapProfile(JSRuntime *rt, FILE *fp, JS_BOOL live);
+#define JS_HEAP_SNAPSHOT_ADDRESS (1 << 0) /* also write the object addresses */
+/* Write the graph of the GC objects. Return -1 in case of error. */
+int JS_WriteHeapSnapshot(JSRuntime *rt, FILE *fp, int flags);
+
 /* atom support */
 #define JS_ATOM_NULL 0
 
@@ -844,6 +941,71 @@ typedef int JSInterruptHandler(JSRuntime *rt, void *opaque);
 void JS_SetInterruptHandler(JSRuntime *rt, JSInterruptHandler *cb, void *opaque);
 /* if can_block is TRUE, Atomics.wait() can be used */
 void JS_SetCanBlock(JSRuntime *rt, JS_BOOL can_block);
+
+/* Native code of bytecode functions (JIT or ahead of time
+   compilation). The native code executes the bytecode of the function
+   from the offset 'pc' with the stack pointer 'sp' and the same stack
+   layout as the interpreter. It returns JS_NATIVE_CODE_RETURN with
+   'ret_val' set when the function returns. Otherwise it returns
+   JS_NATIVE_CODE_BAILOUT and the interpreter continues at 'pc' with
+   'sp'. It is entered at the start of the function and after the
+   'loop' opcodes which start the loops. It must bail out before any
+   operation which may throw an exception and when
+   '*interrupt_counter' becomes <= 0 after being decremented at a
+   'loop' opcode. If it bails out without changing 'pc' and 'sp', it
+   is no longer entered at this position. */
+#define JS_NATIVE_CODE_BAILOUT 0
+#define JS_NATIVE_CODE_RETURN  1
+
+typedef struct JSNativeCodeFrame {
+    JSValue *arg_buf;
+    JSValue *var_buf;
+    JSValue *stack_buf;
+    JSValue *sp;
+    uint32_t pc;
+    const JSValue *cpool;
+    int *interrupt_counter;
+    JSValue ret_val;
+} JSNativeCodeFrame;
+
+typedef int JSNativeCodeFunc(JSContext *ctx, JSNativeCodeFrame *f);
+/* called when the number of calls and loop iterations of a bytecode
+   function reaches 'threshold'. Return its native code or NULL. Only
+   the functions created after JS_SetCompileFunc() are counted. The
+   compile function can be removed by setting it to NULL. */
+typedef JSNativeCodeFunc *JSCompileFunc(JSContext *ctx,
+                                        JSValueConst func_obj, void *opaque);
+void JS_SetCompileFunc(JSRuntime *rt, JSCompileFunc *compile_func,
+                       int threshold, void *opaque);
+/* return -1 if native code is not supported for 'func_obj' */
+int JS_SetNativeCode(JSContext *ctx, JSValueConst func_obj,
+                     JSNativeCodeFunc *code);
+/* set the native code of a compiled function or module ('obj' as
+   returned by JS_ReadObject()) and of the functions it contains:
+   'tab' is indexed in depth first order of the functions and of their
+   constant pools. NULL entries are ignored. */
+int JS_SetNativeCodeTable(JSContext *ctx, JSValueConst obj,
+                          JSNativeCodeFunc * const *tab, int count);
+
+typedef struct JSBytecodeInfo {
+    const uint8_t *byte_code; /* see quickjs-opcode.h */
+    uint32_t byte_code_len;
+    int arg_count;
+    int var_count;
+    int stack_size;
+    const JSValue *cpool;
+    int cpool_count;
+    /* FALSE for the generators, the async functions and the 'use
+       math' mode */
+    JS_BOOL native_code_supported;
+} JSBytecodeInfo;
+/* 'func_obj' is a function object, a compiled function or a module */
+int JS_GetBytecodeInfo(JSContext *ctx, JSValueConst func_obj,
+                       JSBytecodeInfo *info);
+/* set 'stack_levels[pos]' ('byte_code_len' entries) to the stack size
+   before the opcode at 'pos' or to 0xffff if it is not reachable */
+int JS_GetBytecodeStackLevels(JSContext *ctx, JSValueConst func_obj,
+                              uint16_t *stack_levels);
 /* set the [IsHTMLDDA] internal slot */
 void JS_SetIsHTMLDDA(JSContext *ctx, JSValueConst obj);
 
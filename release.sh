@@ -135,7 +135,7 @@ cp Makefile VERSION TODO Changelog readme.txt LICENSE \
    release.sh unicode_download.sh \
    qjs.c qjsc.c qjscalc.js repl.js \
    quickjs.c quickjs.h quickjs-atom.h \
-   quickjs-libc.c quickjs-libc.h quickjs-opcode.h \
+   quickjs-libc.c quickjs-libc.h quickjs-opcode.h quickjs-opcode-info.h \
    cutils.c cutils.h list.h \
    libregexp.c libregexp.h libregexp-opcode.h \
    libunicode.c libunicode.h libunicode-table.h \
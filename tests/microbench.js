@@ -228,6 +228,19 @@ function prop_create(n)
     return n * 4;
 }
 
+function object_churn(n)
+{
+    var obj, m, j, f;
+    m = new Map();
+    for(j = 0; j < n; j++) {
+        obj = { a: j, b: { c: j } };
+        f = function() { return obj; };
+        m.set(j & 63, f);
+    }
+    global_res = m;
+    return n;
+}
+
 function prop_delete(n)
 {
     var obj, j;
@@ -740,6 +753,144 @@ function string_build4(n)
     return n * 100;
 }
 
+/* long substrings */
+function string_slice(n)
+{
+    var i, j, s, r;
+    s = "0123456789".repeat(1000);
+    for(j = 0; j < n; j++) {
+        for(i = 0; i < 100; i++)
+            r = s.substring(i, i + 5000);
+        global_res = r;
+    }
+    return n * 100;
+}
+
+/* one character strings */
+function string_char(n)
+{
+    var i, j, s, r;
+    s = "0123456789".repeat(10);
+    for(j = 0; j < n; j++) {
+        for(i = 0; i < 100; i++)
+            r = s[i];
+        for(i = 0; i < 100; i++)
+            r = s.charAt(i);
+        global_res = r;
+    }
+    return n * 200;
+}
+
+/* string search and comparison */
+function string_search_text(wide)
+{
+    var s = "The quick brown fox jumps over the lazy dog. ".repeat(40);
+    if (wide)
+        s = s.replace(/o/g, "ö‘");
+    return s;
+}
+
+function string_index_of_char(n)
+{
+    var j, s, r;
+    s = string_search_text(false) + "#";
+    for(j = 0; j < n; j++) {
+        r = s.indexOf("#");
+    }
+    global_res = r;
+    return n;
+}
+
+function string_index_of_short(n)
+{
+    var j, s, s16, r;
+    s = string_search_text(false) + "dog!";
+    s16 = string_search_text(true) + "dog!";
+    for(j = 0; j < n; j++) {
+        r = s.indexOf("dog!");
+        r += s16.indexOf("dog!");
+    }
+    global_res = r;
+    return n * 2;
+}
+
+function string_index_of_long(n)
+{
+    var j, s, t, r;
+    s = string_search_text(false);
+    t = "The quick brown fox jumps over the lazy cat.";
+    s += t;
+    for(j = 0; j < n; j++) {
+        r = s.indexOf(t);
+    }
+    global_res = r;
+    return n;
+}
+
+function string_split(n)
+{
+    var j, s, r;
+    s = string_search_text(false);
+    for(j = 0; j < n; j++) {
+        r = s.split("fox");
+    }
+    global_res = r;
+    return n;
+}
+
+function string_compare(n)
+{
+    var j, s1, s2, s3, s4, r;
+    s1 = string_search_text(false) + "a";
+    s2 = string_search_text(false) + "b";
+    s3 = string_search_text(true) + "a";
+    s4 = string_search_text(true) + "b";
+    r = 0;
+    for(j = 0; j < n; j++) {
+        r += (s1 < s2);
+        r += (s3 < s4);
+        r += (s1 === s2);
+    }
+    global_res = r;
+    return n * 3;
+}
+
+/* write a string to a file and read it back: the UTF-8 conversions
+   of JS_ToCStringLen() and JS_NewStringLen() */
+function io_string(n, c)
+{
+    var j, s, f, r;
+    s = "";
+    for(j = 0; j < 1024; j++)
+        s += "Lorem ipsum dolor sit amet, consectetur adipiscing elit" + c;
+    f = std.tmpfile();
+    r = 0;
+    for(j = 0; j < n; j++) {
+        f.seek(0, std.SEEK_SET);
+        f.puts(s);
+        f.seek(0, std.SEEK_SET);
+        r += f.readAsString().length;
+    }
+    f.close();
+    global_res = r;
+    return n;
+}
+
+function io_string_ascii(n)
+{
+    return io_string(n, ".");
+}
+
+function io_string_latin1(n)
+{
+    return io_string(n, "\u00e9");
+}
+
+function io_string_utf16(n)
+{
+    return io_string(n, "\u20ac");
+}
+
 /* sort bench */
 
 function sort_bench(text) {
@@ -958,6 +1109,7 @@ function main(argc, argv, g)
         prop_read,
         prop_write,
         prop_create,
+        object_churn,
         prop_delete,
         array_read,
         array_write,
@@ -985,8 +1137,18 @@ function main(argc, argv, g)
         math_min,
         string_build1,
         string_build2,
-        //string_build3,
-        //string_build4,
+        string_build3,
+        string_build4,
+        string_slice,
+        string_char,
+        string_index_of_char,
+        string_index_of_short,
+        string_index_of_long,
+        string_split,
+        string_compare,
+        io_string_ascii,
+        io_string_latin1,
+        io_string_utf16,
         sort_bench,
         int_to_string,
         float_to_string,
@@ -0,0 +1,725 @@
+/*
+ * QuickJS: C API tests
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../quickjs.h"
+
+/* must be the same as in quickjs.c */
+#define SHORT_OPCODES 1
+
+#include "../quickjs-opcode-info.h"
+
+#define countof(x) (sizeof(x) / sizeof((x)[0]))
+
+#define check(cond) check1(cond, #cond, __LINE__)
+
+static void check1(int cond, const char *str, int line)
+{
+    if (!cond) {
+        fprintf(stderr, "test_api.c:%d: check failed: %s\n", line, str);
+        exit(1);
+    }
+}
+
+static JSValue eval(JSContext *ctx, const char *str)
+{
+    return JS_Eval(ctx, str, strlen(str), "<test>", JS_EVAL_TYPE_GLOBAL);
+}
+
+/* check that 'val' is the exception and that it is an 'out of memory'
+   InternalError */
+static void check_out_of_memory(JSContext *ctx, JSValue val)
+{
+    JSValue exc;
+    const char *str;
+
+    check(JS_IsException(val));
+    exc = JS_GetException(ctx);
+    check(JS_IsError(ctx, exc));
+    str = JS_ToCString(ctx, exc);
+    check(str && !strcmp(str, "InternalError: out of memory"));
+    JS_FreeCString(ctx, str);
+    JS_FreeValue(ctx, exc);
+}
+
+static void test_out_of_memory(void)
+{
+    JSRuntime *rt;
+    JSContext *ctx;
+    JSValue val;
+    const char *str;
+    int i;
+
+    rt = JS_NewRuntime();
+    JS_SetMemoryLimit(rt, 4000000);
+    ctx = JS_NewContext(rt);
+    check(ctx != NULL);
+
+    /* when caught, the memory is still full so the reserve cannot be
+       allocated again before the next error */
+    val = eval(ctx,
+               "var res = [], head, i;\n"
+               "for(i = 0; i < 5; i++) {\n"
+               "    head = null;\n"
+               "    try {\n"
+               "        for(;;) head = { next: head };\n"
+               "    } catch(e) {\n"
+               "        res.push(e instanceof InternalError &&\n"
+               "                 e.message === 'out of memory');\n"
+               "    }\n"
+               "}\n"
+               "head = null;\n"
+               "res.join();\n");
+    str = JS_ToCString(ctx, val);
+    check(str && !strcmp(str, "true,true,true,true,true"));
+    JS_FreeCString(ctx, str);
+    JS_FreeValue(ctx, val);
+
+    /* uncaught errors */
+    for(i = 0; i < 5; i++) {
+        val = eval(ctx, "(function () {\n"
+                   "    var head = null;\n"
+                   "    for(;;) head = { next: head };\n"
+                   "})();\n");
+        check_out_of_memory(ctx, val);
+    }
+
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static void *test_malloc(JSMallocState *s, size_t size)
+{
+    return malloc(size);
+}
+
+static void test_free(JSMallocState *s, void *ptr)
+{
+    free(ptr);
+}
+
+static void *test_realloc(JSMallocState *s, void *ptr, size_t size)
+{
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    return realloc(ptr, size);
+}
+
+static const JSMallocFunctions test_malloc_funcs = {
+    test_malloc,
+    test_free,
+    test_realloc,
+    NULL,
+};
+
+static void test_context_memory_limit(int use_slab)
+{
+    JSRuntime *rt;
+    JSContext *ctx1, *ctx2;
+    JSValue val, global;
+    int64_t usage1, usage2, limit2;
+    const char *str;
+
+    rt = JS_NewRuntime3(&test_malloc_funcs, NULL,
+                        JS_RUNTIME_MEMORY_ACCOUNTING);
+    if (use_slab)
+        check(JS_SetSlabAllocator(rt, 1) == 0);
+    ctx1 = JS_NewContext(rt);
+    ctx2 = JS_NewContext(rt);
+    check(ctx1 != NULL && ctx2 != NULL);
+    check(JS_GetContextMemoryUsage(ctx1) > 0);
+
+    /* the small objects are charged to the context */
+    usage1 = JS_GetContextMemoryUsage(ctx1);
+    JS_FreeValue(ctx1, eval(ctx1, "var l = null, i;\n"
+                            "for(i = 0; i < 10000; i++) l = { next: l };\n"));
+    check(JS_GetContextMemoryUsage(ctx1) >= usage1 + 10000 * 48);
+    JS_FreeValue(ctx1, eval(ctx1, "l = null;"));
+    check(JS_GetContextMemoryUsage(ctx1) < usage1 + 10000);
+
+    /* the limit is hit in ctx1 only */
+    JS_SetContextMemoryLimit(ctx1, JS_GetContextMemoryUsage(ctx1) + 1000000);
+    val = eval(ctx1,
+               "var res = [], a, i;\n"
+               "for(i = 0; i < 3; i++) {\n"
+               "    a = [];\n"
+               "    try {\n"
+               "        for(;;) a.push({});\n"
+               "    } catch(e) {\n"
+               "        /* no memory is left while 'a' is alive */\n"
+               "        a = null;\n"
+               "        res.push(e instanceof InternalError &&\n"
+               "                 e.message === 'out of memory' &&\n"
+               "                 typeof e.stack === 'string');\n"
+               "    }\n"
+               "}\n"
+               "a = null;\n"
+               "res.join();\n");
+    str = JS_ToCString(ctx1, val);
+    check(str && !strcmp(str, "true,true,true"));
+    JS_FreeCString(ctx1, str);
+    JS_FreeValue(ctx1, val);
+    /* the memory is released before the exception is converted */
+    val = eval(ctx1, "try { for(a = [];;) a.push({}); } finally { a = null; }");
+    check_out_of_memory(ctx1, val);
+
+    /* while the exception of a quota error is pending, the limits of
+       the other contexts are unchanged */
+    limit2 = JS_GetContextMemoryUsage(ctx2) + 1000000;
+    JS_SetContextMemoryLimit(ctx2, limit2);
+    val = eval(ctx1, "for(a = [];;) a.push({});");
+    check(JS_IsException(val));
+    val = eval(ctx2, "var b = null;\n"
+               "try { for(;;) b = { next: b }; } catch(e) {}\n");
+    check(!JS_IsException(val));
+    JS_FreeValue(ctx2, val);
+    check(JS_GetContextMemoryUsage(ctx2) < limit2 + 4096);
+    /* no memory is left to compile the code releasing the objects */
+    JS_SetContextMemoryLimit(ctx1, 0);
+    JS_SetContextMemoryLimit(ctx2, 0);
+    JS_FreeValue(ctx2, eval(ctx2, "b = null;"));
+    JS_FreeValue(ctx1, eval(ctx1, "a = null;"));
+
+    /* a block is credited back to the context it was charged to */
+    usage1 = JS_GetContextMemoryUsage(ctx1);
+    val = eval(ctx1, "'abc'.repeat(100000)");
+    check(JS_GetContextMemoryUsage(ctx1) >= usage1 + 300000);
+    global = JS_GetGlobalObject(ctx2);
+    usage2 = JS_GetContextMemoryUsage(ctx2);
+    JS_SetPropertyStr(ctx2, global, "s", val);
+    JS_FreeValue(ctx2, global);
+    val = eval(ctx2, "s = undefined;");
+    check(!JS_IsException(val));
+    JS_FreeValue(ctx2, val);
+    check(JS_GetContextMemoryUsage(ctx1) < usage1 + 300000);
+    check(JS_GetContextMemoryUsage(ctx2) > usage2 - 300000);
+
+    /* free a context with memory still charged to it */
+    val = eval(ctx1, "'abc'.repeat(100000)");
+    global = JS_GetGlobalObject(ctx2);
+    JS_SetPropertyStr(ctx2, global, "s", val);
+    JS_FreeContext(ctx1);
+    val = JS_GetPropertyStr(ctx2, global, "s");
+    str = JS_ToCString(ctx2, val);
+    check(str && strlen(str) == 300000);
+    JS_FreeCString(ctx2, str);
+    JS_FreeValue(ctx2, val);
+    val = eval(ctx2, "s = undefined;");
+    check(!JS_IsException(val));
+    JS_FreeValue(ctx2, val);
+    JS_FreeValue(ctx2, global);
+
+    JS_FreeContext(ctx2);
+    JS_FreeRuntime(rt);
+}
+
+static int interrupt_count;
+
+static int test_interrupt_handler(JSRuntime *rt, void *opaque)
+{
+    interrupt_count++;
+    return 1;
+}
+
+/* the interrupts must be polled in all the loops */
+static void test_interrupt(void)
+{
+    static const char * const loops[] = {
+        "while(1) {}",
+        "for(;;) { continue; }",
+        "do {} while(1);",
+        "var i = 0; for(;;) { if (i++ & 1) continue; }",
+        "a: for(;;) { for(;;) { continue a; } }",
+        "(function () { for(;;); })();",
+        "(function* () { while(true) {} })().next();",
+    };
+    JSRuntime *rt;
+    JSContext *ctx;
+    JSValue val, exc;
+    const char *str;
+    int i;
+
+    rt = JS_NewRuntime();
+    ctx = JS_NewContext(rt);
+    check(ctx != NULL);
+    JS_SetInterruptHandler(rt, test_interrupt_handler, NULL);
+    for(i = 0; i < countof(loops); i++) {
+        interrupt_count = 0;
+        val = eval(ctx, loops[i]);
+        check(JS_IsException(val));
+        check(interrupt_count == 1);
+        exc = JS_GetException(ctx);
+        str = JS_ToCString(ctx, exc);
+        check(str && !strcmp(str, "InternalError: interrupted"));
+        JS_FreeCString(ctx, str);
+        JS_FreeValue(ctx, exc);
+    }
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static int compile_count;
+
+static JSNativeCodeFunc *test_compile(JSContext *ctx, JSValueConst func_obj,
+                                      void *opaque)
+{
+    compile_count++;
+    return NULL;
+}
+
+static void test_compile_func(void)
+{
+    JSRuntime *rt;
+    JSContext *ctx;
+    JSValue val;
+    int32_t res;
+
+    rt = JS_NewRuntime();
+    ctx = JS_NewContext(rt);
+    check(ctx != NULL);
+
+    JS_SetCompileFunc(rt, test_compile, 100, NULL);
+    val = eval(ctx, "function f(x) { return x + 1; }\n"
+               "f(1) + f(2);\n");
+    check(JS_ToInt32(ctx, &res, val) == 0 && res == 5);
+    JS_FreeValue(ctx, val);
+    check(compile_count == 0);
+
+    /* the functions created with a compile function keep working once
+       it is removed */
+    JS_SetCompileFunc(rt, NULL, 0, NULL);
+    val = eval(ctx, "var i, s = 0;\n"
+               "for(i = 0; i < 1000; i++) s += f(i);\n"
+               "s;\n");
+    check(JS_ToInt32(ctx, &res, val) == 0 && res == 500500);
+    JS_FreeValue(ctx, val);
+    check(compile_count == 0);
+
+    JS_SetCompileFunc(rt, test_compile, 100, NULL);
+    val = eval(ctx, "function g(x) { return x + 1; }\n"
+               "for(i = 0; i < 1000; i++) g(i);\n");
+    check(!JS_IsException(val));
+    JS_FreeValue(ctx, val);
+    /* the global code and g */
+    check(compile_count == 2);
+
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static int native_return_count, native_bailout_count;
+
+/* return 42 without running the bytecode */
+static int native_return(JSContext *ctx, JSNativeCodeFrame *f)
+{
+    /* entered at the start of the function with an empty stack */
+    check(f->pc == 0 && f->sp == f->stack_buf);
+    native_return_count++;
+    f->ret_val = JS_NewInt32(ctx, 42);
+    return JS_NATIVE_CODE_RETURN;
+}
+
+/* run the first opcode (get_arg0) and let the interpreter continue */
+static int native_bailout(JSContext *ctx, JSNativeCodeFrame *f)
+{
+    check(f->pc == 0 && f->sp == f->stack_buf);
+    native_bailout_count++;
+    *f->sp++ = JS_DupValue(ctx, f->arg_buf[0]);
+    f->pc = 1;
+    return JS_NATIVE_CODE_BAILOUT;
+}
+
+static JSNativeCodeFunc *test_compile_native(JSContext *ctx,
+                                             JSValueConst func_obj,
+                                             void *opaque)
+{
+    JSBytecodeInfo info;
+    JSNativeCodeFunc *code;
+    uint16_t *stack_levels;
+    JSValue val;
+    const char *name;
+
+    val = JS_GetPropertyStr(ctx, func_obj, "name");
+    name = JS_ToCString(ctx, val);
+    JS_FreeValue(ctx, val);
+    check(name != NULL);
+    code = NULL;
+    if (!strcmp(name, "f_return"))
+        code = native_return;
+    else if (!strcmp(name, "f_bailout"))
+        code = native_bailout;
+    JS_FreeCString(ctx, name);
+    if (!code)
+        return NULL;
+
+    check(JS_GetBytecodeInfo(ctx, func_obj, &info) == 0);
+    check(info.native_code_supported);
+    stack_levels = malloc(sizeof(stack_levels[0]) * info.byte_code_len);
+    check(stack_levels != NULL);
+    check(JS_GetBytecodeStackLevels(ctx, func_obj, stack_levels) == 0);
+    check(stack_levels[0] == 0);
+    if (code == native_bailout) {
+        /* the interpreter resumes after get_arg0 with one value on the
+           stack */
+        check(info.byte_code[0] == OP_get_arg0);
+        check(stack_levels[1] == 1);
+    }
+    free(stack_levels);
+    return code;
+}
+
+static void test_native_code(void)
+{
+    JSRuntime *rt;
+    JSContext *ctx;
+    JSValue val;
+    int32_t res;
+
+    rt = JS_NewRuntime();
+    ctx = JS_NewContext(rt);
+    check(ctx != NULL);
+
+    JS_SetCompileFunc(rt, test_compile_native, 10, NULL);
+    val = eval(ctx, "function f_return(x) { return x + 1; }\n"
+               "function f_bailout(x) { return x + 1; }\n"
+               "var i, s1 = 0, s2 = 0;\n"
+               "for(i = 0; i < 100; i++) {\n"
+               "    s1 += f_return(i);\n"
+               "    s2 += f_bailout(i);\n"
+               "}\n"
+               "[s1, s2];\n");
+    check(!JS_IsException(val));
+    /* the first 9 calls run in the interpreter, the next ones in the
+       native code */
+    check(native_return_count == 91);
+    check(native_bailout_count == 91);
+    check(JS_ToInt32(ctx, &res, JS_GetPropertyUint32(ctx, val, 0)) == 0 &&
+          res == (9 * 10 / 2) + 91 * 42);
+    check(JS_ToInt32(ctx, &res, JS_GetPropertyUint32(ctx, val, 1)) == 0 &&
+          res == 100 * 101 / 2);
+    JS_FreeValue(ctx, val);
+
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static void test_slab_allocator(void)
+{
+    JSRuntime *rt;
+    JSContext *ctx;
+    JSMemoryUsage mu;
+    JSValue val;
+    int64_t size0;
+
+    rt = JS_NewRuntime();
+    /* the atoms of the runtime are moved to the slab pages and back */
+    check(JS_SetSlabAllocator(rt, 1) == 0);
+    check(JS_SetSlabAllocator(rt, 0) == 0);
+    check(JS_SetSlabAllocator(rt, 1) == 0);
+    ctx = JS_NewContext(rt);
+    check(ctx != NULL);
+    check(JS_SetSlabAllocator(rt, 0) < 0);
+
+    JS_RunGC(rt);
+    JS_ComputeMemoryUsage(rt, &mu);
+    size0 = mu.malloc_size;
+    val = eval(ctx, "var a = [], i;\n"
+               "for(i = 0; i < 100000; i++)\n"
+               "    a.push({ x: i, y: 'a' + i, z: [ i ] });\n"
+               "a = null;\n");
+    check(!JS_IsException(val));
+    JS_FreeValue(ctx, val);
+    /* the empty pages are released after a collection */
+    JS_RunGC(rt);
+    JS_ComputeMemoryUsage(rt, &mu);
+    check(mu.malloc_size < size0 + 1024 * 1024);
+
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static void run_void(JSContext *ctx, const char *str)
+{
+    JSValue val;
+
+    val = eval(ctx, str);
+    check(!JS_IsException(val));
+    JS_FreeValue(ctx, val);
+}
+
+static void test_gc_generational(void)
+{
+    JSRuntime *rt;
+    JSContext *ctx;
+    JSGCStats st;
+    int64_t freed_count;
+
+    rt = JS_NewRuntime();
+    ctx = JS_NewContext(rt);
+    check(ctx != NULL);
+    JS_SetGCThreshold(rt, -1);
+    JS_SetGCGenerational(rt, 1);
+    /* all the objects of the context are in the old generation */
+    JS_RunGC(rt);
+
+    /* these cycles survive a minor collection and are promoted */
+    run_void(ctx, "var old = [], i, o;\n"
+             "for(i = 0; i < 1000; i++) {\n"
+             "    o = {}; o.self = o; old.push(o);\n"
+             "}\n"
+             "o = null;\n");
+    JS_RunMinorGC(rt);
+    run_void(ctx, "old = null;\n"
+             "for(i = 0; i < 500; i++) {\n"
+             "    o = {}; o.self = o;\n"
+             "}\n"
+             "o = null;\n");
+
+    /* a minor collection only frees the young cycles */
+    JS_GetGCStats(rt, &st);
+    freed_count = st.freed_count;
+    JS_RunMinorGC(rt);
+    JS_GetGCStats(rt, &st);
+    check(st.minor_count == 2);
+    check(st.freed_count - freed_count >= 500 &&
+          st.freed_count - freed_count < 1000);
+
+    /* the promoted cycles are freed by a full collection */
+    freed_count = st.freed_count;
+    JS_RunGC(rt);
+    JS_GetGCStats(rt, &st);
+    check(st.freed_count - freed_count >= 1000);
+
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static void test_gc_incremental(void)
+{
+    JSRuntime *rt;
+    JSContext *ctx;
+    JSGCStats st;
+    int64_t budget, freed_count;
+    int steps;
+
+    rt = JS_NewRuntime();
+    JS_SetGCThreshold(rt, -1);
+    ctx = JS_NewContext(rt);
+    check(ctx != NULL);
+
+    /* a large heap of live cycles and some cyclic garbage */
+    run_void(ctx, "var live = [], i, j, a, o, k = 0;\n"
+             "for(i = 0; i < 300; i++) {\n"
+             "    a = [];\n"
+             "    for(j = 0; j < 1000; j++) {\n"
+             "        o = { next: null }; o.next = { prev: o }; a.push(o);\n"
+             "    }\n"
+             "    live.push(a);\n"
+             "}\n"
+             "for(i = 0; i < 1000; i++) {\n"
+             "    o = {}; o.self = o;\n"
+             "}\n"
+             "o = null;\n");
+    JS_GetGCStats(rt, &st);
+    freed_count = st.freed_count;
+
+    budget = 5000;
+    steps = 0;
+    while (JS_RunGCStep(rt, budget)) {
+        /* the program modifies the heap between the slices */
+        run_void(ctx, "live[k++ % 300] = [ { x: 1 } ];\n"
+                 "o = {}; o.self = o; o = null;\n");
+        steps++;
+    }
+    JS_GetGCStats(rt, &st);
+    check(steps > 1);
+    check(st.max_pause < budget + 10000);
+    check(st.freed_count - freed_count >= 1000);
+    check(!JS_IsGCInProgress(rt));
+
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+/* return the number of 'op' opcodes in the bytecode of 'func' */
+static int count_opcode(JSContext *ctx, JSValueConst func, int op)
+{
+    JSBytecodeInfo bi;
+    uint32_t pos;
+    int count;
+
+    check(JS_GetBytecodeInfo(ctx, func, &bi) == 0);
+    count = 0;
+    for(pos = 0; pos < bi.byte_code_len;
+        pos += short_opcode_info(bi.byte_code[pos]).size) {
+        if (bi.byte_code[pos] == op)
+            count++;
+    }
+    return count;
+}
+
+static void call_f(JSContext *ctx, JSValueConst f, const char *args)
+{
+    JSValue val;
+    char buf[64];
+
+    snprintf(buf, sizeof(buf), "f(%s);", args);
+    val = eval(ctx, buf);
+    check(!JS_IsException(val));
+    JS_FreeValue(ctx, val);
+}
+
+static void test_quicken(void)
+{
+    JSRuntime *rt;
+    JSContext *ctx;
+    JSValue f;
+    int i;
+
+    rt = JS_NewRuntime();
+    ctx = JS_NewContext(rt);
+    check(ctx != NULL);
+
+    f = eval(ctx, "function f(x, a, b) { return x ? a + b : a * b; } f;");
+    check(JS_IsFunction(ctx, f));
+    call_f(ctx, f, "0, 1.5, 2.5");
+    check(count_opcode(ctx, f, OP_mul_float) == 1);
+    call_f(ctx, f, "1, 1.5, 2.5");
+    check(count_opcode(ctx, f, OP_add_float) == 1);
+
+    /* the add site keeps missing until the quickening is disabled */
+    for(i = 0; i < 20; i++) {
+        call_f(ctx, f, "1, 'a', 'b'");
+        call_f(ctx, f, "1, 1.5, 2.5");
+    }
+    check(count_opcode(ctx, f, OP_add) == 1);
+
+    /* a miss of the mul site, quickened before the limit, must not
+       enable the quickening again */
+    for(i = 0; i < 20; i++) {
+        call_f(ctx, f, "0, 1, 2");
+        call_f(ctx, f, "0, 1.5, 2.5");
+        call_f(ctx, f, "1, 1.5, 2.5");
+    }
+    check(count_opcode(ctx, f, OP_add) == 1);
+    check(count_opcode(ctx, f, OP_mul) == 1);
+    JS_FreeValue(ctx, f);
+
+    /* the concatenation of a rope and a string does not miss */
+    f = eval(ctx, "function f(s) {\n"
+             "    for(var i = 0; i < 1000; i++) s = s + 'abcd';\n"
+             "    return s;\n"
+             "} f;");
+    check(JS_IsFunction(ctx, f));
+    call_f(ctx, f, "'a'.repeat(300)");
+    check(count_opcode(ctx, f, OP_add_string) == 1);
+    JS_FreeValue(ctx, f);
+
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+static JSValue js_get_tag(JSContext *ctx, JSValueConst this_val,
+                          int argc, JSValueConst *argv)
+{
+    return JS_NewInt32(ctx, JS_VALUE_GET_TAG(argv[0]));
+}
+
+static void test_string_rope(void)
+{
+    JSRuntime *rt;
+    JSContext *ctx;
+    JSValue val, global, func, arg;
+    const char *str;
+    size_t len;
+
+    rt = JS_NewRuntime();
+    ctx = JS_NewContext(rt);
+    check(ctx != NULL);
+    global = JS_GetGlobalObject(ctx);
+    JS_SetPropertyStr(ctx, global, "get_tag",
+                      JS_NewCFunction(ctx, js_get_tag, "get_tag", 1));
+
+    /* a long concatenation is internally a rope but the C code only
+       sees flat strings */
+    val = eval(ctx, "var s = 'a'.repeat(200) + 'b'.repeat(100); s;");
+    check(JS_VALUE_GET_TAG(val) == JS_TAG_STRING);
+    str = JS_ToCStringLen(ctx, &len, val);
+    check(str && len == 300 && str[199] == 'a' && str[200] == 'b');
+    JS_FreeCString(ctx, str);
+    JS_FreeValue(ctx, val);
+
+    /* function argument */
+    val = eval(ctx, "get_tag('a'.repeat(200) + 'b'.repeat(100));");
+    check(JS_VALUE_GET_TAG(val) == JS_TAG_INT &&
+          JS_VALUE_GET_INT(val) == JS_TAG_STRING);
+
+    /* property value */
+    JS_FreeValue(ctx, eval(ctx, "var o = { p: 'a'.repeat(200) + "
+                           "'b'.repeat(100) };"));
+    val = JS_GetPropertyStr(ctx, global, "o");
+    func = JS_GetPropertyStr(ctx, val, "p");
+    check(JS_VALUE_GET_TAG(func) == JS_TAG_STRING);
+    JS_FreeValue(ctx, func);
+    JS_FreeValue(ctx, val);
+
+    /* function result and exception */
+    func = eval(ctx, "(function (t) { var r = 'a'.repeat(200) + t; "
+                "if (t == 'x') throw r; return r; })");
+    arg = JS_NewString(ctx, "b");
+    val = JS_Call(ctx, func, JS_UNDEFINED, 1, (JSValueConst *)&arg);
+    check(JS_VALUE_GET_TAG(val) == JS_TAG_STRING);
+    JS_FreeValue(ctx, val);
+    JS_FreeValue(ctx, arg);
+    arg = JS_NewString(ctx, "x");
+    val = JS_Call(ctx, func, JS_UNDEFINED, 1, (JSValueConst *)&arg);
+    check(JS_IsException(val));
+    JS_FreeValue(ctx, arg);
+    val = JS_GetException(ctx);
+    check(JS_VALUE_GET_TAG(val) == JS_TAG_STRING);
+    JS_FreeValue(ctx, val);
+    JS_FreeValue(ctx, func);
+
+    JS_FreeValue(ctx, global);
+    JS_FreeContext(ctx);
+    JS_FreeRuntime(rt);
+}
+
+int main(int argc, char **argv)
+{
+    test_out_of_memory();
+    test_context_memory_limit(0);
+    test_context_memory_limit(1);
+    test_compile_func();
+    test_native_code();
+    test_interrupt();
+    test_slab_allocator();
+    test_gc_generational();
+    test_gc_incremental();
+    test_quicken();
+    test_string_rope();
+    return 0;
+}
@@ -277,6 +277,14 @@ function test_string()
     assert("aaa".lastIndexOf("", 4), 3);
     assert("aaa".lastIndexOf("", Infinity), 3);
 
+    a = "ab".repeat(100) + "abb";
+    assert(a.indexOf("ab".repeat(20) + "b"), 162);
+    assert(a.indexOf("ab".repeat(20) + "b", 163), -1);
+    assert(("\u0101b".repeat(50) + "\u0101bb").indexOf("\u0101b".repeat(20) + "b"), 62);
+    assert("x\u0101".repeat(10).indexOf("\u0101x\u0101"), 1);
+    assert("abc".repeat(30).lastIndexOf("cab"), 86);
+    assert("abc".repeat(30).includes("cabd"), false);
+
     assert("a,b,c".split(","), ["a","b","c"]);
     assert(",b,c".split(","), ["","b","c"]);
     assert("a,b,".split(","), ["a","b",""]);
@@ -304,6 +312,92 @@ function test_string()
     assert("abc".padStart(Infinity, ""), "abc");
 }
 
+/* long concatenations are lazy (ropes) */
+function test_string_rope()
+{
+    var a, b, c, i, j, seed, tab, ref, s, m, o;
+
+    a = "";
+    for(i = 0; i < 1000; i++)
+        a += "ab" + i;
+    b = "";
+    for(i = 999; i >= 0; i--)
+        b = "ab" + i + b;
+    assert(a.length, 4890);
+    assert(a === b);
+    assert(a == b);
+    assert(a[100], "2");
+    assert(a.charCodeAt(4889), 0x39);
+    assert(a.slice(-8), "998ab999");
+    assert(typeof a, "string");
+    assert(!!a, true);
+    assert(a < a + "x");
+    assert(a + "x" > a);
+    assert(Object(a).length, 4890);
+    assert(JSON.stringify([a])[2], "a");
+
+    m = new Map();
+    m.set(a, 1);
+    assert(m.get(b), 1);
+    o = {};
+    o[a] = 2;
+    assert(o[b], 2);
+
+    /* long substrings share the characters of their parent */
+    s = a.substring(10, 3000);
+    assert(s.length, 2990);
+    assert(s[0], "b");
+    assert(s === b.slice(10, 3000));
+    assert(s.slice(0, 100) + s.slice(100) === s);
+    assert((s + "x").length, 2991);
+    assert(o[a.substring(0, 4000) + a.substring(4000)], 2);
+    s = "ā" + a.slice(0, 999);
+    c = s.substring(1, 500);
+    assert(c.charCodeAt(0), 0x61);
+    assert(c === a.substring(0, 499));
+    assert(/(b\d+a){100}/.exec(a)[0].length > 100);
+
+    /* random concatenations checked against Array.prototype.join */
+    seed = 1;
+    function rand(n) {
+        seed = (seed * 1103515245 + 12345) & 0x7fffffff;
+        return seed % n;
+    }
+    tab = [ "" ];
+    ref = [ [] ];
+    for(i = 0; i < 2000; i++) {
+        j = rand(tab.length);
+        switch(rand(4)) {
+        case 0:
+            s = "x\u0101".repeat(rand(200));
+            tab.push(tab[j] + s);
+            ref.push(ref[j].concat([s]));
+            break;
+        case 1:
+            s = "y".repeat(rand(300));
+            tab.push(s + tab[j]);
+            ref.push([s].concat(ref[j]));
+            break;
+        default:
+            c = rand(tab.length);
+            tab.push(tab[j] + tab[c]);
+            ref.push(ref[j].concat(ref[c]));
+            break;
+        }
+        if (tab.length > 50) {
+            c = rand(tab.length);
+            tab.splice(c, 1);
+            ref.splice(c, 1);
+        }
+    }
+    for(i = 0; i < tab.length; i++) {
+        s = ref[i].join("");
+        assert(tab[i].length, s.length);
+        assert(tab[i] === s);
+        assert(tab[i] + "z" === s + "z");
+    }
+}
+
 function test_math()
 {
     var a;
@@ -672,6 +766,7 @@ test_function();
 test_enum();
 test_array();
 test_string();
+test_string_rope();
 test_math();
 test_number();
 test_eval();
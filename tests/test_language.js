@@ -184,6 +184,29 @@ function test_inc_dec()
     a = [true];
     r = a[0]--;
     assert(r === 1 && a[0] === 0, true, "--");
+
+    /* add of a small constant to a local variable */
+    a = 1;
+    a += 100;
+    a = a + 27;
+    assert(a, 128, "+=");
+    a += 300;
+    assert(a, 428, "+=");
+    a = 0x7fffffff;
+    a += 1;
+    assert(a, 2147483648, "+=");
+    a = 0.5;
+    a += 2;
+    assert(a, 2.5, "+=");
+    a = "a";
+    a += 2;
+    assert(a, "a2", "+=");
+    a = { valueOf() { return 3; } };
+    a += 2;
+    assert(a, 5, "+=");
+    a = undefined;
+    a += 1;
+    assert(isNaN(a), true, "+=");
 }
 
 function F(x)
@@ -322,6 +345,15 @@ function test_class()
     assert(o.z === 20);
     assert(o.h() === 1);
 
+    /* 'this' can be initialized only once */
+    class D2 extends C {
+        constructor() {
+            for(var i = 0; i < 2; i++)
+                super();
+        }
+    };
+    assert_throws(ReferenceError, () => new D2());
+
     /* test class name scope */
     var E1 = class E { static F() { return E; } };
     assert(E1 === E1.F());
@@ -526,6 +558,284 @@ function test_function_expr_name()
     assert_throws(TypeError, f);
 }
 
+function test_inline_cache()
+{
+    var a, i, r, o, p;
+    function get(o) { return o.x; }
+    function set(o, v) { "use strict"; o.x = v; }
+
+    /* monomorphic then polymorphic then megamorphic */
+    a = [];
+    for(i = 0; i < 8; i++) {
+        o = { x: i };
+        o["y" + i] = 0;
+        a.push(o);
+    }
+    for(r = 0; r < 3; r++) {
+        for(i = 0; i < a.length; i++) {
+            assert(get(a[i]), i + r);
+            set(a[i], i + r + 1);
+        }
+    }
+
+    /* shape changes on the same object */
+    o = { x: 1 };
+    assert(get(o), 1);
+    Object.defineProperty(o, "x", { get: function() { return 2; } });
+    assert(get(o), 2);
+    o = { x: 1 };
+    assert(get(o), 1);
+    delete o.x;
+    assert(get(o), undefined);
+    Object.prototype.x = 3;
+    assert(get(o), 3);
+    delete Object.prototype.x;
+
+    /* read only properties */
+    o = { x: 1 };
+    set(o, 2);
+    assert(o.x, 2);
+    Object.freeze(o);
+    assert_throws(TypeError, function() { set(o, 3); });
+    assert(get(o), 2);
+    o = { x: 1 };
+    set(o, 4);
+    Object.defineProperty(o, "x", { writable: false });
+    assert_throws(TypeError, function() { set(o, 5); });
+    assert(o.x, 4);
+
+    /* setter on the prototype and exotic objects */
+    p = { set x(v) { this.y = v; } };
+    o = Object.create(p);
+    set(o, 6);
+    assert(o.y, 6);
+    assert(Object.getOwnPropertyNames(o).toString(), "y");
+    o = new Proxy({ x: 7 }, {});
+    assert(get(o), 7);
+    assert(get("x"), undefined);
+}
+
+function test_inline_cache_proto()
+{
+    var a, o, p, q, r;
+    function get(o) { return o.f; }
+    class A { f() { return 1; } }
+    class B extends A { }
+
+    /* property found in a prototype */
+    a = new A();
+    o = new B();
+    assert(get(o), A.prototype.f);
+    assert(get(o), A.prototype.f);
+    assert(get(a), A.prototype.f);
+
+    /* shadowing in an intermediate prototype */
+    B.prototype.f = 2;
+    assert(get(o), 2);
+    assert(get(a), A.prototype.f);
+    delete B.prototype.f;
+    assert(get(o), A.prototype.f);
+
+    /* redefinition in the holder */
+    A.prototype.f = 3;
+    assert(get(o), 3);
+    Object.defineProperty(A.prototype, "f", { get: function() { return 4; } });
+    assert(get(o), 4);
+    Object.defineProperty(A.prototype, "f", { value: 5 });
+    assert(get(o), 5);
+    delete A.prototype.f;
+    assert(get(o), undefined);
+    A.prototype.f = 6;
+    assert(get(o), 6);
+
+    /* prototype change in the chain */
+    p = { f: 7 };
+    q = Object.create(p);
+    o = Object.create(q);
+    assert(get(o), 7);
+    Object.setPrototypeOf(q, { f: 8 });
+    assert(get(o), 8);
+    Object.setPrototypeOf(q, new Proxy({}, { get: function() { return 9; } }));
+    assert(get(o), 9);
+
+    /* exotic receivers with the same prototype */
+    r = new Uint8Array(2);
+    Uint8Array.prototype.f = 10;
+    assert(get(r), 10);
+    assert(get(Object.create(Uint8Array.prototype)), 10);
+    delete Uint8Array.prototype.f;
+    assert(get(r), undefined);
+    assert(get([]), undefined);
+    Array.prototype.f = 11;
+    assert(get([]), 11);
+    delete Array.prototype.f;
+    assert(get([]), undefined);
+}
+
+function test_call_frames()
+{
+    var o, fs, i, n, e;
+
+    /* deep recursion */
+    function rec(n) { return n == 0 ? 0 : rec(n - 1) + 1; }
+    assert(rec(500), 500);
+    function rec_inf(n) { return rec_inf(n + 1) + 1; }
+    assert_throws(InternalError, () => rec_inf(0));
+    assert(rec(100), 100);
+    /* several chunks of the frame stack */
+    for(i = 0; i < 3; i++) {
+        assert(rec(1000), 1000);
+        assert_throws(InternalError, () => rec_inf(0));
+    }
+
+    /* exceptions going through several frames */
+    function thrower(n) { if (n == 0) throw Error("e" + n); return thrower(n - 1); }
+    function catcher(n) {
+        try {
+            return thrower(n);
+        } catch(e) {
+            return e.message + ":" + n;
+        } finally {
+            n++;
+        }
+    }
+    assert(catcher(3), "e0:3");
+    e = null;
+    try { thrower(2); } catch(e1) { e = e1; }
+    assert(e.stack.split("thrower").length - 1, 3);
+
+    /* missing arguments, arguments objects and closures */
+    function args(a, b, c) { return arguments.length + ":" + a + b + c; }
+    assert(args(1), "1:1undefinedundefined");
+    assert(args(1, 2, 3, 4), "4:123");
+    function mapped(a, b) { arguments[1] = 5; return a + b; }
+    assert(isNaN(mapped(1)));
+    assert(mapped(1, 2), 6);
+    function rest(a, ...b) { return b.length; }
+    assert(rest(1, 2, 3), 2);
+    function make(a) { var b = a + 1; return function() { return a + b++; }; }
+    fs = [];
+    for(i = 0; i < 3; i++)
+        fs.push(make(i));
+    assert(fs[2](), 5);
+    assert(fs[2](), 6);
+    assert(fs[0](), 1);
+
+    /* 'this' and new.target */
+    function sloppy_this() { return typeof this; }
+    function strict_this() { "use strict"; return this; }
+    function target() { return new.target; }
+    o = { f: strict_this, g: sloppy_this, h: target };
+    assert(o.f(), o);
+    assert(strict_this(), undefined);
+    assert(sloppy_this(), "object");
+    assert(o.g.call(1), "object");
+    assert(o.h(), undefined);
+    assert(new target(), target);
+    assert_throws(TypeError, () => { class C {}; return C(); });
+
+    /* calls through a native function */
+    n = [1, 2, 3].map(function (x) { return rec(x); }).reduce((a, b) => a + b);
+    assert(n, 6);
+}
+
+function test_tail_call()
+{
+    "use strict";
+    var o, fs, e;
+
+    /* tail calls run in constant space */
+    function loop(n, acc) { if (n == 0) return acc; return loop(n - 1, acc + 1); }
+    assert(loop(100000, 0), 100000);
+    function even(n) { return n == 0 ? true : odd(n - 1); }
+    function odd(n) { return n == 0 ? false : even(n - 1); }
+    assert(even(100001), false);
+    o = { k: 3, m(n) { return n == 0 ? this.k : this.m(n - 1); } };
+    assert(o.m(100000), 3);
+    assert([1, 2].map((x) => loop(100000, x)).join(), "100001,100002");
+
+    /* frames of different sizes */
+    function grow(n) {
+        if (n == 0)
+            return arguments.length;
+        return grow(n - 1, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14);
+    }
+    assert(grow(1000), 15);
+    function shrink(a, b) { return a; }
+    function tail_shrink() { return shrink(1, 2, 3); }
+    assert(tail_shrink(), 1);
+
+    /* closures and exceptions */
+    fs = [];
+    function clo(n) { fs.push(() => n); if (n == 0) return 0; return clo(n - 1); }
+    clo(10);
+    assert(fs[3](), 7);
+    function thrower(n) { if (n == 0) throw Error("e" + n); return thrower(n - 1); }
+    e = null;
+    try { thrower(100000); } catch(e1) { e = e1; }
+    assert(e.message, "e0");
+
+    /* non bytecode functions */
+    function tail_native(n) { return Math.max(n, 2); }
+    assert(tail_native(5), 5);
+}
+
+function test_tail_call_sloppy()
+{
+    var e;
+
+    /* the caller frames are kept in the backtraces */
+    function callee(n) { if (n == 0) throw Error("e"); return n; }
+    function caller(n) { return n > 0 ? callee(n) : callee(n); }
+    assert(caller(2), 2);
+    e = null;
+    try { caller(0); } catch(e1) { e = e1; }
+    assert(e.stack.includes("caller"), true);
+    function loop(n, acc) { if (n == 0) return acc; return loop(n - 1, acc + 1); }
+    assert(loop(1000, 0), 1000);
+}
+
+function test_quickened_ops()
+{
+    var i, r, s;
+    function add(a, b) { return a + b; }
+    function mul(a, b) { return a * b; }
+    function acc(a, b) { var s = a; s += b; return s; }
+
+    /* the type of the operands changes after the quickening */
+    for(i = 0; i < 3; i++)
+        assert(add(0.5, 1.25), 1.75);
+    assert(add(1, 2), 3);
+    assert(add("a", 1), "a1");
+    assert(add(0x7fffffff, 1), 2147483648);
+    for(i = 0; i < 3; i++)
+        assert(add("a", "b"), "ab");
+    assert(add(1.5, 1), 2.5);
+    assert(add({ valueOf() { return 2; } }, "x"), "2x");
+
+    for(i = 0; i < 3; i++)
+        assert(mul(1.5, 2.5), 3.75);
+    assert(mul(2, 3), 6);
+    assert(Object.is(mul(0, -1), -0), true);
+    assert(mul("2", 3), 6);
+
+    for(i = 0; i < 3; i++)
+        assert(acc(0.5, 0.25), 0.75);
+    assert(acc(1, 2), 3);
+    assert(acc("a", 1), "a1");
+    assert(acc(1.5, "a"), "1.5a");
+
+    /* polymorphic site: quickening is eventually disabled */
+    r = 0;
+    s = "";
+    for(i = 0; i < 100; i++) {
+        r = add(r, (i & 1) ? 0.5 : 1);
+        s = add(s, "x");
+    }
+    assert(r, 75);
+    assert(s.length, 100);
+}
+
 test_op1();
 test_cvt();
 test_eq();
@@ -545,3 +855,9 @@ test_spread();
 test_function_length();
 test_argument_scope();
 test_function_expr_name();
+test_inline_cache();
+test_inline_cache_proto();
+test_call_frames();
+test_tail_call();
+test_tail_call_sloppy();
+test_quickened_ops();
@@ -74,6 +74,71 @@ function test_for()
     assert(c === 3 && j === 3);
 }
 
+function test_for_compare()
+{
+    var i, c, a, b, o, log;
+    /* non integer loop bounds */
+    c = 0;
+    for(i = 0.5; i < 3; i++)
+        c++;
+    assert(c === 3);
+    c = 0;
+    for(i = 0; i < NaN; i++)
+        c++;
+    assert(c === 0);
+    c = 0;
+    for(i = "a"; i < "aaa"; i += "a")
+        c++;
+    assert(c === 2);
+    c = 0;
+    for(i = 0n; i < 3n; i++)
+        c++;
+    assert(c === 3);
+
+    /* conversions with side effects and exceptions */
+    log = "";
+    o = { valueOf: function() { log += "v"; return 2; } };
+    c = 0;
+    for(i = 0; i < o; i++)
+        c++;
+    assert(c === 2 && log === "vvv");
+    o = { valueOf: function() { throw "e"; } };
+    try {
+        for(i = 0; i < o; i++)
+            c++;
+        assert(false);
+    } catch(e) {
+        assert(e === "e");
+    }
+
+    /* backward conditional jump */
+    i = 0;
+    c = 0;
+    while (i < 10) {
+        i++;
+        if (i < 5) {
+            c++;
+        }
+    }
+    assert(c === 4);
+
+    /* first two local variables */
+    a = 0;
+    b = 1;
+    for(i = 0; i < 3; i++) {
+        a = a + b;
+        b = a + b;
+    }
+    assert(a === 8 && b === 13);
+    function f() {
+        var t = [], i;
+        for(i = 0; i < 3; i++)
+            t[i] = i;
+        return t;
+    }
+    assert(f().toString(), "0,1,2");
+}
+
 function test_for_in()
 {
     var i, tab, a, b;
@@ -352,6 +417,7 @@ test_while();
 test_while_break();
 test_do_while();
 test_for();
+test_for_compare();
 test_for_break();
 test_switch1();
 test_switch2();
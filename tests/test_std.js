@@ -77,6 +77,45 @@ function test_file2()
     f.close();
 }
 
+function test_file_utf8()
+{
+    var f, str, str1, buf, i;
+
+    /* long enough to use the vectorized paths */
+    str = "";
+    for(i = 0; i < 100; i++)
+        str += "abcdefghijklmnopqrstuvwxyz" + String.fromCharCode(i * 655);
+    str += "\u{1f600}\ud800";
+    f = std.tmpfile();
+    f.puts(str);
+    f.seek(0, std.SEEK_SET);
+    str1 = f.readAsString();
+    assert(str1 === str);
+    f.seek(0, std.SEEK_SET);
+    assert(f.readAsString(26) === "abcdefghijklmnopqrstuvwxyz");
+    f.close();
+
+    /* max_size in the middle of a read block */
+    str = "0123456789".repeat(1000);
+    f = std.tmpfile();
+    f.puts(str);
+    f.seek(0, std.SEEK_SET);
+    assert(f.readAsString(5000), str.substring(0, 5000));
+    assert(f.readAsString(4097), str.substring(5000, 9097));
+    assert(f.readAsString(), str.substring(9097));
+    assert(f.readAsString(), "");
+    f.close();
+
+    /* invalid UTF-8 sequences are replaced by U+FFFD */
+    buf = new Uint8Array([0x61, 0xc3, 0xa9, 0xff, 0x62, 0xc3, 0xe2, 0x82,
+                          0xac, 0xf4, 0x90, 0x80, 0x80, 0x63]);
+    f = std.tmpfile();
+    f.write(buf.buffer, 0, buf.length);
+    f.seek(0, std.SEEK_SET);
+    assert(f.readAsString(), "a\u00e9\ufffdb\ufffd\u20ac\ufffdc");
+    f.close();
+}
+
 function test_getline()
 {
     var f, line, line_count, lines, i;
@@ -122,6 +161,16 @@ function test_popen()
 
     assert(str, content);
 
+    /* the pipe returns the data in several short reads */
+    f = std.popen("printf abc; sleep 0.1; printf def; sleep 0.1; printf ghi",
+                  "r");
+    assert(f.readAsString(), "abcdefghi");
+    f.close();
+    f = std.popen("printf abc; sleep 0.1; printf def", "r");
+    assert(f.readAsString(4), "abcd");
+    assert(f.readAsString(), "ef");
+    f.close();
+
     os.remove(fname);
 }
 
@@ -270,9 +319,57 @@ function test_timer()
         os.clearTimeout(th[i]);
 }
 
+function test_gc()
+{
+    var s0, s1, a, b, n, stats;
+
+    s0 = std.gcStats();
+    a = {};
+    b = { a };
+    a.b = b;
+    a = b = null;
+    std.gc();
+    s1 = std.gcStats();
+    assert(s1.gc_count, s0.gc_count + 1);
+    assert(s1.freed_count >= s0.freed_count + 2);
+    assert(s1.scanned_count > s0.scanned_count);
+    assert(s1.max_pause >= s1.free_max_time);
+
+    n = s1.gc_count;
+    stats = null;
+    std.setGCCallback(function (s) {
+        stats = s;
+        std.setGCCallback(null);
+    });
+    std.gc();
+    /* std.gc() calls the function once the collection is finished */
+    assert(stats !== null, true);
+    assert(stats.gc_count >= n + 1, true);
+    stats = null;
+    std.gc();
+    assert(stats, null);
+
+    var fname = "test_heap_snapshot.txt", lines, lines1, m;
+    m = new Map([[1, { leaked: true }]]);
+    assert(std.writeHeapSnapshot(fname), 0);
+    lines = std.loadFile(fname).split("\n");
+    assert(lines[0].startsWith("quickjs-heap-snapshot 2"), true);
+    assert(lines.some((l) => l.startsWith("N ") && l.split(" ")[2] == "Map"),
+           true);
+    /* the ids are numbers and not addresses */
+    assert(lines.every((l) => !l.startsWith("N ") ||
+                       /^N \d+ /.test(l)), true);
+    assert(std.writeHeapSnapshot(fname, true), 0);
+    lines1 = std.loadFile(fname).split("\n");
+    os.remove(fname);
+    assert(lines1.some((l) => l.startsWith("N ") && / @/.test(l)), true);
+}
+
 test_printf();
+test_gc();
 test_file1();
 test_file2();
+test_file_utf8();
 test_getline();
 test_popen();
 test_os();